@@ -569,6 +569,9 @@ get_file_func (CameraFilesystem *fs, const char *folder, const char *filename,
 		return GP_ERROR_IO_READ;
 	}
 
+	/* Only a hint, the loop below still works without it. */
+	gp_file_reserve (file, stbuf.st_size);
+
 	curread = 0;
 	id = gp_context_progress_start (context, (1.0*stbuf.st_size/BLOCKSIZE), _("Getting file..."));
 	GP_DEBUG ("Progress id: %i", id);
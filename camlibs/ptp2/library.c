@@ -31,6 +31,9 @@
 #include <stdarg.h>
 #include <time.h>
 #include <sys/time.h>
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#endif
 #if defined(HAVE_ICONV) && defined(HAVE_LANGINFO_H)
 #include <langinfo.h>
 #endif
@@ -3835,6 +3838,66 @@ get_folder_from_handle (Camera *camera, uint32_t storage, uint32_t handle, char
 	return (GP_OK);
 }
 
+/* Computes folder and name of object oid in the gphoto2 filesystem. */
+static int
+object_path (Camera *camera, uint32_t oid, CameraFilePath *path, uint16_t *ofc)
+{
+	PTPParams	*params = &camera->pl->params;
+	PTPObject	*ob;
+	uint32_t	storage, parent;
+
+	C_PTP (ptp_object_want (params, oid, PTPOBJECT_OBJECTINFO_LOADED, &ob));
+	if (!ob->oi.Filename || (strlen (ob->oi.Filename) >= sizeof (path->name)))
+		return GP_ERROR;
+	strcpy (path->name, ob->oi.Filename);
+	storage = ob->oi.StorageID;
+	parent  = ob->oi.ParentObject;
+	if (ofc)
+		*ofc = ob->oi.ObjectFormat;
+	sprintf (path->folder,"/"STORAGE_FOLDER_PREFIX"%08lx/",(unsigned long)storage);
+	/* ob might be invalid after this */
+	CR (get_folder_from_handle (camera, storage, parent, path->folder));
+	/* delete last / or we get confused later. */
+	path->folder[ strlen(path->folder)-1 ] = '\0';
+	return GP_OK;
+}
+
+/* The camera created folder oid, add it without forgetting the rest of the tree. */
+static void
+object_added_folder (Camera *camera, uint32_t oid, GPContext *context)
+{
+	CameraFilePath	path;
+
+	if ((object_path (camera, oid, &path, NULL) != GP_OK) ||
+	    (gp_filesystem_make_dir_noop (camera->fs, path.folder, path.name, context) != GP_OK))
+		gp_filesystem_reset (camera->fs);
+}
+
+/* The camera removed object oid, drop it without forgetting the rest of the tree. */
+static void
+object_removed (Camera *camera, uint32_t oid, GPContext *context)
+{
+	PTPParams	*params = &camera->pl->params;
+	PTPObject	*ob;
+	CameraFilePath	path;
+	uint16_t	ofc = 0;
+	int		ret = GP_ERROR;
+
+	/* only objects we have seen can be in the filesystem, do not ask the camera about it */
+	if ((ptp_object_find (params, oid, &ob) == PTP_RC_OK) &&
+	    (ob->flags & PTPOBJECT_OBJECTINFO_LOADED))
+		ret = object_path (camera, oid, &path, &ofc);
+	ptp_remove_object_from_cache (params, oid);
+	if (ret == GP_OK) {
+		if (ofc == PTP_OFC_Association)
+			ret = gp_filesystem_remove_dir_noop (camera->fs, path.folder, path.name, context);
+		else
+			ret = gp_filesystem_delete_file_noop (camera->fs, path.folder, path.name, context);
+	}
+	if (ret != GP_OK)
+		gp_filesystem_reset (camera->fs);
+}
+
 static int
 add_objectid_and_upload (Camera *camera, CameraFilePath *path, GPContext *context,
 	uint32_t newobject, PTPObjectInfo *oi) {
@@ -4044,8 +4107,7 @@ capturetriggered:
 				if (!newobject) newobject = 0xffff0001;
 				break;
 			case PTP_EC_ObjectRemoved:
-				ptp_remove_object_from_cache(params, event.Param1);
-				gp_filesystem_reset (camera->fs);
+				object_removed (camera, event.Param1, context);
 				break;
 			case PTP_EC_ObjectAdded: {
 				PTPObject	*ob;
@@ -4068,7 +4130,7 @@ capturetriggered:
 				 * happens when the camera starts with an empty card. */
 				if (ob->oi.ObjectFormat == PTP_OFC_Association) {
 					/* libgphoto2 vfs does not notice otherwise */
-					gp_filesystem_reset (camera->fs);
+					object_added_folder (camera, event.Param1, context);
 					break;
 				}
 				newobject = event.Param1;
@@ -4245,8 +4307,7 @@ camera_canon_eos_capture (Camera *camera, CameraCaptureType type, CameraFilePath
 				break;
 			case PTP_CANON_EOS_CHANGES_TYPE_OBJECTREMOVED:
 				GP_LOG_D ("Found removed object. OID 0x%x", (unsigned int)entry.u.object.oid);
-				ptp_remove_object_from_cache(params, entry.u.object.oid);
-				gp_filesystem_reset (camera->fs);
+				object_removed (camera, entry.u.object.oid, context);
 				break;
 			case PTP_CANON_EOS_CHANGES_TYPE_OBJECTINFO: {
 				PTPObject	*ob;
@@ -4548,8 +4609,7 @@ camera_canon_capture (Camera *camera, CameraCaptureType type, CameraFilePath *pa
 		GP_LOG_D ("Event: nparams=0x%X, code=0x%X, trans_id=0x%X, p1=0x%X, p2=0x%X, p3=0x%X", event.Nparam,event.Code,event.Transaction_ID, event.Param1, event.Param2, event.Param3);
 		switch (event.Code) {
 		case PTP_EC_ObjectRemoved:
-			ptp_remove_object_from_cache(params, event.Param1);
-			gp_filesystem_reset (camera->fs);
+			object_removed (camera, event.Param1, context);
 			break;
 		case PTP_EC_ObjectAdded: {
 			/* add newly created object to internal structures. this hopefully just is a new folder */
@@ -4562,8 +4622,8 @@ camera_canon_capture (Camera *camera, CameraCaptureType type, CameraFilePath *pa
 				break;
 			/* this might be just the folder add, ignore that. */
 			if (ob->oi.ObjectFormat == PTP_OFC_Association) {
-				/* new directory ... mark fs as to be refreshed */
-				gp_filesystem_reset (camera->fs); /* FIXME: implement more lightweight folder add */
+				/* new directory ... add it to the fs */
+				object_added_folder (camera, event.Param1, context);
 				break;
 			} else {
 				/* new file */
@@ -5613,8 +5673,7 @@ fallback:
 
 		switch (event.Code) {
 		case PTP_EC_ObjectRemoved:
-			ptp_remove_object_from_cache(params, event.Param1);
-			gp_filesystem_reset (camera->fs);
+			object_removed (camera, event.Param1, context);
 			break;
 		case PTP_EC_ObjectAdded: {
 			PTPObject	*ob;
@@ -5626,8 +5685,8 @@ fallback:
 
 			/* this might be just the folder add, ignore that. */
 			if (ob->oi.ObjectFormat == PTP_OFC_Association) {
-				/* new directory ... mark fs as to be refreshed */
-				gp_filesystem_reset (camera->fs);
+				/* new directory ... add it to the fs */
+				object_added_folder (camera, event.Param1, context);
 			} else {
 				newobject = event.Param1;
 				done |= 2;
@@ -6441,8 +6500,7 @@ camera_wait_for_event (Camera *camera, int timeout,
 					/* continue otherwise */
 					break;
 				case PTP_CANON_EOS_CHANGES_TYPE_OBJECTREMOVED:
-					ptp_remove_object_from_cache(params, entry.u.object.oid);
-					gp_filesystem_reset (camera->fs);
+					object_removed (camera, entry.u.object.oid, context);
 					*eventtype = GP_EVENT_UNKNOWN;
 					C_MEM (*eventdata = malloc(strlen("Object Removed")+1));
 					sprintf (*eventdata, "ObjectRemoved");
@@ -6582,7 +6640,8 @@ camera_wait_for_event (Camera *camera, int timeout,
 					if (ofc == PTP_OFC_Association) { /* new folder! */
 						*eventtype = GP_EVENT_FOLDER_ADDED;
 						*eventdata = path;
-						gp_filesystem_reset (camera->fs); /* FIXME: implement more lightweight folder add */
+						if (gp_filesystem_make_dir_noop (camera->fs, path->folder, path->name, context) != GP_OK)
+							gp_filesystem_reset (camera->fs);
 						/* if this was the last current event ... stop and return the folder add */
 						return GP_OK;
 					} else {
@@ -7013,7 +7072,8 @@ handleregular:
 		if (ofc == PTP_OFC_Association) { /* new folder! */
 			*eventtype = GP_EVENT_FOLDER_ADDED;
 			*eventdata = path;
-			gp_filesystem_reset (camera->fs); /* FIXME: implement more lightweight folder add */
+			if (gp_filesystem_make_dir_noop (camera->fs, path->folder, path->name, context) != GP_OK)
+				gp_filesystem_reset (camera->fs);
 		} else {
 			CR (gp_filesystem_append (camera->fs, path->folder,
 						  path->name, context));
@@ -7036,8 +7096,7 @@ handleregular:
 		sprintf (*eventdata, "PTP Property %04x changed", event.Param1 & 0xffff);
 		break;
 	case PTP_EC_ObjectRemoved:
-		ptp_remove_object_from_cache(params, event.Param1);
-		gp_filesystem_reset (camera->fs);
+		object_removed (camera, event.Param1, context);
 		*eventtype = GP_EVENT_UNKNOWN;
 		C_MEM (*eventdata = malloc(strlen("PTP ObjectRemoved, Param1 01234567")+1));
 		sprintf (*eventdata, "PTP ObjectRemoved, Param1 %08x", event.Param1);
@@ -7063,6 +7122,48 @@ handleregular:
 	return GP_OK;
 }
 
+/* Only cameras that send their events on their own, over the USB
+ * interrupt endpoint or the PTP/IP event socket, have something to
+ * wait on. The others are asked with a command in every
+ * camera_wait_for_event() round. */
+static int
+camera_get_pollfds (Camera *camera, GPPortPollFd *fds, int max, GPContext *context)
+{
+	PTPParams	*params = &camera->pl->params;
+
+	if (	(params->device_flags & DEVICE_FLAG_OLYMPUS_XML_WRAPPED) ||
+		((params->deviceinfo.VendorExtensionID == PTP_VENDOR_CANON) &&
+		 (ptp_operation_issupported(params, PTP_OC_CANON_EOS_GetEvent) ||
+		  ptp_operation_issupported(params, PTP_OC_CANON_CheckEvent))) ||
+		((params->deviceinfo.VendorExtensionID == PTP_VENDOR_NIKON) &&
+		 (ptp_operation_issupported(params, PTP_OC_NIKON_GetEvent) ||
+		  ptp_operation_issupported(params, PTP_OC_NIKON_GetEventEx))) ||
+		((params->deviceinfo.VendorExtensionID == PTP_VENDOR_SONY) &&
+		 (ptp_operation_issupported(params, PTP_OC_SONY_SetControlDeviceB) ||
+		  ptp_operation_issupported(params, PTP_OC_SONY_QX_GetAllDevicePropData))) ||
+		((params->deviceinfo.VendorExtensionID == PTP_VENDOR_FUJI) &&
+		 ptp_property_issupported(params, PTP_DPC_FUJI_CurrentState))
+	) {
+		GP_LOG_D ("events of this camera are polled with commands");
+		return GP_ERROR_NOT_SUPPORTED;
+	}
+
+	switch (camera->port->type) {
+	case GP_PORT_USB:
+		return gp_port_get_pollfds (camera->port, fds, max);
+#if defined(POLLIN) && !defined(HAVE_LIBWS232)
+	case GP_PORT_PTPIP:
+		if (max > 0) {
+			fds[0].fd = params->evtfd;
+			fds[0].events = POLLIN;
+		}
+		return 1;
+#endif
+	default:
+		return GP_ERROR_NOT_SUPPORTED;
+	}
+}
+
 static int
 snprintf_ptp_property (char *txt, int spaceleft, PTPPropertyValue *data, uint16_t dt)
 {
@@ -7655,14 +7756,40 @@ folder_to_handle(PTPParams *params, const char *folder, uint32_t storage, uint32
 	}
 }
 
+static int object_to_info (Camera *camera, uint32_t oid, PTPObject *ob, CameraFileInfo *info);
+
+/*
+ * FNV-1a over what changes when a file on the camera is replaced, for
+ * gp_filesystem_set_stamp(). Not the handle: many cameras number their
+ * objects anew in every session.
+ */
+static uint64_t
+object_stamp (PTPObject *ob)
+{
+	uint64_t	v[3], stamp = 0xcbf29ce484222325ULL;
+	unsigned int	i, j;
+
+	v[0] = ob->oi.ObjectCompressedSize;
+	v[1] = (uint64_t)ob->oi.CaptureDate;
+	v[2] = (uint64_t)ob->oi.ModificationDate;
+	for (i = 0; i < sizeof (v) / sizeof (v[0]); i++)
+		for (j = 0; j < 8; j++) {
+			stamp ^= (v[i] >> (8 * j)) & 0xff;
+			stamp *= 0x100000001b3ULL;
+		}
+	return stamp;
+}
+
+/* Lists the files in folder. If infos is not NULL, *infos receives the
+ * file information of each listed file, taken from the objects loaded
+ * while listing anyway. It stays NULL for the special files. */
 static int
-file_list_func (CameraFilesystem *fs, const char *folder, CameraList *list,
-		void *data, GPContext *context)
+list_folder_files (Camera *camera, const char *folder, CameraList *list,
+		   CameraFileInfo **infos, GPContext *context)
 {
-    Camera *camera = (Camera *)data;
     PTPParams *params = &camera->pl->params;
     uint32_t parent, storage=0x0000000;
-    unsigned int i, hasgetstorageids;
+    unsigned int i, hasgetstorageids, count, ninfos = 0;
     SET_CONTEXT_P(params, context);
     unsigned int	lastnrofobjects = params->nrofobjects, redoneonce = 0;
 
@@ -7741,6 +7868,21 @@ retry:
 	    }
 	}
 	CR(gp_list_append (list, ob->oi.Filename, NULL));
+	/* lets the persistent cache tell a reused filename */
+	CR(gp_filesystem_set_stamp (camera->fs, folder, ob->oi.Filename,
+				    object_stamp (ob), context));
+	if (!infos)
+		continue;
+	count = gp_list_count (list);
+	if (count > ninfos) {
+		CameraFileInfo *xinfos;
+
+		ninfos = ninfos ? ninfos * 2 : 64;
+		C_MEM (xinfos = realloc (*infos, ninfos * sizeof (CameraFileInfo)));
+		*infos = xinfos;
+	}
+	memset (&(*infos)[count - 1], 0, sizeof (CameraFileInfo));
+	CR (object_to_info (camera, oid, ob, &(*infos)[count - 1]));
     }
 
     /* Did we change the object tree list during our traversal? if yes, redo the scan. */
@@ -7756,6 +7898,28 @@ retry:
     return GP_OK;
 }
 
+static int
+file_list_func (CameraFilesystem *fs, const char *folder, CameraList *list,
+		void *data, GPContext *context)
+{
+	return list_folder_files ((Camera *)data, folder, list, NULL, context);
+}
+
+static int
+file_list_info_func (CameraFilesystem *fs, const char *folder, CameraList *list,
+		     CameraFileInfo **infos, void *data, GPContext *context)
+{
+	int ret;
+
+	*infos = NULL;
+	ret = list_folder_files ((Camera *)data, folder, list, infos, context);
+	if (ret < GP_OK) {
+		free (*infos);
+		*infos = NULL;
+	}
+	return ret;
+}
+
 static int
 folder_list_func (CameraFilesystem *fs, const char *folder, CameraList *list,
 		void *data, GPContext *context)
@@ -8059,14 +8223,25 @@ ptp_mtp_parse_metadata (
 ) {
 	uint16_t ret, *props = NULL;
 	uint32_t propcnt = 0;
-	char	*filedata = NULL;
+	const char	*data = NULL;
+	char	*filedata;
 	unsigned long	filesize = 0;
 	unsigned int j;
 
-	if (gp_file_get_data_and_size (file, (const char**)&filedata, &filesize) < GP_OK)
+	if (gp_file_get_data_and_size (file, &data, &filesize) < GP_OK)
 		return (GP_ERROR);
 
-	C_PTP (ptp_mtp_getobjectpropssupported (params, ofc, &propcnt, &props));
+	/* The file data may be shared or mapped read-only and is not
+	 * guaranteed to be terminated, so parse a private copy. */
+	C_MEM (filedata = malloc (filesize + 1));
+	memcpy (filedata, data, filesize);
+	filedata[filesize] = '\0';
+
+	ret = ptp_mtp_getobjectpropssupported (params, ofc, &propcnt, &props);
+	if (ret != PTP_RC_OK) {
+		free (filedata);
+		C_PTP (ret);
+	}
 
 	for (j=0;j<propcnt;j++) {
 		char			propname[256],propname2[256+4];
@@ -8092,6 +8267,7 @@ ptp_mtp_parse_metadata (
 		content = strdup(begin);
 		if (!content) {
 			free (props);
+			free (filedata);
 			C_MEM (content);
 		}
 		*end = '<';
@@ -8137,6 +8313,7 @@ ptp_mtp_parse_metadata (
 		free (content); content = NULL;
 	}
 	free(props);
+	free(filedata);
 	return (GP_OK);
 }
 
@@ -8438,12 +8615,11 @@ read_file_func (CameraFilesystem *fs, const char *folder, const char *filename,
 	return GP_OK;
 }
 
+/* Downloads the data of type of the already looked up object oid. */
 static int
-get_file_func (CameraFilesystem *fs, const char *folder, const char *filename,
-	       CameraFileType type, CameraFile *file, void *data,
-	       GPContext *context)
+get_object_file (Camera *camera, uint32_t oid, PTPObject *ob,
+		 CameraFileType type, CameraFile *file, GPContext *context)
 {
-	Camera *camera = data;
 	/* Note that "image" points to unsigned chars whereas all the other
 	 * functions which set image return pointers to chars.
 	 * However, we calculate a number of unsigned values in this function,
@@ -8453,46 +8629,15 @@ get_file_func (CameraFilesystem *fs, const char *folder, const char *filename,
 	 * If you do not like that, feel free to clean up the datatypes.
 	 * (TODO for Marcus and 2.2 ;)
 	 */
-	uint32_t oid;
 	uint64_t size;
-	uint32_t storage;
-	PTPObject *ob;
 	PTPParams *params = &camera->pl->params;
 
-	SET_CONTEXT_P(params, context);
-
-#if 0
-	/* The new Canons like to switch themselves off in the middle. */
-	if (params->deviceinfo.VendorExtensionID == PTP_VENDOR_CANON) {
-		if (ptp_operation_issupported(params, PTP_OC_CANON_KeepDeviceOn))
-			ptp_canon_keepdeviceon (params);
-	}
-#endif
-
-	if (!strcmp (folder, "/special")) {
-		unsigned int i;
-
-		for (i=0;i<nrofspecial_files;i++)
-			if (!strcmp (special_files[i].name, filename))
-				return special_files[i].getfunc (fs, folder, filename, type, file, data, context);
-		return (GP_ERROR_BAD_PARAMETERS); /* file not found */
-	}
-
-	/* compute storage ID value from folder patch */
-	folder_to_storage(folder,storage);
-	/* Get file number omitting storage pseudofolder */
-	find_folder_handle(params, folder, storage, oid);
-	oid = find_child(params, filename, storage, oid, &ob);
-	if (oid == PTP_HANDLER_SPECIAL) {
-		gp_context_error (context, _("File '%s/%s' does not exist."), folder, filename);
-		return GP_ERROR_BAD_PARAMETERS;
-	}
 	if (ob->oi.ModificationDate != 0)
 		gp_file_set_mtime (file, ob->oi.ModificationDate);
 	else
 		gp_file_set_mtime (file, ob->oi.CaptureDate);
 
-	GP_LOG_D ("Getting file '%s'.", filename);
+	GP_LOG_D ("Getting file '%s'.", ob->oi.Filename);
 	switch (type) {
 	case	GP_FILE_TYPE_EXIF: {
 		uint32_t offset, xlen, maxbytes;
@@ -8596,6 +8741,9 @@ get_file_func (CameraFilesystem *fs, const char *folder, const char *filename,
 			return mtp_get_playlist (camera, file, oid, context);
 
 		size=ob->oi.ObjectCompressedSize;
+		/* Only a hint, the transfer below still works without it. */
+		if (size && ((unsigned long)size == size))
+			gp_file_reserve (file, size);
 #define BLOBSIZE 1*1024*1024
 		if (size > 0xffffffffUL) {	/* larger than 4GB */
 			if (	(params->deviceinfo.VendorExtensionID == PTP_VENDOR_NIKON) &&
@@ -8727,6 +8875,134 @@ done:
 	return set_mimetype (file, params->deviceinfo.VendorExtensionID, ob->oi.ObjectFormat);
 }
 
+static int
+get_file_func (CameraFilesystem *fs, const char *folder, const char *filename,
+	       CameraFileType type, CameraFile *file, void *data,
+	       GPContext *context)
+{
+	Camera *camera = data;
+	uint32_t oid;
+	uint32_t storage;
+	PTPObject *ob;
+	PTPParams *params = &camera->pl->params;
+
+	SET_CONTEXT_P(params, context);
+
+#if 0
+	/* The new Canons like to switch themselves off in the middle. */
+	if (params->deviceinfo.VendorExtensionID == PTP_VENDOR_CANON) {
+		if (ptp_operation_issupported(params, PTP_OC_CANON_KeepDeviceOn))
+			ptp_canon_keepdeviceon (params);
+	}
+#endif
+
+	if (!strcmp (folder, "/special")) {
+		unsigned int i;
+
+		for (i=0;i<nrofspecial_files;i++)
+			if (!strcmp (special_files[i].name, filename))
+				return special_files[i].getfunc (fs, folder, filename, type, file, data, context);
+		return (GP_ERROR_BAD_PARAMETERS); /* file not found */
+	}
+
+	/* compute storage ID value from folder patch */
+	folder_to_storage(folder,storage);
+	/* Get file number omitting storage pseudofolder */
+	find_folder_handle(params, folder, storage, oid);
+	oid = find_child(params, filename, storage, oid, &ob);
+	if (oid == PTP_HANDLER_SPECIAL) {
+		gp_context_error (context, _("File '%s/%s' does not exist."), folder, filename);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	return get_object_file (camera, oid, ob, type, file, context);
+}
+
+struct file_request {
+	const CameraFileRequest	*request;
+	uint32_t		storage;
+	uint32_t		oid;	/* 0 if not looked up */
+};
+
+static int
+file_request_compare (const void *a, const void *b)
+{
+	const struct file_request *ra = a, *rb = b;
+
+	if (ra->storage != rb->storage)
+		return (ra->storage < rb->storage) ? -1 : 1;
+	if (ra->oid != rb->oid)
+		return (ra->oid < rb->oid) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Looks up all objects before starting the first transfer, so that the
+ * thumbnail and object transfers then run back to back, in handle order.
+ */
+static int
+get_files_func (CameraFilesystem *fs, const CameraFileRequest *requests,
+		unsigned int count, CameraFileRequestFunc func, void *func_data,
+		void *data, GPContext *context)
+{
+	Camera			*camera = data;
+	PTPParams		*params = &camera->pl->params;
+	struct file_request	*reqs;
+	const char		*lastfolder = NULL;
+	uint32_t		parent = 0, storage = 0;
+	unsigned int		i;
+	int			ret = GP_OK;
+
+	SET_CONTEXT_P(params, context);
+
+	C_MEM (reqs = calloc (count, sizeof (struct file_request)));
+	for (i = 0; i < count; i++) {
+		const char *folder = requests[i].folder;
+
+		reqs[i].request = &requests[i];
+		if (strncmp (folder, "/"STORAGE_FOLDER_PREFIX, strlen (STORAGE_FOLDER_PREFIX) + 1) ||
+		    (strlen (folder) < strlen (STORAGE_FOLDER_PREFIX) + 8 + 1))
+			continue;	/* /special and errors go the usual way */
+		if (!lastfolder || strcmp (lastfolder, folder)) {
+			storage = strtoul (folder + strlen (STORAGE_FOLDER_PREFIX) + 1, NULL, 16);
+			find_folder_handle (params, folder, storage, parent);
+			lastfolder = folder;
+		}
+		reqs[i].storage = storage;
+		reqs[i].oid = find_child (params, requests[i].name, storage, parent, NULL);
+		if (reqs[i].oid == PTP_HANDLER_SPECIAL)
+			reqs[i].oid = 0;
+	}
+	qsort (reqs, count, sizeof (struct file_request), file_request_compare);
+
+	for (i = 0; i < count; i++) {
+		const CameraFileRequest	*request = reqs[i].request;
+		CameraFile		*file;
+		PTPObject		*ob;
+		int			r;
+
+		if (gp_context_cancel (context) == GP_CONTEXT_FEEDBACK_CANCEL) {
+			ret = GP_ERROR_CANCEL;
+			break;
+		}
+		ret = gp_file_new (&file);
+		if (ret < GP_OK)
+			break;
+		/* params->objects may have moved since the lookup */
+		if (reqs[i].oid &&
+		    (ptp_object_want (params, reqs[i].oid, PTPOBJECT_OBJECTINFO_LOADED, &ob) == PTP_RC_OK))
+			r = get_object_file (camera, reqs[i].oid, ob, request->type, file, context);
+		else
+			r = get_file_func (fs, request->folder, request->name,
+					   request->type, file, data, context);
+		ret = func (request, file, r, func_data);
+		gp_file_unref (file);
+		if (ret < GP_OK)
+			break;
+	}
+	free (reqs);
+	return ret;
+}
+
 static int
 put_file_func (CameraFilesystem *fs, const char *folder, const char *filename,
 		CameraFileType type, CameraFile *file, void *data, GPContext *context)
@@ -8801,9 +9077,18 @@ put_file_func (CameraFilesystem *fs, const char *folder, const char *filename,
 
 	if (is_mtp_capable (camera) &&
 	    (	strstr(filename,".zpl") || strstr(filename, ".pla") )) {
-		char *object;
-		gp_file_get_data_and_size (file, (const char**)&object, &intsize);
-		return mtp_put_playlist (camera, object, intsize, &oi, context);
+		const char *object;
+		char *content;
+		int ret;
+
+		gp_file_get_data_and_size (file, &object, &intsize);
+		/* terminated private copy, the file data may be read-only */
+		C_MEM (content = malloc (intsize + 1));
+		memcpy (content, object, intsize);
+		content[intsize] = '\0';
+		ret = mtp_put_playlist (camera, content, intsize, &oi, context);
+		free (content);
+		return ret;
 	}
 
 	/* If the device is using PTP_VENDOR_EASTMAN_KODAK extension try
@@ -8974,27 +9259,12 @@ set_info_func (CameraFilesystem *fs, const char *folder, const char *filename,
 	return (GP_OK);
 }
 
+/* Fills info from the already loaded object info of ob. */
 static int
-get_info_func (CameraFilesystem *fs, const char *folder, const char *filename,
-	       CameraFileInfo *info, void *data, GPContext *context)
+object_to_info (Camera *camera, uint32_t oid, PTPObject *ob, CameraFileInfo *info)
 {
-	Camera *camera = data;
-	PTPObject *ob;
-	uint32_t oid, storage;
 	PTPParams *params = &camera->pl->params;
 
-	SET_CONTEXT_P(params, context);
-
-	C_PARAMS (strcmp (folder, "/special"));
-
-	/* compute storage ID value from folder patch */
-	folder_to_storage(folder,storage);
-	/* Get file number omitting storage pseudofolder */
-	find_folder_handle(params, folder, storage, oid);
-	oid = find_child(params, filename, storage, oid, &ob);
-	if (oid == PTP_HANDLER_SPECIAL)
-		return GP_ERROR;
-
 	info->file.fields = GP_FILE_INFO_SIZE|GP_FILE_INFO_TYPE|GP_FILE_INFO_MTIME;
 	info->file.size   = ob->oi.ObjectCompressedSize;
 
@@ -9006,14 +9276,6 @@ get_info_func (CameraFilesystem *fs, const char *folder, const char *filename,
 			info->file.status = GP_FILE_STATUS_DOWNLOADED;
 	}
 
-	/* MTP playlists have their own size calculation */
-	if (is_mtp_capable (camera) &&
-	    (ob->oi.ObjectFormat == PTP_OFC_MTP_AbstractAudioVideoPlaylist)) {
-		int contentlen;
-		CR (mtp_get_playlist_string (camera, oid, NULL, &contentlen));
-		info->file.size = contentlen;
-	}
-
 	strcpy_mime (info->file.type, params->deviceinfo.VendorExtensionID, ob->oi.ObjectFormat);
 	if (ob->oi.ModificationDate != 0) {
 		info->file.mtime = ob->oi.ModificationDate;
@@ -9063,9 +9325,40 @@ get_info_func (CameraFilesystem *fs, const char *folder, const char *filename,
 			info->file.fields |= GP_FILE_INFO_HEIGHT;
 		}
 	}
+	/* MTP playlists have their own size calculation, this may change ob */
+	if (is_mtp_capable (camera) &&
+	    (ob->oi.ObjectFormat == PTP_OFC_MTP_AbstractAudioVideoPlaylist)) {
+		int contentlen;
+		CR (mtp_get_playlist_string (camera, oid, NULL, &contentlen));
+		info->file.size = contentlen;
+	}
 	return (GP_OK);
 }
 
+static int
+get_info_func (CameraFilesystem *fs, const char *folder, const char *filename,
+	       CameraFileInfo *info, void *data, GPContext *context)
+{
+	Camera *camera = data;
+	PTPObject *ob;
+	uint32_t oid, storage;
+	PTPParams *params = &camera->pl->params;
+
+	SET_CONTEXT_P(params, context);
+
+	C_PARAMS (strcmp (folder, "/special"));
+
+	/* compute storage ID value from folder patch */
+	folder_to_storage(folder,storage);
+	/* Get file number omitting storage pseudofolder */
+	find_folder_handle(params, folder, storage, oid);
+	oid = find_child(params, filename, storage, oid, &ob);
+	if (oid == PTP_HANDLER_SPECIAL)
+		return GP_ERROR;
+
+	return object_to_info (camera, oid, ob, info);
+}
+
 static int
 make_dir_func (CameraFilesystem *fs, const char *folder, const char *foldername,
 	       void *data, GPContext *context)
@@ -9236,6 +9529,79 @@ storage_info_func (CameraFilesystem *fs,
 	return (GP_OK);
 }
 
+static int
+handle_compare (const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* FNV-1a over the storage id and its sorted object handles. */
+static int
+fingerprint_storage (Camera *camera, uint32_t storage, uint64_t *fingerprint)
+{
+	PTPParams		*params = &camera->pl->params;
+	PTPObjectHandles	handles;
+	unsigned int		i, j;
+	uint32_t		v;
+
+	C_PTP (ptp_getobjecthandles (params, storage, 0x000000, 0x000000, &handles));
+	if (handles.n)
+		qsort (handles.Handler, handles.n, sizeof (uint32_t), handle_compare);
+	for (i = 0; i <= handles.n; i++) {
+		v = i ? handles.Handler[i - 1] : storage;
+		for (j = 0; j < 4; j++) {
+			*fingerprint ^= (v >> (8 * j)) & 0xff;
+			*fingerprint *= 0x100000001b3ULL;
+		}
+	}
+	free (handles.Handler);
+	return (GP_OK);
+}
+
+/*
+ * One GetObjectHandles request per storage covers all files on it, while
+ * listing the folders takes an ObjectInfo request per object. Only the
+ * root folder and the storage folders are fingerprinted.
+ */
+static int
+fingerprint_func (CameraFilesystem *fs, const char *folder,
+		  uint64_t *fingerprint, void *data, GPContext *context)
+{
+	Camera		*camera = data;
+	PTPParams	*params = &camera->pl->params;
+	PTPStorageIDs	sids;
+	unsigned int	i;
+	uint32_t	storage;
+	char		*end;
+	int		ret = GP_OK;
+
+	if (!ptp_operation_issupported (params, PTP_OC_GetStorageIDs))
+		return (GP_ERROR_NOT_SUPPORTED);
+
+	SET_CONTEXT_P(params, context);
+	*fingerprint = 0xcbf29ce484222325ULL;
+	if (!strcmp (folder, "/")) {
+		C_PTP (ptp_getstorageids (params, &sids));
+		for (i = 0; (ret == GP_OK) && (i < sids.n); i++) {
+			/* invalid storage, like in folder_list_func */
+			if ((sids.Storage[i] & 0x0000ffff) == 0)
+				continue;
+			ret = fingerprint_storage (camera, sids.Storage[i], fingerprint);
+		}
+		free (sids.Storage);
+		return ret;
+	}
+	if (strncmp (folder, "/"STORAGE_FOLDER_PREFIX, strlen (STORAGE_FOLDER_PREFIX) + 1))
+		return (GP_ERROR_NOT_SUPPORTED);
+	folder += strlen (STORAGE_FOLDER_PREFIX) + 1;
+	storage = strtoul (folder, &end, 16);
+	if ((end - folder != 8) || (*end && strcmp (end, "/")))
+		return (GP_ERROR_NOT_SUPPORTED);
+	return fingerprint_storage (camera, storage, fingerprint);
+}
+
 static void
 debug_objectinfo(PTPParams *params, uint32_t oid, PTPObjectInfo *oi) {
 	GP_LOG_D ("ObjectInfo for '%s':", oi->Filename);
@@ -9261,10 +9627,13 @@ debug_objectinfo(PTPParams *params, uint32_t oid, PTPObjectInfo *oi) {
 
 static CameraFilesystemFuncs fsfuncs = {
 	.file_list_func		= file_list_func,
+	.file_list_info_func	= file_list_info_func,
 	.folder_list_func	= folder_list_func,
+	.fingerprint_func	= fingerprint_func,
 	.get_info_func		= get_info_func,
 	.set_info_func		= set_info_func,
 	.get_file_func		= get_file_func,
+	.get_files_func		= get_files_func,
 	.read_file_func		= read_file_func,
 	.del_file_func		= delete_file_func,
 	.put_file_func		= put_file_func,
@@ -9310,6 +9679,7 @@ camera_init (Camera *camera, GPContext *context)
 	camera->functions->set_config = camera_set_config;
 	camera->functions->list_config = camera_list_config;
 	camera->functions->wait_for_event = camera_wait_for_event;
+	camera->functions->get_pollfds = camera_get_pollfds;
 
 	/* We need some data that we pass around */
 	C_MEM (camera->pl = calloc (1, sizeof (CameraPrivateLibrary)));
@@ -9673,6 +10043,21 @@ camera_init (Camera *camera, GPContext *context)
 	/* read the root directory to avoid the "DCIM WRONG ROOT" bugs */
 	CR (gp_filesystem_set_funcs (camera->fs, &fsfuncs, camera));
 
+	/* let the filesystem keep a persistent cache per camera */
+	if (params->deviceinfo.SerialNumber && params->deviceinfo.SerialNumber[0]) {
+		char	*identity;
+
+		C_MEM (identity = malloc (strlen (params->deviceinfo.SerialNumber) + 2 +
+			(params->deviceinfo.Manufacturer ? strlen (params->deviceinfo.Manufacturer) : 0) +
+			(params->deviceinfo.Model ? strlen (params->deviceinfo.Model) : 0) + 1));
+		sprintf (identity, "%s %s %s",
+			 params->deviceinfo.Manufacturer ? params->deviceinfo.Manufacturer : "",
+			 params->deviceinfo.Model ? params->deviceinfo.Model : "",
+			 params->deviceinfo.SerialNumber);
+		gp_filesystem_set_identity (camera->fs, identity);
+		free (identity);
+	}
+
 	/* initialize the storage ids in Params */
 	if ((!params->storageids.n) && (ptp_operation_issupported(params, PTP_OC_GetStorageIDs)))
 		ptp_getstorageids(params, &params->storageids);
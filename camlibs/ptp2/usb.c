@@ -259,6 +259,40 @@ retry:
 
 #define READLEN 512*1024 /* read blob size, mostly to avoid reading all of it at once. */
 
+/* State of ptp_usb_getdata() while the port streams the data phase. */
+typedef struct {
+	PTPParams	*params;
+	PTPDataHandler	*handler;
+	GPContext	*context;
+	uint32_t	bytes_read;	/* payload bytes read, as in ptp_usb_getdata() */
+	uint32_t	streamed;	/* of those by gp_port_read_stream() */
+	int		report_progress, progress_id;
+	uint16_t	ret;
+} PTPUSBStream;
+
+static int
+ptp_usb_stream_func (GPPort *port, const char *data, int size, void *user_data)
+{
+	PTPUSBStream	*stream = user_data;
+
+	stream->ret = stream->handler->putfunc (stream->params, stream->handler->priv,
+						size, (unsigned char*)data);
+	if (stream->ret != PTP_RC_OK)
+		return GP_ERROR;
+	stream->streamed += size;
+	stream->bytes_read += size;
+	if (stream->report_progress &&
+	    ((stream->bytes_read-size)/CONTEXT_BLOCK_SIZE < stream->bytes_read/CONTEXT_BLOCK_SIZE))
+		gp_context_progress_update (stream->context, stream->progress_id,
+					    stream->bytes_read/CONTEXT_BLOCK_SIZE);
+	if ((stream->bytes_read > 1024*1024) &&
+	    (gp_context_cancel(stream->context) == GP_CONTEXT_FEEDBACK_CANCEL)) {
+		stream->ret = PTP_ERROR_CANCEL;
+		return GP_ERROR_CANCEL;
+	}
+	return GP_OK;
+}
+
 uint16_t
 ptp_usb_getdata (PTPParams* params, PTPContainer* ptp, PTPDataHandler *handler)
 {
@@ -330,8 +364,8 @@ ptp_usb_getdata (PTPParams* params, PTPContainer* ptp, PTPDataHandler *handler)
 			bytes_to_read = dtoh32(usbdata.length) - bytes_read;
 			bytes_read -= PTP_USB_BULK_HDR_LEN;
 
-			data = malloc(READLEN);
-			if (!data) goto exit;
+			if (gp_port_alloc_buffer (camera->port, READLEN, (char**)&data) < GP_OK)
+				goto exit;
 			while (bytes_to_read > 0) {
 				unsigned long chunk_to_read = bytes_to_read;
 
@@ -350,8 +384,6 @@ ptp_usb_getdata (PTPParams* params, PTPContainer* ptp, PTPDataHandler *handler)
 				bytes_to_read -= res;
 				bytes_read += res;
 			}
-			free (data);
-			data = NULL;
 			goto exit;
 		}
 	}
@@ -405,8 +437,10 @@ ptp_usb_getdata (PTPParams* params, PTPContainer* ptp, PTPDataHandler *handler)
 	/* Make bytes_read contain the number of payload-bytes already read. */
 	bytes_read -= PTP_USB_BULK_HDR_LEN;
 
-	data = malloc(READLEN);
-	if (!data) return PTP_RC_GeneralError;
+	/* where the port can, the kernel transfers straight into this buffer
+	 * and the handler gets it without another copy */
+	if (gp_port_alloc_buffer (camera->port, READLEN, (char**)&data) < GP_OK)
+		return PTP_RC_GeneralError;
 
 	report_progress = (bytes_to_read > 2*CONTEXT_BLOCK_SIZE) && (dtoh32(usbdata.length) != 0xffffffffU);
 
@@ -427,6 +461,38 @@ ptp_usb_getdata (PTPParams* params, PTPContainer* ptp, PTPDataHandler *handler)
 
 	if (report_progress)
 		progress_id = gp_context_progress_start (context, (bytes_to_read/CONTEXT_BLOCK_SIZE), _("Downloading..."));
+
+	/* Let the port keep several transfers in flight for large data
+	 * phases, up to the last short packet which is read below. */
+	if ((dtoh32(usbdata.length) != 0xffffffffU) && (bytes_to_read > READLEN)) {
+		PTPUSBStream	stream;
+
+		stream.params		= params;
+		stream.handler		= handler;
+		stream.context		= context;
+		stream.bytes_read	= bytes_read;
+		stream.streamed		= 0;
+		stream.report_progress	= report_progress;
+		stream.progress_id	= progress_id;
+		stream.ret		= PTP_RC_OK;
+		res = gp_port_read_stream (camera->port,
+			bytes_to_read - (bytes_to_read % params->maxpacketsize),
+			ptp_usb_stream_func, &stream);
+		bytes_to_read -= stream.streamed;
+		bytes_read = stream.bytes_read;
+		if (stream.ret != PTP_RC_OK) {
+			ret = stream.ret;
+			bytes_to_read = 0;
+		} else if (res == GP_ERROR_IO_READ && !stream.streamed) {
+			GP_LOG_D ("Clearing halt on IN EP and retrying once.");
+			gp_port_usb_clear_halt (camera->port, GP_PORT_USB_ENDPOINT_IN);
+			do_retry = FALSE;
+		} else if ((res < GP_OK) && (res != GP_ERROR_NOT_SUPPORTED)) {
+			ret = translate_gp_result_to_ptp(res);
+			bytes_to_read = 0;
+		} else if (stream.streamed)
+			do_retry = FALSE;
+	}
 	while (bytes_to_read > 0) {
 		unsigned long chunk_to_read = bytes_to_read;
 
@@ -474,7 +540,7 @@ ptp_usb_getdata (PTPParams* params, PTPContainer* ptp, PTPDataHandler *handler)
 		gp_context_progress_stop (context, progress_id);
 
 exit:
-	free (data);
+	gp_port_free_buffer (camera->port, (char*)data, READLEN);
 
 	if ((ret!=PTP_RC_OK) && (ret!=PTP_ERROR_CANCEL)) {
 		GP_LOG_E ("PTP_OC 0x%04x receiving data failed: %s (0x%04x)", ptp->Code, ptp_strerror(ret, params->deviceinfo.VendorExtensionID), ret);
@@ -251,6 +251,8 @@ typedef int (*CameraAboutFunc)     (Camera *camera, CameraText *text,
 typedef int (*CameraWaitForEvent)  (Camera *camera, int timeout,
 				    CameraEventType *eventtype, void **eventdata,
 				    GPContext *context);
+typedef int (*CameraGetPollFdsFunc) (Camera *camera, GPPortPollFd *fds,
+				     int max, GPContext *context);
 /**@}*/
 
 
@@ -308,8 +310,8 @@ typedef struct _CameraFunctions {
 
 	/* Event Interface */
 	CameraWaitForEvent wait_for_event;	/**< \brief Wait for a specific event from the camera */
+	CameraGetPollFdsFunc get_pollfds;	/**< \brief File descriptors that become ready when an event arrives */
 	/* Reserved space to use in the future without changing the struct size */
-	void *reserved1;			/**< \brief reserved for future use */
 	void *reserved2;			/**< \brief reserved for future use */
 	void *reserved3;			/**< \brief reserved for future use */
 	void *reserved4;			/**< \brief reserved for future use */
@@ -407,6 +409,8 @@ int gp_camera_capture_preview 	 (Camera *camera, CameraFile *file,
 int gp_camera_wait_for_event     (Camera *camera, int timeout,
 		                  CameraEventType *eventtype, void **eventdata,
 			          GPContext *context);
+int gp_camera_get_pollfds        (Camera *camera, GPPortPollFd *fds, int max,
+				  GPContext *context);
 
 int gp_camera_get_storageinfo    (Camera *camera, CameraStorageInformation**,
 				   int *, GPContext *context);
@@ -419,6 +423,11 @@ int gp_camera_get_storageinfo    (Camera *camera, CameraStorageInformation**,
  */
 int gp_camera_folder_list_files   (Camera *camera, const char *folder,
 				   CameraList *list, GPContext *context);
+int gp_camera_folder_list_files_with_info (Camera *camera,
+					   const char *folder,
+					   CameraList *list,
+					   CameraFileInfo **infos,
+					   GPContext *context);
 int gp_camera_folder_list_folders (Camera *camera, const char *folder,
 				   CameraList *list, GPContext *context);
 int gp_camera_folder_delete_all   (Camera *camera, const char *folder,
@@ -431,6 +440,14 @@ int gp_camera_folder_make_dir     (Camera *camera, const char *folder,
 				   const char *name, GPContext *context);
 int gp_camera_folder_remove_dir   (Camera *camera, const char *folder,
 				   const char *name, GPContext *context);
+int gp_camera_folder_snapshot     (Camera *camera, const char *folder,
+				   char **snapshot, unsigned long *size,
+				   GPContext *context);
+int gp_camera_folder_diff         (Camera *camera,
+				   const char *snapshot, unsigned long size,
+				   CameraFilesystemChangeFunc func, void *data,
+				   char **newsnapshot, unsigned long *newsize,
+				   GPContext *context);
 /**@}*/
 
 
@@ -446,6 +463,11 @@ int gp_camera_file_set_info 	(Camera *camera, const char *folder,
 int gp_camera_file_get		(Camera *camera, const char *folder,
 				 const char *file, CameraFileType type,
 				 CameraFile *camera_file, GPContext *context);
+int gp_camera_file_get_many	(Camera *camera,
+				 const CameraFileRequest *requests,
+				 unsigned int count,
+				 CameraFileRequestFunc func, void *data,
+				 GPContext *context);
 int gp_camera_file_read		(Camera *camera, const char *folder, const char *file,
 		    		 CameraFileType type,
 		    		 uint64_t offset, char *buf, uint64_t *size,
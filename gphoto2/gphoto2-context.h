@@ -57,6 +57,19 @@ typedef enum _GPContextFeedback {
 	GP_CONTEXT_FEEDBACK_CANCEL	/**< Please cancel the current transfer if possible. */
 } GPContextFeedback;
 
+/**
+ * \brief Flags changing how libgphoto2 behaves for a context.
+ *
+ * The flags can be combined and are set with gp_context_set_flags().
+ */
+typedef enum _GPContextFlags {
+	GP_CONTEXT_FLAG_NONE		= 0,		/**< Default behaviour. */
+	GP_CONTEXT_FLAG_NO_CACHE	= 1 << 0	/**< Do not keep downloaded file data in the filesystem cache. */
+} GPContextFlags;
+
+void           gp_context_set_flags (GPContext *context, GPContextFlags flags);
+GPContextFlags gp_context_get_flags (GPContext *context);
+
 /* Functions */
 typedef void (* GPContextIdleFunc)     (GPContext *context, void *data);
 typedef void (* GPContextErrorFunc)    (GPContext *context, const char *text, void *data);
@@ -85,14 +85,38 @@ typedef enum {
  * \brief File storage type.
  *
  * The file storage type. Only used internally for now, but might
- * be exposed later on. See gp_file_new() and gp_file_new_from_fd().
+ * be exposed later on. See gp_file_new(), gp_file_new_chunked() and
+ * gp_file_new_from_fd().
  */
 typedef enum {
 	GP_FILE_ACCESSTYPE_MEMORY,	/**< File is in system memory. */
 	GP_FILE_ACCESSTYPE_FD,		/**< File is associated with a UNIX filedescriptor. */
-	GP_FILE_ACCESSTYPE_HANDLER	/**< File is associated with a programmatic handler. */
+	GP_FILE_ACCESSTYPE_HANDLER,	/**< File is associated with a programmatic handler. */
+	GP_FILE_ACCESSTYPE_CHUNKED	/**< File is in system memory, in several chunks. */
 } CameraFileAccessType;
 
+/**
+ * \brief Digests of the file data, see gp_file_set_digest_types().
+ *
+ * gp_file_get_digest() returns them in big-endian byte order.
+ */
+typedef enum {
+	GP_FILE_DIGEST_CRC32C = 1 << 0,	/**< CRC-32C (Castagnoli), 4 bytes. */
+	GP_FILE_DIGEST_XXH64  = 1 << 1,	/**< xxHash64 with seed 0, 8 bytes. */
+	GP_FILE_DIGEST_SHA256 = 1 << 2	/**< SHA-256, 32 bytes. */
+} CameraFileDigestType;
+
+/**
+ * \brief When data written to disk is forced out of the page cache.
+ *
+ * See gp_file_set_sync_policy().
+ */
+typedef enum {
+	GP_FILE_SYNC_NONE = 0,	/**< Leave it to the operating system (default). */
+	GP_FILE_SYNC_DATA,	/**< fdatasync(): the data, and metadata needed to read it back. */
+	GP_FILE_SYNC_FULL	/**< fsync(): the data and all metadata. */
+} CameraFileSyncPolicy;
+
 /* FIXME: api might be unstable. function return gphoto results codes. */
 typedef struct _CameraFileHandler {
 	int (*size) (void*priv, uint64_t *size); /* only for read? */
@@ -110,7 +134,17 @@ typedef struct _CameraFileHandler {
  */
 typedef struct _CameraFile CameraFile;
 
+/**
+ * \brief Releases data passed to gp_file_set_data_external().
+ *
+ * Called with the data, its size and the private pointer once no
+ * #CameraFile uses the data any more.
+ */
+typedef void (*CameraFileReleaseFunc) (void *data, unsigned long int size,
+				       void *priv);
+
 int gp_file_new            (CameraFile **file);
+int gp_file_new_chunked    (CameraFile **file);
 int gp_file_new_from_fd    (CameraFile **file, int fd);
 int gp_file_new_from_handler (CameraFile **file, CameraFileHandler *handler, void*priv);
 int gp_file_ref            (CameraFile *file);
@@ -134,6 +168,21 @@ int gp_file_set_data_and_size (CameraFile*,       char *data,
 			       unsigned long int size);
 int gp_file_get_data_and_size (CameraFile*, const char **data,
 			       unsigned long int *size);
+int gp_file_set_data_external (CameraFile*, const char *data,
+			       unsigned long int size,
+			       CameraFileReleaseFunc release, void *priv);
+int gp_file_count_chunks      (CameraFile*, unsigned int *count);
+int gp_file_get_chunk         (CameraFile*, unsigned int n, const char **data,
+			       unsigned long int *size);
+int gp_file_set_write_behind  (CameraFile*, unsigned int buffers,
+			       unsigned long int size);
+int gp_file_flush             (CameraFile*);
+
+int gp_file_set_digest_types  (CameraFile*, int types);
+int gp_file_get_digest        (CameraFile*, CameraFileDigestType type,
+			       unsigned char *digest, unsigned int *size);
+
+int gp_file_set_sync_policy   (CameraFile*, CameraFileSyncPolicy policy);
 /* "Do not use those"
  *
  * These functions probably were originally intended for internal use only.
@@ -159,6 +208,7 @@ int gp_file_get_data_and_size (CameraFile*, const char **data,
  * header files will not contain definitions for you to use any more.
  */
 int gp_file_open           (CameraFile *file, const char *filename);
+int gp_file_open_mapped    (CameraFile *file, const char *filename);
 int gp_file_save           (CameraFile *file, const char *filename);
 int gp_file_clean          (CameraFile *file);
 int gp_file_copy           (CameraFile *destination, CameraFile *source);
@@ -167,6 +217,7 @@ int gp_file_copy           (CameraFile *destination, CameraFile *source);
 /* These are for use by camera drivers only */
 int gp_file_append            (CameraFile*, const char *data,
 			       unsigned long int size);
+int gp_file_reserve           (CameraFile*, unsigned long int size);
 int gp_file_slurp             (CameraFile*, char *data,
 			       size_t size, size_t *readlen);
 
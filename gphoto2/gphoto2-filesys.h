@@ -242,12 +242,19 @@ int gp_filesystem_append           (CameraFilesystem *fs, const char *folder,
 int gp_filesystem_set_info_noop    (CameraFilesystem *fs,
 				    const char *folder, const char *filename,
 				    CameraFileInfo info, GPContext *context);
+int gp_filesystem_set_stamp        (CameraFilesystem *fs,
+				    const char *folder, const char *filename,
+				    uint64_t stamp, GPContext *context);
 int gp_filesystem_set_file_noop    (CameraFilesystem *fs,
 				    const char *folder, const char *filename,
 				    CameraFileType type,
 				    CameraFile *file, GPContext *context);
 int gp_filesystem_delete_file_noop (CameraFilesystem *fs, const char *folder,
 				    const char *filename, GPContext *context);
+int gp_filesystem_make_dir_noop    (CameraFilesystem *fs, const char *folder,
+				    const char *name, GPContext *context);
+int gp_filesystem_remove_dir_noop  (CameraFilesystem *fs, const char *folder,
+				    const char *name, GPContext *context);
 int gp_filesystem_reset            (CameraFilesystem *fs);
 
 /* Information retrieval */
@@ -281,6 +288,31 @@ typedef int (*CameraFilesystemGetInfoFunc) (CameraFilesystem *fs,
 					    const char *filename,
 					    CameraFileInfo *info, void *data,
 					    GPContext *context);
+
+/**
+ * \brief Lists the files of a folder together with their information.
+ * \param fs a #CameraFilesystem
+ * \param folder the folder to list
+ * \param list the #CameraList to append the file names to
+ * \param infos receives a malloc()ed array with one #CameraFileInfo per
+ *        entry appended to list, or NULL if none is known
+ * \param data the data passed to gp_filesystem_set_funcs()
+ * \param context a #GPContext
+ *
+ * The filesystem frees the infos array. Entries whose fields are all 0
+ * are queried through the get_info_func later.
+ *
+ * \return a gphoto2 error code.
+ */
+typedef int (*CameraFilesystemListInfoFunc) (CameraFilesystem *fs,
+					     const char *folder,
+					     CameraList *list,
+					     CameraFileInfo **infos,
+					     void *data, GPContext *context);
+int gp_filesystem_list_files_with_info (CameraFilesystem *fs,
+					const char *folder, CameraList *list,
+					CameraFileInfo **infos,
+					GPContext *context);
 int gp_filesystem_get_info       (CameraFilesystem *fs, const char *folder,
 				  const char *filename, CameraFileInfo *info,
 				  GPContext *context);
@@ -318,6 +350,44 @@ int gp_filesystem_read_file	(CameraFilesystem *fs, const char *folder,
 int gp_filesystem_delete_file    (CameraFilesystem *fs, const char *folder,
 				  const char *filename, GPContext *context);
 
+/**
+ * \brief A file requested from gp_filesystem_get_files().
+ */
+typedef struct _CameraFileRequest {
+	const char	*folder;	/**< \brief The folder of the file. */
+	const char	*name;		/**< \brief The name of the file. */
+	CameraFileType	type;		/**< \brief The type of data to get. */
+} CameraFileRequest;
+
+/**
+ * \brief Receives the result of one #CameraFileRequest.
+ * \param request the request, as passed in
+ * \param file the retrieved data, only valid during the call unless
+ *        referenced with gp_file_ref()
+ * \param result a gphoto2 error code, file is empty if negative
+ * \param data the data passed along with the function
+ *
+ * Requests may be completed in any order.
+ *
+ * \return a gphoto2 error code, a negative value stops the batch.
+ */
+typedef int (*CameraFileRequestFunc) (const CameraFileRequest *request,
+				      CameraFile *file, int result,
+				      void *data);
+
+typedef int (*CameraFilesystemGetFilesFunc)   (CameraFilesystem *fs,
+					       const CameraFileRequest *requests,
+					       unsigned int count,
+					       CameraFileRequestFunc func,
+					       void *func_data,
+					       void *data,
+					       GPContext *context);
+int gp_filesystem_get_files      (CameraFilesystem *fs,
+				  const CameraFileRequest *requests,
+				  unsigned int count,
+				  CameraFileRequestFunc func, void *data,
+				  GPContext *context);
+
 /* Folders */
 typedef int (*CameraFilesystemPutFileFunc)   (CameraFilesystem *fs,
 					      const char *folder,
@@ -344,6 +414,30 @@ int gp_filesystem_get_storageinfo (CameraFilesystem *fs,
 				   int *nrofstorageinformations,
 				   GPContext *context);
 
+/**
+ * \brief Computes a fingerprint of the files below a folder.
+ * \param fs a #CameraFilesystem
+ * \param folder the folder
+ * \param fingerprint receives the fingerprint
+ * \param data the data passed to gp_filesystem_set_funcs()
+ * \param context a #GPContext
+ *
+ * The fingerprint has to change whenever a file is added to or removed
+ * from folder or any of its subfolders. It is only worth supplying if it
+ * is much cheaper than listing the folders, drivers return
+ * #GP_ERROR_NOT_SUPPORTED for folders where it is not.
+ *
+ * \return a gphoto2 error code.
+ */
+typedef int (*CameraFilesystemFingerprintFunc) (CameraFilesystem *fs,
+						const char *folder,
+						uint64_t *fingerprint,
+						void *data,
+						GPContext *context);
+
+int gp_filesystem_get_fingerprint (CameraFilesystem *fs, const char *folder,
+				   uint64_t *fingerprint, GPContext *context);
+
 typedef struct _CameraFilesystemFuncs CameraFilesystemFuncs;
 struct _CameraFilesystemFuncs {
 	CameraFilesystemListFunc	file_list_func;
@@ -358,9 +452,12 @@ struct _CameraFilesystemFuncs {
 	CameraFilesystemReadFileFunc	read_file_func;
 	CameraFilesystemDeleteFileFunc	del_file_func;
 	CameraFilesystemStorageInfoFunc	storage_info_func;
+	CameraFilesystemGetFilesFunc	get_files_func;
+	CameraFilesystemListInfoFunc	file_list_info_func;
+	CameraFilesystemFingerprintFunc	fingerprint_func;
 
 	/* for later use. Remove one if you add a new function */
-	void				*unused[31];
+	void				*unused[28];
 };
 int gp_filesystem_set_funcs	(CameraFilesystem *fs,
 				 CameraFilesystemFuncs *funcs,
@@ -374,6 +471,88 @@ int gp_filesystem_make_dir   (CameraFilesystem *fs, const char *folder,
 int gp_filesystem_remove_dir (CameraFilesystem *fs, const char *folder,
 			      const char *name, GPContext *context);
 
+/* Snapshots */
+
+/**
+ * \brief How a file differs from a snapshot.
+ */
+typedef enum {
+	GP_FILESYSTEM_CHANGE_ADDED,	/**< \brief The file is not in the snapshot. */
+	GP_FILESYSTEM_CHANGE_REMOVED,	/**< \brief The file is only in the snapshot. */
+	/**
+	 * \brief The size or mtime of the file differs.
+	 *
+	 * Not reported below folders whose fingerprint did not change, so
+	 * files modified in place on a ptp2 camera, whose fingerprint covers
+	 * only the object handles, are missed. See gp_filesystem_diff().
+	 */
+	GP_FILESYSTEM_CHANGE_CHANGED
+} CameraFilesystemChange;
+
+/**
+ * \brief Receives one difference found by gp_filesystem_diff().
+ * \param change how the file differs
+ * \param folder the folder of the file
+ * \param filename the name of the file
+ * \param info the size and mtime of the file, taken from the snapshot
+ *        for #GP_FILESYSTEM_CHANGE_REMOVED
+ * \param data the data passed to gp_filesystem_diff()
+ *
+ * Returning an error aborts gp_filesystem_diff() with that error.
+ *
+ * \return a gphoto2 error code.
+ */
+typedef int (*CameraFilesystemChangeFunc) (CameraFilesystemChange change,
+					   const char *folder,
+					   const char *filename,
+					   const CameraFileInfo *info,
+					   void *data);
+
+int gp_filesystem_snapshot (CameraFilesystem *fs, const char *folder,
+			    char **snapshot, unsigned long *size,
+			    GPContext *context);
+int gp_filesystem_diff     (CameraFilesystem *fs,
+			    const char *snapshot, unsigned long size,
+			    CameraFilesystemChangeFunc func, void *data,
+			    char **newsnapshot, unsigned long *newsize,
+			    GPContext *context);
+
+/* Caching */
+
+/**
+ * \brief Classes of file data kept in the filesystem cache.
+ *
+ * Each class has its own LRU list and byte budget, so that large
+ * downloads do not push out the small previews and vice versa.
+ */
+typedef enum {
+	GP_FILESYSTEM_CACHE_FILES,	/**< \brief #GP_FILE_TYPE_NORMAL, #GP_FILE_TYPE_RAW and #GP_FILE_TYPE_AUDIO data. */
+	GP_FILESYSTEM_CACHE_PREVIEWS	/**< \brief #GP_FILE_TYPE_PREVIEW, #GP_FILE_TYPE_EXIF and #GP_FILE_TYPE_METADATA data. */
+} CameraFilesystemCacheClass;
+
+/**
+ * \brief Usage statistics of one #CameraFilesystemCacheClass.
+ */
+typedef struct _CameraFilesystemCacheStats {
+	uint64_t	hits;		/**< \brief Downloads served from the cache. */
+	uint64_t	misses;		/**< \brief Downloads that went to the camera. */
+	uint64_t	evictions;	/**< \brief Entries dropped to stay within the budget. */
+	uint64_t	size;		/**< \brief Bytes currently cached. */
+	uint64_t	budget;		/**< \brief Byte budget, 0 if unlimited. */
+	unsigned int	entries;	/**< \brief Files currently cached. */
+	uint64_t	relists;	/**< \brief Folders listed by the camera driver, for the whole filesystem. */
+	uint64_t	relists_avoided; /**< \brief Changes reported by the camera driver that were merged into the cached folders instead of listing them again, for the whole filesystem. */
+} CameraFilesystemCacheStats;
+
+int gp_filesystem_set_identity     (CameraFilesystem *fs,
+				    const char *identity);
+int gp_filesystem_set_cache_budget (CameraFilesystem *fs,
+				    CameraFilesystemCacheClass cls,
+				    uint64_t budget);
+int gp_filesystem_get_cache_stats  (CameraFilesystem *fs,
+				    CameraFilesystemCacheClass cls,
+				    CameraFilesystemCacheStats *stats);
+
 /* For debugging */
 int gp_filesystem_dump         (CameraFilesystem *fs);
 
@@ -1453,6 +1453,47 @@ gp_camera_wait_for_event (Camera *camera, int timeout,
 	return (GP_OK);
 }
 
+/**
+ * Get file descriptors to wait on for camera events.
+ *
+ * @param camera a Camera
+ * @param fds array to fill, may be NULL if max is 0
+ * @param max number of entries in fds
+ * @param context a GPContext
+ * @return the number of file descriptors, which can be more than max,
+ *   or a gphoto2 error code
+ *
+ * Fills fds with file descriptors and poll() events that become ready
+ * when the camera has sent an event. An application can wait for them
+ * in its own poll(), epoll or main loop and then fetch the events with
+ * gp_camera_wait_for_event() and a timeout of 0, until it returns
+ * GP_EVENT_TIMEOUT.
+ *
+ * Readiness is only a hint: the fds can also become ready for other
+ * traffic on the port. The fds stay valid while the camera is
+ * initialized; fetch them again after gp_camera_init().
+ *
+ * Returns GP_ERROR_NOT_SUPPORTED for cameras whose events have to be
+ * polled for with commands, and for ports without file descriptors.
+ */
+int
+gp_camera_get_pollfds (Camera *camera, GPPortPollFd *fds, int max,
+		       GPContext *context)
+{
+	int ret;
+
+	C_PARAMS (camera && (max >= 0) && (fds || !max));
+	CHECK_INIT (camera, context);
+
+	if (!camera->functions->get_pollfds) {
+		CAMERA_UNUSED (camera, context);
+		return (GP_ERROR_NOT_SUPPORTED);
+	}
+	ret = camera->functions->get_pollfds (camera, fds, max, context);
+	CAMERA_UNUSED (camera, context);
+	return (ret);
+}
+
 /**
  * Lists the files in supplied \c folder.
  *
@@ -1481,6 +1522,38 @@ gp_camera_folder_list_files (Camera *camera, const char *folder,
         return (GP_OK);
 }
 
+/**
+ * Lists the files in supplied \c folder along with their information.
+ *
+ * @param camera a #Camera
+ * @param folder a folder
+ * @param list a #CameraList
+ * @param infos receives an array of #CameraFileInfo, one per entry of \c list
+ * @param context a #GPContext
+ * @return a gphoto2 error code
+ *
+ * This saves calling #gp_camera_file_get_info for each listed file. The
+ * caller has to free() the returned \c infos.
+ *
+ **/
+int
+gp_camera_folder_list_files_with_info (Camera *camera, const char *folder,
+				       CameraList *list, CameraFileInfo **infos,
+				       GPContext *context)
+{
+	GP_LOG_D ("Listing files with information in '%s'...", folder);
+
+	C_PARAMS (camera && folder && list && infos);
+	CHECK_INIT (camera, context);
+	CR (camera, gp_list_reset (list), context);
+
+	CHECK_RESULT_OPEN_CLOSE (camera, gp_filesystem_list_files_with_info (
+				camera->fs, folder, list, infos, context), context);
+
+	CAMERA_UNUSED (camera, context);
+	return (GP_OK);
+}
+
 /**
  * Lists the folders in supplied \c folder.
  *
@@ -1696,6 +1769,40 @@ gp_camera_file_get (Camera *camera, const char *folder, const char *file,
 	return (GP_OK);
 }
 
+/**
+ * Retrieves many files from the #Camera.
+ *
+ * @param camera a #Camera
+ * @param requests the folder, name and #CameraFileType of each file
+ * @param count the number of requests
+ * @param func the #CameraFileRequestFunc receiving each file
+ * @param data data passed to func
+ * @param context a #GPContext
+ * @return a gphoto2 error code
+ *
+ * Use this instead of calling gp_camera_file_get() in a loop, for instance
+ * to get the previews of a whole folder. The camera is opened only once
+ * and the driver may reorder and pipeline the transfers, so the requests
+ * may complete in any order. See gp_filesystem_get_files() for details.
+ *
+ **/
+int
+gp_camera_file_get_many (Camera *camera, const CameraFileRequest *requests,
+			 unsigned int count, CameraFileRequestFunc func,
+			 void *data, GPContext *context)
+{
+	GP_LOG_D ("Getting %u files...", count);
+
+	C_PARAMS (camera && (requests || !count) && func);
+	CHECK_INIT (camera, context);
+
+	CHECK_RESULT_OPEN_CLOSE (camera, gp_filesystem_get_files (camera->fs,
+			requests, count, func, data, context), context);
+
+	CAMERA_UNUSED (camera, context);
+	return (GP_OK);
+}
+
 /**
  * Reads a file partially from the #Camera.
  *
@@ -1812,6 +1919,73 @@ gp_camera_folder_remove_dir (Camera *camera, const char *folder,
 	return (GP_OK);
 }
 
+/**
+ * Takes a snapshot of the files in supplied \c folder and its subfolders.
+ *
+ * @param camera a #Camera
+ * @param folder a folder
+ * @param snapshot receives the snapshot
+ * @param size receives the size of the snapshot
+ * @param context a #GPContext
+ * @return a gphoto2 error code
+ *
+ * Pass the snapshot to #gp_camera_folder_diff later to find out what
+ * changed in between. The caller has to free() the returned \c snapshot.
+ *
+ **/
+int
+gp_camera_folder_snapshot (Camera *camera, const char *folder,
+			   char **snapshot, unsigned long *size,
+			   GPContext *context)
+{
+	GP_LOG_D ("Taking a snapshot of '%s'...", folder);
+
+	C_PARAMS (camera && folder && snapshot && size);
+	CHECK_INIT (camera, context);
+
+	CHECK_RESULT_OPEN_CLOSE (camera, gp_filesystem_snapshot (camera->fs,
+				folder, snapshot, size, context), context);
+
+	CAMERA_UNUSED (camera, context);
+	return (GP_OK);
+}
+
+/**
+ * Compares the files on the camera with a snapshot.
+ *
+ * @param camera a #Camera
+ * @param snapshot a snapshot from #gp_camera_folder_snapshot
+ * @param size the size of the snapshot
+ * @param func called for each added, removed or changed file
+ * @param data passed to \c func
+ * @param newsnapshot receives a snapshot of the current state, or NULL
+ * @param newsize receives the size of the new snapshot, or NULL
+ * @param context a #GPContext
+ * @return a gphoto2 error code
+ *
+ * See #gp_filesystem_diff. The caller has to free() the returned
+ * \c newsnapshot.
+ *
+ **/
+int
+gp_camera_folder_diff (Camera *camera, const char *snapshot, unsigned long size,
+		       CameraFilesystemChangeFunc func, void *data,
+		       char **newsnapshot, unsigned long *newsize,
+		       GPContext *context)
+{
+	GP_LOG_D ("Comparing with a snapshot...");
+
+	C_PARAMS (camera && snapshot);
+	CHECK_INIT (camera, context);
+
+	CHECK_RESULT_OPEN_CLOSE (camera, gp_filesystem_diff (camera->fs,
+				snapshot, size, func, data, newsnapshot,
+				newsize, context), context);
+
+	CAMERA_UNUSED (camera, context);
+	return (GP_OK);
+}
+
 /**
  * \brief Gets information on the camera attached storage.
  *
@@ -60,6 +60,8 @@ struct _GPContext
 	GPContextMessageFunc  message_func;
 	void                 *message_func_data;
 
+	GPContextFlags flags;
+
 	unsigned int ref_count;
 };
 
@@ -413,3 +415,35 @@ gp_context_set_message_func (GPContext *context, GPContextMessageFunc func,
 	context->message_func      = func;
 	context->message_func_data = data;
 }
+
+/**
+ * \brief Set the behaviour flags of a context.
+ * \param context a #GPContext
+ * \param flags a bitmask of #GPContextFlags
+ *
+ * The flags apply to all operations that are passed this context.
+ **/
+void
+gp_context_set_flags (GPContext *context, GPContextFlags flags)
+{
+	if (!context)
+		return;
+
+	context->flags = flags;
+}
+
+/**
+ * \brief Get the behaviour flags of a context.
+ * \param context a #GPContext
+ *
+ * \return the #GPContextFlags set on the context, #GP_CONTEXT_FLAG_NONE
+ *         if there is no context.
+ **/
+GPContextFlags
+gp_context_get_flags (GPContext *context)
+{
+	if (!context)
+		return (GP_CONTEXT_FLAG_NONE);
+
+	return (context->flags);
+}
@@ -0,0 +1,480 @@
+/** \file gphoto2-file-digest.c
+ * \brief Incremental CRC-32C, xxHash64 and SHA-256 of CameraFile data.
+ *
+ * \author Copyright 2026 The gPhoto project
+ *
+ * \note
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * \note
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * \note
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ *
+ * \note
+ * The digests are updated with the data as it arrives and can be read
+ * out at any time without ending the stream. CRC-32C uses the crc32
+ * instructions of SSE 4.2 (checked at run time) or ARMv8 (checked at
+ * build time) and falls back to slicing-by-8 tables. xxHash64 and
+ * SHA-256 are plain C.
+ */
+
+#include "config.h"
+#include "gphoto2-file-digest.h"
+
+#include <string.h>
+
+#include <gphoto2/gphoto2-result.h>
+#include <gphoto2/gphoto2-port-log.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+# define CRC32C_SSE42
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+# include <arm_acle.h>
+# define CRC32C_ARM
+#endif
+
+static uint32_t
+get32le (const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t
+get64le (const unsigned char *p)
+{
+	return (uint64_t)get32le (p) | ((uint64_t)get32le (p + 4) << 32);
+}
+
+static uint32_t
+get32be (const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	       ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void
+put_be (unsigned char *p, uint64_t v, int bytes)
+{
+	while (bytes--) {
+		p[bytes] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+/*
+ * CRC-32C (Castagnoli), reflected polynomial 0x82F63B78.
+ */
+
+static uint32_t crc32c_table[8][256];
+static int	crc32c_have_table;
+
+static void
+crc32c_init_table (void)
+{
+	uint32_t	crc;
+	int		i, j;
+
+	if (crc32c_have_table)
+		return;
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc32c_table[j][i] = (crc32c_table[j-1][i] >> 8) ^
+				crc32c_table[0][crc32c_table[j-1][i] & 0xff];
+	crc32c_have_table = 1;
+}
+
+static uint32_t
+crc32c_sw (uint32_t crc, const unsigned char *p, unsigned long size)
+{
+	while (size && ((unsigned long)p & 7)) {
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+		size--;
+	}
+	while (size >= 8) {
+		uint32_t lo = get32le (p) ^ crc, hi = get32le (p + 4);
+
+		crc = crc32c_table[7][lo & 0xff] ^
+		      crc32c_table[6][(lo >> 8) & 0xff] ^
+		      crc32c_table[5][(lo >> 16) & 0xff] ^
+		      crc32c_table[4][lo >> 24] ^
+		      crc32c_table[3][hi & 0xff] ^
+		      crc32c_table[2][(hi >> 8) & 0xff] ^
+		      crc32c_table[1][(hi >> 16) & 0xff] ^
+		      crc32c_table[0][hi >> 24];
+		p += 8;
+		size -= 8;
+	}
+	while (size--)
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+#ifdef CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_hw (uint32_t crc, const unsigned char *p, unsigned long size)
+{
+	uint64_t crc64;
+
+	while (size && ((unsigned long)p & 7)) {
+		crc = __builtin_ia32_crc32qi (crc, *p++);
+		size--;
+	}
+	crc64 = crc;
+	while (size >= 8) {
+		crc64 = __builtin_ia32_crc32di (crc64, get64le (p));
+		p += 8;
+		size -= 8;
+	}
+	crc = crc64;
+	while (size--)
+		crc = __builtin_ia32_crc32qi (crc, *p++);
+	return crc;
+}
+#endif
+
+#ifdef CRC32C_ARM
+static uint32_t
+crc32c_hw (uint32_t crc, const unsigned char *p, unsigned long size)
+{
+	while (size && ((unsigned long)p & 7)) {
+		crc = __crc32cb (crc, *p++);
+		size--;
+	}
+	while (size >= 8) {
+		crc = __crc32cd (crc, get64le (p));
+		p += 8;
+		size -= 8;
+	}
+	while (size--)
+		crc = __crc32cb (crc, *p++);
+	return crc;
+}
+#endif
+
+static uint32_t
+crc32c_update (uint32_t crc, const unsigned char *p, unsigned long size)
+{
+#if defined(CRC32C_SSE42)
+	static int have_sse42 = -1;
+
+	if (have_sse42 < 0)
+		have_sse42 = __builtin_cpu_supports ("sse4.2") ? 1 : 0;
+	if (have_sse42)
+		return crc32c_hw (crc, p, size);
+#elif defined(CRC32C_ARM)
+	return crc32c_hw (crc, p, size);
+#endif
+	return crc32c_sw (crc, p, size);
+}
+
+/*
+ * xxHash64, seed 0.
+ */
+
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x,r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t
+xxh_round (uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_P2;
+	acc = ROTL64 (acc, 31);
+	return acc * XXH_P1;
+}
+
+static uint64_t
+xxh_merge (uint64_t h, uint64_t v)
+{
+	h ^= xxh_round (0, v);
+	return h * XXH_P1 + XXH_P4;
+}
+
+static void
+xxh_stripes (GPFileDigest *d, const unsigned char *p, unsigned long n)
+{
+	uint64_t v1 = d->xxh_v[0], v2 = d->xxh_v[1];
+	uint64_t v3 = d->xxh_v[2], v4 = d->xxh_v[3];
+
+	while (n--) {
+		v1 = xxh_round (v1, get64le (p));
+		v2 = xxh_round (v2, get64le (p + 8));
+		v3 = xxh_round (v3, get64le (p + 16));
+		v4 = xxh_round (v4, get64le (p + 24));
+		p += 32;
+	}
+	d->xxh_v[0] = v1; d->xxh_v[1] = v2;
+	d->xxh_v[2] = v3; d->xxh_v[3] = v4;
+}
+
+static void
+xxh_update (GPFileDigest *d, const unsigned char *p, unsigned long size)
+{
+	d->xxh_len += size;
+	if (d->xxh_buflen) {
+		unsigned long n = 32 - d->xxh_buflen;
+
+		if (n > size)
+			n = size;
+		memcpy (d->xxh_buf + d->xxh_buflen, p, n);
+		d->xxh_buflen += n;
+		p += n;
+		size -= n;
+		if (d->xxh_buflen < 32)
+			return;
+		xxh_stripes (d, d->xxh_buf, 1);
+		d->xxh_buflen = 0;
+	}
+	xxh_stripes (d, p, size / 32);
+	p += size & ~31UL;
+	size &= 31;
+	memcpy (d->xxh_buf, p, size);
+	d->xxh_buflen = size;
+}
+
+static uint64_t
+xxh_final (const GPFileDigest *d)
+{
+	const unsigned char	*p = d->xxh_buf, *end = d->xxh_buf + d->xxh_buflen;
+	uint64_t		h;
+
+	if (d->xxh_len >= 32) {
+		h = ROTL64 (d->xxh_v[0], 1) + ROTL64 (d->xxh_v[1], 7) +
+		    ROTL64 (d->xxh_v[2], 12) + ROTL64 (d->xxh_v[3], 18);
+		h = xxh_merge (h, d->xxh_v[0]);
+		h = xxh_merge (h, d->xxh_v[1]);
+		h = xxh_merge (h, d->xxh_v[2]);
+		h = xxh_merge (h, d->xxh_v[3]);
+	} else
+		h = XXH_P5;
+	h += d->xxh_len;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh_round (0, get64le (p));
+		h = ROTL64 (h, 27) * XXH_P1 + XXH_P4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)get32le (p) * XXH_P1;
+		h = ROTL64 (h, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * XXH_P5;
+		h = ROTL64 (h, 11) * XXH_P1;
+	}
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+/*
+ * SHA-256 (FIPS 180-4).
+ */
+
+static const uint32_t sha_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x,r) (((x) >> (r)) | ((x) << (32 - (r))))
+
+static void
+sha_blocks (uint32_t *h, const unsigned char *p, unsigned long n)
+{
+	uint32_t	w[64], a, b, c, d, e, f, g, hh, t1, t2;
+	int		i;
+
+	while (n--) {
+		for (i = 0; i < 16; i++)
+			w[i] = get32be (p + 4 * i);
+		for (i = 16; i < 64; i++) {
+			uint32_t s0 = ROTR32 (w[i-15], 7) ^ ROTR32 (w[i-15], 18) ^ (w[i-15] >> 3);
+			uint32_t s1 = ROTR32 (w[i-2], 17) ^ ROTR32 (w[i-2], 19) ^ (w[i-2] >> 10);
+
+			w[i] = w[i-16] + s0 + w[i-7] + s1;
+		}
+		a = h[0]; b = h[1]; c = h[2]; d = h[3];
+		e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+		for (i = 0; i < 64; i++) {
+			t1 = hh + (ROTR32 (e, 6) ^ ROTR32 (e, 11) ^ ROTR32 (e, 25)) +
+			     ((e & f) ^ (~e & g)) + sha_k[i] + w[i];
+			t2 = (ROTR32 (a, 2) ^ ROTR32 (a, 13) ^ ROTR32 (a, 22)) +
+			     ((a & b) ^ (a & c) ^ (b & c));
+			hh = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+		h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+		p += 64;
+	}
+}
+
+static void
+sha_update (GPFileDigest *d, const unsigned char *p, unsigned long size)
+{
+	d->sha_len += size;
+	if (d->sha_buflen) {
+		unsigned long n = 64 - d->sha_buflen;
+
+		if (n > size)
+			n = size;
+		memcpy (d->sha_buf + d->sha_buflen, p, n);
+		d->sha_buflen += n;
+		p += n;
+		size -= n;
+		if (d->sha_buflen < 64)
+			return;
+		sha_blocks (d->sha_h, d->sha_buf, 1);
+		d->sha_buflen = 0;
+	}
+	sha_blocks (d->sha_h, p, size / 64);
+	p += size & ~63UL;
+	size &= 63;
+	memcpy (d->sha_buf, p, size);
+	d->sha_buflen = size;
+}
+
+static void
+sha_final (const GPFileDigest *d, unsigned char *out)
+{
+	unsigned char	pad[128];
+	uint32_t	h[8];
+	unsigned int	n = d->sha_buflen, blocks = (n < 56) ? 1 : 2;
+	int		i;
+
+	memcpy (h, d->sha_h, sizeof (h));
+	memset (pad, 0, sizeof (pad));
+	memcpy (pad, d->sha_buf, n);
+	pad[n] = 0x80;
+	put_be (pad + blocks * 64 - 8, d->sha_len * 8, 8);
+	sha_blocks (h, pad, blocks);
+	for (i = 0; i < 8; i++)
+		put_be (out + 4 * i, h[i], 4);
+}
+
+/**
+ * \brief Start new digests.
+ * \param digest the digests
+ * \param types the #CameraFileDigestType values to compute, or'ed together
+ */
+void
+gp_file_digest_init (GPFileDigest *digest, int types)
+{
+	static const uint32_t sha_h0[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memset (digest, 0, sizeof (*digest));
+	digest->types = types;
+	if (types & GP_FILE_DIGEST_CRC32C)
+		crc32c_init_table ();
+	digest->crc32c = 0xffffffff;
+	digest->xxh_v[0] = XXH_P1 + XXH_P2;
+	digest->xxh_v[1] = XXH_P2;
+	digest->xxh_v[2] = 0;
+	digest->xxh_v[3] = -XXH_P1;
+	memcpy (digest->sha_h, sha_h0, sizeof (sha_h0));
+}
+
+/**
+ * \brief Add data to the digests.
+ * \param digest the digests
+ * \param data the data
+ * \param size the number of bytes of data
+ */
+void
+gp_file_digest_update (GPFileDigest *digest, const void *data, unsigned long size)
+{
+	const unsigned char *p = data;
+
+	if (!size)
+		return;
+	if (digest->types & GP_FILE_DIGEST_CRC32C)
+		digest->crc32c = crc32c_update (digest->crc32c, p, size);
+	if (digest->types & GP_FILE_DIGEST_XXH64)
+		xxh_update (digest, p, size);
+	if (digest->types & GP_FILE_DIGEST_SHA256)
+		sha_update (digest, p, size);
+}
+
+/**
+ * \brief Get one digest of the data so far, in big-endian byte order.
+ * \param digest the digests
+ * \param type the #CameraFileDigestType to get
+ * \param out room for the digest
+ * \param size the size of out, on return the size of the digest
+ * \return a gphoto2 error code.
+ *
+ * The digests can still be updated afterwards.
+ */
+int
+gp_file_digest_final (const GPFileDigest *digest, CameraFileDigestType type,
+		      unsigned char *out, unsigned int *size)
+{
+	unsigned int len;
+
+	switch (type) {
+	case GP_FILE_DIGEST_CRC32C:	len = 4; break;
+	case GP_FILE_DIGEST_XXH64:	len = 8; break;
+	case GP_FILE_DIGEST_SHA256:	len = 32; break;
+	default:
+		GP_LOG_E ("Unknown digest type %d.", type);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	if (!(digest->types & type)) {
+		GP_LOG_E ("Digest type %d was not requested.", type);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	if (*size < len) {
+		GP_LOG_E ("Need %u bytes for digest type %d.", len, type);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	*size = len;
+
+	switch (type) {
+	case GP_FILE_DIGEST_CRC32C:
+		put_be (out, ~digest->crc32c, 4);
+		break;
+	case GP_FILE_DIGEST_XXH64:
+		put_be (out, xxh_final (digest), 8);
+		break;
+	case GP_FILE_DIGEST_SHA256:
+		sha_final (digest, out);
+		break;
+	}
+	return GP_OK;
+}
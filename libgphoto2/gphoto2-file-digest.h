@@ -0,0 +1,61 @@
+/** \file gphoto2-file-digest.h
+ * \brief Incremental CRC-32C, xxHash64 and SHA-256 of CameraFile data.
+ *
+ * \author Copyright 2026 The gPhoto project
+ *
+ * \note
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * \note
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * \note
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ *
+ * \note
+ * Internal to libgphoto2, used by gphoto2-file.c only.
+ */
+
+#ifndef __GPHOTO2_FILE_DIGEST_H__
+#define __GPHOTO2_FILE_DIGEST_H__
+
+#include <gphoto2/gphoto2-file.h>
+
+/**
+ * \brief The running digests of one file.
+ *
+ * Only the digests whose #CameraFileDigestType bit is set in types are
+ * updated.
+ */
+typedef struct {
+	int		types;
+
+	uint32_t	crc32c;
+
+	uint64_t	xxh_v[4];
+	uint64_t	xxh_len;
+	unsigned char	xxh_buf[32];
+	unsigned int	xxh_buflen;
+
+	uint32_t	sha_h[8];
+	uint64_t	sha_len;
+	unsigned char	sha_buf[64];
+	unsigned int	sha_buflen;
+} GPFileDigest;
+
+void gp_file_digest_init   (GPFileDigest *digest, int types);
+void gp_file_digest_update (GPFileDigest *digest, const void *data,
+			    unsigned long size);
+int  gp_file_digest_final  (const GPFileDigest *digest, CameraFileDigestType type,
+			    unsigned char *out, unsigned int *size);
+
+#endif /* __GPHOTO2_FILE_DIGEST_H__ */
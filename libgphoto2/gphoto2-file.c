@@ -27,16 +27,30 @@
 #define _POSIX_SOURCE
 #define _DEFAULT_SOURCE
 #define _DARWIN_C_SOURCE
+#define _GNU_SOURCE
 
 #include "config.h"
 #include <gphoto2/gphoto2-file.h>
+#include "gphoto2-file-digest.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <utime.h>
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+# include <sys/mman.h>
+# define USE_MMAP
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+#if defined(HAVE_LIBPTHREAD) && defined(HAVE_PTHREAD_H)
+# include <pthread.h>
+# define USE_WRITE_BEHIND
+#endif
 
 #include <gphoto2/gphoto2-port-log.h>
 #include <gphoto2/gphoto2-port-portability.h>
@@ -50,6 +64,34 @@
 # define MAX_PATH 256
 #endif
 
+/* Chunks of GP_FILE_ACCESSTYPE_CHUNKED files. Small files start with a
+ * small first chunk that grows up to CHUNK_SIZE. */
+#define CHUNK_SIZE	(4 * 1024 * 1024)
+#define CHUNK_FIRST	(64 * 1024)
+
+/*! One piece of the data of a GP_FILE_ACCESSTYPE_CHUNKED file.
+ * \internal
+ */
+typedef struct {
+	unsigned char	*data;
+	unsigned long	size;
+	unsigned long	alloc;
+} CameraFileChunk;
+
+/*! Data of GP_FILE_ACCESSTYPE_MEMORY files shared by several files,
+ * after gp_file_copy() or when wrapping memory the file does not own.
+ * \internal
+ */
+typedef struct {
+	int			ref_count;
+	void			*data;
+	unsigned long		size;
+	CameraFileReleaseFunc	release;	/* NULL: free() data */
+	void			*priv;
+} CameraFileBuffer;
+
+typedef struct _CameraFileWriteBehind CameraFileWriteBehind;
+
 /*! The internals of the CameraFile struct are private.
  * \internal
  */
@@ -64,16 +106,58 @@ struct _CameraFile {
 	/* for GP_FILE_ACCESSTYPE_MEMORY files */
         unsigned long	size;
         unsigned char	*data;
+        unsigned long	alloc;	/* allocated size of data, >= size */
+	CameraFileBuffer *buffer; /* data is shared and read only, alloc 0 */
         unsigned long	offset;	/* read pointer */
 
+	/* for GP_FILE_ACCESSTYPE_CHUNKED files, size and offset as above */
+	CameraFileChunk	*chunks;
+	unsigned int	nchunks, chunks_alloc;
+	unsigned int	cur;		/* chunk last read from ... */
+	unsigned long	cur_start;	/* ... and its offset in the file */
+
 	/* for GP_FILE_ACCESSTYPE_FD files */
 	int		fd;
 
 	/* for GP_FILE_ACCESSTYPE_HANDLER files */
 	CameraFileHandler*handler;
 	void		*private;
+
+	/* for FD and HANDLER files, see gp_file_set_write_behind() */
+	CameraFileWriteBehind *wb;
+
+	/* see gp_file_set_digest_types() */
+	GPFileDigest	*digest;
+	int		digest_valid;
+
+	/* see gp_file_set_sync_policy() */
+	CameraFileSyncPolicy sync;
 };
 
+#ifdef USE_WRITE_BEHIND
+/*! Write-behind state of a file. The buffers are used as a ring: the
+ * writer thread drains the queued ones from head on, appends fill the
+ * one after them.
+ * \internal
+ */
+struct _CameraFileWriteBehind {
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;		/* signalled on every change */
+	unsigned char	**buf;
+	unsigned long	*len;		/* bytes in each queued buffer */
+	unsigned int	count;		/* number of buffers */
+	unsigned long	size;		/* size of each buffer */
+	unsigned int	head;		/* next buffer to write */
+	unsigned int	queued;		/* buffers waiting to be written */
+	int		result;		/* first write error, then writes stop */
+	int		stop;
+	/* only used by the appending thread */
+	unsigned int	fill;
+	unsigned long	fill_len;
+};
+#endif
+
 
 /*! Create new #CameraFile object.
  *
@@ -94,6 +178,28 @@ gp_file_new (CameraFile **file)
 }
 
 
+/*! Create new #CameraFile object keeping its data in chunks.
+ *
+ * Like gp_file_new(), but the data is kept in a list of separately
+ * allocated chunks of a few megabytes instead of one buffer, so that
+ * multi-gigabyte movies need neither one huge allocation nor a second
+ * copy while they grow. Use gp_file_count_chunks() and
+ * gp_file_get_chunk() to get at the data without copying it;
+ * gp_file_get_data_and_size() still works, but has to join the chunks
+ * first.
+ *
+ * \param file a pointer to a #CameraFile
+ * \return a gphoto2 error code.
+ */
+int
+gp_file_new_chunked (CameraFile **file)
+{
+	CHECK_RESULT (gp_file_new (file));
+	(*file)->accesstype = GP_FILE_ACCESSTYPE_CHUNKED;
+	return (GP_OK);
+}
+
+
 /*! Create new #CameraFile object from a UNIX filedescriptor.
  *
  * This function takes ownership of the filedescriptor and will close it when closing the CameraFile.
@@ -147,15 +253,21 @@ gp_file_new_from_handler (CameraFile **file, CameraFileHandler* handler, void*pr
  **/
 int gp_file_free (CameraFile *file)
 {
+	int ret = GP_OK;
+
 	C_PARAMS (file);
 
+	/* Data still queued is written, errors are reported here. */
+	if (file->wb)
+		ret = gp_file_set_write_behind (file, 0, 0);
 	CHECK_RESULT (gp_file_clean (file));
 
 	if (file->accesstype == GP_FILE_ACCESSTYPE_FD)
 		close (file->fd);
 
+	free (file->digest);
 	free (file);
-	return (GP_OK);
+	return ret;
 }
 
 
@@ -195,25 +307,234 @@ gp_file_unref (CameraFile *file)
 }
 
 
-/**
- * @param file a #CameraFile
- * @param data
- * @param size
- * @return a gphoto2 error code.
- *
- **/
-int
-gp_file_append (CameraFile *file, const char *data,
-		unsigned long int size)
+/* Adds a chunk taking over data, which has room for alloc bytes. */
+static int
+chunk_add (CameraFile *file, unsigned char *data, unsigned long size,
+	   unsigned long alloc)
 {
-	C_PARAMS (file);
+	CameraFileChunk *c;
 
+	if (file->nchunks == file->chunks_alloc) {
+		unsigned int n = file->chunks_alloc ? file->chunks_alloc * 2 : 16;
+
+		C_MEM (c = realloc (file->chunks, n * sizeof (*c)));
+		file->chunks = c;
+		file->chunks_alloc = n;
+	}
+	c = &file->chunks[file->nchunks++];
+	c->data  = data;
+	c->size  = size;
+	c->alloc = alloc;
+	file->size += size;
+	return (GP_OK);
+}
+
+static void
+chunk_free (CameraFile *file)
+{
+	unsigned int i;
+
+	for (i = 0; i < file->nchunks; i++)
+		free (file->chunks[i].data);
+	free (file->chunks);
+	file->chunks = NULL;
+	file->nchunks = file->chunks_alloc = 0;
+	file->cur = 0;
+	file->cur_start = 0;
+	file->size = 0;
+}
+
+static int
+chunk_append (CameraFile *file, const char *data, unsigned long size)
+{
+	C_PARAMS (file->size + size >= file->size); /* overflow */
+
+	while (size) {
+		CameraFileChunk	*c = NULL;
+		unsigned long	n;
+
+		if (file->nchunks)
+			c = &file->chunks[file->nchunks - 1];
+		if (c && (c->size == c->alloc) && (c->alloc < CHUNK_SIZE)) {
+			unsigned char	*grown;
+			unsigned long	alloc = c->alloc * 2;
+
+			if (alloc < c->size + size)
+				alloc = c->size + size;
+			if (alloc > CHUNK_SIZE)
+				alloc = CHUNK_SIZE;
+			C_MEM (grown = realloc (c->data, alloc));
+			c->data  = grown;
+			c->alloc = alloc;
+		} else if (!c || (c->size == c->alloc)) {
+			unsigned char	*fresh;
+			unsigned long	alloc = CHUNK_SIZE;
+
+			if (!file->nchunks && (size < CHUNK_SIZE))
+				alloc = (size < CHUNK_FIRST) ? CHUNK_FIRST : size;
+			C_MEM (fresh = malloc (alloc));
+			if (chunk_add (file, fresh, 0, alloc) < GP_OK) {
+				free (fresh);
+				return (GP_ERROR_NO_MEMORY);
+			}
+			c = &file->chunks[file->nchunks - 1];
+		}
+		n = c->alloc - c->size;
+		if (n > size)
+			n = size;
+		memcpy (c->data + c->size, data, n);
+		c->size    += n;
+		file->size += n;
+		data += n;
+		size -= n;
+	}
+	return (GP_OK);
+}
+
+/* Finds the chunk holding offset, starting at the one last read from. */
+static unsigned int
+chunk_find (CameraFile *file, unsigned long offset, unsigned long *start)
+{
+	unsigned int	i = file->cur;
+	unsigned long	s = file->cur_start;
+
+	if ((i >= file->nchunks) || (offset < s)) {
+		i = 0;
+		s = 0;
+	}
+	while ((i < file->nchunks) && (offset >= s + file->chunks[i].size)) {
+		s += file->chunks[i].size;
+		i++;
+	}
+	file->cur = i;
+	file->cur_start = s;
+	*start = s;
+	return i;
+}
+
+/* Copies up to size bytes from offset on, returns how many there were. */
+static unsigned long
+chunk_read (CameraFile *file, unsigned long offset, char *data,
+	    unsigned long size)
+{
+	unsigned long	start, done = 0;
+	unsigned int	i = chunk_find (file, offset, &start);
+
+	while ((done < size) && (i < file->nchunks)) {
+		CameraFileChunk	*c = &file->chunks[i];
+		unsigned long	skip = offset + done - start;
+		unsigned long	n = c->size - skip;
+
+		if (n > size - done)
+			n = size - done;
+		memcpy (data + done, c->data + skip, n);
+		done += n;
+		start += c->size;
+		i++;
+	}
+	return done;
+}
+
+/* Joins the chunks into one for callers that need contiguous data. */
+static int
+chunk_flatten (CameraFile *file)
+{
+	unsigned char	*data;
+	unsigned long	done = 0;
+	unsigned int	i;
+
+	if (file->nchunks < 2)
+		return (GP_OK);
+	GP_LOG_D ("Joining %u chunks of %lu bytes.", file->nchunks, file->size);
+	C_MEM (data = malloc (file->size));
+	for (i = 0; i < file->nchunks; i++) {
+		memcpy (data + done, file->chunks[i].data, file->chunks[i].size);
+		done += file->chunks[i].size;
+		free (file->chunks[i].data);
+	}
+	file->chunks[0].data  = data;
+	file->chunks[0].size  = file->size;
+	file->chunks[0].alloc = file->size;
+	file->nchunks = 1;
+	file->cur = 0;
+	file->cur_start = 0;
+	return (GP_OK);
+}
+
+static void
+buffer_unref (CameraFileBuffer *buffer)
+{
+	if (--buffer->ref_count)
+		return;
+	if (buffer->release)
+		buffer->release (buffer->data, buffer->size, buffer->priv);
+	else
+		free (buffer->data);
+	free (buffer);
+}
+
+/* Forgets the data of a memory file, whether it is shared or not. */
+static void
+gp_file_drop_data (CameraFile *file)
+{
+	if (file->buffer) {
+		buffer_unref (file->buffer);
+		file->buffer = NULL;
+	} else
+		free (file->data);
+	file->data = NULL;
+	file->size = 0;
+	file->alloc = 0;
+}
+
+/* Turns the data of a memory file into a buffer other files can share. */
+static int
+gp_file_share (CameraFile *file)
+{
+	CameraFileBuffer *buffer;
+
+	if (file->buffer)
+		return (GP_OK);
+	C_MEM (buffer = calloc (1, sizeof (CameraFileBuffer)));
+	buffer->ref_count = 1;
+	buffer->data = file->data;
+	buffer->size = file->size;
+	file->buffer = buffer;
+	file->alloc = 0;
+	return (GP_OK);
+}
+
+/* Grows the data of a memory file to hold at least size bytes. Shared
+ * data has no room to grow, so this is where it gets copied on write. */
+static int
+gp_file_grow (CameraFile *file, unsigned long int size)
+{
+	unsigned char *data;
+
+	if (size <= file->alloc)
+		return (GP_OK);
+	if (file->buffer) {
+		if (size < file->size)
+			size = file->size;
+		C_MEM (data = malloc (size));
+		memcpy (data, file->data, file->size);
+		buffer_unref (file->buffer);
+		file->buffer = NULL;
+		file->data  = data;
+		file->alloc = size;
+		return (GP_OK);
+	}
+	C_MEM (data = realloc (file->data, size));
+	file->data  = data;
+	file->alloc = size;
+	return (GP_OK);
+}
+
+/* Appends to a FD or HANDLER file right away. */
+static int
+gp_file_write_now (CameraFile *file, const char *data, unsigned long int size)
+{
 	switch (file->accesstype) {
-	case GP_FILE_ACCESSTYPE_MEMORY:
-		C_MEM (file->data = realloc (file->data, sizeof (char) * (file->size + size)));
-		memcpy (&file->data[file->size], data, size);
-		file->size += size;
-		break;
 	case GP_FILE_ACCESSTYPE_FD: {
 		unsigned long int curwritten = 0;
 		while (curwritten < size) {
@@ -243,6 +564,416 @@ gp_file_append (CameraFile *file, const char *data,
         return (GP_OK);
 }
 
+#ifdef USE_WRITE_BEHIND
+static void *
+gp_file_writer (void *data)
+{
+	CameraFile		*file = data;
+	CameraFileWriteBehind	*wb = file->wb;
+	unsigned int		b;
+	int			ret;
+
+	pthread_mutex_lock (&wb->lock);
+	while (1) {
+		while (!wb->queued && !wb->stop)
+			pthread_cond_wait (&wb->cond, &wb->lock);
+		if (!wb->queued)
+			break;
+		b = wb->head;
+		/* After an error the rest is dropped, appends fail anyway. */
+		if (wb->result == GP_OK) {
+			pthread_mutex_unlock (&wb->lock);
+			ret = gp_file_write_now (file, (char*)wb->buf[b], wb->len[b]);
+			if ((ret >= GP_OK) && file->digest)
+				gp_file_digest_update (file->digest, wb->buf[b], wb->len[b]);
+			pthread_mutex_lock (&wb->lock);
+			if (ret < GP_OK)
+				wb->result = ret;
+		}
+		wb->head = (b + 1) % wb->count;
+		wb->queued--;
+		pthread_cond_broadcast (&wb->cond);
+	}
+	pthread_mutex_unlock (&wb->lock);
+	return NULL;
+}
+
+/* Hands the buffer being filled to the writer and waits for a free one. */
+static int
+gp_file_write_behind_submit (CameraFileWriteBehind *wb)
+{
+	int ret;
+
+	pthread_mutex_lock (&wb->lock);
+	wb->len[wb->fill] = wb->fill_len;
+	wb->queued++;
+	pthread_cond_broadcast (&wb->cond);
+	while (wb->queued == wb->count)
+		pthread_cond_wait (&wb->cond, &wb->lock);
+	ret = wb->result;
+	pthread_mutex_unlock (&wb->lock);
+
+	wb->fill = (wb->fill + 1) % wb->count;
+	wb->fill_len = 0;
+	return ret;
+}
+
+static int
+gp_file_write_behind (CameraFile *file, const char *data, unsigned long int size)
+{
+	CameraFileWriteBehind *wb = file->wb;
+
+	while (size) {
+		unsigned long n = wb->size - wb->fill_len;
+
+		if (n > size)
+			n = size;
+		memcpy (wb->buf[wb->fill] + wb->fill_len, data, n);
+		wb->fill_len += n;
+		data += n;
+		size -= n;
+		if (wb->fill_len == wb->size)
+			CHECK_RESULT (gp_file_write_behind_submit (wb));
+	}
+	return (GP_OK);
+}
+
+static void
+gp_file_write_behind_free (CameraFileWriteBehind *wb)
+{
+	unsigned int i;
+
+	for (i = 0; wb->buf && (i < wb->count); i++)
+		free (wb->buf[i]);
+	free (wb->buf);
+	free (wb->len);
+	free (wb);
+}
+#endif
+
+/* Starts the digests over with the data the file has now. Files not in
+ * memory cannot be read back cheaply, their digests only cover what is
+ * written from now on and are only usable if the caller says so. */
+static void
+gp_file_digest_restart (CameraFile *file, int valid)
+{
+	unsigned int i;
+
+	if (!file->digest)
+		return;
+	gp_file_digest_init (file->digest, file->digest->types);
+	switch (file->accesstype) {
+	case GP_FILE_ACCESSTYPE_MEMORY:
+		gp_file_digest_update (file->digest, file->data, file->size);
+		file->digest_valid = 1;
+		break;
+	case GP_FILE_ACCESSTYPE_CHUNKED:
+		for (i = 0; i < file->nchunks; i++)
+			gp_file_digest_update (file->digest, file->chunks[i].data,
+					       file->chunks[i].size);
+		file->digest_valid = 1;
+		break;
+	default:
+		file->digest_valid = valid;
+		break;
+	}
+}
+
+/**
+ * @param file a #CameraFile
+ * @param data
+ * @param size
+ * @return a gphoto2 error code.
+ *
+ * Memory files grow geometrically, so appending many blocks copies the
+ * data only a few times. See also #gp_file_reserve.
+ *
+ **/
+int
+gp_file_append (CameraFile *file, const char *data,
+		unsigned long int size)
+{
+	int ret;
+
+	C_PARAMS (file);
+
+	switch (file->accesstype) {
+	case GP_FILE_ACCESSTYPE_MEMORY: {
+		unsigned long int need = file->size + size;
+
+		C_PARAMS (need >= file->size); /* overflow */
+		if (need > file->alloc) {
+			unsigned long int alloc = file->alloc * 2;
+
+			if (alloc < 4096)
+				alloc = 4096;
+			if ((alloc < need) || (alloc < file->alloc))
+				alloc = need;
+			CHECK_RESULT (gp_file_grow (file, alloc));
+		}
+		memcpy (&file->data[file->size], data, size);
+		file->size += size;
+		break;
+	}
+	case GP_FILE_ACCESSTYPE_CHUNKED: {
+		unsigned long int oldsize = file->size;
+
+		ret = chunk_append (file, data, size);
+		if (ret < GP_OK) {
+			/* Some of the chunks may have made it in. */
+			if (file->size != oldsize)
+				file->digest_valid = 0;
+			return ret;
+		}
+		break;
+	}
+	case GP_FILE_ACCESSTYPE_FD:
+	case GP_FILE_ACCESSTYPE_HANDLER:
+#ifdef USE_WRITE_BEHIND
+		/* The writer thread updates the digests. */
+		if (file->wb)
+			return gp_file_write_behind (file, data, size);
+#endif
+		ret = gp_file_write_now (file, data, size);
+		if (ret < GP_OK) {
+			/* Nobody knows how much of data was written. */
+			file->digest_valid = 0;
+			return ret;
+		}
+		break;
+	default:
+		GP_LOG_E ("Unknown file access type %d", file->accesstype);
+		return GP_ERROR;
+	}
+
+	/* Only over data the file actually got. */
+	if (file->digest)
+		gp_file_digest_update (file->digest, data, size);
+        return (GP_OK);
+}
+
+
+/**
+ * Makes room for data to be appended.
+ *
+ * @param file a #CameraFile
+ * @param size the expected total size of the file in bytes
+ * @return a gphoto2 error code.
+ *
+ * Camera drivers call this once they know the size of a file they are
+ * about to append to file block by block, so that the data does not
+ * need to be moved while it grows. This is only a hint; the file can
+ * still grow beyond size, and nothing is done for files not kept in
+ * memory.
+ *
+ **/
+int
+gp_file_reserve (CameraFile *file, unsigned long int size)
+{
+	C_PARAMS (file);
+
+	if (file->accesstype != GP_FILE_ACCESSTYPE_MEMORY)
+		return (GP_OK);
+	return gp_file_grow (file, size);
+}
+
+/**
+ * Let a writer thread do the writes of a file.
+ *
+ * @param file a #CameraFile
+ * @param buffers the number of buffers, at least 2, or 0 to stop
+ * @param size the size of each buffer in bytes
+ * @return a gphoto2 error code.
+ *
+ * Files associated with a filedescriptor or a handler normally write
+ * the data camera drivers append to them right away, so a slow disk
+ * stalls the transfer from the camera. With write-behind, appended data
+ * is copied into one of a few buffers that a separate thread writes
+ * out, and gp_file_append() only waits once all buffers are full.
+ * Handler functions are then called from that thread.
+ *
+ * Write errors show up at the next gp_file_append() that has to hand a
+ * buffer over, and at the latest in gp_file_flush(), which waits until
+ * everything is written. All other functions accessing the data flush
+ * first, as does gp_file_free(), which returns the error of the last
+ * writes. Stopping write-behind also flushes.
+ *
+ * Returns #GP_ERROR_NOT_SUPPORTED for files kept in memory and where
+ * libgphoto2 was built without thread support.
+ *
+ **/
+int
+gp_file_set_write_behind (CameraFile *file, unsigned int buffers,
+			  unsigned long int size)
+{
+#ifdef USE_WRITE_BEHIND
+	CameraFileWriteBehind	*wb;
+	unsigned int		i;
+	int			ret = GP_OK;
+
+	C_PARAMS (file);
+
+	if ((file->accesstype != GP_FILE_ACCESSTYPE_FD) &&
+	    (file->accesstype != GP_FILE_ACCESSTYPE_HANDLER))
+		return (GP_ERROR_NOT_SUPPORTED);
+
+	if (file->wb) {
+		wb = file->wb;
+		ret = gp_file_flush (file);
+		pthread_mutex_lock (&wb->lock);
+		wb->stop = 1;
+		pthread_cond_broadcast (&wb->cond);
+		pthread_mutex_unlock (&wb->lock);
+		pthread_join (wb->thread, NULL);
+		pthread_cond_destroy (&wb->cond);
+		pthread_mutex_destroy (&wb->lock);
+		gp_file_write_behind_free (wb);
+		file->wb = NULL;
+	}
+	if (!buffers || (ret < GP_OK))
+		return ret;
+	C_PARAMS ((buffers >= 2) && size);
+
+	C_MEM (wb = calloc (1, sizeof (CameraFileWriteBehind)));
+	wb->count = buffers;
+	wb->size = size;
+	wb->buf = calloc (buffers, sizeof (*wb->buf));
+	wb->len = calloc (buffers, sizeof (*wb->len));
+	for (i = 0; wb->buf && (i < buffers); i++)
+		if (!(wb->buf[i] = malloc (size)))
+			break;
+	if (!wb->len || !wb->buf || (i < buffers)) {
+		gp_file_write_behind_free (wb);
+		return (GP_ERROR_NO_MEMORY);
+	}
+	pthread_mutex_init (&wb->lock, NULL);
+	pthread_cond_init (&wb->cond, NULL);
+	file->wb = wb;
+	if (pthread_create (&wb->thread, NULL, gp_file_writer, file)) {
+		GP_LOG_E ("Could not start the writer thread.");
+		file->wb = NULL;
+		pthread_cond_destroy (&wb->cond);
+		pthread_mutex_destroy (&wb->lock);
+		gp_file_write_behind_free (wb);
+		return (GP_ERROR);
+	}
+	return (GP_OK);
+#else
+	C_PARAMS (file);
+	return buffers ? GP_ERROR_NOT_SUPPORTED : GP_OK;
+#endif
+}
+
+/**
+ * Wait until all data appended to a file is written.
+ *
+ * @param file a #CameraFile
+ * @return a gphoto2 error code.
+ *
+ * Returns the first error the writer thread ran into. Does nothing
+ * for files without write-behind, see gp_file_set_write_behind().
+ *
+ **/
+int
+gp_file_flush (CameraFile *file)
+{
+#ifdef USE_WRITE_BEHIND
+	CameraFileWriteBehind	*wb;
+	int			ret;
+
+	C_PARAMS (file);
+
+	wb = file->wb;
+	if (!wb)
+		return (GP_OK);
+	if (wb->fill_len)
+		gp_file_write_behind_submit (wb);
+	pthread_mutex_lock (&wb->lock);
+	while (wb->queued)
+		pthread_cond_wait (&wb->cond, &wb->lock);
+	ret = wb->result;
+	pthread_mutex_unlock (&wb->lock);
+	return ret;
+#else
+	C_PARAMS (file);
+	return (GP_OK);
+#endif
+}
+
+/**
+ * Compute digests of the data while it is written to a file.
+ *
+ * @param file a #CameraFile
+ * @param types the #CameraFileDigestType values to compute, or'ed
+ *              together, or 0 to stop
+ * @return a gphoto2 error code.
+ *
+ * The digests are updated by gp_file_append() and
+ * gp_file_set_data_and_size() as camera drivers deliver the data, so
+ * checking a download needs no second pass over it. With write-behind
+ * the writer thread does this. Read them with gp_file_get_digest().
+ *
+ * For files kept in memory the digests always cover all of the data.
+ * For files associated with a filedescriptor or handler they cover
+ * what is written after this call or after gp_file_set_data_and_size();
+ * they cannot be recomputed after gp_file_copy() or gp_file_open()
+ * changed such a file.
+ *
+ **/
+int
+gp_file_set_digest_types (CameraFile *file, int types)
+{
+	C_PARAMS (file);
+	C_PARAMS (!(types & ~(GP_FILE_DIGEST_CRC32C | GP_FILE_DIGEST_XXH64 |
+			      GP_FILE_DIGEST_SHA256)));
+
+	CHECK_RESULT (gp_file_flush (file));
+
+	if (!types) {
+		free (file->digest);
+		file->digest = NULL;
+		return (GP_OK);
+	}
+	if (!file->digest)
+		C_MEM (file->digest = malloc (sizeof (GPFileDigest)));
+	file->digest->types = types;
+	gp_file_digest_restart (file, 1);
+	return (GP_OK);
+}
+
+/**
+ * Get a digest of the data of a file.
+ *
+ * @param file a #CameraFile
+ * @param type the #CameraFileDigestType to get
+ * @param digest room for the digest
+ * @param size the size of digest, on return the size of the digest
+ * @return a gphoto2 error code.
+ *
+ * The type must have been requested with gp_file_set_digest_types().
+ * The digest is returned in big-endian byte order, so a 32 byte buffer
+ * has room for all types. Getting a digest does not stop the digests,
+ * data can still be appended afterwards.
+ *
+ **/
+int
+gp_file_get_digest (CameraFile *file, CameraFileDigestType type,
+		    unsigned char *digest, unsigned int *size)
+{
+	C_PARAMS (file && digest && size);
+
+	if (!file->digest) {
+		GP_LOG_E ("No digests were requested for this file.");
+		return (GP_ERROR_BAD_PARAMETERS);
+	}
+	CHECK_RESULT (gp_file_flush (file));
+	if (!file->digest_valid) {
+		GP_LOG_E ("The data was changed in a way the digests cannot follow.");
+		return (GP_ERROR_NOT_SUPPORTED);
+	}
+	return gp_file_digest_final (file->digest, type, digest, size);
+}
+
 /**
  * @param file a #CameraFile
  * @param data
@@ -257,6 +988,8 @@ gp_file_slurp (CameraFile *file, char *data,
 ) {
 	C_PARAMS (file);
 
+	CHECK_RESULT (gp_file_flush (file));
+
 	switch (file->accesstype) {
 	case GP_FILE_ACCESSTYPE_MEMORY:
 		if (size > file->size-file->offset)
@@ -265,6 +998,11 @@ gp_file_slurp (CameraFile *file, char *data,
 		file->offset += size;
 		if (readlen) *readlen = size;
 		break;
+	case GP_FILE_ACCESSTYPE_CHUNKED:
+		size = chunk_read (file, file->offset, data, size);
+		file->offset += size;
+		if (readlen) *readlen = size;
+		break;
 	case GP_FILE_ACCESSTYPE_FD: {
 		unsigned long int curread = 0;
 		while (curread < size) {
@@ -316,11 +1054,30 @@ gp_file_set_data_and_size (CameraFile *file, char *data,
 {
 	C_PARAMS (file);
 
+	CHECK_RESULT (gp_file_flush (file));
+	if (file->digest) {
+		gp_file_digest_init (file->digest, file->digest->types);
+		gp_file_digest_update (file->digest, data, size);
+		file->digest_valid = 1;
+	}
+
 	switch (file->accesstype) {
 	case GP_FILE_ACCESSTYPE_MEMORY:
-		free (file->data);
+		gp_file_drop_data (file);
 		file->data = (unsigned char*)data;
 		file->size = size;
+		file->alloc = size;
+		break;
+	case GP_FILE_ACCESSTYPE_CHUNKED:
+		chunk_free (file);
+		if (!size) {
+			free (data);
+			break;
+		}
+		if (chunk_add (file, (unsigned char*)data, size, size) < GP_OK) {
+			free (data);
+			return (GP_ERROR_NO_MEMORY);
+		}
 		break;
 	case GP_FILE_ACCESSTYPE_FD: {
 		unsigned int curwritten = 0;
@@ -389,6 +1146,11 @@ gp_file_set_data_and_size (CameraFile *file, char *data,
  *
  * For regular CameraFiles, the pointer to data that is returned is
  * still owned by libgphoto2 and its lifetime is the same as the #file.
+ * The data can be shared with copies made by gp_file_copy() or with
+ * the memory passed to gp_file_set_data_external() and must not be
+ * changed through this pointer.
+ * Chunked files (see gp_file_new_chunked()) first have to join their
+ * chunks into one buffer when data is requested.
  *
  * For filedescriptor or handler based CameraFile types, the returned
  * data pointer is owned by the caller and needs to be free()d to avoid
@@ -401,13 +1163,34 @@ gp_file_get_data_and_size (CameraFile *file, const char **data,
 {
 	C_PARAMS (file);
 
+	CHECK_RESULT (gp_file_flush (file));
+
 	switch (file->accesstype) {
 	case GP_FILE_ACCESSTYPE_MEMORY:
+		/* Give back what gp_file_append() allocated ahead, but
+		 * keep the byte that terminates the data of gp_file_open(). */
+		if (file->size && (file->alloc > file->size + 1)) {
+			unsigned char *trimmed = realloc (file->data, file->size + 1);
+
+			if (trimmed) {
+				file->data  = trimmed;
+				file->alloc = file->size + 1;
+			}
+		}
 		if (data)
 			*data = (char*)file->data;
 		if (size)
 			*size = file->size;
 		break;
+	case GP_FILE_ACCESSTYPE_CHUNKED:
+		/* Only callers that want the data pay for joining it. */
+		if (data) {
+			CHECK_RESULT (chunk_flatten (file));
+			*data = file->nchunks ? (char*)file->chunks[0].data : NULL;
+		}
+		if (size)
+			*size = file->size;
+		break;
 	case GP_FILE_ACCESSTYPE_FD: {
 		off_t	offset;
 		off_t	curread = 0;
@@ -478,84 +1261,356 @@ gp_file_get_data_and_size (CameraFile *file, const char **data,
 
 
 /**
+ * Get the number of chunks the data of a file is kept in.
+ *
  * @param file a #CameraFile
- * @param filename
+ * @param count the number of chunks
  * @return a gphoto2 error code.
  *
+ * Together with gp_file_get_chunk() this walks the data of a file kept
+ * in memory without joining it into one buffer, e.g. to fill the
+ * struct iovec array for writev(). Files created with gp_file_new()
+ * have one chunk, empty files none. Files associated with a
+ * filedescriptor or a handler are not kept in memory and return
+ * #GP_ERROR_NOT_SUPPORTED.
+ *
  **/
 int
-gp_file_save (CameraFile *file, const char *filename)
+gp_file_count_chunks (CameraFile *file, unsigned int *count)
 {
-	FILE *fp;
-	struct utimbuf u;
-
-	C_PARAMS (file && filename);
+	C_PARAMS (file && count);
 
 	switch (file->accesstype) {
 	case GP_FILE_ACCESSTYPE_MEMORY:
-		if (!(fp = fopen (filename, "wb")))
-			return GP_ERROR;
-		if (fwrite (file->data, (size_t)sizeof(char), (size_t)file->size, fp) != (size_t)file->size) {
-			GP_LOG_E ("Not enough space on device in order to save '%s'.", filename);
-			fclose (fp);
-			unlink (filename);
-			return GP_ERROR;
-		}
-		fclose (fp);
+		*count = file->size ? 1 : 0;
+		return (GP_OK);
+	case GP_FILE_ACCESSTYPE_CHUNKED:
+		*count = file->nchunks;
+		return (GP_OK);
+	default:
+		return (GP_ERROR_NOT_SUPPORTED);
+	}
+}
+
+/**
+ * Get one chunk of the data of a file.
+ *
+ * @param file a #CameraFile
+ * @param n the number of the chunk, from 0 to the count returned by
+ *          gp_file_count_chunks() - 1
+ * @param data the start of the chunk
+ * @param size the number of bytes in the chunk
+ * @return a gphoto2 error code.
+ *
+ * The data is still owned by the file and stays valid until the file
+ * is changed. Chunks are in file order and only the last one can be
+ * empty.
+ *
+ **/
+int
+gp_file_get_chunk (CameraFile *file, unsigned int n, const char **data,
+		   unsigned long int *size)
+{
+	unsigned int count;
+
+	C_PARAMS (file && data && size);
+	CHECK_RESULT (gp_file_count_chunks (file, &count));
+	C_PARAMS (n < count);
+
+	if (file->accesstype == GP_FILE_ACCESSTYPE_MEMORY) {
+		*data = (char*)file->data;
+		*size = file->size;
+	} else {
+		*data = (char*)file->chunks[n].data;
+		*size = file->chunks[n].size;
+	}
+	return (GP_OK);
+}
+
+
+/**
+ * Set when data written to disk is forced out of the page cache.
+ *
+ * @param file a #CameraFile
+ * @param policy a #CameraFileSyncPolicy
+ * @return a gphoto2 error code.
+ *
+ * The policy applies when gp_file_save() writes the file and when
+ * gp_file_copy() copies into a file associated with a filedescriptor.
+ * The default, #GP_FILE_SYNC_NONE, is the fastest; the others make
+ * sure the data survives a crash or a yanked card reader once the call
+ * returned, at the cost of waiting for the disk.
+ *
+ **/
+int
+gp_file_set_sync_policy (CameraFile *file, CameraFileSyncPolicy policy)
+{
+	C_PARAMS (file);
+	C_PARAMS ((policy == GP_FILE_SYNC_NONE) || (policy == GP_FILE_SYNC_DATA) ||
+		  (policy == GP_FILE_SYNC_FULL));
+
+	file->sync = policy;
+	return (GP_OK);
+}
+
+/* Applies a CameraFileSyncPolicy to a filedescriptor. Pipes and sockets
+ * cannot be synced, that is not an error. */
+static int
+gp_file_sync_fd (int fd, CameraFileSyncPolicy policy)
+{
+	int res = 0;
+
+	switch (policy) {
+	case GP_FILE_SYNC_DATA:
+#ifdef HAVE_FDATASYNC
+		res = fdatasync (fd);
 		break;
-	case GP_FILE_ACCESSTYPE_FD: {
-		char *data;
-		off_t	curread = 0;
-		off_t	offset;
+#endif
+		/* fall through */
+	case GP_FILE_SYNC_FULL:
+#ifdef HAVE_FSYNC
+		res = fsync (fd);
+#endif
+		break;
+	default:
+		break;
+	}
+	if ((res == -1) && (errno != EINVAL) && (errno != EROFS)) {
+		GP_LOG_E ("Encountered error %d syncing.", errno);
+		return GP_ERROR_IO_WRITE;
+	}
+	return GP_OK;
+}
 
-		if (-1 == lseek (file->fd, 0, SEEK_END))
-			return GP_ERROR_IO;
-		if (-1 == (offset = lseek (file->fd, 0, SEEK_CUR))) {
-			/* should not happen if we passed the above case */
-			GP_LOG_E ("Encountered error %d lseekin to CUR.", errno);
-			return GP_ERROR_IO_READ;
+/* Reserves size bytes from the current offset of fd on disk, so the
+ * filesystem can lay the file out in one piece and a full disk is
+ * noticed before the transfer instead of halfway through it. */
+static int
+gp_file_preallocate (int fd, off_t size)
+{
+#if defined(HAVE_FALLOCATE) || defined(HAVE_POSIX_FALLOCATE)
+	struct stat	st;
+	off_t		offset;
+	int		res;
+
+	if ((size <= 0) || fstat (fd, &st) || !S_ISREG (st.st_mode))
+		return GP_OK;
+	if (-1 == (offset = lseek (fd, 0, SEEK_CUR)))
+		return GP_OK;
+#ifdef HAVE_FALLOCATE
+	/* Where the filesystem cannot reserve space (vfat, exfat, NFS)
+	 * posix_fallocate() would write every block, fallocate() fails. */
+	res = fallocate (fd, 0, offset, size) ? errno : 0;
+	if ((res == EOPNOTSUPP) || (res == ENOSYS))
+		return GP_OK;
+#else
+	res = posix_fallocate (fd, offset, size);
+#endif
+	if (res == ENOSPC) {
+		GP_LOG_E ("Not enough space on device for %ld bytes.", (long)size);
+		return GP_ERROR_NO_SPACE;
+	}
+	if (res)
+		GP_LOG_D ("Could not preallocate %ld bytes: %d.", (long)size, res);
+#endif
+	return GP_OK;
+}
+
+#if defined(HAVE_COPY_FILE_RANGE) || (defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H))
+/* Errors that mean the kernel cannot copy between these two
+ * filedescriptors, so the next way of copying should be tried. */
+static int
+gp_file_copy_unsupported (int err)
+{
+	return (err == ENOSYS) || (err == EXDEV) || (err == EINVAL) ||
+	       (err == EOPNOTSUPP) || (err == EBADF) || (err == EPERM);
+}
+#endif
+
+/* Largest piece handed to the kernel at once. */
+#define COPY_MAX	(1024 * 1024 * 1024)
+
+/* Copies size bytes, or up to the end of file if size is -1, from the
+ * current offset of src to the current offset of dst. Tries
+ * copy_file_range() and sendfile(), which copy inside the kernel or even
+ * inside the filesystem, before reading and writing 64 KB blocks. */
+static int
+gp_file_copy_fd (int dst, int src, off_t size)
+{
+	off_t	done = 0;
+	ssize_t	res;
+	size_t	len;
+	char	*buf;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	while ((size < 0) || (done < size)) {
+		len = ((size < 0) || (size - done > COPY_MAX)) ? COPY_MAX : size - done;
+		res = copy_file_range (src, NULL, dst, NULL, len, 0);
+		if (res > 0) {
+			done += res;
+			continue;
 		}
-		if (-1 == lseek (file->fd, 0, SEEK_SET)) {
-			/* should not happen if we passed the above case */
-			GP_LOG_E ("Encountered error %d lseekin to BEGIN.", errno);
-			return GP_ERROR_IO_READ;
+		/* Older kernels report 0 for files they cannot copy. */
+		if ((res == 0) && done)
+			goto eof;
+		if ((res == -1) && !gp_file_copy_unsupported (errno)) {
+			GP_LOG_E ("Encountered error %d copying.", errno);
+			return (errno == ENOSPC) ? GP_ERROR_NO_SPACE : GP_ERROR_IO_WRITE;
 		}
-		C_MEM (data = malloc(65536));
-		if (!(fp = fopen (filename, "wb"))) {
-			free (data);
-			return GP_ERROR;
+		break;
+	}
+	if ((size >= 0) && (done == size))
+		return GP_OK;
+#endif
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+	while ((size < 0) || (done < size)) {
+		len = ((size < 0) || (size - done > COPY_MAX)) ? COPY_MAX : size - done;
+		res = sendfile (dst, src, NULL, len);
+		if (res > 0) {
+			done += res;
+			continue;
 		}
-		while (curread < offset) {
-			int toread, res;
-
-			toread = 65536;
-			if (toread > (offset-curread))
-				toread = offset-curread;
-			res = read (file->fd, data, toread);
-			if (res <= 0) {
-				free (data);
-				fclose (fp);
-				unlink (filename);
-				return GP_ERROR_IO_READ;
-			}
-			if ((int)fwrite (data, 1, res, fp) != res) {
-				GP_LOG_E ("Not enough space on device in order to save '%s'.", filename);
-				free (data);
-				fclose (fp);
-				unlink (filename);
-				return GP_ERROR;
+		if (res == 0)
+			goto eof;
+		if (!gp_file_copy_unsupported (errno)) {
+			GP_LOG_E ("Encountered error %d copying.", errno);
+			return (errno == ENOSPC) ? GP_ERROR_NO_SPACE : GP_ERROR_IO_WRITE;
+		}
+		break;
+	}
+	if ((size >= 0) && (done == size))
+		return GP_OK;
+#endif
+	C_MEM (buf = malloc (65536));
+	while ((size < 0) || (done < size)) {
+		ssize_t curwritten = 0;
+
+		len = ((size < 0) || (size - done > 65536)) ? 65536 : size - done;
+		res = read (src, buf, len);
+		if (res == -1) {
+			free (buf);
+			GP_LOG_E ("Encountered error %d reading.", errno);
+			return GP_ERROR_IO_READ;
+		}
+		if (res == 0)
+			break;
+		while (curwritten < res) {
+			ssize_t res2 = write (dst, buf + curwritten, res - curwritten);
+
+			if (res2 <= 0) {
+				free (buf);
+				GP_LOG_E ("Encountered error %d writing.", errno);
+				return ((res2 == -1) && (errno == ENOSPC)) ?
+					GP_ERROR_NO_SPACE : GP_ERROR_IO_WRITE;
 			}
-			curread += res;
+			curwritten += res2;
 		}
-		free (data);
-		fclose (fp);
+		done += res;
+	}
+	free (buf);
+#if defined(HAVE_COPY_FILE_RANGE) || (defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H))
+eof:
+#endif
+	if ((size >= 0) && (done < size)) {
+		GP_LOG_E ("File ended after %ld of %ld bytes.", (long)done, (long)size);
+		return GP_ERROR_IO_READ;
+	}
+	return GP_OK;
+}
+
+/* gp_file_save() of a GP_FILE_ACCESSTYPE_FD file. */
+static int
+gp_file_save_fd (CameraFile *file, int fd)
+{
+	off_t	offset;
+
+	if (-1 == lseek (file->fd, 0, SEEK_END))
+		return GP_ERROR_IO;
+	if (-1 == (offset = lseek (file->fd, 0, SEEK_CUR))) {
+		/* should not happen if we passed the above case */
+		GP_LOG_E ("Encountered error %d lseekin to CUR.", errno);
+		return GP_ERROR_IO_READ;
+	}
+	if (-1 == lseek (file->fd, 0, SEEK_SET)) {
+		/* should not happen if we passed the above case */
+		GP_LOG_E ("Encountered error %d lseekin to BEGIN.", errno);
+		return GP_ERROR_IO_READ;
+	}
+	CHECK_RESULT (gp_file_preallocate (fd, offset));
+	return gp_file_copy_fd (fd, file->fd, offset);
+}
+
+/**
+ * @param file a #CameraFile
+ * @param filename
+ * @return a gphoto2 error code.
+ *
+ * Files associated with a filedescriptor are copied by the kernel where
+ * it can. The space for the file is reserved before writing it. See
+ * gp_file_set_sync_policy() for how to make sure it reached the disk.
+ *
+ **/
+int
+gp_file_save (CameraFile *file, const char *filename)
+{
+	FILE *fp;
+	struct utimbuf u;
+	unsigned int i;
+	int ret;
+
+	C_PARAMS (file && filename);
+
+	CHECK_RESULT (gp_file_flush (file));
+
+	switch (file->accesstype) {
+	case GP_FILE_ACCESSTYPE_MEMORY:
+	case GP_FILE_ACCESSTYPE_CHUNKED:
+	case GP_FILE_ACCESSTYPE_FD:
 		break;
-	}
 	default:
 		GP_LOG_E ("Unknown file access type %d", file->accesstype);
 		return GP_ERROR;
 	}
 
+	if (!(fp = fopen (filename, "wb")))
+		return GP_ERROR;
+
+	if (file->accesstype == GP_FILE_ACCESSTYPE_FD)
+		ret = gp_file_save_fd (file, fileno (fp));
+	else
+		ret = gp_file_preallocate (fileno (fp), file->size);
+
+	if ((ret == GP_OK) && (file->accesstype == GP_FILE_ACCESSTYPE_MEMORY)) {
+		if (fwrite (file->data, (size_t)sizeof(char), (size_t)file->size, fp) != (size_t)file->size) {
+			GP_LOG_E ("Not enough space on device in order to save '%s'.", filename);
+			ret = GP_ERROR;
+		}
+	}
+	for (i = 0; (ret == GP_OK) && (file->accesstype == GP_FILE_ACCESSTYPE_CHUNKED) &&
+		    (i < file->nchunks); i++) {
+		size_t size = file->chunks[i].size;
+
+		if (fwrite (file->chunks[i].data, 1, size, fp) != size) {
+			GP_LOG_E ("Not enough space on device in order to save '%s'.", filename);
+			ret = GP_ERROR;
+		}
+	}
+
+	if ((ret == GP_OK) && (file->sync != GP_FILE_SYNC_NONE)) {
+		if (fflush (fp))
+			ret = GP_ERROR_IO_WRITE;
+		else
+			ret = gp_file_sync_fd (fileno (fp), file->sync);
+	}
+	if (fclose (fp) && (ret == GP_OK)) {
+		GP_LOG_E ("Encountered error %d writing '%s'.", errno, filename);
+		ret = GP_ERROR_IO_WRITE;
+	}
+	if (ret < GP_OK) {
+		unlink (filename);
+		return ret;
+	}
+
 	if (file->mtime) {
 		u.actime = file->mtime;
 		u.modtime = file->mtime;
@@ -565,7 +1620,6 @@ gp_file_save (CameraFile *file, const char *filename)
 	return (GP_OK);
 }
 
-
 /*
  * mime types that cannot be determined by the filename
  * extension. Better hack would be to use library that examine
@@ -594,6 +1648,50 @@ static const char *mime_table[] = {
     "arw",  GP_MIME_ARW,
     "txt",  GP_MIME_TXT,
     NULL};
+/* Name, mime type and mtime of a file opened from the local disk. */
+static void
+gp_file_open_name (CameraFile *file, const char *filename)
+{
+        char *name, *dot;
+        int  i;
+	struct stat s;
+
+        name = strrchr (filename, '/');
+        if (name)
+                strncpy (file->name, name + 1, sizeof (file->name));
+           else
+                strncpy (file->name, filename, sizeof (file->name));
+
+        /* MIME lookup */
+        dot = strrchr (filename, '.');
+        if (dot) {
+            for (i = 0; mime_table[i] ; i+=2)
+                if (!strcasecmp (mime_table[i], dot+1)) {
+                    strncpy (file->mime_type, mime_table[i+1], sizeof(file->mime_type));
+                    break;
+                }
+            if (!mime_table[i])
+                /*
+                 * We did not found the type in the lookup table,
+                 * so we use the file suffix as mime type.
+                 * Note: This should probably use GP_MIME_UNKNOWN instead
+                 * of returning a non-standard type.
+                 */
+                sprintf(file->mime_type, "image/%s", dot + 1);
+        } else
+            /*
+             * Damn, no filename suffix...
+             */
+            strncpy (file->mime_type, GP_MIME_UNKNOWN,
+		     sizeof (file->mime_type));
+
+	if (stat (filename, &s) != -1) {
+		file->mtime = s.st_mtime;
+	} else {
+		file->mtime = time (NULL);
+	}
+}
+
 /**
  * @param file a #CameraFile
  * @param filename
@@ -604,14 +1702,12 @@ int
 gp_file_open (CameraFile *file, const char *filename)
 {
         FILE *fp;
-        char *name, *dot;
         long size, size_read;
-        int  i;
-	struct stat s;
 
 
 	C_PARAMS (file && filename);
 
+	CHECK_RESULT (gp_file_flush (file));
 	CHECK_RESULT (gp_file_clean (file));
 
         fp = fopen(filename, "r");
@@ -636,8 +1732,40 @@ gp_file_open (CameraFile *file, const char *filename)
 		}
 		fclose(fp);
 		file->size = size_read;
+		file->alloc = size + 1;
 		file->data[size_read] = 0;
 		break;
+	case GP_FILE_ACCESSTYPE_CHUNKED: {
+		unsigned char	*chunk;
+		unsigned long	left = (size > 0) ? size : 0;
+		size_t		alloc, n;
+
+		/* Chunks as chunk_append() would make them, a small file
+		 * gets one chunk of its size. */
+		while (left) {
+			alloc = (left < CHUNK_SIZE) ? left : CHUNK_SIZE;
+			chunk = malloc (alloc);
+			if (!chunk) {
+				gp_file_clean (file);
+				fclose (fp);
+				return (GP_ERROR_NO_MEMORY);
+			}
+			n = fread (chunk, 1, alloc, fp);
+			if (ferror (fp) || (n && (chunk_add (file, chunk, n, alloc) < GP_OK))) {
+				free (chunk);
+				gp_file_clean (file);
+				fclose (fp);
+				return (GP_ERROR);
+			}
+			if (!n)
+				free (chunk);
+			if (n < alloc)
+				break;	/* the file got shorter */
+			left -= n;
+		}
+		fclose (fp);
+		break;
+	}
 	case GP_FILE_ACCESSTYPE_FD: {
 		if (file->fd == -1) {
 			file->fd = dup(fileno(fp));
@@ -652,42 +1780,137 @@ gp_file_open (CameraFile *file, const char *filename)
 		break;
 	}
 
-        name = strrchr (filename, '/');
-        if (name)
-                strncpy (file->name, name + 1, sizeof (file->name));
-           else
-                strncpy (file->name, filename, sizeof (file->name));
+	gp_file_digest_restart (file, 0);
+	gp_file_open_name (file, filename);
 
-        /* MIME lookup */
-        dot = strrchr (filename, '.');
-        if (dot) {
-            for (i = 0; mime_table[i] ; i+=2)
-                if (!strcasecmp (mime_table[i], dot+1)) {
-                    strncpy (file->mime_type, mime_table[i+1], sizeof(file->mime_type));
-                    break;
-                }
-            if (!mime_table[i])
-                /*
-                 * We did not found the type in the lookup table,
-                 * so we use the file suffix as mime type.
-                 * Note: This should probably use GP_MIME_UNKNOWN instead
-                 * of returning a non-standard type.
-                 */
-                sprintf(file->mime_type, "image/%s", dot + 1);
-        } else
-            /*
-             * Damn, no filename suffix...
-             */
-            strncpy (file->mime_type, GP_MIME_UNKNOWN,
-		     sizeof (file->mime_type));
+        return (GP_OK);
+}
 
-	if (stat (filename, &s) != -1) {
-		file->mtime = s.st_mtime;
-	} else {
-		file->mtime = time (NULL);
+#ifdef USE_MMAP
+static void
+gp_file_unmap (void *data, unsigned long int size, void *priv)
+{
+	munmap (data, size);
+}
+#endif
+
+/**
+ * Like gp_file_open(), but maps the file into memory instead of reading it.
+ *
+ * @param file a #CameraFile
+ * @param filename
+ * @return a gphoto2 error code.
+ *
+ * Uploading a large file opened this way does not read all of it into
+ * memory first; the camera driver reads it straight from the page
+ * cache. The file on disk must not be truncated while file or a copy
+ * of it is in use. Where mmap() is not available, and for files not
+ * kept in system memory, this is the same as gp_file_open().
+ *
+ * As with gp_file_open(), the data is followed by a NUL byte, so
+ * callers may treat text files as strings. The mapping is read-only:
+ * the data returned by gp_file_get_data_and_size() must not be
+ * written to, change the file with gp_file_append() and friends or
+ * work on a copy instead.
+ *
+ **/
+int
+gp_file_open_mapped (CameraFile *file, const char *filename)
+{
+#ifdef USE_MMAP
+	struct stat	st;
+	void		*map;
+	int		fd, ret;
+
+	C_PARAMS (file && filename);
+
+	if (file->accesstype != GP_FILE_ACCESSTYPE_MEMORY)
+		return gp_file_open (file, filename);
+	fd = open (filename, O_RDONLY);
+	if (fd == -1)
+		return (GP_ERROR);
+	/* Empty or special files and those too large to map are read.
+	 * The kernel zero-fills the rest of the last page of a mapping,
+	 * which terminates the data; files filling their last page have
+	 * no such byte and are read as well. */
+	if ((fstat (fd, &st) == -1) || !S_ISREG (st.st_mode) || !st.st_size ||
+	    ((off_t)(unsigned long)st.st_size != st.st_size) ||
+	    !(st.st_size % sysconf (_SC_PAGESIZE)) ||
+	    ((map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+		close (fd);
+		return gp_file_open (file, filename);
 	}
+	close (fd);
+#ifdef MADV_SEQUENTIAL
+	madvise (map, st.st_size, MADV_SEQUENTIAL);
+#endif
 
-        return (GP_OK);
+	CHECK_RESULT (gp_file_clean (file));
+	ret = gp_file_set_data_external (file, map, st.st_size, gp_file_unmap, NULL);
+	if (ret < GP_OK) {
+		munmap (map, st.st_size);
+		return ret;
+	}
+	gp_file_open_name (file, filename);
+	return (GP_OK);
+#else
+	return gp_file_open (file, filename);
+#endif
+}
+
+/* Release function for memory the caller keeps owning. */
+static void
+buffer_keep (void *data, unsigned long int size, void *priv)
+{
+}
+
+/**
+ * Let a file use data that stays owned by someone else.
+ *
+ * @param file a #CameraFile
+ * @param data the data
+ * @param size the number of bytes of data
+ * @param release called with data, size and priv once no file uses
+ *                data any more, or NULL
+ * @param priv passed to release
+ * @return a gphoto2 error code.
+ *
+ * The file, and copies made of it with gp_file_copy(), use data in
+ * place until they are changed, e.g. with gp_file_append(), which
+ * copies it first. This avoids a copy of data that is already in
+ * memory, like a mapped file or a buffer of a frontend. data has to
+ * stay valid and unchanged until release is called or, without a
+ * release function, until the file and all its copies are freed or
+ * changed.
+ *
+ * Only files kept in system memory (see gp_file_new()) support this,
+ * others return #GP_ERROR_NOT_SUPPORTED without calling release.
+ *
+ **/
+int
+gp_file_set_data_external (CameraFile *file, const char *data,
+			   unsigned long int size,
+			   CameraFileReleaseFunc release, void *priv)
+{
+	CameraFileBuffer *buffer;
+
+	C_PARAMS (file && (data || !size));
+
+	if (file->accesstype != GP_FILE_ACCESSTYPE_MEMORY)
+		return (GP_ERROR_NOT_SUPPORTED);
+	C_MEM (buffer = calloc (1, sizeof (CameraFileBuffer)));
+	buffer->ref_count = 1;
+	buffer->data = (char*)data;
+	buffer->size = size;
+	buffer->release = release ? release : buffer_keep;
+	buffer->priv = priv;
+
+	gp_file_drop_data (file);
+	file->buffer = buffer;
+	file->data = (unsigned char*)data;
+	file->size = size;
+	gp_file_digest_restart (file, 0);
+	return (GP_OK);
 }
 
 
@@ -708,43 +1931,154 @@ gp_file_clean (CameraFile *file)
 
 	switch (file->accesstype) {
 	case GP_FILE_ACCESSTYPE_MEMORY:
-		free (file->data);
-		file->data = NULL;
-		file->size = 0;
+		gp_file_drop_data (file);
+		break;
+	case GP_FILE_ACCESSTYPE_CHUNKED:
+		chunk_free (file);
 		break;
 	case GP_FILE_ACCESSTYPE_FD:
 		break;
 	default:break;
 	}
+	gp_file_digest_restart (file, 1);
 	strcpy (file->name, "");
         return (GP_OK);
 }
 
-/**
- * @param destination a #CameraFile
- * @param source a #CameraFile
- * @return a gphoto2 error code.
- *
- **/
-int
-gp_file_copy (CameraFile *destination, CameraFile *source)
+/* Writes one piece of data to a filedescriptor or handler file. */
+static int
+gp_file_write_to (CameraFile *destination, const char *data,
+		  unsigned long size)
+{
+	unsigned long curwritten = 0;
+
+	while (curwritten < size) {
+		if (destination->accesstype == GP_FILE_ACCESSTYPE_FD) {
+			ssize_t res = write (destination->fd, data+curwritten, size-curwritten);
+
+			if (res == -1)
+				return GP_ERROR_IO_WRITE;
+			if (!res) /* no progress? */
+				return GP_ERROR_IO_WRITE;
+			curwritten += res;
+		} else {
+			uint64_t tmpsize = size - curwritten;
+			int res = destination->handler->write (destination->private, (unsigned char*)data+curwritten, &tmpsize);
+
+			if (res < GP_OK)
+				return res;
+			if (!tmpsize) /* no progress? */
+				return GP_ERROR_IO_WRITE;
+			curwritten += tmpsize;
+		}
+	}
+	return GP_OK;
+}
+
+/* gp_file_copy() if source or destination are chunked files. */
+static int
+gp_file_copy_chunked (CameraFile *destination, CameraFile *source)
+{
+	const char	*data;
+	unsigned long	size;
+	unsigned int	i, n;
+
+	switch (destination->accesstype) {
+	case GP_FILE_ACCESSTYPE_MEMORY:
+	case GP_FILE_ACCESSTYPE_CHUNKED:
+		if (destination->accesstype == GP_FILE_ACCESSTYPE_MEMORY) {
+			gp_file_drop_data (destination);
+			CHECK_RESULT (gp_file_reserve (destination, source->size));
+		} else
+			chunk_free (destination);
+
+		if (source->accesstype == GP_FILE_ACCESSTYPE_FD) {
+			char	*buf;
+			ssize_t	res;
+
+			if (-1 == lseek (source->fd, 0, SEEK_SET)) {
+				GP_LOG_E ("Encountered error %d lseeking to 0.", errno);
+				return GP_ERROR_IO_READ;
+			}
+			C_MEM (buf = malloc (65536));
+			while ((res = read (source->fd, buf, 65536)) > 0) {
+				int ret = gp_file_append (destination, buf, res);
+
+				if (ret < GP_OK) {
+					free (buf);
+					return ret;
+				}
+			}
+			free (buf);
+			if (res == -1) {
+				GP_LOG_E ("Encountered error %d reading.", errno);
+				return GP_ERROR_IO_READ;
+			}
+			return GP_OK;
+		}
+		/* fall through */
+	case GP_FILE_ACCESSTYPE_FD:
+	case GP_FILE_ACCESSTYPE_HANDLER:
+		if ((source->accesstype != GP_FILE_ACCESSTYPE_MEMORY) &&
+		    (source->accesstype != GP_FILE_ACCESSTYPE_CHUNKED))
+			break;
+		if (destination->accesstype == GP_FILE_ACCESSTYPE_HANDLER) {
+			uint64_t xsize = source->size;
+
+			destination->handler->size (destination->private, &xsize);
+		}
+		if (destination->accesstype == GP_FILE_ACCESSTYPE_FD)
+			CHECK_RESULT (gp_file_preallocate (destination->fd, source->size));
+		CHECK_RESULT (gp_file_count_chunks (source, &n));
+		for (i = 0; i < n; i++) {
+			CHECK_RESULT (gp_file_get_chunk (source, i, &data, &size));
+			if ((destination->accesstype == GP_FILE_ACCESSTYPE_MEMORY) ||
+			    (destination->accesstype == GP_FILE_ACCESSTYPE_CHUNKED))
+				CHECK_RESULT (gp_file_append (destination, data, size))
+			else
+				CHECK_RESULT (gp_file_write_to (destination, data, size))
+		}
+		return GP_OK;
+	default:
+		break;
+	}
+	GP_LOG_E ("Unhandled cases in gp_copy_file. Bad!");
+	return GP_ERROR;
+}
+
+static int
+gp_file_copy_data (CameraFile *destination, CameraFile *source)
 {
 	C_PARAMS (destination && source);
+	CHECK_RESULT (gp_file_flush (destination));
+	CHECK_RESULT (gp_file_flush (source));
 
 	GP_LOG_D ("Copying '%s' onto '%s'...", source->name, destination->name);
 
+	/* Onto itself: clearing the destination would lose the data. */
+	if (destination == source)
+		return (GP_OK);
+
 	/* struct members we can just copy. All generic ones, but not refcount. */
 	memcpy (destination->name, source->name, sizeof (source->name));
 	memcpy (destination->mime_type, source->mime_type, sizeof (source->mime_type));
 	destination->mtime = source->mtime;
 
+	if ((destination->accesstype == GP_FILE_ACCESSTYPE_CHUNKED) ||
+	    (source->accesstype == GP_FILE_ACCESSTYPE_CHUNKED))
+		return gp_file_copy_chunked (destination, source);
+
 	if ((destination->accesstype == GP_FILE_ACCESSTYPE_MEMORY) &&
 	    (source->accesstype == GP_FILE_ACCESSTYPE_MEMORY)) {
-		free (destination->data);
-		destination->data = NULL;
+		/* Both share the data until one of them changes it. */
+		gp_file_drop_data (destination);
+		if (!source->size)
+			return (GP_OK);
+		CHECK_RESULT (gp_file_share (source));
+		source->buffer->ref_count++;
+		destination->buffer = source->buffer;
+		destination->data = source->data;
 		destination->size = source->size;
-		C_MEM (destination->data = malloc (sizeof (char) * source->size));
-		memcpy (destination->data, source->data, source->size);
 		return (GP_OK);
 	}
 	if (	(destination->accesstype == GP_FILE_ACCESSTYPE_MEMORY) &&
@@ -753,8 +2087,7 @@ gp_file_copy (CameraFile *destination, CameraFile *source)
 		off_t	offset;
 		off_t	curread = 0;
 
-		free (destination->data);
-		destination->data = NULL;
+		gp_file_drop_data (destination);
 
 		if (-1 == lseek (source->fd, 0, SEEK_END)) {
 			if (errno == EBADF) return GP_ERROR_IO;
@@ -771,17 +2104,18 @@ gp_file_copy (CameraFile *destination, CameraFile *source)
 			GP_LOG_E ("Encountered error %d lseekin to CUR.", errno);
 			return GP_ERROR_IO_READ;
 		}
-		destination->size = offset;
 		C_MEM (destination->data = malloc (offset));
+		destination->size = offset;
+		destination->alloc = offset;
 		while (curread < offset) {
 			ssize_t res = read (source->fd, destination->data+curread, offset-curread);
 			if (res == -1) {
-				free (destination->data);
+				gp_file_drop_data (destination);
 				GP_LOG_E ("Encountered error %d reading.", errno);
 				return GP_ERROR_IO_READ;
 			}
 			if (res == 0) {
-				free (destination->data);
+				gp_file_drop_data (destination);
 				GP_LOG_E ("No progress during reading.");
 				return GP_ERROR_IO_READ;
 			}
@@ -792,44 +2126,31 @@ gp_file_copy (CameraFile *destination, CameraFile *source)
 	if (	(destination->accesstype == GP_FILE_ACCESSTYPE_FD) &&
 		(source->accesstype == GP_FILE_ACCESSTYPE_FD)
 	) {
-		char *data;
+		struct stat	st;
+		off_t		end;
+		int		ret;
 
 		lseek (destination->fd, 0, SEEK_SET);
 		if (-1 == ftruncate (destination->fd, 0))
 			perror("ftruncate");
 		lseek (source->fd, 0, SEEK_SET);
-		C_MEM (data = malloc (65536));
-		while (1) {
-			ssize_t curwritten = 0;
-			ssize_t res;
-
-			res = read (source->fd, data, 65536);
-			if (res == -1) {
-				free (data);
-				return GP_ERROR_IO_READ;
-			}
-			if (res == 0)
-				break;
-			while (curwritten < res) {
-				ssize_t res2 = write (destination->fd, data+curwritten, res-curwritten);
-				if (res2 == -1) {
-					free (data);
-					return GP_ERROR_IO_WRITE;
-				}
-				if (res2 == 0)
-					break;
-				curwritten += res2;
-			}
-			if (res < 65536) /* end of file */
-				break;
-		}
-		free (data);
-		return GP_OK;
+		if (fstat (source->fd, &st) || !S_ISREG (st.st_mode))
+			st.st_size = 0;
+		CHECK_RESULT (gp_file_preallocate (destination->fd, st.st_size));
+		ret = gp_file_copy_fd (destination->fd, source->fd, -1);
+		/* drop what was reserved if the source shrank meanwhile */
+		end = lseek (destination->fd, 0, SEEK_CUR);
+		if ((end != -1) && (end < st.st_size) &&
+		    (-1 == ftruncate (destination->fd, end)))
+			perror("ftruncate");
+		return ret;
 	}
 	if (	(destination->accesstype == GP_FILE_ACCESSTYPE_FD) &&
 		(source->accesstype == GP_FILE_ACCESSTYPE_MEMORY)
 	) {
 		unsigned long curwritten = 0;
+
+		CHECK_RESULT (gp_file_preallocate (destination->fd, source->size));
 		while (curwritten < source->size) {
 			int res = write (destination->fd, source->data+curwritten, source->size-curwritten);
 
@@ -864,6 +2185,31 @@ gp_file_copy (CameraFile *destination, CameraFile *source)
 	return GP_ERROR;
 }
 
+/**
+ * @param destination a #CameraFile
+ * @param source a #CameraFile
+ * @return a gphoto2 error code.
+ *
+ * Between two files associated with filedescriptors the kernel copies
+ * the data where it can. The sync policy of the destination is applied
+ * when it is associated with a filedescriptor.
+ *
+ **/
+int
+gp_file_copy (CameraFile *destination, CameraFile *source)
+{
+	int ret;
+
+	/* Even a failed copy may have replaced part of the data. */
+	ret = gp_file_copy_data (destination, source);
+	if (destination == source)
+		return (ret);
+	gp_file_digest_restart (destination, 0);
+	if ((ret == GP_OK) && (destination->accesstype == GP_FILE_ACCESSTYPE_FD))
+		ret = gp_file_sync_fd (destination->fd, destination->sync);
+	return (ret);
+}
+
 /**
  * @param file a #CameraFile
  * @param name a pointer to a name string
@@ -1035,6 +2381,8 @@ gp_file_detect_mime_type (CameraFile *file)
 
 	C_PARAMS (file);
 
+	CHECK_RESULT (gp_file_flush (file));
+
 	switch (file->accesstype) {
 	case GP_FILE_ACCESSTYPE_MEMORY:
 		/* image/tiff */
@@ -1068,6 +2416,21 @@ gp_file_detect_mime_type (CameraFile *file)
 		lseek (file->fd, offset, SEEK_SET);
 		break;
 	}
+	case GP_FILE_ACCESSTYPE_CHUNKED: {
+		char		data[5];
+		unsigned long	res = chunk_read (file, 0, data, sizeof(data));
+
+		/* image/tiff */
+		if ((res >= 5) && !memcmp (data, TIFF_SOI_MARKER, 5))
+			CHECK_RESULT (gp_file_set_mime_type (file, GP_MIME_TIFF))
+
+		/* image/jpeg */
+		else if ((res >= 2) && !memcmp (data, JPEG_SOI_MARKER, 2))
+			CHECK_RESULT (gp_file_set_mime_type (file, GP_MIME_JPEG))
+		else
+			CHECK_RESULT (gp_file_set_mime_type (file, GP_MIME_RAW));
+		break;
+	}
 	default:
 		break;
 	}
@@ -0,0 +1,1129 @@
+/** \file gphoto2-filesys-cache.c
+ * \brief Persistent on-disk cache of file information, previews and EXIF data.
+ *
+ * \author Copyright 2026 The gPhoto project
+ *
+ * \note
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * \note
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * \note
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ *
+ * \note
+ * Every camera gets one cache file, named after a hash of the identity
+ * string its driver passed to gp_filesystem_set_identity(). The file
+ * starts with a header holding the identity, followed by an append-only
+ * log of records:
+ *
+ *	magic, length, CRC-32, kind, size, mtime, stamp, path, MIME type, data
+ *
+ * A newer record for the same path and kind replaces an older one, a
+ * REMOVED record drops all records of a path. Opening the file only walks
+ * the record headers to build the in-memory index; a torn record at the
+ * end (from a crash during an append) is cut off. The CRC of a record is
+ * checked when the record is read.
+ *
+ * Paths get reused, e.g. after the memory card was formatted, so every
+ * record also keeps the stamp the camera driver reported for the file
+ * while listing it (see gp_filesystem_set_stamp()), and previews and
+ * EXIF data the size and mtime of the file. A record is only returned
+ * while these still match the live file.
+ *
+ * Several processes may use the same cache file. Appends are serialized
+ * with a lock on a separate lock file; before appending, records other
+ * processes appended in the meantime are indexed. The cache file is
+ * never truncated under the mappings of other processes: once it exceeds
+ * its size cap, the newest records are copied to a new file which
+ * atomically replaces the old one, and the others switch to the new file
+ * on their next append.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "config.h"
+#include "gphoto2-filesys-cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+# include <sys/mman.h>
+# define USE_MMAP
+#endif
+
+#include <gphoto2/gphoto2-result.h>
+#include <gphoto2/gphoto2-port-log.h>
+#include <gphoto2/gphoto2-port-portability.h>
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+#ifndef PATH_MAX
+# define PATH_MAX 4096
+#endif
+
+#define CR(result) {int __r = (result); if (__r < 0) return (__r);}
+
+#define FSCACHE_MAGIC		"GPFSC02"
+#define FSCACHE_BYTEORDER	0x01020304
+#define FSCACHE_RECORD_MAGIC	0x52435047
+#define FSCACHE_MIN_HASH	64
+
+#define FSCACHE_FLAG_STAMP	(1 << 0)	/* the stamp field is valid */
+
+enum {
+	FSCACHE_KIND_INFO,
+	FSCACHE_KIND_PREVIEW,
+	FSCACHE_KIND_EXIF,
+	FSCACHE_KIND_REMOVED
+};
+
+/* The file header, followed by the identity and padded to 8 bytes. */
+typedef struct {
+	char		magic[8];
+	uint32_t	byteorder;
+	uint32_t	infosize;
+	uint32_t	idlen;
+	uint32_t	reserved;
+} FSCacheHeader;
+
+/* A record header, followed by path, MIME type, data and padding. */
+typedef struct {
+	uint32_t	magic;
+	uint32_t	length;
+	uint32_t	crc;		/* over everything after this field */
+	uint32_t	kind;
+	uint64_t	size;		/* size of the camera file */
+	int64_t		mtime;		/* mtime of the camera file */
+	uint64_t	stamp;		/* stamp of the camera file */
+	uint32_t	flags;
+	uint32_t	reserved;
+	uint32_t	pathlen;
+	uint32_t	mimelen;
+	uint64_t	datalen;
+} FSCacheRecord;
+
+#define FSCACHE_CRC_OFFSET	(2 * sizeof (uint32_t) + sizeof (uint32_t))
+
+typedef struct _FSCacheEntry {
+	struct _FSCacheEntry	*next;
+	uint32_t		hash;
+	uint32_t		kind;
+	uint64_t		offset;
+	uint32_t		length;
+} FSCacheEntry;
+
+struct _GPFilesystemCache {
+	char		*path;
+	char		*identity;
+	int		fd;
+	int		lockfd;		/* -1 if locking is not supported */
+	uint64_t	start;		/* offset of the first record */
+	uint64_t	end;		/* end of the last valid record */
+	uint64_t	max_bytes;
+#ifdef USE_MMAP
+	unsigned char	*map;
+	uint64_t	mapsize;
+#else
+	unsigned char	*buf;
+	uint64_t	bufsize;
+#endif
+	FSCacheEntry	**hash;
+	unsigned int	hash_size;
+	unsigned int	count;
+};
+
+static uint64_t
+fscache_align (uint64_t len)
+{
+	return (len + 7) & ~(uint64_t)7;
+}
+
+static uint32_t
+fscache_crc32 (const unsigned char *data, uint64_t len)
+{
+	static uint32_t table[256];
+	uint32_t crc = 0xffffffff;
+	unsigned int i, j;
+
+	if (!table[1]) {
+		for (i = 0; i < 256; i++) {
+			crc = i;
+			for (j = 0; j < 8; j++)
+				crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+			table[i] = crc;
+		}
+		crc = 0xffffffff;
+	}
+	while (len--)
+		crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xffffffff;
+}
+
+/* FNV-1a */
+static uint32_t
+fscache_hash (const char *key, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	while (len--)
+		h = (h ^ (unsigned char)*key++) * 16777619u;
+	return h;
+}
+
+static int
+fscache_kind (CameraFileType type)
+{
+	switch (type) {
+	case GP_FILE_TYPE_PREVIEW:	return FSCACHE_KIND_PREVIEW;
+	case GP_FILE_TYPE_EXIF:		return FSCACHE_KIND_EXIF;
+	default:			return -1;
+	}
+}
+
+/* Builds the lookup key "folder/filename" of a camera file. */
+static int
+fscache_key (const char *folder, const char *filename, char *key, size_t size)
+{
+	size_t len = strlen (folder);
+
+	while (len && (folder[len - 1] == '/'))
+		len--;
+	if (len + 1 + strlen (filename) + 1 > size)
+		return (GP_ERROR_BAD_PARAMETERS);
+	memcpy (key, folder, len);
+	key[len] = '/';
+	strcpy (key + len + 1, filename);
+	return (GP_OK);
+}
+
+static int
+fscache_write (int fd, uint64_t offset, const void *data, uint64_t len)
+{
+	const char *p = data;
+	ssize_t ret;
+
+	if (lseek (fd, offset, SEEK_SET) == (off_t)-1)
+		return (GP_ERROR_IO_WRITE);
+	while (len) {
+		ret = write (fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			GP_LOG_E ("Could not write to cache file: %s",
+				  strerror (errno));
+			return (GP_ERROR_IO_WRITE);
+		}
+		p += ret;
+		len -= ret;
+	}
+	return (GP_OK);
+}
+
+static void
+fscache_unmap (GPFilesystemCache *cache)
+{
+#ifdef USE_MMAP
+	if (cache->map)
+		munmap (cache->map, cache->mapsize);
+	cache->map = NULL;
+	cache->mapsize = 0;
+#else
+	free (cache->buf);
+	cache->buf = NULL;
+	cache->bufsize = 0;
+#endif
+}
+
+/*
+ * Returns a pointer to len bytes of the cache file at offset, or NULL if
+ * they cannot be read. The pointer stays valid until the next call.
+ */
+static const unsigned char *
+fscache_data (GPFilesystemCache *cache, uint64_t offset, uint64_t len)
+{
+	if (offset + len > cache->end)
+		return (NULL);
+#ifdef USE_MMAP
+	if (offset + len > cache->mapsize) {
+		void *map;
+
+		fscache_unmap (cache);
+		map = mmap (NULL, cache->end, PROT_READ, MAP_SHARED,
+			    cache->fd, 0);
+		if (map == MAP_FAILED) {
+			GP_LOG_E ("Could not map cache file '%s': %s",
+				  cache->path, strerror (errno));
+			return (NULL);
+		}
+		cache->map = map;
+		cache->mapsize = cache->end;
+	}
+	return (cache->map + offset);
+#else
+	{
+		uint64_t done = 0;
+		ssize_t ret;
+
+		if (len > cache->bufsize) {
+			unsigned char *buf = realloc (cache->buf, len);
+
+			if (!buf)
+				return (NULL);
+			cache->buf = buf;
+			cache->bufsize = len;
+		}
+		if (lseek (cache->fd, offset, SEEK_SET) == (off_t)-1)
+			return (NULL);
+		while (done < len) {
+			ret = read (cache->fd, cache->buf + done, len - done);
+			if (ret <= 0)
+				return (NULL);
+			done += ret;
+		}
+		return (cache->buf);
+	}
+#endif
+}
+
+static void
+fscache_free_index (GPFilesystemCache *cache)
+{
+	FSCacheEntry *e, *next;
+	unsigned int i;
+
+	for (i = 0; i < cache->hash_size; i++)
+		for (e = cache->hash[i]; e; e = next) {
+			next = e->next;
+			free (e);
+		}
+	free (cache->hash);
+	cache->hash = NULL;
+	cache->hash_size = 0;
+	cache->count = 0;
+}
+
+static int
+fscache_rehash (GPFilesystemCache *cache, unsigned int size)
+{
+	FSCacheEntry **hash, *e, *next;
+	unsigned int i;
+
+	C_MEM (hash = calloc (size, sizeof (FSCacheEntry *)));
+	for (i = 0; i < cache->hash_size; i++)
+		for (e = cache->hash[i]; e; e = next) {
+			next = e->next;
+			e->next = hash[e->hash % size];
+			hash[e->hash % size] = e;
+		}
+	free (cache->hash);
+	cache->hash = hash;
+	cache->hash_size = size;
+	return (GP_OK);
+}
+
+/* Returns the link pointing to the entry of the given kind and key. */
+static FSCacheEntry **
+fscache_find (GPFilesystemCache *cache, uint32_t kind, const char *key,
+	      uint32_t keylen, uint32_t hash)
+{
+	FSCacheEntry **link;
+	FSCacheRecord rec;
+	const unsigned char *p;
+
+	if (!cache->hash_size)
+		return (NULL);
+	for (link = &cache->hash[hash % cache->hash_size]; *link;
+	     link = &(*link)->next) {
+		if (((*link)->hash != hash) || ((*link)->kind != kind))
+			continue;
+		p = fscache_data (cache, (*link)->offset, sizeof (rec) + keylen);
+		if (!p)
+			continue;
+		memcpy (&rec, p, sizeof (rec));
+		if ((rec.pathlen == keylen) &&
+		    !memcmp (p + sizeof (rec), key, keylen))
+			return (link);
+	}
+	return (NULL);
+}
+
+static void
+fscache_drop (GPFilesystemCache *cache, FSCacheEntry **link)
+{
+	FSCacheEntry *e = *link;
+
+	*link = e->next;
+	free (e);
+	cache->count--;
+}
+
+/* Makes the record at offset the current one for its kind and key. */
+static int
+fscache_index (GPFilesystemCache *cache, uint32_t kind, const char *key,
+	       uint32_t keylen, uint64_t offset, uint32_t length)
+{
+	uint32_t	hash = fscache_hash (key, keylen);
+	FSCacheEntry	**link, *e;
+	uint32_t	k;
+
+	if (kind == FSCACHE_KIND_REMOVED) {
+		for (k = 0; k < FSCACHE_KIND_REMOVED; k++) {
+			link = fscache_find (cache, k, key, keylen, hash);
+			if (link)
+				fscache_drop (cache, link);
+		}
+		return (GP_OK);
+	}
+
+	link = fscache_find (cache, kind, key, keylen, hash);
+	if (link) {
+		(*link)->offset = offset;
+		(*link)->length = length;
+		return (GP_OK);
+	}
+
+	if (cache->count >= cache->hash_size)
+		CR (fscache_rehash (cache, cache->hash_size ?
+				    cache->hash_size * 2 : FSCACHE_MIN_HASH));
+	C_MEM (e = calloc (1, sizeof (FSCacheEntry)));
+	e->hash = hash;
+	e->kind = kind;
+	e->offset = offset;
+	e->length = length;
+	e->next = cache->hash[hash % cache->hash_size];
+	cache->hash[hash % cache->hash_size] = e;
+	cache->count++;
+	return (GP_OK);
+}
+
+/* Serializes changes of the cache file between processes. */
+static int
+fscache_lock (GPFilesystemCache *cache)
+{
+#ifdef F_SETLKW
+	struct flock	fl;
+
+	if (cache->lockfd < 0)
+		return (GP_OK);
+	memset (&fl, 0, sizeof (fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	while (fcntl (cache->lockfd, F_SETLKW, &fl) < 0) {
+		if (errno == EINTR)
+			continue;
+		GP_LOG_E ("Could not lock cache file '%s': %s", cache->path,
+			  strerror (errno));
+		return (GP_ERROR_IO_LOCK);
+	}
+#endif
+	return (GP_OK);
+}
+
+static void
+fscache_unlock (GPFilesystemCache *cache)
+{
+#ifdef F_SETLKW
+	struct flock	fl;
+
+	if (cache->lockfd < 0)
+		return;
+	memset (&fl, 0, sizeof (fl));
+	fl.l_type = F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	fcntl (cache->lockfd, F_SETLK, &fl);
+#endif
+}
+
+/* Creates tmp next to the cache file, holding just a fresh header. */
+static int
+fscache_new_file (GPFilesystemCache *cache, char *tmp, size_t size, int *fd)
+{
+	FSCacheHeader	hdr;
+	unsigned char	*buf;
+	int		ret;
+
+	snprintf (tmp, size, "%s.tmp", cache->path);
+	*fd = open (tmp, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0600);
+	if (*fd < 0) {
+		GP_LOG_E ("Could not create '%s': %s", tmp, strerror (errno));
+		return (GP_ERROR_IO);
+	}
+
+	memset (&hdr, 0, sizeof (hdr));
+	memcpy (hdr.magic, FSCACHE_MAGIC, sizeof (hdr.magic));
+	hdr.byteorder = FSCACHE_BYTEORDER;
+	hdr.infosize = sizeof (CameraFileInfo);
+	hdr.idlen = strlen (cache->identity);
+
+	buf = calloc (1, cache->start);
+	if (!buf) {
+		close (*fd);
+		unlink (tmp);
+		return (GP_ERROR_NO_MEMORY);
+	}
+	memcpy (buf, &hdr, sizeof (hdr));
+	memcpy (buf + sizeof (hdr), cache->identity, hdr.idlen);
+	ret = fscache_write (*fd, 0, buf, cache->start);
+	free (buf);
+	if (ret < GP_OK) {
+		close (*fd);
+		unlink (tmp);
+	}
+	return (ret);
+}
+
+static int fscache_load (GPFilesystemCache *cache);
+
+/*
+ * Moves the file written by fscache_new_file() in place of the cache file
+ * and opens it, or removes it if ret is an error. Other processes keep
+ * the old file mapped until they notice the new one.
+ */
+static int
+fscache_commit_file (GPFilesystemCache *cache, const char *tmp, int fd, int ret)
+{
+#ifdef HAVE_UNISTD_H
+	if ((ret == GP_OK) && (fsync (fd) < 0))
+		ret = GP_ERROR_IO_WRITE;
+#endif
+	close (fd);
+	if (ret != GP_OK) {
+		unlink (tmp);
+		return (ret);
+	}
+
+	fscache_unmap (cache);
+#ifdef WIN32
+	close (cache->fd);
+	cache->fd = -1;
+	unlink (cache->path);
+#endif
+	if (rename (tmp, cache->path) < 0) {
+		GP_LOG_E ("Could not rename '%s' to '%s': %s", tmp,
+			  cache->path, strerror (errno));
+		unlink (tmp);
+		return (GP_ERROR_IO_WRITE);
+	}
+	return (fscache_load (cache));
+}
+
+/*
+ * Indexes the records from offset to the end of the cache file. With the
+ * lock held, nobody appends behind a torn record, so it is cut off.
+ */
+static int
+fscache_scan (GPFilesystemCache *cache, uint64_t offset)
+{
+	FSCacheRecord		rec;
+	const unsigned char	*p;
+	char			key[PATH_MAX];
+	struct stat		st;
+
+	if (fstat (cache->fd, &st) < 0)
+		return (GP_ERROR_IO);
+	cache->end = st.st_size;
+
+	for (; offset + sizeof (rec) <= cache->end; offset += rec.length) {
+		p = fscache_data (cache, offset, sizeof (rec));
+		if (!p)
+			break;
+		memcpy (&rec, p, sizeof (rec));
+		if ((rec.magic != FSCACHE_RECORD_MAGIC) ||
+		    (rec.kind > FSCACHE_KIND_REMOVED) ||
+		    (rec.length < sizeof (rec)) || (rec.length % 8) ||
+		    (offset + rec.length > cache->end) ||
+		    (rec.pathlen >= sizeof (key)) ||
+		    (sizeof (rec) + rec.pathlen + rec.mimelen + rec.datalen >
+		     rec.length))
+			break;
+		p = fscache_data (cache, offset + sizeof (rec), rec.pathlen);
+		if (!p)
+			break;
+		memcpy (key, p, rec.pathlen);
+		CR (fscache_index (cache, rec.kind, key, rec.pathlen,
+				   offset, rec.length));
+	}
+
+	if (offset != cache->end) {
+		GP_LOG_D ("Dropping %lu bytes of incomplete records from "
+			  "cache file '%s'.",
+			  (unsigned long)(cache->end - offset), cache->path);
+		fscache_unmap (cache);
+		/* Only bytes nobody has indexed are cut off. If that
+		 * fails, the next append overwrites them. */
+		if (ftruncate (cache->fd, offset) < 0)
+			GP_LOG_E ("Could not truncate cache file '%s': %s",
+				  cache->path, strerror (errno));
+		cache->end = offset;
+	}
+	return (GP_OK);
+}
+
+/* (Re)opens the cache file and rebuilds the index from the record headers. */
+static int
+fscache_load (GPFilesystemCache *cache)
+{
+	FSCacheHeader		hdr;
+	const unsigned char	*p;
+	char			tmp[PATH_MAX];
+	struct stat		st;
+	int			fd;
+
+	fscache_free_index (cache);
+	fscache_unmap (cache);
+	if (cache->fd >= 0)
+		close (cache->fd);
+
+	cache->fd = open (cache->path, O_RDWR | O_CREAT | O_BINARY, 0600);
+	if (cache->fd < 0) {
+		GP_LOG_E ("Could not open cache file '%s': %s", cache->path,
+			  strerror (errno));
+		return (GP_ERROR_IO);
+	}
+	if (fstat (cache->fd, &st) < 0)
+		return (GP_ERROR_IO);
+	cache->end = st.st_size;
+
+	p = fscache_data (cache, 0, cache->start);
+	if (p)
+		memcpy (&hdr, p, sizeof (hdr));
+	if (!p || memcmp (hdr.magic, FSCACHE_MAGIC, sizeof (hdr.magic)) ||
+	    (hdr.byteorder != FSCACHE_BYTEORDER) ||
+	    (hdr.infosize != sizeof (CameraFileInfo)) ||
+	    (hdr.idlen != strlen (cache->identity)) ||
+	    memcmp (p + sizeof (hdr), cache->identity, hdr.idlen)) {
+		GP_LOG_D ("Initializing cache file '%s'.", cache->path);
+		CR (fscache_new_file (cache, tmp, sizeof (tmp), &fd));
+		return (fscache_commit_file (cache, tmp, fd, GP_OK));
+	}
+
+	CR (fscache_scan (cache, cache->start));
+	GP_LOG_D ("Loaded %u entries from cache file '%s'.", cache->count,
+		  cache->path);
+	return (GP_OK);
+}
+
+/*
+ * Catches up with other processes using the cache file, with the lock
+ * held: records they appended are indexed, and if they replaced the file,
+ * the new one is loaded.
+ */
+static int
+fscache_sync (GPFilesystemCache *cache)
+{
+	struct stat	st, cur;
+
+	if ((stat (cache->path, &st) < 0) || (fstat (cache->fd, &cur) < 0) ||
+	    (st.st_dev != cur.st_dev) || (st.st_ino != cur.st_ino) ||
+	    ((uint64_t)cur.st_size < cache->end))
+		return (fscache_load (cache));
+	if ((uint64_t)cur.st_size > cache->end)
+		return (fscache_scan (cache, cache->end));
+	return (GP_OK);
+}
+
+static int
+fscache_compare_offset (const void *a, const void *b)
+{
+	const FSCacheEntry *ea = *(const FSCacheEntry * const *)a;
+	const FSCacheEntry *eb = *(const FSCacheEntry * const *)b;
+
+	return (ea->offset < eb->offset) ? -1 : (ea->offset > eb->offset);
+}
+
+/*
+ * Rewrites the cache file with the newest records only, leaving room for
+ * need more bytes within three quarters of the size cap. The lock has to
+ * be held.
+ */
+static int
+fscache_compact (GPFilesystemCache *cache, uint64_t need)
+{
+	FSCacheEntry		**entries, *e;
+	FSCacheRecord		rec;
+	const unsigned char	*p;
+	char			tmp[PATH_MAX];
+	uint64_t		target, kept = 0, offset;
+	unsigned int		i, n = 0, first;
+	int			fd, ret;
+
+	GP_LOG_D ("Compacting cache file '%s' (%u entries, %lu bytes)...",
+		  cache->path, cache->count, (unsigned long)cache->end);
+
+	target = cache->max_bytes / 4 * 3;
+	target = (target > cache->start + need) ? target - cache->start - need : 0;
+
+	C_MEM (entries = calloc (cache->count + 1, sizeof (FSCacheEntry *)));
+	for (i = 0; i < cache->hash_size; i++)
+		for (e = cache->hash[i]; e; e = e->next)
+			entries[n++] = e;
+	qsort (entries, n, sizeof (FSCacheEntry *), fscache_compare_offset);
+	for (first = n; first > 0; first--) {
+		if (kept + entries[first - 1]->length > target)
+			break;
+		kept += entries[first - 1]->length;
+	}
+
+	ret = fscache_new_file (cache, tmp, sizeof (tmp), &fd);
+	if (ret < GP_OK) {
+		free (entries);
+		return (ret);
+	}
+
+	offset = cache->start;
+	for (i = first; (ret == GP_OK) && (i < n); i++) {
+		p = fscache_data (cache, entries[i]->offset, entries[i]->length);
+		if (!p)
+			continue;
+		memcpy (&rec, p, sizeof (rec));
+		if (rec.crc != fscache_crc32 (p + FSCACHE_CRC_OFFSET,
+					      entries[i]->length - FSCACHE_CRC_OFFSET))
+			continue;
+		ret = fscache_write (fd, offset, p, entries[i]->length);
+		offset += entries[i]->length;
+	}
+	free (entries);
+	return (fscache_commit_file (cache, tmp, fd, ret));
+}
+
+static int
+fscache_append (GPFilesystemCache *cache, uint32_t kind, const char *key,
+		uint64_t size, int64_t mtime, const uint64_t *stamp,
+		const char *mime, const void *data, uint64_t datalen)
+{
+	FSCacheRecord	rec;
+	unsigned char	*buf;
+	uint64_t	length;
+	int		ret;
+
+	memset (&rec, 0, sizeof (rec));
+	rec.magic = FSCACHE_RECORD_MAGIC;
+	rec.kind = kind;
+	rec.size = size;
+	rec.mtime = mtime;
+	if (stamp) {
+		rec.stamp = *stamp;
+		rec.flags |= FSCACHE_FLAG_STAMP;
+	}
+	rec.pathlen = strlen (key);
+	rec.mimelen = mime ? strlen (mime) : 0;
+	rec.datalen = datalen;
+
+	length = fscache_align (sizeof (rec) + rec.pathlen + rec.mimelen + datalen);
+	if (length > cache->max_bytes / 4) {
+		GP_LOG_D ("Not caching %lu bytes for '%s', too large.",
+			  (unsigned long)datalen, key);
+		return (GP_OK);
+	}
+	rec.length = length;
+
+	C_MEM (buf = calloc (1, length));
+	memcpy (buf + sizeof (rec), key, rec.pathlen);
+	if (rec.mimelen)
+		memcpy (buf + sizeof (rec) + rec.pathlen, mime, rec.mimelen);
+	if (datalen)
+		memcpy (buf + sizeof (rec) + rec.pathlen + rec.mimelen, data, datalen);
+	memcpy (buf, &rec, sizeof (rec));
+	rec.crc = fscache_crc32 (buf + FSCACHE_CRC_OFFSET, length - FSCACHE_CRC_OFFSET);
+	memcpy (buf, &rec, sizeof (rec));
+
+	ret = fscache_lock (cache);
+	if (ret < GP_OK) {
+		free (buf);
+		return (ret);
+	}
+	ret = fscache_sync (cache);
+	if ((ret == GP_OK) && (cache->end + length > cache->max_bytes))
+		ret = fscache_compact (cache, length);
+	if (ret == GP_OK) {
+		ret = fscache_write (cache->fd, cache->end, buf, length);
+		if (ret < GP_OK) {
+			/* Do not leave a partial record behind. */
+			if (ftruncate (cache->fd, cache->end) < 0)
+				GP_LOG_E ("Could not truncate cache file '%s'.",
+					  cache->path);
+		} else {
+			ret = fscache_index (cache, kind, key, rec.pathlen,
+					     cache->end, length);
+			cache->end += length;
+		}
+	}
+	fscache_unlock (cache);
+	free (buf);
+	return (ret);
+}
+
+/*
+ * Looks up the current record of the given kind and key and checks its
+ * CRC. On success, *rec is filled in and *payload points to its path.
+ */
+static int
+fscache_lookup (GPFilesystemCache *cache, uint32_t kind, const char *key,
+		FSCacheRecord *rec, const unsigned char **payload)
+{
+	uint32_t		keylen = strlen (key);
+	FSCacheEntry		**link;
+	const unsigned char	*p;
+
+	link = fscache_find (cache, kind, key, keylen, fscache_hash (key, keylen));
+	if (!link)
+		return (GP_ERROR_FILE_NOT_FOUND);
+	p = fscache_data (cache, (*link)->offset, (*link)->length);
+	if (!p)
+		return (GP_ERROR_IO_READ);
+	memcpy (rec, p, sizeof (*rec));
+	if (rec->crc != fscache_crc32 (p + FSCACHE_CRC_OFFSET,
+				       (*link)->length - FSCACHE_CRC_OFFSET)) {
+		GP_LOG_E ("Dropping corrupted cache record for '%s'.", key);
+		fscache_drop (cache, link);
+		return (GP_ERROR_CORRUPTED_DATA);
+	}
+	*payload = p + sizeof (*rec);
+	return (GP_OK);
+}
+
+/* Drops an outdated record of the given kind and key from the index. */
+static void
+fscache_forget (GPFilesystemCache *cache, uint32_t kind, const char *key)
+{
+	uint32_t	keylen = strlen (key);
+	FSCacheEntry	**link;
+
+	GP_LOG_D ("Cached data of '%s' is outdated.", key);
+	link = fscache_find (cache, kind, key, keylen, fscache_hash (key, keylen));
+	if (link)
+		fscache_drop (cache, link);
+}
+
+/**
+ * \brief Open the persistent cache file of a camera
+ * \param cache pointer receiving the #GPFilesystemCache
+ * \param dir the directory holding the cache files
+ * \param identity a string uniquely identifying the camera
+ * \param max_bytes the size cap of the cache file
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_cache_open (GPFilesystemCache **cache, const char *dir,
+			  const char *identity, uint64_t max_bytes)
+{
+	char	path[PATH_MAX], lock[PATH_MAX + 8];
+	size_t	i, len = strlen (identity);
+	uint64_t h = 14695981039346656037ULL;
+	int	ret;
+
+	C_PARAMS (cache && dir && identity);
+
+	/* FNV-1a 64 of the identity, which may contain any character. */
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)identity[i]) * 1099511628211ULL;
+	(void)gp_system_mkdir (dir);
+	snprintf (path, sizeof (path), "%s/%016llx.cache", dir,
+		  (unsigned long long)h);
+
+	C_MEM (*cache = calloc (1, sizeof (GPFilesystemCache)));
+	(*cache)->fd = -1;
+	(*cache)->lockfd = -1;
+	(*cache)->max_bytes = max_bytes;
+	(*cache)->start = fscache_align (sizeof (FSCacheHeader) + len);
+	(*cache)->path = strdup (path);
+	(*cache)->identity = strdup (identity);
+	if (!(*cache)->path || !(*cache)->identity) {
+		gp_filesystem_cache_close (*cache);
+		*cache = NULL;
+		return (GP_ERROR_NO_MEMORY);
+	}
+#ifdef F_SETLKW
+	snprintf (lock, sizeof (lock), "%s.lock", path);
+	(*cache)->lockfd = open (lock, O_RDWR | O_CREAT | O_BINARY, 0600);
+	if ((*cache)->lockfd < 0) {
+		GP_LOG_E ("Could not open '%s': %s", lock, strerror (errno));
+		gp_filesystem_cache_close (*cache);
+		*cache = NULL;
+		return (GP_ERROR_IO);
+	}
+#endif
+	ret = fscache_lock (*cache);
+	if (ret == GP_OK) {
+		ret = fscache_load (*cache);
+		if ((ret == GP_OK) && ((*cache)->end > max_bytes))
+			ret = fscache_compact (*cache, 0);
+		fscache_unlock (*cache);
+	}
+	if (ret < GP_OK) {
+		gp_filesystem_cache_close (*cache);
+		*cache = NULL;
+	}
+	return (ret);
+}
+
+/**
+ * \brief Close a persistent cache file
+ * \param cache a #GPFilesystemCache
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_cache_close (GPFilesystemCache *cache)
+{
+	if (!cache)
+		return (GP_OK);
+	fscache_free_index (cache);
+	fscache_unmap (cache);
+	if (cache->fd >= 0)
+		close (cache->fd);
+	if (cache->lockfd >= 0)
+		close (cache->lockfd);
+	free (cache->path);
+	free (cache->identity);
+	free (cache);
+	return (GP_OK);
+}
+
+/**
+ * \brief Check whether file data of the given type is cached on disk
+ * \param type a #CameraFileType
+ *
+ * \return 1 for #GP_FILE_TYPE_PREVIEW and #GP_FILE_TYPE_EXIF, 0 otherwise.
+ **/
+int
+gp_filesystem_cache_supports (CameraFileType type)
+{
+	return (fscache_kind (type) >= 0);
+}
+
+/**
+ * \brief Get the cached information of a file
+ * \param cache a #GPFilesystemCache
+ * \param folder the folder of the file
+ * \param filename the name of the file
+ * \param stamp the stamp the camera driver reported for the file
+ * \param info the #CameraFileInfo to fill in
+ *
+ * Information stored with a different stamp is outdated and not returned.
+ *
+ * \return a gphoto2 error code, #GP_ERROR_FILE_NOT_FOUND if nothing is cached.
+ **/
+int
+gp_filesystem_cache_get_info (GPFilesystemCache *cache, const char *folder,
+			      const char *filename, uint64_t stamp,
+			      CameraFileInfo *info)
+{
+	char			key[PATH_MAX];
+	FSCacheRecord		rec;
+	const unsigned char	*p;
+
+	C_PARAMS (cache && folder && filename && info);
+
+	CR (fscache_key (folder, filename, key, sizeof (key)));
+	CR (fscache_lookup (cache, FSCACHE_KIND_INFO, key, &rec, &p));
+	if (!(rec.flags & FSCACHE_FLAG_STAMP) || (rec.stamp != stamp)) {
+		fscache_forget (cache, FSCACHE_KIND_INFO, key);
+		return (GP_ERROR_FILE_NOT_FOUND);
+	}
+	if (rec.datalen != sizeof (CameraFileInfo))
+		return (GP_ERROR_CORRUPTED_DATA);
+	memcpy (info, p + rec.pathlen + rec.mimelen, sizeof (CameraFileInfo));
+	return (GP_OK);
+}
+
+/**
+ * \brief Store the information of a file
+ * \param cache a #GPFilesystemCache
+ * \param folder the folder of the file
+ * \param filename the name of the file
+ * \param stamp the stamp the camera driver reported for the file, or NULL
+ * \param info the #CameraFileInfo to store
+ *
+ * Nothing is written if the cached information is already up to date,
+ * or without a stamp to tell later whether it still is.
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_cache_put_info (GPFilesystemCache *cache, const char *folder,
+			      const char *filename, const uint64_t *stamp,
+			      const CameraFileInfo *info)
+{
+	char			key[PATH_MAX];
+	FSCacheRecord		rec;
+	const unsigned char	*p;
+
+	C_PARAMS (cache && folder && filename && info);
+
+	if (!stamp)
+		return (GP_OK);
+	CR (fscache_key (folder, filename, key, sizeof (key)));
+	if ((fscache_lookup (cache, FSCACHE_KIND_INFO, key, &rec, &p) == GP_OK) &&
+	    (rec.flags & FSCACHE_FLAG_STAMP) && (rec.stamp == *stamp) &&
+	    (rec.datalen == sizeof (CameraFileInfo)) &&
+	    !memcmp (p + rec.pathlen + rec.mimelen, info, sizeof (CameraFileInfo)))
+		return (GP_OK);
+	return (fscache_append (cache, FSCACHE_KIND_INFO, key, info->file.size,
+				info->file.mtime, stamp, NULL, info,
+				sizeof (CameraFileInfo)));
+}
+
+/**
+ * \brief Get cached file data
+ * \param cache a #GPFilesystemCache
+ * \param folder the folder of the file
+ * \param filename the name of the file
+ * \param type a #CameraFileType supported by the cache
+ * \param stamp the stamp the camera driver reported for the file, or NULL
+ * \param info the #CameraFileInfo the camera reported for the file, or
+ *        NULL if unknown
+ * \param file the #CameraFile receiving the data
+ *
+ * Data cached for an older version of the file, that is with a different
+ * stamp, or a different size or mtime than given in info, is not
+ * returned. Neither is data that cannot be checked against any of them.
+ *
+ * \return a gphoto2 error code, #GP_ERROR_FILE_NOT_FOUND if nothing is cached.
+ **/
+int
+gp_filesystem_cache_get_file (GPFilesystemCache *cache, const char *folder,
+			      const char *filename, CameraFileType type,
+			      const uint64_t *stamp, const CameraFileInfo *info,
+			      CameraFile *file)
+{
+	char			key[PATH_MAX], mime[64];
+	FSCacheRecord		rec;
+	const unsigned char	*p;
+	int			kind = fscache_kind (type);
+	int			checked = 0, outdated = 0;
+
+	C_PARAMS (cache && folder && filename && file && (kind >= 0));
+
+	CR (fscache_key (folder, filename, key, sizeof (key)));
+	CR (fscache_lookup (cache, kind, key, &rec, &p));
+	if (stamp) {
+		checked = 1;
+		if (!(rec.flags & FSCACHE_FLAG_STAMP) || (rec.stamp != *stamp))
+			outdated = 1;
+	}
+	if (info && (info->file.fields & (GP_FILE_INFO_SIZE | GP_FILE_INFO_MTIME))) {
+		checked = 1;
+		if (((info->file.fields & GP_FILE_INFO_SIZE) &&
+		     (rec.size != info->file.size)) ||
+		    ((info->file.fields & GP_FILE_INFO_MTIME) &&
+		     (rec.mtime != info->file.mtime)))
+			outdated = 1;
+	}
+	if (outdated) {
+		fscache_forget (cache, kind, key);
+		return (GP_ERROR_FILE_NOT_FOUND);
+	}
+	if (!checked)
+		return (GP_ERROR_FILE_NOT_FOUND);
+
+	if (rec.mimelen >= sizeof (mime))
+		return (GP_ERROR_CORRUPTED_DATA);
+	memcpy (mime, p + rec.pathlen, rec.mimelen);
+	mime[rec.mimelen] = '\0';
+	CR (gp_file_append (file, (const char *)p + rec.pathlen + rec.mimelen,
+			    rec.datalen));
+	if (mime[0])
+		CR (gp_file_set_mime_type (file, mime));
+	return (GP_OK);
+}
+
+/**
+ * \brief Store file data
+ * \param cache a #GPFilesystemCache
+ * \param folder the folder of the file
+ * \param filename the name of the file
+ * \param type a #CameraFileType supported by the cache
+ * \param stamp the stamp the camera driver reported for the file, or NULL
+ * \param info the #CameraFileInfo the camera reported for the file, or
+ *        NULL if unknown
+ * \param file the #CameraFile holding the data
+ *
+ * Nothing is written without a stamp, size or mtime to tell later
+ * whether the data is still current.
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_cache_put_file (GPFilesystemCache *cache, const char *folder,
+			      const char *filename, CameraFileType type,
+			      const uint64_t *stamp, const CameraFileInfo *info,
+			      CameraFile *file)
+{
+	char			key[PATH_MAX];
+	const char		*mime, *data;
+	unsigned long int	size;
+	CameraFile		*copy;
+	int			ret, kind = fscache_kind (type);
+
+	C_PARAMS (cache && folder && filename && file && (kind >= 0));
+
+	if (!stamp &&
+	    !(info && (info->file.fields & (GP_FILE_INFO_SIZE | GP_FILE_INFO_MTIME))))
+		return (GP_OK);
+	CR (fscache_key (folder, filename, key, sizeof (key)));
+
+	/* Get the data into memory, whatever kind of file was passed. */
+	CR (gp_file_new (&copy));
+	ret = gp_file_copy (copy, file);
+	if (ret == GP_OK)
+		ret = gp_file_get_data_and_size (copy, &data, &size);
+	if (ret == GP_OK)
+		ret = gp_file_get_mime_type (copy, &mime);
+	if (ret == GP_OK)
+		ret = fscache_append (cache, kind, key,
+			(info && (info->file.fields & GP_FILE_INFO_SIZE)) ? info->file.size : 0,
+			(info && (info->file.fields & GP_FILE_INFO_MTIME)) ? info->file.mtime : 0,
+			stamp, mime, data, size);
+	gp_file_unref (copy);
+	return (ret);
+}
+
+/**
+ * \brief Remove everything cached about a file
+ * \param cache a #GPFilesystemCache
+ * \param folder the folder of the file
+ * \param filename the name of the file
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_cache_remove (GPFilesystemCache *cache, const char *folder,
+			    const char *filename)
+{
+	char		key[PATH_MAX];
+	uint32_t	keylen, hash, kind;
+
+	C_PARAMS (cache && folder && filename);
+
+	CR (fscache_key (folder, filename, key, sizeof (key)));
+	keylen = strlen (key);
+	hash = fscache_hash (key, keylen);
+	for (kind = 0; kind < FSCACHE_KIND_REMOVED; kind++)
+		if (fscache_find (cache, kind, key, keylen, hash))
+			return (fscache_append (cache, FSCACHE_KIND_REMOVED,
+						key, 0, 0, NULL, NULL, NULL, 0));
+	return (GP_OK);
+}
@@ -0,0 +1,67 @@
+/** \file gphoto2-filesys-cache.h
+ * \brief Persistent on-disk cache of file information, previews and EXIF data.
+ *
+ * \author Copyright 2026 The gPhoto project
+ *
+ * \note
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * \note
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * \note
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ *
+ * \note
+ * Internal to libgphoto2, used by gphoto2-filesys.c only.
+ */
+
+#ifndef __GPHOTO2_FILESYS_CACHE_H__
+#define __GPHOTO2_FILESYS_CACHE_H__
+
+#include <gphoto2/gphoto2-filesys.h>
+
+/**
+ * \brief A persistent cache file of one camera.
+ *
+ * Entries are keyed by the path of a file on the camera and remember the
+ * stamp the camera driver reported for the file while listing it. Previews
+ * and EXIF data additionally remember the size and mtime of the camera
+ * file they were taken from. Entries are only returned while those still
+ * match the live file.
+ */
+typedef struct _GPFilesystemCache GPFilesystemCache;
+
+int gp_filesystem_cache_open  (GPFilesystemCache **cache, const char *dir,
+			       const char *identity, uint64_t max_bytes);
+int gp_filesystem_cache_close (GPFilesystemCache *cache);
+
+int gp_filesystem_cache_supports (CameraFileType type);
+
+int gp_filesystem_cache_get_info (GPFilesystemCache *cache, const char *folder,
+				  const char *filename, uint64_t stamp,
+				  CameraFileInfo *info);
+int gp_filesystem_cache_put_info (GPFilesystemCache *cache, const char *folder,
+				  const char *filename, const uint64_t *stamp,
+				  const CameraFileInfo *info);
+int gp_filesystem_cache_get_file (GPFilesystemCache *cache, const char *folder,
+				  const char *filename, CameraFileType type,
+				  const uint64_t *stamp,
+				  const CameraFileInfo *info, CameraFile *file);
+int gp_filesystem_cache_put_file (GPFilesystemCache *cache, const char *folder,
+				  const char *filename, CameraFileType type,
+				  const uint64_t *stamp,
+				  const CameraFileInfo *info, CameraFile *file);
+int gp_filesystem_cache_remove   (GPFilesystemCache *cache, const char *folder,
+				  const char *filename);
+
+#endif /* __GPHOTO2_FILESYS_CACHE_H__ */
@@ -0,0 +1,651 @@
+/** \file gphoto2-filesys-snapshot.c
+ * \brief Snapshots of the camera filesystem for incremental syncing.
+ *
+ * \author Copyright 2026 The gPhoto project
+ *
+ * \note
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * \note
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * \note
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ *
+ * \note
+ * A snapshot is plain text, one line per folder and file:
+ *
+ *	gphoto2-snapshot 1
+ *	D <fingerprint> <folder>
+ *	F <size> <mtime> <name>
+ *
+ * File lines belong to the folder line before them. Folders are written
+ * depth first and files sorted by name, so the lines of a folder and all
+ * its subfolders are one block. Unknown values are written as "-". The
+ * fingerprint is the one of gp_filesystem_get_fingerprint(), taken before
+ * the folder was listed; a folder whose fingerprint did not change is not
+ * listed again by gp_filesystem_diff() and its block is copied over.
+ */
+
+#include "config.h"
+#include <gphoto2/gphoto2-filesys.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <gphoto2/gphoto2-result.h>
+#include <gphoto2/gphoto2-port-log.h>
+
+#define CR(result) {int __r = (result); if (__r < 0) return (__r);}
+
+#define SNAPSHOT_MAGIC	"gphoto2-snapshot 1"
+
+typedef struct {
+	const char	*name;
+	unsigned int	fields;		/* GP_FILE_INFO_SIZE | GP_FILE_INFO_MTIME */
+	uint64_t	size;
+	time_t		mtime;
+} SnapshotFile;
+
+typedef struct {
+	const char	*path;
+	int		has_fingerprint;
+	uint64_t	fingerprint;
+	unsigned int	first, count;	/* files of this folder */
+	unsigned long	offset;		/* of the folder line in the snapshot */
+	int		visited;
+} SnapshotFolder;
+
+typedef struct {
+	const char	*data;
+	unsigned long	size;
+	char		*text;		/* copy of data, lines 0 terminated */
+	SnapshotFolder	*folders;
+	unsigned int	nfolders;
+	SnapshotFile	*files;
+	unsigned int	nfiles;
+	unsigned int	hint;		/* where the next folder is expected */
+} Snapshot;
+
+typedef struct {
+	char		*data;
+	unsigned long	size, alloc;
+} SnapshotBuffer;
+
+typedef struct {
+	CameraFilesystem		*fs;
+	Snapshot			*old;
+	CameraFilesystemChangeFunc	func;
+	void				*data;
+	SnapshotBuffer			*out;
+	GPContext			*context;
+} SnapshotWalk;
+
+static int
+buffer_append (SnapshotBuffer *buf, const char *data, unsigned long size)
+{
+	char *newdata;
+
+	if (buf->size + size + 1 > buf->alloc) {
+		unsigned long alloc = buf->alloc ? buf->alloc * 2 : 4096;
+
+		while (alloc < buf->size + size + 1)
+			alloc *= 2;
+		C_MEM (newdata = realloc (buf->data, alloc));
+		buf->data  = newdata;
+		buf->alloc = alloc;
+	}
+	memcpy (buf->data + buf->size, data, size);
+	buf->size += size;
+	buf->data[buf->size] = '\0';
+	return (GP_OK);
+}
+
+static int
+#ifdef __GNUC__
+__attribute__((__format__(printf,2,3)))
+#endif
+buffer_printf (SnapshotBuffer *buf, const char *format, ...)
+{
+	char	line[2048];
+	va_list	args;
+	int	len;
+
+	va_start (args, format);
+	len = vsnprintf (line, sizeof (line), format, args);
+	va_end (args);
+	if ((len < 0) || (len >= (int)sizeof (line)))
+		return (GP_ERROR_BAD_PARAMETERS);
+	return buffer_append (buf, line, len);
+}
+
+/* Whether a file or folder name fits on a snapshot line. */
+static int
+valid_name (const char *name)
+{
+	return *name && !strchr (name, '\n') && (strlen (name) < 1024);
+}
+
+static int
+is_below (const char *path, const char *folder)
+{
+	size_t len = strlen (folder);
+
+	if (!strcmp (folder, "/"))
+		return (path[0] == '/') && path[1];
+	return !strncmp (path, folder, len) && (path[len] == '/');
+}
+
+static int
+cmp_file (const void *a, const void *b)
+{
+	return strcmp (((const SnapshotFile *)a)->name,
+		       ((const SnapshotFile *)b)->name);
+}
+
+/*
+ * Parses one number or "-" followed by a blank. Returns 1 for a number,
+ * 0 for "-".
+ */
+static int
+parse_value (char **p, uint64_t *value, int base)
+{
+	const char	*digits = (base == 16) ? "0123456789abcdef" : "0123456789";
+	size_t		len;
+
+	*value = 0;
+	if (!strncmp (*p, "- ", 2)) {
+		*p += 2;
+		return 0;
+	}
+	len = strspn (*p, digits);
+	if (!len || ((*p)[len] != ' '))
+		return (GP_ERROR_CORRUPTED_DATA);
+	*value = strtoull (*p, NULL, base);
+	*p += len + 1;
+	return 1;
+}
+
+static void
+snapshot_free (Snapshot *snap)
+{
+	free (snap->text);
+	free (snap->folders);
+	free (snap->files);
+}
+
+static int
+snapshot_parse (Snapshot *snap, const char *data, unsigned long size)
+{
+	unsigned int	afolders = 0, afiles = 0, i;
+	uint64_t	v;
+	char		*line, *next, *p;
+	int		ret;
+
+	memset (snap, 0, sizeof (*snap));
+	snap->data = data;
+	snap->size = size;
+	if ((size < strlen (SNAPSHOT_MAGIC) + 1) ||
+	    memcmp (data, SNAPSHOT_MAGIC "\n", strlen (SNAPSHOT_MAGIC) + 1)) {
+		GP_LOG_E ("Not a filesystem snapshot.");
+		return (GP_ERROR_CORRUPTED_DATA);
+	}
+	C_MEM (snap->text = malloc (size + 1));
+	memcpy (snap->text, data, size);
+	snap->text[size] = '\0';
+
+	for (line = snap->text + strlen (SNAPSHOT_MAGIC) + 1; *line; line = next) {
+		next = strchr (line, '\n');
+		if (next)
+			*next++ = '\0';
+		else
+			next = line + strlen (line);
+		if (!strncmp (line, "D ", 2)) {
+			SnapshotFolder *f;
+
+			if (snap->nfolders == afolders) {
+				afolders = afolders ? afolders * 2 : 64;
+				f = realloc (snap->folders, afolders * sizeof (*f));
+				if (!f)
+					goto nomem;
+				snap->folders = f;
+			}
+			f = &snap->folders[snap->nfolders++];
+			memset (f, 0, sizeof (*f));
+			p = line + 2;
+			ret = parse_value (&p, &f->fingerprint, 16);
+			if (ret < GP_OK)
+				goto corrupt;
+			f->has_fingerprint = ret;
+			if (*p != '/')
+				goto corrupt;
+			f->path   = p;
+			f->first  = snap->nfiles;
+			f->offset = line - snap->text;
+		} else if (!strncmp (line, "F ", 2) && snap->nfolders) {
+			SnapshotFile *x;
+
+			if (snap->nfiles == afiles) {
+				afiles = afiles ? afiles * 2 : 256;
+				x = realloc (snap->files, afiles * sizeof (*x));
+				if (!x)
+					goto nomem;
+				snap->files = x;
+			}
+			x = &snap->files[snap->nfiles++];
+			memset (x, 0, sizeof (*x));
+			p = line + 2;
+			ret = parse_value (&p, &x->size, 10);
+			if (ret < GP_OK)
+				goto corrupt;
+			if (ret)
+				x->fields |= GP_FILE_INFO_SIZE;
+			ret = parse_value (&p, &v, 10);
+			if (ret < GP_OK)
+				goto corrupt;
+			if (ret) {
+				x->fields |= GP_FILE_INFO_MTIME;
+				x->mtime = v;
+			}
+			if (!*p)
+				goto corrupt;
+			x->name = p;
+			snap->folders[snap->nfolders - 1].count++;
+		} else
+			goto corrupt;
+	}
+	if (!snap->nfolders)
+		goto corrupt;
+
+	/* Merging with the new listings relies on the files being sorted. */
+	for (i = 0; i < snap->nfolders; i++)
+		qsort (snap->files + snap->folders[i].first,
+		       snap->folders[i].count, sizeof (SnapshotFile), cmp_file);
+	return (GP_OK);
+
+corrupt:
+	GP_LOG_E ("Corrupt filesystem snapshot line '%s'.", line);
+	snapshot_free (snap);
+	return (GP_ERROR_CORRUPTED_DATA);
+nomem:
+	snapshot_free (snap);
+	return (GP_ERROR_NO_MEMORY);
+}
+
+/*
+ * Folders are looked up in the order of the walk, which is the order in
+ * which they were written. Starting at the folder after the last match
+ * finds them in one step unless folders were added or removed.
+ */
+static SnapshotFolder *
+snapshot_find_folder (Snapshot *snap, const char *path)
+{
+	unsigned int i, n;
+
+	for (n = 0; n < snap->nfolders; n++) {
+		i = (snap->hint + n) % snap->nfolders;
+		if (!strcmp (snap->folders[i].path, path)) {
+			snap->hint = i + 1;
+			return &snap->folders[i];
+		}
+	}
+	return NULL;
+}
+
+/* The index after the last subfolder of folder f. */
+static unsigned int
+snapshot_subtree_end (Snapshot *snap, SnapshotFolder *f)
+{
+	unsigned int i = f - snap->folders + 1;
+
+	while ((i < snap->nfolders) && is_below (snap->folders[i].path, f->path))
+		i++;
+	return i;
+}
+
+static void
+file_to_info (const SnapshotFile *x, CameraFileInfo *info)
+{
+	memset (info, 0, sizeof (*info));
+	info->file.fields = x->fields;
+	info->file.size   = x->size;
+	info->file.mtime  = x->mtime;
+}
+
+static int
+report_removed (SnapshotWalk *walk, SnapshotFolder *f, unsigned int i)
+{
+	CameraFileInfo info;
+
+	if (!walk->func)
+		return (GP_OK);
+	file_to_info (&walk->old->files[i], &info);
+	return walk->func (GP_FILESYSTEM_CHANGE_REMOVED, f->path,
+			   walk->old->files[i].name, &info, walk->data);
+}
+
+static int
+file_changed (const SnapshotFile *x, const CameraFileInfo *info)
+{
+	unsigned int fields = x->fields & info->file.fields;
+
+	return ((fields & GP_FILE_INFO_SIZE) && (x->size != info->file.size)) ||
+	       ((fields & GP_FILE_INFO_MTIME) && (x->mtime != info->file.mtime));
+}
+
+static int
+write_file (SnapshotWalk *walk, const char *name, const CameraFileInfo *info)
+{
+	char size[32], mtime[32];
+
+	if (!walk->out)
+		return (GP_OK);
+	strcpy (size, "-");
+	strcpy (mtime, "-");
+	if (info->file.fields & GP_FILE_INFO_SIZE)
+		snprintf (size, sizeof (size), "%llu",
+			  (unsigned long long)info->file.size);
+	if (info->file.fields & GP_FILE_INFO_MTIME)
+		snprintf (mtime, sizeof (mtime), "%llu",
+			  (unsigned long long)info->file.mtime);
+	return buffer_printf (walk->out, "F %s %s %s\n", size, mtime, name);
+}
+
+/*
+ * Lists the files of a folder and merges the sorted listing with the
+ * sorted files of the folder in the old snapshot.
+ */
+static int
+snapshot_walk_files (SnapshotWalk *walk, const char *folder, SnapshotFolder *of)
+{
+	CameraFileInfo	*infos = NULL;
+	CameraList	*list;
+	SnapshotFile	*x;
+	const char	*name;
+	unsigned int	o = 0, ocount = of ? of->count : 0;
+	int		i, count, cmp, ret;
+
+	CR (gp_list_new (&list));
+	ret = gp_filesystem_list_files_with_info (walk->fs, folder, list, &infos,
+						  walk->context);
+	if (ret < GP_OK)
+		goto out;
+	count = gp_list_count (list);
+	for (i = 0; (i < count) || (o < ocount); ) {
+		name = NULL;
+		if (i < count)
+			gp_list_get_name (list, i, &name);
+		x = (o < ocount) ? &walk->old->files[of->first + o] : NULL;
+		cmp = !x ? -1 : !name ? 1 : strcmp (name, x->name);
+		if (cmp > 0) {
+			ret = report_removed (walk, of, of->first + o++);
+			if (ret < GP_OK)
+				goto out;
+			continue;
+		}
+		i++;
+		if (!cmp)
+			o++;
+		if (!valid_name (name)) {
+			GP_LOG_E ("Leaving '%s' out of the snapshot.", name);
+			continue;
+		}
+		if (walk->func && (cmp || file_changed (x, &infos[i - 1]))) {
+			ret = walk->func (cmp ? GP_FILESYSTEM_CHANGE_ADDED
+					      : GP_FILESYSTEM_CHANGE_CHANGED,
+					  folder, name, &infos[i - 1], walk->data);
+			if (ret < GP_OK)
+				goto out;
+		}
+		ret = write_file (walk, name, &infos[i - 1]);
+		if (ret < GP_OK)
+			goto out;
+	}
+	ret = GP_OK;
+out:
+	free (infos);
+	gp_list_free (list);
+	return ret;
+}
+
+static int
+snapshot_walk (SnapshotWalk *walk, const char *folder)
+{
+	SnapshotFolder	*of = NULL;
+	CameraList	*list;
+	const char	*name;
+	char		*path;
+	uint64_t	fingerprint = 0;
+	unsigned int	end, i;
+	int		has_fingerprint, n, ret;
+
+	ret = gp_filesystem_get_fingerprint (walk->fs, folder, &fingerprint,
+					     walk->context);
+	if ((ret < GP_OK) && (ret != GP_ERROR_NOT_SUPPORTED))
+		return ret;
+	has_fingerprint = (ret == GP_OK);
+
+	if (walk->old)
+		of = snapshot_find_folder (walk->old, folder);
+	if (of && has_fingerprint && of->has_fingerprint &&
+	    (of->fingerprint == fingerprint)) {
+		Snapshot	*old = walk->old;
+		unsigned long	stop;
+
+		GP_LOG_D ("Fingerprint of '%s' unchanged, not listing it.",
+			  folder);
+		end = snapshot_subtree_end (old, of);
+		for (i = of - old->folders; i < end; i++)
+			old->folders[i].visited = 1;
+		if (!walk->out)
+			return (GP_OK);
+		stop = (end < old->nfolders) ? old->folders[end].offset
+					     : old->size;
+		CR (buffer_append (walk->out, old->data + of->offset,
+				   stop - of->offset));
+		if (walk->out->data[walk->out->size - 1] != '\n')
+			CR (buffer_append (walk->out, "\n", 1));
+		return (GP_OK);
+	}
+
+	if (walk->out) {
+		char value[32];
+
+		strcpy (value, "-");
+		if (has_fingerprint)
+			snprintf (value, sizeof (value), "%llx",
+				  (unsigned long long)fingerprint);
+		CR (buffer_printf (walk->out, "D %s %s\n", value, folder));
+	}
+	CR (snapshot_walk_files (walk, folder, of));
+	if (of)
+		of->visited = 1;
+
+	CR (gp_list_new (&list));
+	ret = gp_filesystem_list_folders (walk->fs, folder, list, walk->context);
+	if (ret >= GP_OK)
+		ret = gp_list_sort (list);
+	n = (ret >= GP_OK) ? gp_list_count (list) : 0;
+	for (i = 0; (ret >= GP_OK) && (i < (unsigned int)n); i++) {
+		gp_list_get_name (list, i, &name);
+		path = malloc (strlen (folder) + strlen (name) + 2);
+		if (!path) {
+			ret = GP_ERROR_NO_MEMORY;
+			break;
+		}
+		sprintf (path, "%s%s%s", folder,
+			 strcmp (folder, "/") ? "/" : "", name);
+		if (valid_name (name))
+			ret = snapshot_walk (walk, path);
+		else
+			GP_LOG_E ("Leaving '%s' out of the snapshot.", path);
+		free (path);
+	}
+	gp_list_free (list);
+	return ret;
+}
+
+/* Strips a trailing slash, folders are written without one. */
+static int
+snapshot_folder (const char *folder, char **path)
+{
+	size_t len = strlen (folder);
+
+	if ((folder[0] != '/') || !valid_name (folder))
+		return (GP_ERROR_PATH_NOT_ABSOLUTE);
+	C_MEM (*path = strdup (folder));
+	if ((len > 1) && ((*path)[len - 1] == '/'))
+		(*path)[len - 1] = '\0';
+	return (GP_OK);
+}
+
+/**
+ * \brief Take a snapshot of a folder and its subfolders
+ * \param fs a #CameraFilesystem
+ * \param folder the folder
+ * \param snapshot receives the malloc()ed snapshot
+ * \param size receives the size of the snapshot in bytes
+ * \param context a #GPContext
+ *
+ * Records the names, sizes and modification times of all files below
+ * the folder in a compact text form, to be handed to gp_filesystem_diff()
+ * later, possibly by another process. Where the camera driver supplies
+ * fingerprints (see gp_filesystem_get_fingerprint()) they are recorded,
+ * too.
+ *
+ * The caller has to free() *snapshot.
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_snapshot (CameraFilesystem *fs, const char *folder,
+			char **snapshot, unsigned long *size,
+			GPContext *context)
+{
+	SnapshotBuffer	buf;
+	SnapshotWalk	walk;
+	char		*path;
+	int		ret;
+
+	C_PARAMS (fs && folder && snapshot && size);
+
+	*snapshot = NULL;
+	*size = 0;
+	CR (snapshot_folder (folder, &path));
+	memset (&buf, 0, sizeof (buf));
+	memset (&walk, 0, sizeof (walk));
+	walk.fs      = fs;
+	walk.out     = &buf;
+	walk.context = context;
+	ret = buffer_append (&buf, SNAPSHOT_MAGIC "\n",
+			     strlen (SNAPSHOT_MAGIC) + 1);
+	if (ret >= GP_OK)
+		ret = snapshot_walk (&walk, path);
+	free (path);
+	if (ret < GP_OK) {
+		free (buf.data);
+		return ret;
+	}
+	*snapshot = buf.data;
+	*size     = buf.size;
+	return (GP_OK);
+}
+
+/**
+ * \brief Compare the filesystem with a snapshot
+ * \param fs a #CameraFilesystem
+ * \param snapshot a snapshot from gp_filesystem_snapshot()
+ * \param size the size of the snapshot
+ * \param func the #CameraFilesystemChangeFunc called for each difference
+ * \param data the data passed to func
+ * \param newsnapshot receives a snapshot of the current state, or NULL
+ * \param newsize receives the size of the new snapshot, or NULL
+ * \param context a #GPContext
+ *
+ * Walks the folder the snapshot was taken of and calls func for every
+ * file added, removed or changed since. Subfolders whose fingerprint did
+ * not change are not listed at all, which turns the walk of a large
+ * memory card into a handful of requests to the camera when little has
+ * changed. Only files are reported, not folders.
+ *
+ * A fingerprint only has to change when files are added or removed, so
+ * files modified in place below an unchanged fingerprint are not
+ * reported as #GP_FILESYSTEM_CHANGE_CHANGED. The ptp2 driver, for one,
+ * fingerprints the set of object handles on a storage.
+ *
+ * Passing newsnapshot takes the snapshot for the next call in the same
+ * walk. The caller has to free() *newsnapshot.
+ *
+ * Folders are listed through the filesystem cache, like with
+ * gp_filesystem_list_files(). Call gp_filesystem_reset() first if the
+ * camera driver does not report changes through events.
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_diff (CameraFilesystem *fs, const char *snapshot,
+		    unsigned long size,
+		    CameraFilesystemChangeFunc func, void *data,
+		    char **newsnapshot, unsigned long *newsize,
+		    GPContext *context)
+{
+	SnapshotBuffer	buf;
+	SnapshotWalk	walk;
+	Snapshot	old;
+	unsigned int	i, j;
+	int		ret;
+
+	C_PARAMS (fs && snapshot);
+	C_PARAMS (!newsnapshot == !newsize);
+
+	if (newsnapshot) {
+		*newsnapshot = NULL;
+		*newsize = 0;
+	}
+	CR (snapshot_parse (&old, snapshot, size));
+
+	memset (&buf, 0, sizeof (buf));
+	memset (&walk, 0, sizeof (walk));
+	walk.fs      = fs;
+	walk.old     = &old;
+	walk.func    = func;
+	walk.data    = data;
+	walk.out     = newsnapshot ? &buf : NULL;
+	walk.context = context;
+	ret = GP_OK;
+	if (walk.out)
+		ret = buffer_append (&buf, SNAPSHOT_MAGIC "\n",
+				     strlen (SNAPSHOT_MAGIC) + 1);
+	if (ret >= GP_OK)
+		ret = snapshot_walk (&walk, old.folders[0].path);
+
+	/* Everything in folders that are gone now was removed. */
+	for (i = 0; (ret >= GP_OK) && (i < old.nfolders); i++) {
+		if (old.folders[i].visited)
+			continue;
+		for (j = 0; (ret >= GP_OK) && (j < old.folders[i].count); j++)
+			ret = report_removed (&walk, &old.folders[i],
+					      old.folders[i].first + j);
+	}
+	snapshot_free (&old);
+	if (ret < GP_OK) {
+		free (buf.data);
+		return ret;
+	}
+	if (newsnapshot) {
+		*newsnapshot = buf.data;
+		*newsize     = buf.size;
+	}
+	return (GP_OK);
+}
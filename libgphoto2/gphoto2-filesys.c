@@ -36,6 +36,8 @@
 #include <gphoto2/gphoto2-port-log.h>
 #include <gphoto2/gphoto2-setting.h>
 
+#include "gphoto2-filesys-cache.h"
+
 #include <limits.h>
 
 #ifdef HAVE_LIBEXIF
@@ -65,34 +67,69 @@
 # define PATH_MAX 4096
 #endif
 
+/* Number of #CameraFilesystemCacheClass values */
+#define GP_FILESYSTEM_CACHE_CLASSES	2
+
+/*
+ * The downloaded data of a file and its place in the LRU chains. Most
+ * files never get any data cached, so this is only allocated on demand.
+ */
+typedef struct _CameraFilesystemFileData {
+	CameraFile *slot[GP_FILE_TYPE_METADATA + 1]; /* by CameraFileType */
+
+	/* one LRU chain per CameraFilesystemCacheClass */
+	struct _CameraFilesystemFile *lru_prev[GP_FILESYSTEM_CACHE_CLASSES];
+	struct _CameraFilesystemFile *lru_next[GP_FILESYSTEM_CACHE_CLASSES];
+	unsigned long int lru_size[GP_FILESYSTEM_CACHE_CLASSES];
+} CameraFilesystemFileData;
+
 typedef struct _CameraFilesystemFile {
-	char *name;
+	char *name;		/* in the node arena */
+
+	unsigned int info_dirty : 1;
+	unsigned int info_cached : 1;	/* info came from the persistent cache */
+	unsigned int announced : 1;	/* appended before or while the folder was listed */
+	unsigned int relisted : 1;	/* seen by the listing being merged */
+	unsigned int exif_mtime_known : 1; /* exif_mtime has been looked up */
+	unsigned int stamped : 1;	/* stamp has been set by the camera driver */
 
-	int info_dirty;
+	time_t exif_mtime;	/* capture time from the EXIF data, 0 if none */
+	uint64_t stamp;		/* see gp_filesystem_set_stamp() */
 
 	CameraFileInfo info;
 
-	struct _CameraFilesystemFile *lru_prev;
-	struct _CameraFilesystemFile *lru_next;
-	CameraFile *preview;
-	CameraFile *normal;
-	CameraFile *raw;
-	CameraFile *audio;
-	CameraFile *exif;
-	CameraFile *metadata;
+	CameraFilesystemFileData *data; /* NULL if nothing is cached */
 
-	struct _CameraFilesystemFile *next; /* in folder */
+	struct _CameraFilesystemFile *next; /* in folder, or in the free list */
+	struct _CameraFilesystemFile *hash_next; /* in folder name hash bucket */
+	unsigned int number; /* position in folder */
 } CameraFilesystemFile;
 
 typedef struct _CameraFilesystemFolder {
-	char *name;
+	char *name;		/* in the node arena, except for the root */
 
 	int files_dirty;
 	int folders_dirty;
+	int files_listing;	/* the camera driver is listing the files */
 
-	struct _CameraFilesystemFolder *next; /* chain in same folder */
+	struct _CameraFilesystemFolder *next; /* chain in same folder, or in the free list */
 	struct _CameraFilesystemFolder *folders; /* childchain of this folder */
 	struct _CameraFilesystemFile *files; /* of this folder */
+
+	/*
+	 * Lookup indices, so that folders with many thousand entries do
+	 * not need to be walked with strcmp() on every access.
+	 */
+	struct _CameraFilesystemFolder *hash_next; /* in parent name hash bucket */
+	struct _CameraFilesystemFolder **folders_hash; /* subfolders by name */
+	unsigned int folders_hash_size;
+	unsigned int nfolders;
+
+	struct _CameraFilesystemFile **files_hash; /* files by name */
+	unsigned int files_hash_size;
+	struct _CameraFilesystemFile **files_index; /* files by number */
+	unsigned int files_index_alloc;
+	unsigned int nfiles;
 } CameraFilesystemFolder;
 
 /**
@@ -106,12 +143,32 @@ typedef struct _CameraFilesystemFolder {
  */
 static int pictures_to_keep = -1;
 
+/**
+ * The default number of bytes to keep in the internal cache per
+ * #CameraFilesystemCacheClass, can be overridden by settings.
+ */
+#define BYTES_TO_KEEP		(256UL * 1024 * 1024)
+#define PREVIEW_BYTES_TO_KEEP	(32UL * 1024 * 1024)
+/**
+ * The current byte budgets of the internal cache, either from
+ * #BYTES_TO_KEEP and #PREVIEW_BYTES_TO_KEEP or from the settings.
+ */
+static long int bytes_to_keep[GP_FILESYSTEM_CACHE_CLASSES] = { -1, -1 };
+
+/**
+ * The default size cap of the persistent cache file of a camera,
+ * can be overridden by the "persistent-cache-bytes" setting.
+ */
+#define PERSISTENT_BYTES_TO_KEEP	(64UL * 1024 * 1024)
+
+static void gp_filesystem_lru_settings (void);
+static int gp_filesystem_lru_class (CameraFileType type);
+static CameraFile **gp_filesystem_file_slot (CameraFilesystem *fs, CameraFilesystemFile *xfile, CameraFileType type, int create);
+static int gp_filesystem_lru_update (CameraFilesystem *fs, int cls, CameraFilesystemFile *xfile);
 static int gp_filesystem_lru_clear (CameraFilesystem *fs);
-static int gp_filesystem_lru_remove_one (CameraFilesystem *fs, CameraFilesystemFile *item);
-static int gp_filesystem_lru_update (CameraFilesystem *fs,
-			  const char *folder, const char *filename,
-			  CameraFileType type,
-			  CameraFile *file, GPContext *context);
+static void gp_filesystem_lru_remove_one (CameraFilesystem *fs, CameraFilesystemFile *item);
+static void gp_filesystem_file_trim (CameraFilesystem *fs, CameraFilesystemFile *xfile);
+static int gp_filesystem_load_info (CameraFilesystem *fs, const char *folder, const char *filename, CameraFilesystemFile *xfile, GPContext *context);
 
 #ifdef HAVE_LIBEXIF
 
@@ -210,12 +267,6 @@ gp_filesystem_get_exif_mtime (CameraFilesystem *fs, const char *folder,
 	if (!fs)
 		return 0;
 
-	/* This is only useful for JPEGs. Avoid querying it for other types. */
-	if (	!strstr(filename,"jpg")  && !strstr(filename,"JPG") &&
-		!strstr(filename,"jpeg") && !strstr(filename,"JPEG")
-	)
-		return 0;
-
 	gp_file_new (&file);
 	if (gp_filesystem_get_file (fs, folder, filename,
 				GP_FILE_TYPE_EXIF, file, NULL) != GP_OK) {
@@ -242,9 +293,29 @@ gp_filesystem_get_exif_mtime (CameraFilesystem *fs, const char *folder,
 struct _CameraFilesystem {
 	CameraFilesystemFolder *rootfolder;
 
-	CameraFilesystemFile *lru_first;
-	CameraFilesystemFile *lru_last;
-	unsigned long int lru_size;
+	struct {
+		CameraFilesystemFile *first;	/* least recently used */
+		CameraFilesystemFile *last;	/* most recently used */
+		unsigned int count;
+		unsigned long int size;
+		unsigned long int budget;	/* 0 for unlimited */
+		uint64_t hits, misses, evictions;
+	} lru[GP_FILESYSTEM_CACHE_CLASSES];
+
+	GPFilesystemCache *pcache;	/* persistent cache, NULL if disabled */
+
+	uint64_t relists;		/* folder listings asked from the driver */
+	uint64_t relists_avoided;	/* driver changes patched in without listing */
+
+	struct {
+		struct _CameraFilesystemChunk *chunks;
+		char *pos;			/* free space in the newest chunk */
+		size_t left;
+		CameraFilesystemFile *free_files;
+		CameraFilesystemFolder *free_folders;
+		unsigned int ndata;		/* files with CameraFilesystemFileData */
+		int dropping;			/* gp_filesystem_reset() is running */
+	} arena;
 
 	CameraFilesystemGetInfoFunc get_info_func;
 	CameraFilesystemSetInfoFunc set_info_func;
@@ -258,6 +329,9 @@ struct _CameraFilesystem {
 	CameraFilesystemDirFunc make_dir_func;
 	CameraFilesystemDirFunc remove_dir_func;
 	CameraFilesystemStorageInfoFunc	storage_info_func;
+	CameraFilesystemGetFilesFunc get_files_func;
+	CameraFilesystemListInfoFunc file_list_info_func;
+	CameraFilesystemFingerprintFunc fingerprint_func;
 
 	void *data;
 };
@@ -302,6 +376,353 @@ struct _CameraFilesystem {
 	}								\
 }
 
+/*
+ * File and folder nodes and their names are carved out of large chunks
+ * owned by the filesystem instead of being allocated one by one. Freed
+ * nodes are kept in free lists for reuse. The chunks, and with them the
+ * names, are only released when gp_filesystem_reset() drops the whole
+ * tree, which then takes a few free() calls instead of two per file.
+ */
+#define ARENA_CHUNK_SIZE	(64 * 1024)
+#define ARENA_HEADER_SIZE	16	/* keeps the chunk data aligned */
+#define ARENA_NODE_ALIGN	8
+
+typedef struct _CameraFilesystemChunk {
+	struct _CameraFilesystemChunk *next;
+} CameraFilesystemChunk;
+
+static void *
+arena_alloc (CameraFilesystem *fs, size_t size, size_t align)
+{
+	CameraFilesystemChunk	*chunk;
+	size_t			pad, csize = ARENA_CHUNK_SIZE;
+
+	pad = (align - ((uintptr_t)fs->arena.pos & (align - 1))) & (align - 1);
+	if (fs->arena.pos && (pad + size <= fs->arena.left)) {
+		void *p = fs->arena.pos + pad;
+
+		fs->arena.pos  += pad + size;
+		fs->arena.left -= pad + size;
+		return p;
+	}
+
+	/* Large requests get a chunk of their own. */
+	if (size > ARENA_CHUNK_SIZE / 4)
+		csize = size;
+	chunk = malloc (ARENA_HEADER_SIZE + csize);
+	if (!chunk)
+		return NULL;
+	chunk->next = fs->arena.chunks;
+	fs->arena.chunks = chunk;
+	if (csize != ARENA_CHUNK_SIZE)
+		return (char *)chunk + ARENA_HEADER_SIZE;
+	fs->arena.pos  = (char *)chunk + ARENA_HEADER_SIZE + size;
+	fs->arena.left = csize - size;
+	return (char *)chunk + ARENA_HEADER_SIZE;
+}
+
+static char *
+arena_strndup (CameraFilesystem *fs, const char *name, size_t len)
+{
+	char *copy = arena_alloc (fs, len + 1, 1);
+
+	if (copy) {
+		memcpy (copy, name, len);
+		copy[len] = '\0';
+	}
+	return copy;
+}
+
+/* Drops all chunks, only to be called once no node is in use anymore. */
+static void
+arena_release (CameraFilesystem *fs)
+{
+	CameraFilesystemChunk *chunk;
+
+	while (fs->arena.chunks) {
+		chunk = fs->arena.chunks;
+		fs->arena.chunks = chunk->next;
+		free (chunk);
+	}
+	memset (&fs->arena, 0, sizeof (fs->arena));
+}
+
+static CameraFilesystemFile *
+file_node_new (CameraFilesystem *fs, const char *name)
+{
+	CameraFilesystemFile *file = fs->arena.free_files;
+
+	if (file)
+		fs->arena.free_files = file->next;
+	else if (!(file = arena_alloc (fs, sizeof (*file), ARENA_NODE_ALIGN)))
+		return NULL;
+	memset (file, 0, sizeof (*file));
+	file->name = arena_strndup (fs, name, strlen (name));
+	if (!file->name) {
+		file->next = fs->arena.free_files;
+		fs->arena.free_files = file;
+		return NULL;
+	}
+	return file;
+}
+
+static CameraFilesystemFolder *
+folder_node_new (CameraFilesystem *fs, const char *name, size_t len)
+{
+	CameraFilesystemFolder *folder = fs->arena.free_folders;
+
+	if (folder)
+		fs->arena.free_folders = folder->next;
+	else if (!(folder = arena_alloc (fs, sizeof (*folder), ARENA_NODE_ALIGN)))
+		return NULL;
+	memset (folder, 0, sizeof (*folder));
+	folder->name = arena_strndup (fs, name, len);
+	if (!folder->name) {
+		folder->next = fs->arena.free_folders;
+		fs->arena.free_folders = folder;
+		return NULL;
+	}
+	return folder;
+}
+
+/* FNV-1a over the first len bytes of name, used by the name indices. */
+static unsigned int
+name_hash (const char *name, size_t len)
+{
+	unsigned int h = 2166136261U;
+
+	while (len--)
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	return h;
+}
+
+#define INDEX_MIN_SIZE	16
+
+static int
+file_index_rehash (CameraFilesystemFolder *folder, unsigned int size)
+{
+	CameraFilesystemFile	**hash;
+	unsigned int		i, b;
+
+	C_MEM (hash = calloc (size, sizeof (CameraFilesystemFile*)));
+	for (i = 0; i < folder->nfiles; i++) {
+		CameraFilesystemFile *file = folder->files_index[i];
+
+		b = name_hash (file->name, strlen (file->name)) & (size - 1);
+		file->hash_next = hash[b];
+		hash[b] = file;
+	}
+	free (folder->files_hash);
+	folder->files_hash = hash;
+	folder->files_hash_size = size;
+	return GP_OK;
+}
+
+/* Appends file to the end of the file chain and the indices of folder. */
+static int
+file_index_append (CameraFilesystemFolder *folder, CameraFilesystemFile *file)
+{
+	unsigned int b;
+
+	if (folder->nfiles == folder->files_index_alloc) {
+		CameraFilesystemFile	**index;
+		unsigned int		alloc = folder->files_index_alloc * 2;
+
+		if (alloc < INDEX_MIN_SIZE)
+			alloc = INDEX_MIN_SIZE;
+		C_MEM (index = realloc (folder->files_index, alloc * sizeof (CameraFilesystemFile*)));
+		folder->files_index = index;
+		folder->files_index_alloc = alloc;
+	}
+	if (folder->nfiles >= folder->files_hash_size)
+		CR (file_index_rehash (folder, folder->files_index_alloc));
+
+	if (folder->nfiles)
+		folder->files_index[folder->nfiles - 1]->next = file;
+	else
+		folder->files = file;
+	file->next = NULL;
+	file->number = folder->nfiles;
+	folder->files_index[folder->nfiles++] = file;
+
+	b = name_hash (file->name, strlen (file->name)) & (folder->files_hash_size - 1);
+	file->hash_next = folder->files_hash[b];
+	folder->files_hash[b] = file;
+	return GP_OK;
+}
+
+/* Unlinks file from the file chain and the indices of folder. */
+static int
+file_index_remove (CameraFilesystemFolder *folder, CameraFilesystemFile *file)
+{
+	CameraFilesystemFile	**prev;
+	unsigned int		i, b;
+
+	if ((file->number >= folder->nfiles) ||
+	    (folder->files_index[file->number] != file))
+		return GP_ERROR;
+
+	b = name_hash (file->name, strlen (file->name)) & (folder->files_hash_size - 1);
+	prev = &folder->files_hash[b];
+	while (*prev && (*prev != file))
+		prev = &(*prev)->hash_next;
+	if (*prev)
+		*prev = file->hash_next;
+	file->hash_next = NULL;
+
+	if (file->number)
+		folder->files_index[file->number - 1]->next = file->next;
+	else
+		folder->files = file->next;
+	file->next = NULL;
+
+	folder->nfiles--;
+	for (i = file->number; i < folder->nfiles; i++) {
+		folder->files_index[i] = folder->files_index[i + 1];
+		folder->files_index[i]->number = i;
+	}
+	return GP_OK;
+}
+
+static CameraFilesystemFile *
+file_index_lookup (CameraFilesystemFolder *folder, const char *name)
+{
+	CameraFilesystemFile	*file;
+	size_t			len;
+
+	if (!folder->files_hash_size)
+		return NULL;
+	len = strlen (name);
+	file = folder->files_hash[name_hash (name, len) & (folder->files_hash_size - 1)];
+	while (file) {
+		if (!strcmp (file->name, name))
+			return file;
+		file = file->hash_next;
+	}
+	return NULL;
+}
+
+static void
+file_index_free (CameraFilesystemFolder *folder)
+{
+	free (folder->files_hash);
+	free (folder->files_index);
+	folder->files_hash = NULL;
+	folder->files_index = NULL;
+	folder->files_hash_size = 0;
+	folder->files_index_alloc = 0;
+	folder->nfiles = 0;
+}
+
+static int
+folder_index_rehash (CameraFilesystemFolder *folder, unsigned int size)
+{
+	CameraFilesystemFolder	**hash, *f;
+	unsigned int		b;
+
+	C_MEM (hash = calloc (size, sizeof (CameraFilesystemFolder*)));
+	for (f = folder->folders; f; f = f->next) {
+		b = name_hash (f->name, strlen (f->name)) & (size - 1);
+		f->hash_next = hash[b];
+		hash[b] = f;
+	}
+	free (folder->folders_hash);
+	folder->folders_hash = hash;
+	folder->folders_hash_size = size;
+	return GP_OK;
+}
+
+/* Prepends subfolder f to the folder chain and name index of folder. */
+static int
+folder_index_prepend (CameraFilesystemFolder *folder, CameraFilesystemFolder *f)
+{
+	unsigned int b;
+
+	if (folder->nfolders >= folder->folders_hash_size)
+		CR (folder_index_rehash (folder, folder->folders_hash_size ?
+				folder->folders_hash_size * 2 : INDEX_MIN_SIZE));
+
+	f->next = folder->folders;
+	folder->folders = f;
+	folder->nfolders++;
+
+	b = name_hash (f->name, strlen (f->name)) & (folder->folders_hash_size - 1);
+	f->hash_next = folder->folders_hash[b];
+	folder->folders_hash[b] = f;
+	return GP_OK;
+}
+
+/* Lookup a subfolder by the first len bytes of name. */
+static CameraFilesystemFolder *
+folder_index_lookup (CameraFilesystemFolder *folder, const char *name, size_t len)
+{
+	CameraFilesystemFolder *f;
+
+	if (!folder->folders_hash_size)
+		return NULL;
+	f = folder->folders_hash[name_hash (name, len) & (folder->folders_hash_size - 1)];
+	while (f) {
+		if (!strncmp (f->name, name, len) && !f->name[len])
+			return f;
+		f = f->hash_next;
+	}
+	return NULL;
+}
+
+/* The pointer to subfolder f in the chain of folder, for delete_folder(). */
+static CameraFilesystemFolder **
+folder_link (CameraFilesystemFolder *folder, CameraFilesystemFolder *f)
+{
+	CameraFilesystemFolder **prev = &folder->folders;
+
+	while (*prev != f)
+		prev = &(*prev)->next;
+	return prev;
+}
+
+static void
+folder_index_remove (CameraFilesystemFolder *folder, CameraFilesystemFolder *f)
+{
+	CameraFilesystemFolder **prev;
+
+	if (!folder->folders_hash_size)
+		return;
+	prev = &folder->folders_hash[name_hash (f->name, strlen (f->name)) & (folder->folders_hash_size - 1)];
+	while (*prev && (*prev != f))
+		prev = &(*prev)->hash_next;
+	if (*prev) {
+		*prev = f->hash_next;
+		folder->nfolders--;
+	}
+	f->hash_next = NULL;
+}
+
+/* The stamp of a file for the persistent cache, NULL if there is none. */
+static const uint64_t *
+file_stamp (const CameraFilesystemFile *xfile)
+{
+	return (xfile->stamped ? &xfile->stamp : NULL);
+}
+
+/* Drops the cached data of file and frees it. */
+static void
+free_file (CameraFilesystem *fs, CameraFilesystemFile *file)
+{
+	unsigned int i;
+
+	gp_filesystem_lru_remove_one (fs, file);
+	/* Get rid of cached files */
+	if (file->data) {
+		for (i = 0; i <= GP_FILE_TYPE_METADATA; i++)
+			if (file->data->slot[i])
+				gp_file_unref (file->data->slot[i]);
+		free (file->data);
+		fs->arena.ndata--;
+	}
+	file->next = fs->arena.free_files;
+	fs->arena.free_files = file;
+}
+
 static int
 delete_all_files (CameraFilesystem *fs, CameraFilesystemFolder *folder)
 {
@@ -310,55 +731,34 @@ delete_all_files (CameraFilesystem *fs, CameraFilesystemFolder *folder)
 	C_PARAMS (folder);
 	GP_LOG_D ("Delete all files in folder %p/%s", folder, folder->name);
 
-	file = folder->files;
+	/* Nothing to do per file if the arena goes away as a whole. */
+	file = (fs->arena.dropping && !fs->arena.ndata) ? NULL : folder->files;
 	while (file) {
 		CameraFilesystemFile	*next;
-		/* Get rid of cached files */
-		gp_filesystem_lru_remove_one (fs, file);
-		if (file->preview) {
-			gp_file_unref (file->preview);
-			file->preview = NULL;
-		}
-		if (file->normal) {
-			gp_file_unref (file->normal);
-			file->normal = NULL;
-		}
-		if (file->raw) {
-			gp_file_unref (file->raw);
-			file->raw = NULL;
-		}
-		if (file->audio) {
-			gp_file_unref (file->audio);
-			file->audio = NULL;
-		}
-		if (file->exif) {
-			gp_file_unref (file->exif);
-			file->exif = NULL;
-		}
-		if (file->metadata) {
-			gp_file_unref (file->metadata);
-			file->metadata = NULL;
-		}
+
 		next = file->next;
-		free (file->name);
-		free (file);
+		free_file (fs, file);
 		file = next;
 	}
 	folder->files = NULL;
+	file_index_free (folder);
 	return (GP_OK);
 }
 
 static int
-delete_folder (CameraFilesystem *fs, CameraFilesystemFolder **folder)
+delete_folder (CameraFilesystem *fs, CameraFilesystemFolder *parent,
+	       CameraFilesystemFolder **folder)
 {
 	CameraFilesystemFolder *next;
 	C_PARAMS (folder);
 
 	GP_LOG_D ("Delete one folder %p/%s", *folder, (*folder)->name);
 	next = (*folder)->next;
+	folder_index_remove (parent, *folder);
 	delete_all_files (fs, *folder);
-	free ((*folder)->name);
-	free (*folder);
+	free ((*folder)->folders_hash);
+	(*folder)->next = fs->arena.free_folders;
+	fs->arena.free_folders = *folder;
 	*folder = next;
 	return (GP_OK);
 }
@@ -369,7 +769,6 @@ lookup_folder (
 	CameraFilesystemFolder *folder, const char *foldername,
 	GPContext *context
 ) {
-	CameraFilesystemFolder	*f;
 	const char	*curpt = foldername;
 	const char	*s;
 
@@ -407,23 +806,12 @@ lookup_folder (
 			}
 			free (copy);
 		}
-		f = folder->folders;
-		while (f) {
-			if (s) {
-				if (!strncmp(f->name,curpt, (s-curpt)) &&
-				    ((ssize_t)strlen(f->name) == (s-curpt))
-				) {
-					folder = f;
-					curpt = s;
-					break;
-				}
-			} else {
-				if (!strcmp(f->name,curpt))
-					return f;
-			}
-			f = f->next;
+		if (s) {
+			folder = folder_index_lookup (folder, curpt, s - curpt);
+			curpt = s;
+		} else {
+			return folder_index_lookup (folder, curpt, strlen (curpt));
 		}
-		folder = f;
 	}
 	return NULL;
 }
@@ -441,8 +829,12 @@ lookup_folder_file (
 	GP_LOG_D ("Lookup folder %s file %s", folder, filename);
 	xf = lookup_folder (fs, fs->rootfolder, folder, context);
 	if (!xf) return GP_ERROR_DIRECTORY_NOT_FOUND;
-	/* Check if we need to load the filelist of the folder ... */
-	if (xf->files_dirty) {
+	/*
+	 * Check if we need to load the filelist of the folder ... unless the
+	 * camera driver already told us about this file.
+	 */
+	f = file_index_lookup (xf, filename);
+	if (!f && xf->files_dirty) {
 		CameraList	*list;
 		int		ret;
 		/*
@@ -458,18 +850,13 @@ lookup_folder_file (
 		}
 		if (ret != GP_OK)
 			GP_LOG_D ("Making folder %s clean failed: %d", folder, ret);
+		f = file_index_lookup (xf, filename);
 	}
-
-	f = xf->files;
-	while (f) {
-		if (!strcmp (f->name, filename)) {
-			*xfile = f;
-			*xfolder = xf;
-			return GP_OK;
-		}
-		f = f->next;
-	}
-	return GP_ERROR_FILE_NOT_FOUND;
+	if (!f)
+		return GP_ERROR_FILE_NOT_FOUND;
+	*xfile = f;
+	*xfolder = xf;
+	return GP_OK;
 }
 
 /* delete all folder content */
@@ -481,7 +868,7 @@ recurse_delete_folder (CameraFilesystem *fs, CameraFilesystemFolder *folder) {
 	f = &folder->folders;
 	while (*f) {
 		recurse_delete_folder (fs, *f);
-		delete_folder (fs, f); /* will also advance to next */
+		delete_folder (fs, folder, f); /* will also advance to next */
 	}
 	return GP_OK;
 }
@@ -507,37 +894,38 @@ delete_all_folders (CameraFilesystem *fs, const char *foldername,
 /* create and append 1 new folder entry to the current folder */
 static int
 append_folder_one (
+	CameraFilesystem *fs,
 	CameraFilesystemFolder *folder,
-	const char *name,
+	const char *name, size_t len,
 	CameraFilesystemFolder **newfolder
 ) {
 	CameraFilesystemFolder *f;
 
-	GP_LOG_D ("Append one folder %s", name);
-	C_MEM (f = calloc(1, sizeof(CameraFilesystemFolder)));
-	f->name = strdup (name);
-	if (!f->name) {
-		free (f);
-		return GP_ERROR_NO_MEMORY;
-	}
+	GP_LOG_D ("Append one folder %.*s", (int)len, name);
+	C_MEM (f = folder_node_new (fs, name, len));
 	f->files_dirty = 1;
 	f->folders_dirty = 1;
 
 	/* Link into the current chain...  perhaps later alphabetically? */
-	f->next = folder->folders;
-	folder->folders = f;
+	if (folder_index_prepend (folder, f) < GP_OK) {
+		f->next = fs->arena.free_folders;
+		fs->arena.free_folders = f;
+		return GP_ERROR_NO_MEMORY;
+	}
 	if (newfolder) *newfolder = f;
 	return (GP_OK);
 }
 
 /* This is a mix between lookup and folder creator */
 static int
-append_to_folder (CameraFilesystemFolder *folder,
+append_to_folder (CameraFilesystem *fs,
+	CameraFilesystemFolder *folder,
 	const char *foldername,
 	CameraFilesystemFolder **newfolder
 ) {
 	CameraFilesystemFolder	*f;
 	char	*s;
+	size_t	len;
 
 	GP_LOG_D ("Append to folder %p/%s - %s", folder, folder->name, foldername);
 	/* Handle multiple slashes, and slashes at the end */
@@ -549,33 +937,16 @@ append_to_folder (CameraFilesystemFolder *folder,
 	}
 
 	s = strchr(foldername,'/');
-	f = folder->folders;
-	while (f) {
-		if (s) {
-			if (!strncmp(f->name,foldername, (s-foldername)) &&
-			    ((ssize_t)strlen(f->name) == (s-foldername))
-			)
-				return append_to_folder (f, s+1, newfolder);
-		} else {
-			if (!strcmp(f->name,foldername)) {
-				if (newfolder) *newfolder = f;
-				return (GP_OK);
-			}
-		}
-		f = f->next;
+	len = s ? (size_t)(s - foldername) : strlen (foldername);
+	f = folder_index_lookup (folder, foldername, len);
+	if (f) {
+		if (s)
+			return append_to_folder (fs, f, s+1, newfolder);
+		if (newfolder) *newfolder = f;
+		return (GP_OK);
 	}
 	/* Not found ... create new folder */
-	if (s) {
-		char *x;
-		C_MEM (x = calloc ((s-foldername)+1,1));
-		memcpy (x, foldername, (s-foldername));
-		x[s-foldername] = 0;
-		CR (append_folder_one (folder, x, newfolder));
-		free (x);
-	} else {
-		CR (append_folder_one (folder, foldername, newfolder));
-	}
-	return (GP_OK);
+	return append_folder_one (fs, folder, foldername, len, newfolder);
 }
 
 static int
@@ -589,31 +960,29 @@ append_folder (CameraFilesystem *fs,
 	C_PARAMS (folder);
 	CC (context);
 	CA (folder, context);
-	return append_to_folder (fs->rootfolder, folder, newfolder);
+	return append_to_folder (fs, fs->rootfolder, folder, newfolder);
 }
 
 static int
 append_file (CameraFilesystem *fs, CameraFilesystemFolder *folder, const char *name, CameraFile *file, GPContext *context)
 {
-	CameraFilesystemFile **new;
+	CameraFilesystemFile *new;
 
 	C_PARAMS (fs && file);
 	GP_LOG_D ("Appending file %s...", name);
 
-	new = &folder->files;
-	while (*new) {
-		if (!strcmp((*new)->name, name)) {
-			GP_LOG_E ("File %s already exists!", name);
-			return (GP_ERROR);
-		}
-		new = &((*new)->next);
-	}
-	/* new now points to the location of the last ->next pointer,
-	 * if we write to it, we set last->next */
-	C_MEM ((*new) = calloc (1, sizeof (CameraFilesystemFile)));
-	C_MEM ((*new)->name = strdup (name));
-	(*new)->info_dirty = 1;
-	(*new)->normal = file;
+	if (file_index_lookup (folder, name)) {
+		GP_LOG_E ("File %s already exists!", name);
+		return (GP_ERROR);
+	}
+	C_MEM (new = file_node_new (fs, name));
+	if (!gp_filesystem_file_slot (fs, new, GP_FILE_TYPE_NORMAL, 1) ||
+	    (file_index_append (folder, new) < GP_OK)) {
+		free_file (fs, new);
+		return (GP_ERROR_NO_MEMORY);
+	}
+	new->info_dirty = 1;
+	new->data->slot[GP_FILE_TYPE_NORMAL] = file;
 	gp_file_ref (file);
 	return (GP_OK);
 }
@@ -630,12 +999,19 @@ append_file (CameraFilesystem *fs, CameraFilesystemFolder *folder, const char *n
 int
 gp_filesystem_reset (CameraFilesystem *fs)
 {
+	int ret;
+
 	GP_LOG_D ("resetting filesystem");
 	CR (gp_filesystem_lru_clear (fs));
-	CR (delete_all_folders (fs, "/", NULL));
-
-	/* the recurse delete will not delete the files in /, only in subdirs */
-	delete_all_files (fs, fs->rootfolder);
+	fs->arena.dropping = 1;
+	ret = delete_all_folders (fs, "/", NULL);
+	if (ret == GP_OK) {
+		/* the recurse delete will not delete the files in /, only in subdirs */
+		delete_all_files (fs, fs->rootfolder);
+		arena_release (fs);
+	}
+	fs->arena.dropping = 0;
+	CR (ret);
 
 	if (fs->rootfolder) {
 		fs->rootfolder->files_dirty = 1;
@@ -675,6 +1051,10 @@ gp_filesystem_new (CameraFilesystem **fs)
 	}
 	(*fs)->rootfolder->files_dirty = 1;
 	(*fs)->rootfolder->folders_dirty = 1;
+
+	gp_filesystem_lru_settings ();
+	(*fs)->lru[GP_FILESYSTEM_CACHE_FILES].budget = bytes_to_keep[GP_FILESYSTEM_CACHE_FILES];
+	(*fs)->lru[GP_FILESYSTEM_CACHE_PREVIEWS].budget = bytes_to_keep[GP_FILESYSTEM_CACHE_PREVIEWS];
 	return (GP_OK);
 }
 
@@ -691,9 +1071,13 @@ gp_filesystem_free (CameraFilesystem *fs)
 {
 	/* We don't care for success or failure */
 	gp_filesystem_reset (fs);
+	gp_filesystem_cache_close (fs->pcache);
+	/* A failed reset keeps the nodes, nothing uses them any more. */
+	arena_release (fs);
 
 	/* Now, we've only got left over the root folder. Free that and
 	 * the filesystem. */
+	free (fs->rootfolder->folders_hash);
 	free (fs->rootfolder->name);
 	free (fs->rootfolder);
 	free (fs);
@@ -718,31 +1102,96 @@ static int
 internal_append (CameraFilesystem *fs, CameraFilesystemFolder *f,
 		      const char *filename, GPContext *context)
 {
-	CameraFilesystemFile **new;
+	CameraFilesystemFile *new;
 
 	C_PARAMS (fs && f);
 
 	GP_LOG_D ("Internal append %s to folder %s", filename, f->name);
-	/* Check folder for existence, if not, create it. */
-	new = &f->files;
-	while (*new) {
-		if (!strcmp((*new)->name, filename)) break;
-		new = &((*new)->next);
-	}
-	if (*new)
+	if (file_index_lookup (f, filename))
 		return (GP_ERROR_FILE_EXISTS);
 
-	C_MEM ((*new) = calloc (sizeof (CameraFilesystemFile), 1));
-	(*new)->name = strdup (filename);
-	if (!(*new)->name) {
-		free (*new);
-		*new = NULL;
+	C_MEM (new = file_node_new (fs, filename));
+	if (file_index_append (f, new) < GP_OK) {
+		free_file (fs, new);
 		return (GP_ERROR_NO_MEMORY);
 	}
-	(*new)->info_dirty = 1;
+	new->info_dirty = 1;
 	return (GP_OK);
 }
 
+/*
+ * Replaces the files of the dirty folder f by the names in list, in list
+ * order. Files that are already known keep their information and cached
+ * data. Files the camera driver appended before the folder got listed are
+ * kept at the end even if the listing does not contain them.
+ */
+static int
+relist_files (CameraFilesystem *fs, CameraFilesystemFolder *f,
+	      CameraList *list, GPContext *context)
+{
+	CameraFilesystemFolder	old;
+	CameraFilesystemFile	**found = NULL, *file;
+	const char		*name;
+	unsigned int		i;
+	int			count, y, ret = GP_OK;
+
+	CR (count = gp_list_count (list));
+	if (f->nfiles && count)
+		C_MEM (found = calloc (count, sizeof (CameraFilesystemFile*)));
+
+	/* Look everything up before the old chains get relinked. */
+	for (y = 0; found && (y < count); y++) {
+		if (gp_list_get_name (list, y, &name) == GP_OK)
+			found[y] = file_index_lookup (f, name);
+	}
+
+	memset (&old, 0, sizeof (old));
+	old.files_index = f->files_index;
+	old.files_hash  = f->files_hash;
+	old.nfiles	= f->nfiles;
+	f->files = NULL;
+	f->files_index = NULL;
+	f->files_hash = NULL;
+	f->files_hash_size = 0;
+	f->files_index_alloc = 0;
+	f->nfiles = 0;
+
+	for (y = 0; (ret == GP_OK) && (y < count); y++) {
+		ret = gp_list_get_name (list, y, &name);
+		if (ret < GP_OK)
+			break;
+		GP_LOG_D ("Added '%s'", name);
+		file = found ? found[y] : NULL;
+		if (!file) {
+			ret = internal_append (fs, f, name, context);
+			if (ret == GP_ERROR_FILE_EXISTS) /* listed twice */
+				ret = GP_OK;
+		} else if (!file->relisted) {
+			file->relisted = 1;
+			ret = file_index_append (f, file);
+		}
+	}
+
+	for (i = 0; i < old.nfiles; i++) {
+		file = old.files_index[i];
+		if (file->relisted) {
+			file->relisted = 0;
+		} else if (file->announced && (ret == GP_OK) &&
+			   !file_index_lookup (f, file->name)) {
+			GP_LOG_D ("Keeping '%s' appended before listing", file->name);
+			ret = file_index_append (f, file);
+		} else {
+			free_file (fs, file);
+			continue;
+		}
+		file->announced = 0;
+	}
+	free (old.files_index);
+	free (old.files_hash);
+	free (found);
+	return ret;
+}
+
 int
 gp_filesystem_append (CameraFilesystem *fs, const char *folder,
 		      const char *filename, GPContext *context)
@@ -759,20 +1208,30 @@ gp_filesystem_append (CameraFilesystem *fs, const char *folder,
 	f = lookup_folder (fs, fs->rootfolder, folder, context);
 	if (!f)
 		CR (append_folder (fs, folder, &f, context));
-	if (f->files_dirty) { /* Need to load folder from driver first ... capture case */
-		CameraList	*xlist;
-		int ret;
-
-		ret = gp_list_new (&xlist);
-		if (ret != GP_OK) return ret;
-		ret = gp_filesystem_list_files (fs, folder, xlist, context);
-		gp_list_free (xlist);
-		if (ret != GP_OK) return ret;
-	}
+	if (!filename) /* just the folder */
+		return GP_OK;
 	ret = internal_append (fs, f, filename, context);
-	if (ret == GP_ERROR_FILE_EXISTS) /* not an error here ... just in case we add files twice to the list */
-		ret = GP_OK;
-	return ret;
+	if ((ret != GP_OK) && (ret != GP_ERROR_FILE_EXISTS))
+		return ret;
+	if (f->files_listing) {
+		/*
+		 * Camera drivers that add their files with
+		 * gp_filesystem_append() from their file_list_func and
+		 * return an empty list. The listing keeps them.
+		 */
+		file_index_lookup (f, filename)->announced = 1;
+	} else if ((ret == GP_OK) && f->files_dirty) {
+		/*
+		 * Capture case: the folder has not been listed yet. Do not
+		 * list it now, the listing will merge the new file in.
+		 */
+		GP_LOG_D ("Folder %s not listed yet, appended %s without listing",
+			  folder, filename);
+		file_index_lookup (f, filename)->announced = 1;
+		fs->relists_avoided++;
+	}
+	/* not an error here ... just in case we add files twice to the list */
+	return GP_OK;
 }
 
 
@@ -813,44 +1272,8 @@ gp_filesystem_dump (CameraFilesystem *fs)
 static int
 delete_file (CameraFilesystem *fs, CameraFilesystemFolder *folder, CameraFilesystemFile *file)
 {
-	CameraFilesystemFile **prev;
-
-	gp_filesystem_lru_remove_one (fs, file);
-	/* Get rid of cached files */
-	if (file->preview) {
-		gp_file_unref (file->preview);
-		file->preview = NULL;
-	}
-	if (file->normal) {
-		gp_file_unref (file->normal);
-		file->normal = NULL;
-	}
-	if (file->raw) {
-		gp_file_unref (file->raw);
-		file->raw = NULL;
-	}
-	if (file->audio) {
-		gp_file_unref (file->audio);
-		file->audio = NULL;
-	}
-	if (file->exif) {
-		gp_file_unref (file->exif);
-		file->exif = NULL;
-	}
-	if (file->metadata) {
-		gp_file_unref (file->metadata);
-		file->metadata = NULL;
-	}
-
-	prev = &(folder->files);
-	while ((*prev) && ((*prev) != file))
-		prev = &((*prev)->next);
-	if (!*prev)
-		return GP_ERROR;
-	*prev = file->next;
-	file->next = NULL;
-	free (file->name);
-	free (file);
+	CR (file_index_remove (folder, file));
+	free_file (fs, file);
 	return (GP_OK);
 }
 
@@ -953,8 +1376,7 @@ int
 gp_filesystem_list_files (CameraFilesystem *fs, const char *folder,
 			  CameraList *list, GPContext *context)
 {
-	int count, y;
-	const char *name;
+	int ret;
 	CameraFilesystemFolder	*f;
 	CameraFilesystemFile	*file;
 
@@ -970,22 +1392,21 @@ gp_filesystem_list_files (CameraFilesystem *fs, const char *folder,
 	f = lookup_folder (fs, fs->rootfolder, folder, context);
 	if (!f) return (GP_ERROR_DIRECTORY_NOT_FOUND);
 
-	/* If the folder is dirty, delete the contents and query the camera */
+	/* If the folder is dirty, query the camera and merge the contents */
 	if (f->files_dirty && fs->file_list_func) {
 		GP_LOG_D ("Querying folder %s...", folder);
-		CR (delete_all_files (fs, f));
 
 		/* set it to non-dirty now, so we do not recurse via _append. */
 		f->files_dirty = 0;
-		CR (fs->file_list_func (fs, folder, list,
-					fs->data, context));
-
-		CR (count = gp_list_count (list));
-		for (y = 0; y < count; y++) {
-			CR (gp_list_get_name (list, y, &name));
-			GP_LOG_D ("Added '%s'", name);
-			CR (internal_append (fs, f, name, context));
+		fs->relists++;
+		f->files_listing = 1;
+		ret = fs->file_list_func (fs, folder, list, fs->data, context);
+		f->files_listing = 0;
+		if (ret < GP_OK) {
+			f->files_dirty = 1;
+			return ret;
 		}
+		CR (relist_files (fs, f, list, context));
 		gp_list_reset (list);
 	}
 	/* The folder is clean now */
@@ -1001,14 +1422,145 @@ gp_filesystem_list_files (CameraFilesystem *fs, const char *folder,
 	return (GP_OK);
 }
 
+/*
+ * Queries a dirty folder through the file_list_info_func and stores the
+ * information the camera driver returned along with the names.
+ */
+static int
+gp_filesystem_list_files_info (CameraFilesystem *fs, CameraFilesystemFolder *f,
+			       const char *folder, CameraList *list,
+			       GPContext *context)
+{
+	CameraFileInfo		*infos = NULL;
+	CameraFilesystemFile	*xfile;
+	const char		*name;
+	int			count, y, ret;
+
+	GP_LOG_D ("Querying folder %s with file information...", folder);
+
+	/* set it to non-dirty now, so we do not recurse via _append. */
+	f->files_dirty = 0;
+	fs->relists++;
+	gp_list_reset (list);
+	f->files_listing = 1;
+	ret = fs->file_list_info_func (fs, folder, list, &infos, fs->data,
+				       context);
+	f->files_listing = 0;
+	if (ret < GP_OK) {
+		f->files_dirty = 1;
+		goto out;
+	}
+	ret = relist_files (fs, f, list, context);
+	if (ret < GP_OK)
+		goto out;
+
+	ret = count = gp_list_count (list);
+	if (ret < GP_OK)
+		goto out;
+	for (y = 0; y < count; y++) {
+		ret = gp_list_get_name (list, y, &name);
+		if (ret < GP_OK)
+			goto out;
+		if (!infos || (!infos[y].file.fields &&
+			       !infos[y].preview.fields &&
+			       !infos[y].audio.fields))
+			continue;
+		xfile = file_index_lookup (f, name);
+		if (!xfile)
+			continue;
+		memcpy (&xfile->info, &infos[y], sizeof (CameraFileInfo));
+		xfile->info_dirty = 0;
+		xfile->info_cached = 0;
+		if (fs->pcache)
+			gp_filesystem_cache_put_info (fs->pcache, folder, name,
+						      file_stamp (xfile),
+						      &xfile->info);
+	}
+	ret = GP_OK;
+out:
+	free (infos);
+	gp_list_reset (list);
+	return ret;
+}
+
 /**
- * \brief List all subfolders within a filesystem folder
+ * \brief Get the list of files in a folder along with their information
  * \param fs a #CameraFilesystem
- * \param folder a folder
- * \param list a #CameraList where subfolders should be listed
+ * \param folder a folder of which a file list should be generated
+ * \param list a #CameraList where to put the list of files into
+ * \param infos receives a malloc()ed array of #CameraFileInfo
  * \param context a #GPContext
  *
- * Generates a list of subfolders of the supplied folder either using
+ * Like #gp_filesystem_list_files, but also returns the information about
+ * each listed file. The list is sorted by name and infos[i] describes the
+ * i-th entry of the list. Camera drivers supplying a file_list_info_func
+ * deliver both in one pass, otherwise the information is gathered from
+ * the cache or the get_info_func file by file. The mtime is not looked
+ * up in the EXIF data as #gp_filesystem_get_info does.
+ *
+ * The caller has to free() *infos.
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_list_files_with_info (CameraFilesystem *fs, const char *folder,
+				    CameraList *list, CameraFileInfo **infos,
+				    GPContext *context)
+{
+	CameraFilesystemFolder	*f;
+	CameraFilesystemFile	*xfile;
+	const char		*name;
+	int			count, y, ret;
+
+	C_PARAMS (fs && list && folder && infos);
+	CC (context);
+	CA (folder, context);
+
+	*infos = NULL;
+
+	f = lookup_folder (fs, fs->rootfolder, folder, context);
+	if (!f) return (GP_ERROR_DIRECTORY_NOT_FOUND);
+
+	if (f->files_dirty && fs->file_list_info_func)
+		CR (gp_filesystem_list_files_info (fs, f, folder, list, context));
+
+	CR (gp_filesystem_list_files (fs, folder, list, context));
+	CR (gp_list_sort (list));
+	CR (count = gp_list_count (list));
+
+	C_MEM (*infos = calloc (count ? count : 1, sizeof (CameraFileInfo)));
+	for (y = 0; y < count; y++) {
+		ret = gp_list_get_name (list, y, &name);
+		if (ret < GP_OK)
+			goto fail;
+		xfile = file_index_lookup (f, name);
+		if (!xfile) {
+			ret = GP_ERROR_FILE_NOT_FOUND;
+			goto fail;
+		}
+		ret = gp_filesystem_load_info (fs, folder, name, xfile, context);
+		if (ret == GP_ERROR_NOT_SUPPORTED)
+			continue;
+		if (ret < GP_OK)
+			goto fail;
+		memcpy (&(*infos)[y], &xfile->info, sizeof (CameraFileInfo));
+	}
+	return (GP_OK);
+
+fail:
+	free (*infos);
+	*infos = NULL;
+	return ret;
+}
+
+/**
+ * \brief List all subfolders within a filesystem folder
+ * \param fs a #CameraFilesystem
+ * \param folder a folder
+ * \param list a #CameraList where subfolders should be listed
+ * \param context a #GPContext
+ *
+ * Generates a list of subfolders of the supplied folder either using
  * cached values (if there are any) or the folder_list_func if it has been
  * supplied previously. If not, it is assumed that only a root folder
  * exists (which is the case for many cameras).
@@ -1039,6 +1591,7 @@ gp_filesystem_list_folders (CameraFilesystem *fs, const char *folder,
 	/* If the folder is dirty, query the contents. */
 	if (f->folders_dirty && fs->folder_list_func) {
 		GP_LOG_D ("... is dirty, getting from camera");
+		fs->relists++;
 		CR (fs->folder_list_func (fs, folder, list,
 					  fs->data, context));
 		CR (delete_all_folders (fs, folder, context));
@@ -1046,7 +1599,7 @@ gp_filesystem_list_folders (CameraFilesystem *fs, const char *folder,
 		CR (count = gp_list_count (list));
 		for (y = 0; y < count; y++) {
 			CR (gp_list_get_name (list, y, &name));
-			CR (append_folder_one (f, name, NULL));
+			CR (append_folder_one (fs, f, name, strlen (name), NULL));
 		}
 		/* FIXME: why not just return (GP_OK); ? the list should be fine */
 		gp_list_reset (list);
@@ -1063,6 +1616,24 @@ gp_filesystem_list_folders (CameraFilesystem *fs, const char *folder,
 	return (GP_OK);
 }
 
+/*
+ * Positions in a folder are only meaningful once it has been listed. Files
+ * appended before that get their final place from the listing.
+ */
+static int
+list_announced (CameraFilesystem *fs, const char *folder,
+		CameraFilesystemFolder *f, GPContext *context)
+{
+	CameraList *list;
+
+	if (!f->files_dirty || !f->nfiles)
+		return (GP_OK);
+	CR (gp_list_new (&list));
+	CL (gp_filesystem_list_files (fs, folder, list, context), list);
+	gp_list_free (list);
+	return (GP_OK);
+}
+
 /**
  * \brief Count files a folder of a filesystem.
  * \param fs a #CameraFilesystem
@@ -1077,9 +1648,7 @@ int
 gp_filesystem_count (CameraFilesystem *fs, const char *folder,
 		     GPContext *context)
 {
-	int x;
 	CameraFilesystemFolder	*f;
-	CameraFilesystemFile	*file;
 
 	C_PARAMS (fs && folder);
 	CC (context);
@@ -1087,14 +1656,9 @@ gp_filesystem_count (CameraFilesystem *fs, const char *folder,
 
 	f = lookup_folder (fs, fs->rootfolder, folder, context);
 	if (!f) return (GP_ERROR_DIRECTORY_NOT_FOUND);
+	CR (list_announced (fs, folder, f, context));
 
-	x = 0;
-	file = f->files;
-	while (file) {
-		x++;
-		file = file->next;
-	}
-	return x;
+	return f->nfiles;
 }
 
 /**
@@ -1138,6 +1702,8 @@ gp_filesystem_delete_file (CameraFilesystem *fs, const char *folder,
 	CR (fs->delete_file_func (fs, folder, filename,
 				  fs->data, context));
 	CR (delete_file (fs, f, file));
+	if (fs->pcache)
+		gp_filesystem_cache_remove (fs->pcache, folder, filename);
 	return (GP_OK);
 }
 
@@ -1151,6 +1717,7 @@ gp_filesystem_delete_file (CameraFilesystem *fs, const char *folder,
  * Remove a file from the filesystem. Compared to gp_filesystem_delete_file()
  * this just removes the file from the libgphoto2 view of the filesystem, but
  * does not call the camera driver to delete it from the physical device.
+ * Camera drivers use it when the camera reports a removed file.
  *
  * \return a gphoto2 error code.
  **/
@@ -1164,9 +1731,91 @@ gp_filesystem_delete_file_noop (CameraFilesystem *fs, const char *folder,
 	C_PARAMS (fs && folder && filename);
 	CC (context);
 	CA (folder, context);
+	if (fs->pcache)
+		gp_filesystem_cache_remove (fs->pcache, folder, filename);
+
+	/* A folder that has not been listed yet will not list the file. */
+	f = lookup_folder (fs, fs->rootfolder, folder, context);
+	if (f && f->files_dirty && !file_index_lookup (f, filename))
+		return (GP_OK);
+
 	/* Search the folder and the file */
 	CR (lookup_folder_file (fs, folder, filename, &f, &file, context));
-	return delete_file (fs, f, file);
+	CR (delete_file (fs, f, file));
+	if (!f->files_dirty)
+		fs->relists_avoided++;
+	return (GP_OK);
+}
+
+/**
+ * \brief Add a subfolder to a folder in the filesystem
+ * \param fs a #CameraFilesystem
+ * \param folder the folder that contains the new folder
+ * \param name the name of the new folder
+ * \param context a #GPContext
+ *
+ * Tells the fs about a folder the camera created, e.g. on a
+ * #GP_EVENT_FOLDER_ADDED. Compared to gp_filesystem_make_dir() this does
+ * not call the camera driver. The rest of the cached tree stays valid, so
+ * camera drivers should prefer this over gp_filesystem_reset().
+ *
+ * \return a gphoto2 error code
+ **/
+int
+gp_filesystem_make_dir_noop (CameraFilesystem *fs, const char *folder,
+			     const char *name, GPContext *context)
+{
+	CameraFilesystemFolder	*f;
+
+	C_PARAMS (fs && folder && name);
+	CC (context);
+	CA (folder, context);
+
+	f = lookup_folder (fs, fs->rootfolder, folder, context);
+	if (!f) return (GP_ERROR_DIRECTORY_NOT_FOUND);
+
+	/* A folder that has not been listed yet will list the new one. */
+	if (!f->folders_dirty && !folder_index_lookup (f, name, strlen (name))) {
+		CR (append_folder_one (fs, f, name, strlen (name), NULL));
+		fs->relists_avoided++;
+	}
+	return (GP_OK);
+}
+
+/**
+ * \brief Remove a subfolder from a folder in the filesystem
+ * \param fs a #CameraFilesystem
+ * \param folder the folder that contains the removed folder
+ * \param name the name of the removed folder
+ * \param context a #GPContext
+ *
+ * Tells the fs that the camera removed a folder along with everything in
+ * it. Compared to gp_filesystem_remove_dir() this does not call the camera
+ * driver.
+ *
+ * \return a gphoto2 error code
+ **/
+int
+gp_filesystem_remove_dir_noop (CameraFilesystem *fs, const char *folder,
+			       const char *name, GPContext *context)
+{
+	CameraFilesystemFolder	*f, *sub;
+
+	C_PARAMS (fs && folder && name);
+	CC (context);
+	CA (folder, context);
+
+	f = lookup_folder (fs, fs->rootfolder, folder, context);
+	if (!f) return (GP_ERROR_DIRECTORY_NOT_FOUND);
+
+	sub = folder_index_lookup (f, name, strlen (name));
+	if (!sub)
+		return (GP_OK);
+	CR (recurse_delete_folder (fs, sub));
+	CR (delete_folder (fs, f, folder_link (f, sub)));
+	if (!f->folders_dirty)
+		fs->relists_avoided++;
+	return (GP_OK);
 }
 
 /**
@@ -1200,7 +1849,7 @@ gp_filesystem_make_dir (CameraFilesystem *fs, const char *folder,
 	/* Create the directory */
 	CR (fs->make_dir_func (fs, folder, name, fs->data, context));
 	/* and append to internal fs */
-	return append_folder_one (f, name, NULL);
+	return append_folder_one (fs, f, name, strlen (name), NULL);
 }
 
 /**
@@ -1219,7 +1868,7 @@ gp_filesystem_remove_dir (CameraFilesystem *fs, const char *folder,
 			  const char *name, GPContext *context)
 {
 	CameraFilesystemFolder *f;
-	CameraFilesystemFolder **prev;
+	CameraFilesystemFolder *sub;
 
 	C_PARAMS (fs && folder && name);
 	CC (context);
@@ -1251,20 +1900,15 @@ gp_filesystem_remove_dir (CameraFilesystem *fs, const char *folder,
 			GP_LOG_D ("Done making folder %s clean...", folder);
 		}
 	}
-	prev = &(f->folders);
-	while (*prev) {
-		if (!strcmp (name, (*prev)->name))
-			break;
-		prev = &((*prev)->next);
-	}
-	if (!*prev) return (GP_ERROR_DIRECTORY_NOT_FOUND);
+	sub = folder_index_lookup (f, name, strlen (name));
+	if (!sub) return (GP_ERROR_DIRECTORY_NOT_FOUND);
 
-	if ((*prev)->folders) {
+	if (sub->folders) {
 		gp_context_error (context, _("There are still subfolders in "
 			"folder '%s/%s' that you are trying to remove."), folder, name);
 		return (GP_ERROR_DIRECTORY_EXISTS);
 	}
-	if ((*prev)->files) {
+	if (sub->files) {
 		gp_context_error (context, _("There are still files in "
 			"folder '%s/%s' that you are trying to remove."), folder,name);
 		return (GP_ERROR_FILE_EXISTS);
@@ -1272,7 +1916,7 @@ gp_filesystem_remove_dir (CameraFilesystem *fs, const char *folder,
 
 	/* Remove the directory */
 	CR (fs->remove_dir_func (fs, folder, name, fs->data, context));
-	CR (delete_folder (fs, prev));
+	CR (delete_folder (fs, f, folder_link (f, sub)));
 	return (GP_OK);
 }
 
@@ -1340,32 +1984,21 @@ gp_filesystem_name (CameraFilesystem *fs, const char *folder, int filenumber,
 		    const char **filename, GPContext *context)
 {
 	CameraFilesystemFolder	*f;
-	CameraFilesystemFile	*file;
-	int count;
 	C_PARAMS (fs && folder);
 	CC (context);
 	CA (folder, context);
 
 	f = lookup_folder (fs, fs->rootfolder, folder, context);
 	if (!f) return (GP_ERROR_DIRECTORY_NOT_FOUND);
+	CR (list_announced (fs, folder, f, context));
 
-	file = f->files;
-	count = 0;
-	while (file) {
-		if (filenumber == 0)
-			break;
-		filenumber--;
-		count++;
-		file = file->next;
-	}
-
-	if (!file) {
+	if ((filenumber < 0) || ((unsigned int)filenumber >= f->nfiles)) {
 		gp_context_error (context, _("Folder '%s' only contains "
 			"%i files, but you requested a file with number %i."),
-			folder, count, filenumber);
+			folder, (int)f->nfiles, filenumber);
 		return (GP_ERROR_FILE_NOT_FOUND);
 	}
-	*filename = file->name;
+	*filename = f->files_index[filenumber]->name;
 	return (GP_OK);
 }
 
@@ -1388,7 +2021,6 @@ gp_filesystem_number (CameraFilesystem *fs, const char *folder,
 	CameraFilesystemFolder	*f;
 	CameraFilesystemFile	*file;
 	CameraList *list;
-	int num;
 
 	C_PARAMS (fs && folder && filename);
 	CC (context);
@@ -1396,15 +2028,11 @@ gp_filesystem_number (CameraFilesystem *fs, const char *folder,
 
 	f = lookup_folder (fs, fs->rootfolder, folder, context);
 	if (!f) return (GP_ERROR_DIRECTORY_NOT_FOUND);
+	CR (list_announced (fs, folder, f, context));
 
-	file = f->files;
-	num = 0;
-	while (file) {
-		if (!strcmp (file->name, filename))
-			return num;
-		num++;
-		file = file->next;
-	}
+	file = file_index_lookup (f, filename);
+	if (file)
+		return file->number;
 
 	/* Ok, we didn't find the file. Is the folder dirty? */
 	if (!f->files_dirty) {
@@ -1464,17 +2092,12 @@ recursive_folder_scan (
 	CameraFilesystemFolder *folder, const char *lookforfile,
 	char **foldername
 ) {
-	CameraFilesystemFile	*file;
 	CameraFilesystemFolder	*f;
 	int ret;
 
-	file = folder->files;
-	while (file) {
-		if (!strcmp(file->name, lookforfile)) {
-			*foldername = strdup (folder->name);
-			return GP_OK;
-		}
-		file = file->next;
+	if (file_index_lookup (folder, lookforfile)) {
+		*foldername = strdup (folder->name);
+		return GP_OK;
 	}
 	f = folder->folders;
 	while (f) {
@@ -1529,76 +2152,142 @@ gp_filesystem_get_folder (CameraFilesystem *fs, const char *filename,
 	return (GP_ERROR_FILE_NOT_FOUND);
 }
 
+/*
+ * Makes sure xfile->info is valid, asking the persistent cache or the
+ * camera driver if needed.
+ */
 static int
-gp_filesystem_get_file_impl (CameraFilesystem *fs, const char *folder,
-			     const char *filename, CameraFileType type,
-			     CameraFile *file, GPContext *context)
+gp_filesystem_load_info (CameraFilesystem *fs, const char *folder,
+			 const char *filename, CameraFilesystemFile *xfile,
+			 GPContext *context)
 {
-	CameraFilesystemFolder	*xfolder;
-	CameraFilesystemFile	*xfile;
-	int			ret;
-
-	C_PARAMS (fs && folder && file && filename);
-	CC (context);
-	CA (folder, context);
-
-	GP_LOG_D ("Getting file '%s' from folder '%s' (type %i)...",
-		  filename, folder, type);
+	if (!xfile->info_dirty)
+		return (GP_OK);
 
-	CR (gp_file_set_name (file, filename));
+	/* Only the stamp tells whether cached information is current. */
+	if (fs->pcache && xfile->stamped &&
+	    (gp_filesystem_cache_get_info (fs->pcache, folder, filename,
+					   xfile->stamp, &xfile->info) == GP_OK)) {
+		GP_LOG_D ("Persistent cache used for info of '%s'.", filename);
+		xfile->info_dirty = 0;
+		xfile->info_cached = 1;
+		return (GP_OK);
+	}
 
-	if (!fs->get_file_func) {
-		gp_context_error (context,
-			_("The filesystem doesn't support getting files"));
+	if (!fs->get_info_func)
 		return (GP_ERROR_NOT_SUPPORTED);
-	}
+	CR (fs->get_info_func (fs, folder, filename, &xfile->info,
+			       fs->data, context));
+	xfile->info_dirty = 0;
+	xfile->info_cached = 0;
+	if (fs->pcache)
+		gp_filesystem_cache_put_info (fs->pcache, folder, filename,
+					      file_stamp (xfile), &xfile->info);
+	return (GP_OK);
+}
+
+/*
+ * Looks for the requested data in the in-memory and the persistent cache.
+ * Returns 1 if file has been filled in from a cache, 0 if the data needs
+ * to be downloaded, or a gphoto2 error code.
+ */
+static int
+gp_filesystem_get_file_cached (CameraFilesystem *fs, const char *folder,
+			       const char *filename, CameraFileType type,
+			       CameraFile *file, GPContext *context)
+{
+	CameraFilesystemFolder	*xfolder;
+	CameraFilesystemFile	*xfile;
+	CameraFile		**slot;
+	CameraFileInfo		*info;
+	int			cls;
 
 	/* Search folder and file */
 	CR( lookup_folder_file (fs, folder, filename, &xfolder, &xfile, context));
 
-	ret = GP_ERROR;
-	switch (type) {
-	case GP_FILE_TYPE_PREVIEW:
-		if (xfile->preview)
-			ret = gp_file_copy (file, xfile->preview);
-		break;
-	case GP_FILE_TYPE_NORMAL:
-		if (xfile->normal)
-			ret = gp_file_copy (file, xfile->normal);
-		break;
-	case GP_FILE_TYPE_RAW:
-		if (xfile->raw)
-			ret = gp_file_copy (file, xfile->raw);
-		break;
-	case GP_FILE_TYPE_AUDIO:
-		if (xfile->audio)
-			ret = gp_file_copy (file, xfile->audio);
-		break;
-	case GP_FILE_TYPE_EXIF:
-		if (xfile->exif)
-			ret = gp_file_copy (file, xfile->exif);
-		break;
-	case GP_FILE_TYPE_METADATA:
-		if (xfile->metadata)
-			ret = gp_file_copy (file, xfile->metadata);
-		break;
-	default:
+	cls = gp_filesystem_lru_class (type);
+	if (cls < 0) {
 		gp_context_error (context, _("Unknown file type %i."), type);
 		return (GP_ERROR);
 	}
-	if (ret == GP_OK) {
+	slot = gp_filesystem_file_slot (fs, xfile, type, 0);
+	if (slot && *slot && (gp_file_copy (file, *slot) == GP_OK)) {
 		GP_LOG_D ("LRU cache used for type %d!", type);
-		return GP_OK;
+		fs->lru[cls].hits++;
+
+		/*
+		 * Bulk downloads do not want the filesystem to keep a
+		 * second copy around once the data has been handed out.
+		 */
+		if (gp_context_get_flags (context) & GP_CONTEXT_FLAG_NO_CACHE) {
+			gp_file_unref (*slot);
+			*slot = NULL;
+			CR (gp_filesystem_lru_update (fs, cls, xfile));
+		}
+		return (1);
 	}
+	fs->lru[cls].misses++;
 
-	GP_LOG_D ("Downloading '%s' from folder '%s'...", filename, folder);
+	/*
+	 * Previews and EXIF data of files seen in an earlier session can
+	 * come from the persistent cache, as long as the file itself has
+	 * not changed since: its stamp, or the size and mtime the camera
+	 * reports for it, have to match those stored with the data.
+	 */
+	if (fs->pcache && gp_filesystem_cache_supports (type)) {
+		info = NULL;
+		if ((gp_filesystem_load_info (fs, folder, filename, xfile,
+					      context) == GP_OK) &&
+		    !xfile->info_cached)
+			info = &xfile->info;
+		if (gp_filesystem_cache_get_file (fs->pcache, folder, filename,
+						  type, file_stamp (xfile), info,
+						  file) == GP_OK) {
+			GP_LOG_D ("Persistent cache used for type %d!", type);
+			CR (gp_file_set_name (file, filename));
+			CR (gp_file_adjust_name_for_mime_type (file));
+			return (1);
+		}
+	}
+	return (0);
+}
 
-	CR (fs->get_file_func (fs, folder, filename, type, file,
-			       fs->data, context));
+/* Post-processes data the camera driver downloaded into file. */
+static int
+gp_filesystem_got_file (CameraFilesystem *fs, const char *folder,
+			const char *filename, CameraFileType type,
+			CameraFile *file, GPContext *context)
+{
+	CameraFilesystemFolder	*xfolder;
+	CameraFilesystemFile	*xfile;
+	unsigned long int	size;
 
 	/* We don't trust the camera drivers */
 	CR (gp_file_set_name (file, filename));
 
+	if (fs->pcache &&
+	    (lookup_folder_file (fs, folder, filename, &xfolder, &xfile, context) == GP_OK)) {
+		/*
+		 * Information from the persistent cache is only checked
+		 * once the file itself is downloaded. If it is outdated,
+		 * forget everything cached and ask the camera next time.
+		 */
+		if ((type == GP_FILE_TYPE_NORMAL) && xfile->info_cached &&
+		    (xfile->info.file.fields & GP_FILE_INFO_SIZE) &&
+		    (gp_file_get_data_and_size (file, NULL, &size) == GP_OK) &&
+		    (size != xfile->info.file.size)) {
+			GP_LOG_D ("Cached information of '%s' is outdated.", filename);
+			gp_filesystem_cache_remove (fs->pcache, folder, filename);
+			xfile->info_dirty = 1;
+			xfile->info_cached = 0;
+		}
+		if (gp_filesystem_cache_supports (type) &&
+		    !(gp_context_get_flags (context) & GP_CONTEXT_FLAG_NO_CACHE))
+			gp_filesystem_cache_put_file (fs->pcache, folder, filename, type,
+				file_stamp (xfile),
+				xfile->info_dirty ? NULL : &xfile->info, file);
+	}
+
 #if 0
 	/* this disables LRU completely. */
 	/* Cache this file */
@@ -1615,6 +2304,41 @@ gp_filesystem_get_file_impl (CameraFilesystem *fs, const char *folder,
 	return (GP_OK);
 }
 
+static int
+gp_filesystem_get_file_impl (CameraFilesystem *fs, const char *folder,
+			     const char *filename, CameraFileType type,
+			     CameraFile *file, GPContext *context)
+{
+	int ret;
+
+	C_PARAMS (fs && folder && file && filename);
+	CC (context);
+	CA (folder, context);
+
+	GP_LOG_D ("Getting file '%s' from folder '%s' (type %i)...",
+		  filename, folder, type);
+
+	CR (gp_file_set_name (file, filename));
+
+	if (!fs->get_file_func) {
+		gp_context_error (context,
+			_("The filesystem doesn't support getting files"));
+		return (GP_ERROR_NOT_SUPPORTED);
+	}
+
+	ret = gp_filesystem_get_file_cached (fs, folder, filename, type,
+					     file, context);
+	if (ret)
+		return (ret < 0) ? ret : GP_OK;
+
+	GP_LOG_D ("Downloading '%s' from folder '%s'...", filename, folder);
+
+	CR (fs->get_file_func (fs, folder, filename, type, file,
+			       fs->data, context));
+
+	return (gp_filesystem_got_file (fs, folder, filename, type, file, context));
+}
+
 /**
  * \brief Get file data from the filesystem
  * \param fs a #CameraFilesystem
@@ -1688,7 +2412,8 @@ gp_filesystem_get_file (CameraFilesystem *fs, const char *folder,
 		exif_data_unref (ed);
 		CR (gp_file_set_name (file, filename));
 		CR (gp_file_set_mime_type (file, GP_MIME_JPEG));
-		CR (gp_filesystem_set_file_noop (fs, folder, filename, GP_FILE_TYPE_PREVIEW, file, context));
+		if (!(gp_context_get_flags (context) & GP_CONTEXT_FLAG_NO_CACHE))
+			CR (gp_filesystem_set_file_noop (fs, folder, filename, GP_FILE_TYPE_PREVIEW, file, context));
 		CR (gp_file_adjust_name_for_mime_type (file));
 #else
 		GP_LOG_D ("Getting previews is not supported and "
@@ -1725,7 +2450,8 @@ gp_filesystem_get_file (CameraFilesystem *fs, const char *folder,
 		}
 		CR (gp_file_set_name (file, filename));
 		CR (gp_file_set_mime_type (file, GP_MIME_EXIF));
-		CR (gp_filesystem_set_file_noop (fs, folder, filename, GP_FILE_TYPE_EXIF, file, context));
+		if (!(gp_context_get_flags (context) & GP_CONTEXT_FLAG_NO_CACHE))
+			CR (gp_filesystem_set_file_noop (fs, folder, filename, GP_FILE_TYPE_EXIF, file, context));
 		CR (gp_file_adjust_name_for_mime_type (file));
 #else
 		GP_LOG_D ("Getting EXIF data is not supported and libgphoto2 "
@@ -1742,43 +2468,247 @@ gp_filesystem_get_file (CameraFilesystem *fs, const char *folder,
 	return (GP_OK);
 }
 
+/* State of a gp_filesystem_get_files() batch while the driver handles it. */
+typedef struct {
+	CameraFilesystem	*fs;
+	GPContext		*context;
+	const CameraFileRequest	*requests;	/* as passed by the caller */
+	CameraFileRequest	*pending;	/* as passed to the driver */
+	unsigned int		*index;		/* pending -> requests */
+	unsigned char		*state;
+	unsigned int		npending;
+	CameraFileRequestFunc	func;
+	void			*data;
+	int			stopped;
+} GetFilesBatch;
+
+enum {
+	GET_FILES_PENDING,
+	GET_FILES_DONE,
+	GET_FILES_FALLBACK	/* driver can't, try gp_filesystem_get_file() */
+};
+
+static int
+gp_filesystem_get_files_done (const CameraFileRequest *request,
+			      CameraFile *file, int result, void *data)
+{
+	GetFilesBatch		*batch = data;
+	const CameraFileRequest	*orig;
+	unsigned int		i;
+	int			ret;
+
+	C_PARAMS (batch && request && file &&
+		  (request >= batch->pending) &&
+		  (request < batch->pending + batch->npending));
+	i = request - batch->pending;
+	if (batch->state[i] != GET_FILES_PENDING)
+		return (GP_OK);
+	orig = &batch->requests[batch->index[i]];
+
+	if ((result == GP_ERROR_NOT_SUPPORTED) &&
+	    ((orig->type == GP_FILE_TYPE_PREVIEW) ||
+	     (orig->type == GP_FILE_TYPE_EXIF))) {
+		batch->state[i] = GET_FILES_FALLBACK;
+		return (GP_OK);
+	}
+	batch->state[i] = GET_FILES_DONE;
+	if (result >= 0)
+		result = gp_filesystem_got_file (batch->fs, orig->folder,
+				orig->name, orig->type, file, batch->context);
+	ret = batch->func (orig, file, result, batch->data);
+	if (ret < 0)
+		batch->stopped = ret;
+	return (ret);
+}
+
+/* Downloads one file without the help of a get_files_func. */
+static int
+gp_filesystem_get_files_one (CameraFilesystem *fs,
+			     const CameraFileRequest *request, int fallback,
+			     CameraFileRequestFunc func, void *data,
+			     GPContext *context)
+{
+	CameraFile	*file;
+	int		ret;
+
+	CR (gp_file_new (&file));
+	if (!fallback && fs->get_file_func) {
+		ret = gp_file_set_name (file, request->name);
+		if (ret == GP_OK)
+			ret = fs->get_file_func (fs, request->folder,
+				request->name, request->type, file,
+				fs->data, context);
+		if (ret == GP_OK)
+			ret = gp_filesystem_got_file (fs, request->folder,
+				request->name, request->type, file, context);
+		fallback = (ret == GP_ERROR_NOT_SUPPORTED) &&
+			   ((request->type == GP_FILE_TYPE_PREVIEW) ||
+			    (request->type == GP_FILE_TYPE_EXIF));
+	} else
+		fallback = 1;
+	if (fallback) {
+		gp_file_clean (file);
+		ret = gp_filesystem_get_file (fs, request->folder, request->name,
+					      request->type, file, context);
+	}
+	ret = func (request, file, ret, data);
+	gp_file_unref (file);
+	return (ret);
+}
+
 /**
- * \brief Get partial file data from the filesystem
+ * \brief Get the data of many files from the filesystem
  * \param fs a #CameraFilesystem
- * \param folder the folder in which the file can be found
- * \param filename the name of the file to download
- * \param type the type of the file
- * \param offset the offset where the data starts
- * \param buf the targetbuffer where the data will be put
- * \param size the size to read and that was read into the buffer
+ * \param requests the files to get
+ * \param count the number of requests
+ * \param func the #CameraFileRequestFunc receiving each file
+ * \param data data passed to func
  * \param context a #GPContext
  *
- * Downloads the file called filename from the folder using the
- * read_file_func if such a function has been previously supplied. If the
- * file has been previously downloaded, the file is retrieved from cache.
+ * Works like calling gp_filesystem_get_file() for every request, but
+ * requests that can be served from the cache are completed first and the
+ * others are passed to the camera driver in one go, so that it can
+ * reorder and pipeline the transfers. Drivers without such support get
+ * one request after the other.
  *
- * The file is read partially into the passed buffer. The read starts
- * at offset on the device and goes for at most size bytes.
- * Reading over the end of the file might give errors, so get the maximum
- * file size via an info function before.
+ * A failing request does not stop the batch, its error code is passed to
+ * func instead. The batch stops if func returns a negative value, or if
+ * the operation is cancelled.
  *
  * \return a gphoto2 error code.
  **/
 int
-gp_filesystem_read_file (CameraFilesystem *fs, const char *folder,
-			const char *filename, CameraFileType type,
-			uint64_t offset, char *buf, uint64_t *size,
-			GPContext *context)
+gp_filesystem_get_files (CameraFilesystem *fs,
+			 const CameraFileRequest *requests, unsigned int count,
+			 CameraFileRequestFunc func, void *data,
+			 GPContext *context)
 {
-	int r;
-	const char	*xdata;
-	unsigned long	xsize;
+	GetFilesBatch	batch;
 	CameraFile	*file;
+	unsigned int	i;
+	int		ret = GP_OK;
 
-	C_PARAMS (fs && folder && filename && buf && size);
+	C_PARAMS (fs && (requests || !count) && func);
 	CC (context);
-	CA (folder, context);
-
+	for (i = 0; i < count; i++) {
+		C_PARAMS (requests[i].folder && requests[i].name);
+		CA (requests[i].folder, context);
+	}
+
+	GP_LOG_D ("Getting %u files...", count);
+
+	memset (&batch, 0, sizeof (batch));
+	batch.fs = fs;
+	batch.context = context;
+	batch.requests = requests;
+	batch.func = func;
+	batch.data = data;
+	batch.pending = calloc (count + 1, sizeof (CameraFileRequest));
+	batch.index = calloc (count + 1, sizeof (unsigned int));
+	batch.state = calloc (count + 1, sizeof (unsigned char));
+	if (!batch.pending || !batch.index || !batch.state) {
+		ret = GP_ERROR_NO_MEMORY;
+		goto out;
+	}
+
+	/* Whatever is cached does not need to go through the driver. */
+	for (i = 0; i < count; i++) {
+		ret = gp_file_new (&file);
+		if (ret < GP_OK)
+			goto out;
+		ret = gp_file_set_name (file, requests[i].name);
+		if (ret == GP_OK)
+			ret = gp_filesystem_get_file_cached (fs, requests[i].folder,
+				requests[i].name, requests[i].type, file, context);
+		if (!ret) {
+			batch.pending[batch.npending] = requests[i];
+			batch.index[batch.npending++] = i;
+			gp_file_unref (file);
+			continue;
+		}
+		ret = func (&requests[i], file, (ret < 0) ? ret : GP_OK, data);
+		gp_file_unref (file);
+		if (ret < GP_OK)
+			goto out;
+	}
+	ret = GP_OK;
+
+	if (batch.npending && fs->get_files_func) {
+		GP_LOG_D ("Downloading %u files in one batch...", batch.npending);
+		ret = fs->get_files_func (fs, batch.pending, batch.npending,
+					  gp_filesystem_get_files_done, &batch,
+					  fs->data, context);
+		if (batch.stopped) {
+			ret = batch.stopped;
+			goto out;
+		}
+		if (ret < GP_OK)
+			GP_LOG_D ("Batch download failed (%s), getting the "
+				  "remaining files one by one.",
+				  gp_result_as_string (ret));
+		ret = GP_OK;
+	}
+
+	/* Whatever the driver did not handle. */
+	for (i = 0; i < batch.npending; i++) {
+		if (batch.state[i] == GET_FILES_DONE)
+			continue;
+		if (gp_context_cancel (context) == GP_CONTEXT_FEEDBACK_CANCEL) {
+			ret = GP_ERROR_CANCEL;
+			break;
+		}
+		ret = gp_filesystem_get_files_one (fs,
+				&requests[batch.index[i]],
+				batch.state[i] == GET_FILES_FALLBACK,
+				func, data, context);
+		if (ret < GP_OK)
+			break;
+	}
+
+out:
+	free (batch.pending);
+	free (batch.index);
+	free (batch.state);
+	return (ret);
+}
+
+/**
+ * \brief Get partial file data from the filesystem
+ * \param fs a #CameraFilesystem
+ * \param folder the folder in which the file can be found
+ * \param filename the name of the file to download
+ * \param type the type of the file
+ * \param offset the offset where the data starts
+ * \param buf the targetbuffer where the data will be put
+ * \param size the size to read and that was read into the buffer
+ * \param context a #GPContext
+ *
+ * Downloads the file called filename from the folder using the
+ * read_file_func if such a function has been previously supplied. If the
+ * file has been previously downloaded, the file is retrieved from cache.
+ *
+ * The file is read partially into the passed buffer. The read starts
+ * at offset on the device and goes for at most size bytes.
+ * Reading over the end of the file might give errors, so get the maximum
+ * file size via an info function before.
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_read_file (CameraFilesystem *fs, const char *folder,
+			const char *filename, CameraFileType type,
+			uint64_t offset, char *buf, uint64_t *size,
+			GPContext *context)
+{
+	int r;
+	const char	*xdata;
+	unsigned long	xsize;
+	CameraFile	*file;
+
+	C_PARAMS (fs && folder && filename && buf && size);
+	CC (context);
+	CA (folder, context);
+
 	if (fs->read_file_func) {
 		r = fs->read_file_func (fs, folder, filename, type,
 			offset, buf, size, fs->data, context);
@@ -1840,10 +2770,243 @@ gp_filesystem_set_funcs	(CameraFilesystem *fs,
 	fs->get_file_func	= funcs->get_file_func;
 	fs->read_file_func	= funcs->read_file_func;
 	fs->storage_info_func	= funcs->storage_info_func;
+	fs->get_files_func	= funcs->get_files_func;
+	fs->file_list_info_func	= funcs->file_list_info_func;
+	fs->fingerprint_func	= funcs->fingerprint_func;
 	fs->data = data;
 	return (GP_OK);
 }
 
+/*
+ * Reading the EXIF date tags from the start of a JPEG file. Only the
+ * APP1 segment is fetched through the read_file_func, which is a small
+ * partial read compared to downloading the file or its EXIF data.
+ */
+
+/* Bytes read first, holds the EXIF date tags of most cameras. */
+#define EXIF_PROBE_SIZE		4096
+/* Give up if the APP1 segment does not start within this many bytes. */
+#define EXIF_MAX_HEADER		(256 * 1024)
+
+#define EXIF_TAG_DATETIME		0x0132
+#define EXIF_TAG_EXIF_IFD		0x8769
+#define EXIF_TAG_DATETIME_ORIGINAL	0x9003
+#define EXIF_TAG_DATETIME_DIGITIZED	0x9004
+
+static unsigned int
+exif_get16 (const unsigned char *p, int le)
+{
+	return le ? (p[0] | (p[1] << 8)) : ((p[0] << 8) | p[1]);
+}
+
+static uint32_t
+exif_get32 (const unsigned char *p, int le)
+{
+	return le ? ((uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0])
+		  : ((uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+}
+
+/* Parses an EXIF "YYYY:MM:DD HH:MM:SS" date. */
+static time_t
+exif_parse_date (const unsigned char *data)
+{
+	struct tm	ts;
+	char		buf[20];
+
+	memcpy (buf, data, 19);
+	buf[19] = '\0';
+	memset (&ts, 0, sizeof (ts));
+	if (sscanf (buf, "%d:%d:%d %d:%d:%d", &ts.tm_year, &ts.tm_mon,
+		    &ts.tm_mday, &ts.tm_hour, &ts.tm_min, &ts.tm_sec) != 6)
+		return 0;
+	if (!ts.tm_year) /* "0000:00:00 00:00:00", not set */
+		return 0;
+	ts.tm_year -= 1900;
+	ts.tm_mon  -= 1;
+	ts.tm_isdst = -1;
+	return mktime (&ts);
+}
+
+/*
+ * Picks the date tags out of the IFD at offset off of the TIFF data. The
+ * times go to t[0] (DateTime), t[1] (DateTimeOriginal) and t[2]
+ * (DateTimeDigitized). Returns the offset of the EXIF IFD, if any.
+ */
+static uint32_t
+exif_scan_ifd (const unsigned char *tiff, uint32_t size, int le, uint32_t off,
+	       time_t *t)
+{
+	uint32_t	count, val, exif_ifd = 0;
+	unsigned int	i, n, tag, type;
+	const unsigned char *e;
+
+	if ((size < 2) || (off < 8) || (off > size - 2))
+		return 0;
+	n = exif_get16 (tiff + off, le);
+	if (n > (size - off - 2) / 12)
+		n = (size - off - 2) / 12;
+	for (i = 0; i < n; i++) {
+		e = tiff + off + 2 + 12 * i;
+		tag   = exif_get16 (e, le);
+		type  = exif_get16 (e + 2, le);
+		count = exif_get32 (e + 4, le);
+		val   = exif_get32 (e + 8, le);
+		if (tag == EXIF_TAG_EXIF_IFD) {
+			exif_ifd = val;
+			continue;
+		}
+		/* dates are ASCII with 20 bytes, stored at offset val */
+		if ((type != 2) || (count < 20) || (size < 20) || (val > size - 20))
+			continue;
+		switch (tag) {
+		case EXIF_TAG_DATETIME:			t[0] = exif_parse_date (tiff + val); break;
+		case EXIF_TAG_DATETIME_ORIGINAL:	t[1] = exif_parse_date (tiff + val); break;
+		case EXIF_TAG_DATETIME_DIGITIZED:	t[2] = exif_parse_date (tiff + val); break;
+		default: break;
+		}
+	}
+	return exif_ifd;
+}
+
+/* Makes sure buf holds the first want bytes of the file. */
+static int
+exif_read_more (CameraFilesystem *fs, const char *folder, const char *filename,
+		unsigned char **buf, uint64_t *have, uint64_t want,
+		GPContext *context)
+{
+	unsigned char	*nbuf;
+	uint64_t	size;
+
+	if (want <= *have)
+		return (GP_OK);
+	C_MEM (nbuf = realloc (*buf, want));
+	*buf = nbuf;
+	size = want - *have;
+	CR (gp_filesystem_read_file (fs, folder, filename, GP_FILE_TYPE_NORMAL,
+				     *have, (char*)*buf + *have, &size, context));
+	if (size != want - *have)
+		return (GP_ERROR_CORRUPTED_DATA); /* file ends early */
+	*have = want;
+	return (GP_OK);
+}
+
+/*
+ * Gets the capture time out of the EXIF header of a JPEG file using
+ * partial reads only. *mtime is 0 if the file has no EXIF date. Fails if
+ * the camera driver cannot read parts of the file.
+ */
+static int
+gp_filesystem_read_exif_mtime (CameraFilesystem *fs, const char *folder,
+			       const char *filename, time_t *mtime,
+			       GPContext *context)
+{
+	unsigned char	*buf = NULL;
+	uint64_t	have = 0, pos = 2, len;
+	uint32_t	tiffsize, ifd;
+	const unsigned char *tiff;
+	time_t		t[3] = { 0, 0, 0 };
+	int		le, ret;
+
+	*mtime = 0;
+	if (!fs->read_file_func)
+		return (GP_ERROR_NOT_SUPPORTED);
+	ret = exif_read_more (fs, folder, filename, &buf, &have, 4, context);
+	if (ret < GP_OK) {
+		free (buf);
+		return ret;
+	}
+	if ((buf[0] != 0xff) || (buf[1] != 0xd8))
+		goto out;
+	/* the probe may be cut short by small files, that is fine */
+	if (exif_read_more (fs, folder, filename, &buf, &have, EXIF_PROBE_SIZE, context) < GP_OK)
+		have = 4;
+	while (pos < EXIF_MAX_HEADER) {
+		if (exif_read_more (fs, folder, filename, &buf, &have, pos + 4, context) < GP_OK)
+			goto out;
+		if (buf[pos] != 0xff)
+			goto out;
+		len = exif_get16 (buf + pos + 2, 0);
+		if (buf[pos + 1] == 0xe1) {
+			if (len < 16)
+				goto out;
+			if (exif_read_more (fs, folder, filename, &buf, &have, pos + 2 + len, context) < GP_OK)
+				goto out;
+			if (!memcmp (buf + pos + 4, "Exif\0\0", 6))
+				break;
+		} else if ((buf[pos + 1] < 0xe0) && (buf[pos + 1] != 0xfe)) {
+			/* image data starts, neither APPn nor COM */
+			goto out;
+		}
+		pos += 2 + len;
+	}
+	if (pos >= EXIF_MAX_HEADER)
+		goto out;
+
+	tiff = buf + pos + 10;
+	tiffsize = len - 8;
+	if (!memcmp (tiff, "II*\0", 4))
+		le = 1;
+	else if (!memcmp (tiff, "MM\0*", 4))
+		le = 0;
+	else
+		goto out;
+	ifd = exif_scan_ifd (tiff, tiffsize, le, exif_get32 (tiff + 4, le), t);
+	if (ifd)
+		exif_scan_ifd (tiff, tiffsize, le, ifd, t);
+
+out:
+	free (buf);
+	/* Same sanity checking as get_exif_mtime () */
+	*mtime = t[0];
+	if (t[1] > *mtime)
+		*mtime = t[1];
+	if (t[2] > *mtime)
+		*mtime = t[2];
+	if (*mtime)
+		GP_LOG_D ("Found time in EXIF header of '%s'.", filename);
+	return (GP_OK);
+}
+
+/* EXIF data is only worth looking for in JPEG files. */
+static int
+is_jpeg (const char *filename, const CameraFileInfo *info)
+{
+	const char *ext;
+
+	if ((info->file.fields & GP_FILE_INFO_TYPE) && info->file.type[0])
+		return !strcmp (info->file.type, GP_MIME_JPEG);
+	ext = strrchr (filename, '.');
+	return ext && (!strcasecmp (ext, ".jpg") || !strcasecmp (ext, ".jpeg"));
+}
+
+/*
+ * Looks up the capture time of a file in its EXIF data, reading only the
+ * EXIF header if the camera driver supports partial reads. The result,
+ * found or not, is kept with the file.
+ */
+static time_t
+gp_filesystem_file_exif_mtime (CameraFilesystem *fs, const char *folder,
+			       const char *filename, CameraFilesystemFile *xfile,
+			       GPContext *context)
+{
+	time_t t = 0;
+
+	if (xfile->exif_mtime_known)
+		return xfile->exif_mtime;
+
+	if (is_jpeg (filename, &xfile->info) &&
+	    (gp_filesystem_read_exif_mtime (fs, folder, filename, &t,
+					    context) < GP_OK)) {
+#ifdef HAVE_LIBEXIF
+		/* download the whole EXIF data instead */
+		t = gp_filesystem_get_exif_mtime (fs, folder, filename);
+#endif
+	}
+	xfile->exif_mtime = t;
+	xfile->exif_mtime_known = 1;
+	return t;
+}
+
 /**
  * \brief Get information about the specified file
  * \param fs a #CameraFilesystem
@@ -1861,9 +3024,7 @@ gp_filesystem_get_info (CameraFilesystem *fs, const char *folder,
 {
 	CameraFilesystemFolder	*f;
 	CameraFilesystemFile	*file;
-#ifdef HAVE_LIBEXIF
 	time_t t;
-#endif
 
 	C_PARAMS (fs && folder && filename && info);
 	CC (context);
@@ -1882,304 +3043,378 @@ gp_filesystem_get_info (CameraFilesystem *fs, const char *folder,
 	/* Search folder and file and get info if needed */
 	CR ( lookup_folder_file (fs, folder, filename, &f, &file, context));
 
-	if (file->info_dirty) {
-		CR (fs->get_info_func (fs, folder, filename,
-						&file->info,
-						fs->data, context));
-		file->info_dirty = 0;
-	}
+	CR (gp_filesystem_load_info (fs, folder, filename, file, context));
 
 	/*
 	 * If we didn't get GP_FILE_INFO_MTIME, we'll have a look if we
 	 * can get it from EXIF data.
 	 */
-#ifdef HAVE_LIBEXIF
 	if (!(file->info.file.fields & GP_FILE_INFO_MTIME)) {
 		GP_LOG_D ("Did not get mtime. Trying EXIF information...");
-		t = gp_filesystem_get_exif_mtime (fs, folder, filename);
+		t = gp_filesystem_file_exif_mtime (fs, folder, filename, file,
+						   context);
 		if (t) {
 			file->info.file.mtime = t;
 			file->info.file.fields |= GP_FILE_INFO_MTIME;
 		}
 	}
-#endif
 	memcpy (info, &file->info, sizeof (CameraFileInfo));
 	return (GP_OK);
 }
 
+/* Maps a file type to the LRU chain caching it, or -1 if unknown. */
 static int
-gp_filesystem_lru_clear (CameraFilesystem *fs)
+gp_filesystem_lru_class (CameraFileType type)
 {
-	int n = 0;
-	CameraFilesystemFile *ptr, *prev;
+	switch (type) {
+	case GP_FILE_TYPE_NORMAL:
+	case GP_FILE_TYPE_RAW:
+	case GP_FILE_TYPE_AUDIO:
+		return GP_FILESYSTEM_CACHE_FILES;
+	case GP_FILE_TYPE_PREVIEW:
+	case GP_FILE_TYPE_EXIF:
+	case GP_FILE_TYPE_METADATA:
+		return GP_FILESYSTEM_CACHE_PREVIEWS;
+	default:
+		return -1;
+	}
+}
 
-	GP_LOG_D ("Clearing fscache LRU list...");
+/*
+ * The place of the cached data of the given type of xfile. Returns NULL
+ * for unknown types, and if nothing has been cached for xfile yet unless
+ * create is set.
+ */
+static CameraFile **
+gp_filesystem_file_slot (CameraFilesystem *fs, CameraFilesystemFile *xfile,
+			 CameraFileType type, int create)
+{
+	if ((type < GP_FILE_TYPE_PREVIEW) || (type > GP_FILE_TYPE_METADATA))
+		return NULL;
+	if (!xfile->data && create) {
+		xfile->data = calloc (1, sizeof (CameraFilesystemFileData));
+		if (xfile->data)
+			fs->arena.ndata++;
+	}
+	return xfile->data ? &xfile->data->slot[type] : NULL;
+}
 
-	if (fs->lru_first == NULL) {
-		GP_LOG_D ("fscache LRU list already empty");
-		return (GP_OK);
-	}
+/* Number of bytes of the given cache class held by xfile. */
+static unsigned long int
+gp_filesystem_lru_entry_size (CameraFilesystem *fs, CameraFilesystemFile *xfile,
+			      int cls)
+{
+	CameraFileType		type;
+	CameraFile		**slot;
+	unsigned long int	size, total = 0;
+
+	for (type = GP_FILE_TYPE_PREVIEW; type <= GP_FILE_TYPE_METADATA; type++) {
+		if (gp_filesystem_lru_class (type) != cls)
+			continue;
+		slot = gp_filesystem_file_slot (fs, xfile, type, 0);
+		if (slot && *slot && (gp_file_get_data_and_size (*slot, NULL, &size) == GP_OK))
+			total += size;
+	}
+	return total;
+}
 
-	ptr = prev = fs->lru_first;
-	while (ptr != NULL) {
-		n++;
-		if (ptr->lru_prev != prev) {
-			GP_LOG_D ("fscache LRU list corrupted (%i)", n);
-			return (GP_ERROR);
-		}
-		prev = ptr;
-		ptr = ptr->lru_next;
+static int
+gp_filesystem_lru_linked (CameraFilesystem *fs, int cls, CameraFilesystemFile *item)
+{
+	return item->data &&
+	       (item->data->lru_prev[cls] || (fs->lru[cls].first == item));
+}
 
-		prev->lru_prev = NULL;
-		prev->lru_next = NULL;
-	}
+static void
+gp_filesystem_lru_unlink (CameraFilesystem *fs, int cls, CameraFilesystemFile *item)
+{
+	CameraFilesystemFileData *d;
 
-	fs->lru_first = NULL;
-	fs->lru_last = NULL;
-	fs->lru_size = 0;
+	if (!gp_filesystem_lru_linked (fs, cls, item))
+		return;
 
-	GP_LOG_D ("fscache LRU list cleared (removed %i items)", n);
+	d = item->data;
+	if (d->lru_prev[cls])
+		d->lru_prev[cls]->data->lru_next[cls] = d->lru_next[cls];
+	else
+		fs->lru[cls].first = d->lru_next[cls];
+	if (d->lru_next[cls])
+		d->lru_next[cls]->data->lru_prev[cls] = d->lru_prev[cls];
+	else
+		fs->lru[cls].last = d->lru_prev[cls];
 
-	return (GP_OK);
+	fs->lru[cls].count--;
+	fs->lru[cls].size -= d->lru_size[cls];
+	d->lru_prev[cls] = NULL;
+	d->lru_next[cls] = NULL;
+	d->lru_size[cls] = 0;
 }
 
-static int
-gp_filesystem_lru_remove_one (CameraFilesystem *fs, CameraFilesystemFile *item)
+/* Appends item as the most recently used entry of its chain. */
+static void
+gp_filesystem_lru_link (CameraFilesystem *fs, int cls, CameraFilesystemFile *item)
 {
-	if (item->lru_prev == NULL)
-		return (GP_ERROR);
-
-	/* Update the prev and next pointers. */
-	if (item->lru_prev) item->lru_prev->lru_next = item->lru_next;
-	if (item->lru_next) item->lru_next->lru_prev = item->lru_prev;
-	if (fs->lru_last == item) {
-		if (fs->lru_first == item) {
+	CameraFilesystemFileData *d = item->data;
 
-			/*
-			 * Case 1: ITEM is the only one in the list. We'll
-			 * remove it, and the list will be empty afterwards.
-			 */
-			fs->lru_last  = NULL;
-			fs->lru_first = NULL;
-		} else {
+	d->lru_size[cls] = gp_filesystem_lru_entry_size (fs, item, cls);
+	d->lru_next[cls] = NULL;
+	d->lru_prev[cls] = fs->lru[cls].last;
+	if (fs->lru[cls].last)
+		fs->lru[cls].last->data->lru_next[cls] = item;
+	else
+		fs->lru[cls].first = item;
+	fs->lru[cls].last = item;
+	fs->lru[cls].count++;
+	fs->lru[cls].size += d->lru_size[cls];
+}
 
-			/* Case 2: ITEM is the last in the list. */
-			fs->lru_last = item->lru_prev;
+/* Drops all cached data of the given class from item. */
+static void
+gp_filesystem_lru_evict (CameraFilesystem *fs, int cls, CameraFilesystemFile *item)
+{
+	CameraFileType	type;
+	CameraFile	**slot;
+
+	GP_LOG_D ("Freeing cached data for file '%s' (cache class %d)...",
+		  item->name, cls);
+
+	gp_filesystem_lru_unlink (fs, cls, item);
+	for (type = GP_FILE_TYPE_PREVIEW; type <= GP_FILE_TYPE_METADATA; type++) {
+		if (gp_filesystem_lru_class (type) != cls)
+			continue;
+		slot = gp_filesystem_file_slot (fs, item, type, 0);
+		if (slot && *slot) {
+			gp_file_unref (*slot);
+			*slot = NULL;
 		}
-	} else if (fs->lru_first == item) {
-
-		/* Case 3: ITEM is the first in the list. */
-		fs->lru_first = item->lru_next;
-		/* the first item prev links back to itself */
-		fs->lru_first->lru_prev = fs->lru_first;
 	}
+	gp_filesystem_file_trim (fs, item);
+}
 
-	/* Clear the pointers */
-	item->lru_prev = NULL;
-	item->lru_next = NULL;
+static void
+gp_filesystem_lru_remove_one (CameraFilesystem *fs, CameraFilesystemFile *item)
+{
+	int cls;
 
-	return (GP_OK);
+	for (cls = 0; cls < GP_FILESYSTEM_CACHE_CLASSES; cls++)
+		gp_filesystem_lru_unlink (fs, cls, item);
 }
 
-static int
-gp_filesystem_lru_free (CameraFilesystem *fs)
+/* Drops the cached data of xfile once nothing is left in it. */
+static void
+gp_filesystem_file_trim (CameraFilesystem *fs, CameraFilesystemFile *xfile)
 {
-	CameraFilesystemFile *ptr;
-	unsigned long int size;
-
-	C_PARAMS (fs && fs->lru_first);
+	int i;
+
+	if (!xfile->data)
+		return;
+	for (i = 0; i <= GP_FILE_TYPE_METADATA; i++)
+		if (xfile->data->slot[i])
+			return;
+	for (i = 0; i < GP_FILESYSTEM_CACHE_CLASSES; i++)
+		if (gp_filesystem_lru_linked (fs, i, xfile))
+			return;
+	free (xfile->data);
+	xfile->data = NULL;
+	fs->arena.ndata--;
+}
 
-	ptr = fs->lru_first;
+static int
+gp_filesystem_lru_clear (CameraFilesystem *fs)
+{
+	int cls;
 
-	GP_LOG_D ("Freeing cached data for file '%s'...", ptr->name);
+	GP_LOG_D ("Clearing fscache LRU lists...");
 
-	/* Remove it from the list. */
-	fs->lru_first = ptr->lru_next;
-	if (fs->lru_first)
-		fs->lru_first->lru_prev = fs->lru_first;
-	else
-		fs->lru_last = NULL;
-
-	/* Free its content. */
-	if (ptr->normal) {
-		CR( gp_file_get_data_and_size (ptr->normal, NULL, &size));
-		fs->lru_size -= size;
-		gp_file_unref (ptr->normal);
-		ptr->normal = NULL;
-	}
-	if (ptr->raw) {
-		CR( gp_file_get_data_and_size (ptr->raw, NULL, &size));
-		fs->lru_size -= size;
-		gp_file_unref (ptr->raw);
-		ptr->raw = NULL;
-	}
-	if (ptr->audio) {
-		CR( gp_file_get_data_and_size (ptr->audio, NULL, &size));
-		fs->lru_size -= size;
-		gp_file_unref (ptr->audio);
-		ptr->audio = NULL;
-	}
-	ptr->lru_next = ptr->lru_prev = NULL;
+	for (cls = 0; cls < GP_FILESYSTEM_CACHE_CLASSES; cls++)
+		while (fs->lru[cls].first)
+			gp_filesystem_lru_unlink (fs, cls, fs->lru[cls].first);
 	return (GP_OK);
 }
 
-static int
-gp_filesystem_lru_count (CameraFilesystem *fs)
+/* Reads the cache limits from the settings, storing the defaults if unset. */
+static void
+gp_filesystem_lru_settings (void)
 {
-	CameraFilesystemFile *ptr;
-	int count = 0;
+	char buf[1024];
+	static char *names[GP_FILESYSTEM_CACHE_CLASSES] = {
+		"cached-bytes", "cached-preview-bytes"
+	};
+	static const unsigned long int defaults[GP_FILESYSTEM_CACHE_CLASSES] = {
+		BYTES_TO_KEEP, PREVIEW_BYTES_TO_KEEP
+	};
+	int cls;
 
-	if (!fs) return 0;
-	ptr = fs->lru_first;
-	while (ptr) {
-		if (ptr->normal || ptr->raw || ptr->audio)
-			count++;
-		ptr = ptr->lru_next;
+	if (pictures_to_keep == -1) {
+		if (gp_setting_get ("libgphoto", "cached-images", buf) == GP_OK) {
+			pictures_to_keep = atoi(buf);
+		} else {
+			/* store a default setting */
+			sprintf (buf, "%d", PICTURES_TO_KEEP);
+			gp_setting_set ("libgphoto", "cached-images", buf);
+		}
+	}
+	if (pictures_to_keep < 0) /* also sanity check, but no upper limit. */
+		pictures_to_keep = PICTURES_TO_KEEP;
+
+	for (cls = 0; cls < GP_FILESYSTEM_CACHE_CLASSES; cls++) {
+		if (bytes_to_keep[cls] != -1)
+			continue;
+		if (gp_setting_get ("libgphoto", names[cls], buf) == GP_OK) {
+			bytes_to_keep[cls] = atol (buf);
+		} else {
+			sprintf (buf, "%lu", defaults[cls]);
+			gp_setting_set ("libgphoto", names[cls], buf);
+		}
+		if (bytes_to_keep[cls] < 0)
+			bytes_to_keep[cls] = defaults[cls];
 	}
-	return count;
 }
 
+/*
+ * Moves xfile to the most recently used end of the chain for the given
+ * class, after pruning the least recently used entries until the new
+ * data fits into the budget.
+ */
 static int
-gp_filesystem_lru_update (CameraFilesystem *fs,
-			  const char *folder, const char *filename,
-			  CameraFileType type,
-			  CameraFile *file, GPContext *context)
+gp_filesystem_lru_update (CameraFilesystem *fs, int cls,
+			  CameraFilesystemFile *xfile)
 {
-	CameraFilesystemFolder	*f;
-	CameraFilesystemFile	*xfile;
-	CameraFile *oldfile = NULL;
 	unsigned long int size;
-	int x;
-	char cached_images[1024];
 
-	C_PARAMS (fs && folder && file);
+	C_PARAMS (fs && xfile);
 
-	CR (gp_file_get_data_and_size (file, NULL, &size));
+	gp_filesystem_lru_unlink (fs, cls, xfile);
+	size = gp_filesystem_lru_entry_size (fs, xfile, cls);
 
 	/*
-	 * The following is a very simple case which is used to prune
-	 * the LRU. We keep PICTURES_TO_KEEP pictures in the LRU.
-	 *
 	 * We have 2 main scenarios:
 	 *	- query all thumbnails (repeatedly) ... they are cached and
-	 *	  are not pruned by lru free.
+	 *	  are only pruned once they exceed their own budget.
 	 *	- download all images, linear.	no real need for caching.
 	 *	- skip back 1 image (in viewers) (really? I don't know.)
 	 *
-	 * So lets just keep 2 pictures in memory.
+	 * So keep PICTURES_TO_KEEP pictures in memory, and never more
+	 * than the byte budget, but always keep the newest entry: the
+	 * camera driver might not be able to download it again.
 	 */
-	if (pictures_to_keep == -1) {
-		if (gp_setting_get ("libgphoto", "cached-images", cached_images) == GP_OK) {
-			pictures_to_keep = atoi(cached_images);
-		} else {
-			/* store a default setting */
-			sprintf (cached_images, "%d", PICTURES_TO_KEEP);
-			gp_setting_set ("libgphoto", "cached-images", cached_images);
-		}
-	}
-
-	if (pictures_to_keep < 0) /* also sanity check, but no upper limit. */
-		pictures_to_keep = PICTURES_TO_KEEP;
-
-	x = gp_filesystem_lru_count (fs);
-	while (x > pictures_to_keep) {
-		CR (gp_filesystem_lru_free (fs));
-		x = gp_filesystem_lru_count (fs);
-	}
-
-	GP_LOG_D ("Adding file '%s' from folder '%s' to the fscache LRU list "
-		  "(type %i)...", filename, folder, type);
-
-	/* Search folder and file */
-	CR (lookup_folder_file (fs, folder, filename, &f, &xfile, context));
-
-	/*
-	 * If the file is already in the lru, we first remove it. Note that
-	 * we will only remove 'normal', 'raw' and 'audio' from cache.
-	 * See gp_filesystem_lru_free.
-	 */
-	if (xfile->lru_prev != NULL) {
-		switch (type) {
-		case GP_FILE_TYPE_NORMAL:
-			oldfile = xfile->normal;
-			break;
-		case GP_FILE_TYPE_RAW:
-			oldfile = xfile->raw;
-			break;
-		case GP_FILE_TYPE_AUDIO:
-			oldfile = xfile->audio;
+	while (fs->lru[cls].first) {
+		if (!((cls == GP_FILESYSTEM_CACHE_FILES) &&
+		      (fs->lru[cls].count > (unsigned int)pictures_to_keep)) &&
+		    !(fs->lru[cls].budget &&
+		      (fs->lru[cls].size + size > fs->lru[cls].budget)))
 			break;
-		case GP_FILE_TYPE_PREVIEW:
-		case GP_FILE_TYPE_EXIF:
-		case GP_FILE_TYPE_METADATA:
-			break;
-		default:
-			gp_context_error (context, _("Unknown file type %i."),
-					  type);
-			return (GP_ERROR);
-		}
-		if (oldfile) {
-			CR( gp_file_get_data_and_size (oldfile, NULL, &size));
-			fs->lru_size -= size;
-		}
-
-		CR (gp_filesystem_lru_remove_one (fs, xfile));
+		gp_filesystem_lru_evict (fs, cls, fs->lru[cls].first);
+		fs->lru[cls].evictions++;
 	}
 
-	/* Then add the file at the end of the LRU. */
-	if (fs->lru_first == NULL) {
-		fs->lru_first = xfile;
-		fs->lru_last = xfile;
-
-		/*
-		 * For the first item, prev point it itself to show that the
-		 * item is in the list.
-		 */
-		xfile->lru_prev = xfile;
+	if (size) {
+		gp_filesystem_lru_link (fs, cls, xfile);
+		GP_LOG_D ("File '%s' added in fscache LRU list %d (%d items, "
+			  "%lu bytes).", xfile->name, cls, fs->lru[cls].count,
+			  fs->lru[cls].size);
+	} else
+		gp_filesystem_file_trim (fs, xfile);
+	return (GP_OK);
+}
 
-	} else {
-		xfile->lru_next = NULL;
-		xfile->lru_prev = fs->lru_last;
-		fs->lru_last->lru_next = xfile;
-		fs->lru_last = xfile;
-	}
+/**
+ * \brief Set the identity of the camera behind the filesystem.
+ * \param fs a #CameraFilesystem
+ * \param identity a string uniquely identifying the camera, like its
+ *        manufacturer, model and serial number
+ *
+ * Camera drivers call this function once they know which camera they
+ * are talking to. If the "persistent-cache-dir" setting names a
+ * directory, file information, previews and EXIF data are then also
+ * cached in a file there and are still available after reconnecting
+ * the camera. The size of that file is capped by the
+ * "persistent-cache-bytes" setting. Only files the camera driver
+ * stamps with gp_filesystem_set_stamp() while listing them get their
+ * information from there; see there for how outdated entries are
+ * recognized.
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_set_identity (CameraFilesystem *fs, const char *identity)
+{
+	char	dir[1024], buf[1024];
+	unsigned long int max_bytes = PERSISTENT_BYTES_TO_KEEP;
+	int	ret;
 
-	CR( gp_file_get_data_and_size (file, NULL, &size));
-	fs->lru_size += size;
+	C_PARAMS (fs && identity);
 
-	GP_LOG_D ("File '%s' from folder '%s' added in fscache LRU list.",
-		  filename, folder);
+	gp_filesystem_cache_close (fs->pcache);
+	fs->pcache = NULL;
 
+	if ((gp_setting_get ("libgphoto", "persistent-cache-dir", dir) != GP_OK) ||
+	    !dir[0])
+		return (GP_OK);
+	if ((gp_setting_get ("libgphoto", "persistent-cache-bytes", buf) == GP_OK) &&
+	    (atol (buf) > 0))
+		max_bytes = atol (buf);
+
+	GP_LOG_D ("Using persistent cache in '%s' for '%s'.", dir, identity);
+	ret = gp_filesystem_cache_open (&fs->pcache, dir, identity, max_bytes);
+	if (ret < GP_OK)
+		GP_LOG_E ("Could not open persistent cache in '%s' (%s).", dir,
+			  gp_result_as_string (ret));
+	/* The cache is optional, carry on without it. */
 	return (GP_OK);
 }
 
-static int
-gp_filesystem_lru_check (CameraFilesystem *fs)
+/**
+ * \brief Set the byte budget of the filesystem cache.
+ * \param fs a #CameraFilesystem
+ * \param cls the #CameraFilesystemCacheClass to configure
+ * \param budget the maximum number of bytes to cache, 0 for no limit
+ *
+ * The initial budgets are taken from the "cached-bytes" and
+ * "cached-preview-bytes" settings. The most recently cached entry is
+ * always kept, even if it alone exceeds the budget.
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_set_cache_budget (CameraFilesystem *fs,
+				CameraFilesystemCacheClass cls, uint64_t budget)
 {
-	int n = 0;
-	CameraFilesystemFile *ptr, *prev;
-
-	GP_LOG_D ("Checking fscache LRU list integrity...");
-
-	if (fs->lru_first == NULL) {
-		GP_LOG_D ("fscache LRU list empty");
-		return (GP_OK);
-	}
+	C_PARAMS (fs && (cls >= 0) && (cls < GP_FILESYSTEM_CACHE_CLASSES));
 
-	ptr = prev = fs->lru_first;
-	while (ptr != NULL) {
-		n++;
-		if (ptr->lru_prev != prev) {
-			GP_LOG_E ("fscache LRU list corrupted (%i)", n);
-			return (GP_ERROR);
-		}
-		prev = ptr;
-		ptr = ptr->lru_next;
+	fs->lru[cls].budget = budget;
+	while (fs->lru[cls].budget && (fs->lru[cls].count > 1) &&
+	       (fs->lru[cls].size > fs->lru[cls].budget)) {
+		gp_filesystem_lru_evict (fs, cls, fs->lru[cls].first);
+		fs->lru[cls].evictions++;
 	}
+	return (GP_OK);
+}
 
-	GP_LOG_D ("fscache LRU list ok with %i items (%ld bytes)", n,
-		  fs->lru_size);
-
+/**
+ * \brief Get usage statistics of the filesystem cache.
+ * \param fs a #CameraFilesystem
+ * \param cls the #CameraFilesystemCacheClass to query
+ * \param stats pointer to a #CameraFilesystemCacheStats to fill in
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_get_cache_stats (CameraFilesystem *fs,
+			       CameraFilesystemCacheClass cls,
+			       CameraFilesystemCacheStats *stats)
+{
+	C_PARAMS (fs && stats && (cls >= 0) && (cls < GP_FILESYSTEM_CACHE_CLASSES));
+
+	memset (stats, 0, sizeof (*stats));
+	stats->hits	 = fs->lru[cls].hits;
+	stats->misses	 = fs->lru[cls].misses;
+	stats->evictions = fs->lru[cls].evictions;
+	stats->size	 = fs->lru[cls].size;
+	stats->budget	 = fs->lru[cls].budget;
+	stats->entries	 = fs->lru[cls].count;
+	stats->relists	 = fs->relists;
+	stats->relists_avoided = fs->relists_avoided;
 	return (GP_OK);
 }
 
@@ -2206,6 +3441,7 @@ gp_filesystem_set_file_noop (CameraFilesystem *fs,
 	CameraFileInfo info;
 	CameraFilesystemFolder	*f;
 	CameraFilesystemFile	*xfile;
+	CameraFile		**slot;
 	int r;
 	time_t t;
 
@@ -2219,60 +3455,21 @@ gp_filesystem_set_file_noop (CameraFilesystem *fs,
 	/* Search folder and file */
 	CR (lookup_folder_file (fs, folder, filename, &f, &xfile, context));
 
-	/*
-	 * If we add a significant amount of data in the cache, we put (or
-	 * move) a reference to this file in the LRU linked list. We
-	 * assume that only GP_FILE_TYPE_[RAW,NORMAL,EXIF] will contain a
-	 * significant amount of data.
-	 */
-	if ((type == GP_FILE_TYPE_RAW) || (type == GP_FILE_TYPE_NORMAL) ||
-	    (type == GP_FILE_TYPE_AUDIO))
-		CR (gp_filesystem_lru_update (fs, folder, filename, type, file, context));
-
-	/* Redundant sanity check. */
-	CR (gp_filesystem_lru_check (fs));
-
-	switch (type) {
-	case GP_FILE_TYPE_PREVIEW:
-		if (xfile->preview)
-			gp_file_unref (xfile->preview);
-		xfile->preview = file;
-		gp_file_ref (file);
-		break;
-	case GP_FILE_TYPE_NORMAL:
-		if (xfile->normal)
-			gp_file_unref (xfile->normal);
-		xfile->normal = file;
-		gp_file_ref (file);
-		break;
-	case GP_FILE_TYPE_RAW:
-		if (xfile->raw)
-			gp_file_unref (xfile->raw);
-		xfile->raw = file;
-		gp_file_ref (file);
-		break;
-	case GP_FILE_TYPE_AUDIO:
-		if (xfile->audio)
-			gp_file_unref (xfile->audio);
-		xfile->audio = file;
-		gp_file_ref (file);
-		break;
-	case GP_FILE_TYPE_EXIF:
-		if (xfile->exif)
-			gp_file_unref (xfile->exif);
-		xfile->exif = file;
-		gp_file_ref (file);
-		break;
-	case GP_FILE_TYPE_METADATA:
-		if (xfile->metadata)
-			gp_file_unref (xfile->metadata);
-		xfile->metadata = file;
-		gp_file_ref (file);
-		break;
-	default:
+	if (gp_filesystem_lru_class (type) < 0) {
 		gp_context_error (context, _("Unknown file type %i."), type);
 		return (GP_ERROR);
 	}
+	C_MEM (slot = gp_filesystem_file_slot (fs, xfile, type, 1));
+	if (*slot)
+		gp_file_unref (*slot);
+	*slot = file;
+	gp_file_ref (file);
+
+	/*
+	 * Put (or move) a reference to this file in the LRU linked list
+	 * of its cache class, this might prune other cached files.
+	 */
+	CR (gp_filesystem_lru_update (fs, gp_filesystem_lru_class (type), xfile));
 
 	/*
 	 * If we didn't get a mtime, try to get it from the CameraFileInfo.
@@ -2302,15 +3499,16 @@ gp_filesystem_set_file_noop (CameraFilesystem *fs,
 			t = get_exif_mtime ((unsigned char*)data, size);
 		}
 	}
+#endif
 	/*
-	 * Still no mtime? Let's see if the camera offers us data of type
-	 * GP_FILE_TYPE_EXIF that includes information on the mtime.
+	 * Still no mtime? Let's see if the EXIF header of the file on the
+	 * camera has it. This is only tried for JPEGs and remembered.
 	 */
 	if (!t) {
 		GP_LOG_D ("Trying EXIF information...");
-		t = gp_filesystem_get_exif_mtime (fs, folder, filename);
+		t = gp_filesystem_file_exif_mtime (fs, folder, filename, xfile,
+						   context);
 	}
-#endif
 
 	if (t)
 		CR (gp_file_set_mtime (file, t));
@@ -2349,6 +3547,61 @@ gp_filesystem_set_info_noop (CameraFilesystem *fs,
 
 	memcpy (&xfile->info, &info, sizeof (CameraFileInfo));
 	xfile->info_dirty = 0;
+	xfile->info_cached = 0;
+	if (fs->pcache)
+		gp_filesystem_cache_put_info (fs->pcache, folder, filename,
+					      file_stamp (xfile), &info);
+	return (GP_OK);
+}
+
+/**
+ * \brief Set the stamp of a file
+ * \param fs a #CameraFilesystem
+ * \param folder the folder of the file
+ * \param filename the name of the file
+ * \param stamp a value that changes whenever the file is replaced
+ * \param context a #GPContext
+ *
+ * Camera drivers call this from their file_list_func for each file they
+ * list, with a value computed from what the camera reports for the file
+ * anyway, like its size and modification time. The file is added to the
+ * folder like with gp_filesystem_append().
+ *
+ * Names get reused, e.g. after the memory card has been formatted. The
+ * persistent cache (see gp_filesystem_set_identity()) only returns the
+ * information of a file if it was stored with the same stamp, and
+ * previews and EXIF data if they were stored with the same stamp or
+ * with the size and mtime the camera currently reports.
+ *
+ * \return a gphoto2 error code.
+ **/
+int
+gp_filesystem_set_stamp (CameraFilesystem *fs, const char *folder,
+			 const char *filename, uint64_t stamp,
+			 GPContext *context)
+{
+	CameraFilesystemFolder	*f;
+	CameraFilesystemFile	*xfile;
+
+	C_PARAMS (fs && folder && filename);
+	CC (context);
+	CA (folder, context);
+
+	CR (gp_filesystem_append (fs, folder, filename, context));
+	f = lookup_folder (fs, fs->rootfolder, folder, context);
+	if (!f)
+		return (GP_ERROR_DIRECTORY_NOT_FOUND);
+	xfile = file_index_lookup (f, filename);
+	if (!xfile)
+		return (GP_ERROR_FILE_NOT_FOUND);
+
+	/* A new stamp means a new file behind the same name. */
+	if (xfile->stamped && (xfile->stamp != stamp)) {
+		xfile->info_dirty = 1;
+		xfile->info_cached = 0;
+	}
+	xfile->stamp = stamp;
+	xfile->stamped = 1;
 	return (GP_OK);
 }
 
@@ -2466,3 +3719,33 @@ gp_filesystem_get_storageinfo (
 		storageinfo, nrofstorageinfos,
 		fs->data, context);
 }
+
+/**
+ * \brief Get a fingerprint of the files below a folder
+ * \param fs a #CameraFilesystem
+ * \param folder the folder
+ * \param fingerprint receives the fingerprint
+ * \param context a #GPContext
+ *
+ * Asks the camera driver for a value that changes whenever a file is
+ * added to or removed from the folder or any of its subfolders. Only
+ * fingerprints of the same folder can be compared with each other.
+ * Modifications of a file that do not add or remove it are not
+ * necessarily noticed.
+ *
+ * \return a gphoto2 error code, #GP_ERROR_NOT_SUPPORTED if the driver
+ *         cannot compute the fingerprint cheaply.
+ **/
+int
+gp_filesystem_get_fingerprint (CameraFilesystem *fs, const char *folder,
+			       uint64_t *fingerprint, GPContext *context)
+{
+	C_PARAMS (fs && folder && fingerprint);
+	CC (context);
+	CA (folder, context);
+
+	if (!fs->fingerprint_func)
+		return (GP_ERROR_NOT_SUPPORTED);
+	return fs->fingerprint_func (fs, folder, fingerprint, fs->data,
+				     context);
+}
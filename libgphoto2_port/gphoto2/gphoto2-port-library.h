@@ -83,6 +83,27 @@ typedef struct _GPPortOperations {
 
         int (*reset)     (GPPort *);
 
+	/* For USB devices: bulk IN reads with several transfers in flight,
+	 * see gp_port_read_stream() */
+	int (*read_stream) (GPPort *port, unsigned long size, int transfers,
+			    int transfer_size, GPPortStreamFunc func,
+			    void *user_data);
+
+	/* For USB devices: buffers the kernel can transfer into without
+	 * copying, see gp_port_alloc_buffer(). alloc_buffer returns NULL
+	 * and free_buffer an error for buffers the port did not hand out. */
+	char *(*alloc_buffer) (GPPort *port, int size);
+	int (*free_buffer) (GPPort *port, char *buffer, int size);
+
+	/* File descriptors that become ready when check_int has something
+	 * to report, see gp_port_get_pollfds() */
+	int (*get_pollfds) (GPPort *port, GPPortPollFd *fds, int max);
+
+	/* Counters the io library keeps itself, see gp_port_get_stats().
+	 * get_stats only sets the fields it knows about. */
+	int (*get_stats) (GPPort *port, GPPortStats *stats);
+	int (*reset_stats) (GPPort *port);
+
 } GPPortOperations;
 
 typedef GPPortType (* GPPortLibraryType) (void);
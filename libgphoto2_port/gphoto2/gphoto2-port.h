@@ -24,6 +24,8 @@
 #ifndef __GPHOTO2_PORT_H__
 #define __GPHOTO2_PORT_H__
 
+#include <stdint.h>
+
 #include <gphoto2/gphoto2-port-info-list.h>
 
 /* For portability */
@@ -169,6 +171,80 @@ int gp_port_read        (GPPort *port,       char *data, int size);
 int gp_port_check_int   (GPPort *port,       char *data, int size);
 int gp_port_check_int_fast (GPPort *port,    char *data, int size);
 
+/**
+ * \brief Callback of gp_port_read_stream().
+ *
+ * Gets the data in the order it arrived. Returning an error stops the
+ * stream and gp_port_read_stream() returns that error.
+ */
+typedef int (*GPPortStreamFunc) (GPPort *port, const char *data, int size,
+				 void *user_data);
+
+int gp_port_read_stream  (GPPort *port, unsigned long size,
+			  GPPortStreamFunc func, void *user_data);
+int gp_port_set_stream_transfers (GPPort *port, int transfers, int size);
+
+int gp_port_alloc_buffer (GPPort *port, int size, char **buffer);
+int gp_port_free_buffer  (GPPort *port, char *buffer, int size);
+
+/**
+ * \brief A file descriptor to wait on, see gp_port_get_pollfds().
+ */
+typedef struct _GPPortPollFd {
+	int   fd;		/**< \brief The file descriptor. */
+	short events;		/**< \brief The poll() events to wait for (POLLIN, POLLOUT). */
+} GPPortPollFd;
+
+int gp_port_get_pollfds  (GPPort *port, GPPortPollFd *fds, int max);
+
+/**
+ * \brief Kind of transfer counted in #GPPortStats.
+ */
+typedef enum _GPPortStatsType {
+	GP_PORT_STATS_READ = 0,		/**< \brief gp_port_read(), bulk IN */
+	GP_PORT_STATS_READ_STREAM,	/**< \brief gp_port_read_stream(), bulk IN */
+	GP_PORT_STATS_WRITE,		/**< \brief gp_port_write(), bulk OUT */
+	GP_PORT_STATS_CHECK_INT,	/**< \brief gp_port_check_int(), interrupt IN */
+	GP_PORT_STATS_MSG_READ,		/**< \brief gp_port_usb_msg_*read(), control IN */
+	GP_PORT_STATS_MSG_WRITE,	/**< \brief gp_port_usb_msg_*write(), control OUT */
+	GP_PORT_STATS_LAST		/**< \brief Number of kinds, not a kind */
+} GPPortStatsType;
+
+/**
+ * \brief Number of buckets in the latency histograms of #GPPortStats.
+ *
+ * Bucket 0 counts calls that took less than 16 microseconds, bucket i
+ * those that took less than 16 << i microseconds (about 4 seconds for
+ * the second to last) and the last one everything slower.
+ */
+#define GP_PORT_STATS_BUCKETS	20
+
+/**
+ * \brief Counters of one kind of transfer, see gp_port_get_stats().
+ */
+typedef struct _GPPortTransferStats {
+	uint64_t calls;		/**< \brief Number of calls. */
+	uint64_t bytes;		/**< \brief Bytes transferred. */
+	uint64_t errors;	/**< \brief Calls that failed, timeouts included. */
+	uint64_t timeouts;	/**< \brief Calls that failed with #GP_ERROR_TIMEOUT. */
+	uint64_t clear_halts;	/**< \brief gp_port_usb_clear_halt() calls on the endpoint. */
+	uint64_t usecs;		/**< \brief Total time spent in the calls. */
+	uint64_t latency[GP_PORT_STATS_BUCKETS];	/**< \brief Latency histogram. */
+} GPPortTransferStats;
+
+/**
+ * \brief Transfer metrics of a port, see gp_port_get_stats().
+ */
+typedef struct _GPPortStats {
+	GPPortTransferStats transfers[GP_PORT_STATS_LAST]; /**< \brief Indexed by #GPPortStatsType. */
+	uint64_t irqs_dropped;	/**< \brief Interrupts dropped because the io library's queue was full. */
+	uint64_t irqs_highwater;	/**< \brief Most interrupts ever queued for gp_port_check_int(). */
+} GPPortStats;
+
+int gp_port_set_stats_enabled (GPPort *port, int enabled);
+int gp_port_get_stats    (GPPort *port, GPPortStats *stats);
+int gp_port_reset_stats  (GPPort *port);
+
 int gp_port_get_timeout  (GPPort *port, int *timeout);
 int gp_port_set_timeout  (GPPort *port, int  timeout);
 
@@ -67,6 +67,21 @@
 #  define N_(String) (String)
 #endif
 
+#ifdef HAVE_REGEX
+/* The compiled path of a generic entry. */
+typedef struct {
+	unsigned int	entry;		/* index into info */
+	int		result;		/* of compiling, pattern is only valid if 0 */
+	regex_t		pattern;
+} PathPattern;
+#endif
+
+/* A slot of the path hash. */
+typedef struct {
+	unsigned int	entry;		/* index into info + 1, 0 if free */
+	unsigned int	index;		/* index excluding generic entries */
+} PathSlot;
+
 /**
  * \internal GPPortInfoList:
  *
@@ -76,6 +91,17 @@ struct _GPPortInfoList {
 	GPPortInfo *info;
 	unsigned int count;
 	unsigned int iolib_count;
+	unsigned int iolib_types;	/* GPPortType bits of the loaded iolibs */
+
+	/* Lookup index of the first 'indexed' entries, see list_index() */
+	unsigned int indexed;
+	unsigned int regular;		/* of them not generic */
+	PathSlot *hash;			/* regular entries by path */
+	unsigned int hash_size;
+#ifdef HAVE_REGEX
+	PathPattern *patterns;		/* generic entries in list order */
+	unsigned int npatterns;
+#endif
 };
 
 #define CR(x)         {int r=(x);if (r<0) return (r);}
@@ -154,6 +180,17 @@ gp_port_info_list_free (GPPortInfoList *list)
 	}
 	list->count = 0;
 
+#ifdef HAVE_REGEX
+	{
+		unsigned int i;
+
+		for (i = 0; i < list->npatterns; i++)
+			if (!list->patterns[i].result)
+				regfree (&list->patterns[i].pattern);
+	}
+	free (list->patterns);
+#endif
+	free (list->hash);
 	free (list);
 
 	return (GP_OK);
@@ -221,11 +258,10 @@ foreach_func (const char *filename, lt_ptr data)
 		return (0);
 	}
 
+	/* One iolib per port type, the first one found wins. An iolib of
+	 * type GP_PORT_NONE only adds ports for the others, e.g. replay. */
 	type = lib_type ();
-	for (j = 0; j < list->count; j++)
-		if (list->info[j]->type == type)
-			break;
-	if (j != list->count) {
+	if (list->iolib_types & type) {
 		GP_LOG_D ("'%s' already loaded", filename);
 		lt_dlclose (lh);
 		return (0);
@@ -246,6 +282,7 @@ foreach_func (const char *filename, lt_ptr data)
 		 * at least some entries were added
 		 */
 		list->iolib_count++;
+		list->iolib_types |= type;
 
 		for (j = old_size; j < list->count; j++){
 			GP_LOG_D ("Loaded '%s' ('%s') from '%s'.",
@@ -321,6 +358,99 @@ gp_port_info_list_count (GPPortInfoList *list)
 	return count;
 }
 
+/* FNV-1a, used by the path hash. */
+static unsigned int
+path_hash (const char *path)
+{
+	unsigned int h = 2166136261U;
+
+	while (*path)
+		h = (h ^ (unsigned char)*path++) * 16777619U;
+	return h;
+}
+
+/* Find path in the hash, returns its slot or the free one to put it in. */
+static PathSlot *
+path_slot (GPPortInfoList *list, const char *path)
+{
+	unsigned int b = path_hash (path) & (list->hash_size - 1);
+
+	while (list->hash[b].entry &&
+	       strcmp (list->info[list->hash[b].entry - 1]->path, path))
+		b = (b + 1) & (list->hash_size - 1);
+	return &list->hash[b];
+}
+
+static int
+path_rehash (GPPortInfoList *list, unsigned int size)
+{
+	PathSlot *old = list->hash, *slot;
+	unsigned int i, oldsize = list->hash_size;
+
+	C_MEM (list->hash = calloc (size, sizeof (PathSlot)));
+	list->hash_size = size;
+	for (i = 0; i < oldsize; i++)
+		if (old[i].entry) {
+			slot = path_slot (list, list->info[old[i].entry - 1]->path);
+			*slot = old[i];
+		}
+	free (old);
+	return (GP_OK);
+}
+
+/*
+ * Index the entries appended since the last lookup: regular entries go
+ * into the path hash, the paths of generic ones are compiled once here
+ * instead of on every lookup.
+ */
+static int
+list_index (GPPortInfoList *list)
+{
+	for (; list->indexed < list->count; list->indexed++) {
+		GPPortInfo info = list->info[list->indexed];
+		PathSlot *slot;
+
+		if (strlen (info->name)) {
+			if (2 * (list->regular + 1) > list->hash_size)
+				CR (path_rehash (list, list->hash_size ? 2 * list->hash_size : 64));
+			slot = path_slot (list, info->path);
+			/* The first of several entries with one path wins. */
+			if (!slot->entry) {
+				slot->entry = list->indexed + 1;
+				slot->index = list->regular;
+			}
+			list->regular++;
+			continue;
+		}
+#ifdef HAVE_REGEX
+		{
+			PathPattern *patterns, *p;
+
+			C_MEM (patterns = realloc (list->patterns,
+				sizeof (PathPattern) * (list->npatterns + 1)));
+			list->patterns = patterns;
+			p = &list->patterns[list->npatterns++];
+			p->entry = list->indexed;
+#ifdef HAVE_GNU_REGEX
+			{
+				const char *rv;
+
+				memset (&p->pattern, 0, sizeof (p->pattern));
+				rv = re_compile_pattern (info->path, strlen (info->path),
+							 &p->pattern);
+				p->result = rv ? 1 : 0;
+				if (rv)
+					GP_LOG_D ("%s", rv);
+			}
+#else
+			p->result = regcomp (&p->pattern, info->path, REG_ICASE);
+#endif
+		}
+#endif
+	}
+	return (GP_OK);
+}
+
 /**
  * \brief Lookup a specific path in the list
  *
@@ -336,13 +466,11 @@ gp_port_info_list_count (GPPortInfoList *list)
 int
 gp_port_info_list_lookup_path (GPPortInfoList *list, const char *path)
 {
-	unsigned int i;
-	int result, generic;
+	PathSlot *slot;
 #ifdef HAVE_REGEX
-	regex_t pattern;
-#ifdef HAVE_GNU_REGEX
-	const char *rv;
-#else
+	unsigned int i;
+	int result;
+#ifndef HAVE_GNU_REGEX
 	regmatch_t match;
 #endif
 #endif
@@ -351,64 +479,54 @@ gp_port_info_list_lookup_path (GPPortInfoList *list, const char *path)
 
 	GP_LOG_D ("Looking for path '%s' (%i entries available)...", path, list->count);
 
+	CR (list_index (list));
+
 	/* Exact match? */
-	for (generic = i = 0; i < list->count; i++)
-		if (!strlen (list->info[i]->name))
-			generic++;
-		else if (!strcmp (list->info[i]->path, path))
-			return (i - generic);
+	if (list->hash_size) {
+		slot = path_slot (list, path);
+		if (slot->entry)
+			return (slot->index);
+	}
 
 #ifdef HAVE_REGEX
 	/* Regex match? */
 	GP_LOG_D ("Starting regex search for '%s'...", path);
-	for (i = 0; i < list->count; i++) {
-		GPPortInfo newinfo;
-
-		if (strlen (list->info[i]->name))
-			continue;
+	for (i = 0; i < list->npatterns; i++) {
+		PathPattern *p = &list->patterns[i];
+		GPPortInfo info = list->info[p->entry], newinfo;
 
-		GP_LOG_D ("Trying '%s'...", list->info[i]->path);
+		GP_LOG_D ("Trying '%s'...", info->path);
 
-		/* Compile the pattern */
 #ifdef HAVE_GNU_REGEX
-		memset (&pattern, 0, sizeof (pattern));
-		rv = re_compile_pattern (list->info[i]->path,
-					 strlen (list->info[i]->path), &pattern);
-		if (rv) {
-			GP_LOG_D ("%s", rv);
+		if (p->result)
+			continue;
+
+		/* Try to match */
+		result = re_match (&p->pattern, path, strlen (path), 0, NULL);
+		if (result < 0) {
+			GP_LOG_D ("re_match failed (%i)", result);
 			continue;
 		}
 #else
-		result = regcomp (&pattern, list->info[i]->path, REG_ICASE);
-		if (result) {
+		if (p->result) {
 			char buf[1024];
-			if (regerror (result, &pattern, buf, sizeof (buf)))
+			if (regerror (p->result, &p->pattern, buf, sizeof (buf)))
 				GP_LOG_E ("%s", buf);
 			else
 				GP_LOG_E ("regcomp failed");
 			return (GP_ERROR_UNKNOWN_PORT);
 		}
-#endif
 
 		/* Try to match */
-#ifdef HAVE_GNU_REGEX
-		result = re_match (&pattern, path, strlen (path), 0, NULL);
-		regfree (&pattern);
-		if (result < 0) {
-			GP_LOG_D ("re_match failed (%i)", result);
-			continue;
-		}
-#else
-		result = regexec (&pattern, path, 1, &match, 0);
-		regfree (&pattern);
+		result = regexec (&p->pattern, path, 1, &match, 0);
 		if (result) {
 			GP_LOG_D ("regexec failed");
 			continue;
 		}
 #endif
 		gp_port_info_new (&newinfo);
-		gp_port_info_set_type (newinfo, list->info[i]->type);
-		newinfo->library_filename = strdup(list->info[i]->library_filename);
+		gp_port_info_set_type (newinfo, info->type);
+		newinfo->library_filename = strdup(info->library_filename);
 		gp_port_info_set_name (newinfo, _("Generic Port"));
 		gp_port_info_set_path (newinfo, path);
 		CR (result = gp_port_info_list_append (list, newinfo));
@@ -31,6 +31,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
 
 #include <ltdl.h>
 
@@ -76,8 +80,84 @@ struct _GPPortPrivateCore {
 	struct _GPPortInfo info;	/**< Internal port information of this port. */
 	GPPortOperations *ops;	/**< Internal port operations. */
 	lt_dlhandle lh;		/**< Internal libtool library handle. */
+
+	int stream_transfers;	/**< Transfers kept in flight by gp_port_read_stream(). */
+	int stream_size;	/**< Size of each of them. */
+
+	int stats_enabled;	/**< Whether transfers update stats. */
+	GPPortStats stats;	/**< Transfer metrics, see gp_port_get_stats(). */
 };
 
+/* Defaults for gp_port_read_stream(): 4 MB in flight keeps a USB 3
+ * controller busy and stays well below the 16 MB Linux allows usbfs. */
+#define STREAM_TRANSFERS	8
+#define STREAM_SIZE		(512 * 1024)
+
+/* The stats are updated by the thread doing the I/O and may be read or
+ * reset by another one at any time, without a lock. Where 64 bit
+ * atomics would need one, a counter read meanwhile may come out torn,
+ * which is good enough for metrics. */
+#ifdef __ATOMIC_RELAXED
+# define STATS_ENABLED(p)	__atomic_load_n (&(p)->pc->stats_enabled, __ATOMIC_RELAXED)
+#else
+# define STATS_ENABLED(p)	((p)->pc->stats_enabled)
+#endif
+#if defined(__ATOMIC_RELAXED) && (__GCC_ATOMIC_LLONG_LOCK_FREE == 2)
+# define STATS_ADD(x,v)		__atomic_fetch_add (&(x), (v), __ATOMIC_RELAXED)
+# define STATS_LOAD(x)		__atomic_load_n (&(x), __ATOMIC_RELAXED)
+# define STATS_STORE(x,v)	__atomic_store_n (&(x), (v), __ATOMIC_RELAXED)
+#else
+# define STATS_ADD(x,v)		((x) += (v))
+# define STATS_LOAD(x)		(x)
+# define STATS_STORE(x,v)	((x) = (v))
+#endif
+
+/* Start timing a transfer, 0 when stats are disabled. */
+#define STATS_START(p)	(STATS_ENABLED (p) ? stats_now () : 0)
+
+/* Monotonic time in microseconds, never 0. */
+static uint64_t
+stats_now (void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+		return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + 1);
+#endif
+	{
+		struct timeval tv;
+
+		gettimeofday (&tv, NULL);
+		return ((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec + 1);
+	}
+}
+
+/* Account a transfer started at start; result is what the port library
+ * returned, the number of bytes transferred if not negative. */
+static void
+stats_record (GPPort *port, GPPortStatsType type, uint64_t start, int result)
+{
+	GPPortTransferStats *s = &port->pc->stats.transfers[type];
+	uint64_t usecs = stats_now () - start;
+	int bucket = 0;
+
+	while ((bucket < GP_PORT_STATS_BUCKETS - 1) &&
+	       (usecs >= ((uint64_t)16 << bucket)))
+		bucket++;
+
+	STATS_ADD (s->calls, 1);
+	STATS_ADD (s->usecs, usecs);
+	STATS_ADD (s->latency[bucket], 1);
+	if (result > 0)
+		STATS_ADD (s->bytes, result);
+	else if (result < 0) {
+		STATS_ADD (s->errors, 1);
+		if (result == GP_ERROR_TIMEOUT)
+			STATS_ADD (s->timeouts, 1);
+	}
+}
+
 /**
  * \brief Create new GPPort
  *
@@ -104,6 +184,8 @@ gp_port_new (GPPort **port)
 		gp_port_free (*port);
 		return (GP_ERROR_NO_MEMORY);
 	}
+	(*port)->pc->stream_transfers = STREAM_TRANSFERS;
+	(*port)->pc->stream_size = STREAM_SIZE;
 
         return (GP_OK);
 }
@@ -148,12 +230,17 @@ gp_port_exit (GPPort *port)
 int
 gp_port_set_info (GPPort *port, GPPortInfo info)
 {
-	int ret;
+	int ret, reload;
 
 	GPPortLibraryOperations ops_func;
 
 	C_PARAMS (port);
 
+	/* Keep the io library loaded when only the path changes, e.g. while
+	 * autodetection walks all USB ports; it may keep state across ports. */
+	reload = !port->pc->lh || !port->pc->info.library_filename ||
+		 strcmp (port->pc->info.library_filename, info->library_filename);
+
 	free (port->pc->info.name);
 	C_MEM (port->pc->info.name = strdup (info->name));
 	free (port->pc->info.path);
@@ -170,19 +257,21 @@ gp_port_set_info (GPPort *port, GPPortInfo info)
 		free (port->pc->ops);
 		port->pc->ops = NULL;
 	}
-	if (port->pc->lh) {
+	if (reload) {
+		if (port->pc->lh) {
 #if !defined(VALGRIND)
-		lt_dlclose (port->pc->lh);
-		lt_dlexit ();
+			lt_dlclose (port->pc->lh);
+			lt_dlexit ();
 #endif
-	}
+		}
 
-	lt_dlinit ();
-	port->pc->lh = lt_dlopenext (info->library_filename);
-	if (!port->pc->lh) {
-		GP_LOG_E ("Could not load '%s' ('%s').", info->library_filename, lt_dlerror ());
-		lt_dlexit ();
-		return (GP_ERROR_LIBRARY);
+		lt_dlinit ();
+		port->pc->lh = lt_dlopenext (info->library_filename);
+		if (!port->pc->lh) {
+			GP_LOG_E ("Could not load '%s' ('%s').", info->library_filename, lt_dlerror ());
+			lt_dlexit ();
+			return (GP_ERROR_LIBRARY);
+		}
 	}
 
 	/* Load the operations */
@@ -392,6 +481,7 @@ int
 gp_port_write (GPPort *port, const char *data, int size)
 {
 	int retval;
+	uint64_t start;
 
         gp_log (GP_LOG_DATA, __func__, "Writing %i = 0x%x bytes to port...", size, size);
 
@@ -400,7 +490,10 @@ gp_port_write (GPPort *port, const char *data, int size)
 
 	/* Check if we wrote all bytes */
 	CHECK_SUPP (port, "write", port->pc->ops->write);
+	start = STATS_START (port);
 	retval = port->pc->ops->write (port, data, size);
+	if (start)
+		stats_record (port, GP_PORT_STATS_WRITE, start, retval);
 	if (retval < 0) {
 		GP_LOG_E ("Writing %i = 0x%x bytes to port failed: %s (%d)",
 			  size, size, gp_port_result_as_string(retval), retval);
@@ -427,6 +520,7 @@ int
 gp_port_read (GPPort *port, char *data, int size)
 {
         int retval;
+	uint64_t start;
 
 	gp_log (GP_LOG_DATA, __func__, "Reading %i = 0x%x bytes from port...", size, size);
 
@@ -435,7 +529,10 @@ gp_port_read (GPPort *port, char *data, int size)
 
 	/* Check if we read as many bytes as expected */
 	CHECK_SUPP (port, "read", port->pc->ops->read);
+	start = STATS_START (port);
 	retval = port->pc->ops->read (port, data, size);
+	if (start)
+		stats_record (port, GP_PORT_STATS_READ, start, retval);
 	if (retval < 0) {
 		GP_LOG_E ("Reading %i = 0x%x bytes from port failed: %s (%d)",
 			  size, size, gp_port_result_as_string(retval), retval);
@@ -446,6 +543,265 @@ gp_port_read (GPPort *port, char *data, int size)
 	return (retval);
 }
 
+/* Counts the bytes of gp_port_read_stream() on their way to the caller. */
+typedef struct {
+	GPPortStreamFunc func;
+	void *user_data;
+} StatsStream;
+
+static int
+stats_stream_func (GPPort *port, const char *data, int size, void *user_data)
+{
+	StatsStream *stream = user_data;
+
+	STATS_ADD (port->pc->stats.transfers[GP_PORT_STATS_READ_STREAM].bytes, size);
+	return (stream->func (port, data, size, stream->user_data));
+}
+
+/**
+ * \brief Read a large amount of data from the port
+ *
+ * \param port a #GPPort
+ * \param size the number of bytes to read
+ * \param func a #GPPortStreamFunc called with each piece of data
+ * \param user_data passed to func
+ *
+ * Reads size bytes from the port like a series of gp_port_read() calls
+ * would, but keeps several transfers in flight, so the device never
+ * waits for the caller to ask for the next piece. The data is handed to
+ * func in the order it arrived. Reading stops early when the device
+ * sends less than asked for; func then has seen everything it sent.
+ *
+ * Not all ports support this; callers fall back to gp_port_read() on
+ * #GP_ERROR_NOT_SUPPORTED. See gp_port_set_stream_transfers() for the
+ * number and size of the transfers.
+ *
+ * \return a gphoto2 error code
+ **/
+int
+gp_port_read_stream (GPPort *port, unsigned long size,
+		     GPPortStreamFunc func, void *user_data)
+{
+	int retval;
+	uint64_t start;
+	StatsStream stream;
+
+	gp_log (GP_LOG_DATA, __func__, "Streaming %lu = 0x%lx bytes from port...", size, size);
+
+	C_PARAMS (port && func);
+	CHECK_INIT (port);
+
+	/* Quietly, callers fall back to gp_port_read(). */
+	if (!port->pc->ops->read_stream || !port->pc->stream_transfers)
+		return (GP_ERROR_NOT_SUPPORTED);
+	start = STATS_START (port);
+	if (start) {
+		stream.func = func;
+		stream.user_data = user_data;
+		func = stats_stream_func;
+		user_data = &stream;
+	}
+	retval = port->pc->ops->read_stream (port, size,
+		port->pc->stream_transfers, port->pc->stream_size,
+		func, user_data);
+	if (start)
+		stats_record (port, GP_PORT_STATS_READ_STREAM, start,
+			      retval < 0 ? retval : 0);
+	if ((retval < 0) && (retval != GP_ERROR_NOT_SUPPORTED))
+		GP_LOG_E ("Streaming %lu = 0x%lx bytes from port failed: %s (%d)",
+			  size, size, gp_port_result_as_string(retval), retval);
+	return (retval);
+}
+
+/**
+ * \brief Set how gp_port_read_stream() reads
+ *
+ * \param port a #GPPort
+ * \param transfers the number of transfers kept in flight, 0 to make
+ *        gp_port_read_stream() unsupported
+ * \param size the size of each transfer in bytes
+ *
+ * The default is 8 transfers of 512 KB. More or larger transfers help
+ * fast devices on busy buses, at the cost of memory the operating system
+ * may limit (on Linux usbfs allows 16 MB by default).
+ *
+ * \return a gphoto2 error code
+ **/
+int
+gp_port_set_stream_transfers (GPPort *port, int transfers, int size)
+{
+	C_PARAMS (port && (transfers >= 0) && (!transfers || (size > 0)));
+
+	GP_LOG_D ("Setting stream to %i transfers of %i bytes.", transfers, size);
+	port->pc->stream_transfers = transfers;
+	port->pc->stream_size = size;
+	return (GP_OK);
+}
+
+/**
+ * \brief Get a buffer for large reads
+ *
+ * \param port a #GPPort
+ * \param size the size of the buffer
+ * \param buffer pointer to the buffer
+ *
+ * Where the port supports it, the buffer is memory the kernel can
+ * transfer USB data into directly, saving a copy of every byte read with
+ * gp_port_read() into it. Otherwise it is plain malloc() memory. Return
+ * it with gp_port_free_buffer() before the port is closed; the port
+ * keeps it for the next caller.
+ *
+ * \return a gphoto2 error code
+ **/
+int
+gp_port_alloc_buffer (GPPort *port, int size, char **buffer)
+{
+	C_PARAMS (port && buffer && (size > 0));
+	CHECK_INIT (port);
+
+	*buffer = NULL;
+	if (port->pc->ops->alloc_buffer)
+		*buffer = port->pc->ops->alloc_buffer (port, size);
+	if (!*buffer)
+		C_MEM (*buffer = malloc (size));
+	return (GP_OK);
+}
+
+/**
+ * \brief Return a buffer from gp_port_alloc_buffer()
+ *
+ * \param port a #GPPort
+ * \param buffer the buffer, may be NULL
+ * \param size the size it was allocated with
+ *
+ * \return a gphoto2 error code
+ **/
+int
+gp_port_free_buffer (GPPort *port, char *buffer, int size)
+{
+	C_PARAMS (port);
+
+	if (!buffer)
+		return (GP_OK);
+	if (!port->pc->ops || !port->pc->ops->free_buffer ||
+	    (port->pc->ops->free_buffer (port, buffer, size) < GP_OK))
+		free (buffer);
+	return (GP_OK);
+}
+
+/**
+ * \brief Get file descriptors to wait on for interrupt data
+ *
+ * \param port a #GPPort
+ * \param fds array to fill, may be NULL if max is 0
+ * \param max number of entries in fds
+ *
+ * Fills fds with the file descriptors and poll() events that become
+ * ready when the port has interrupt data or another event to process,
+ * so that an application can wait for them in its own poll(), epoll or
+ * main loop instead of blocking in gp_port_check_int(). When one is
+ * ready, gp_port_check_int() handles what arrived without waiting for
+ * its timeout. The set can change when the port is opened or closed, so
+ * fetch it again after that.
+ *
+ * \return the number of file descriptors, which can be more than max,
+ *   or a gphoto2 error code (%GP_ERROR_NOT_SUPPORTED if the port has
+ *   none, e.g. libusb on Windows)
+ **/
+int
+gp_port_get_pollfds (GPPort *port, GPPortPollFd *fds, int max)
+{
+	C_PARAMS (port && (max >= 0) && (fds || !max));
+	CHECK_INIT (port);
+
+	CHECK_SUPP (port, "get_pollfds", port->pc->ops->get_pollfds);
+	return (port->pc->ops->get_pollfds (port, fds, max));
+}
+
+/**
+ * \brief Enable or disable transfer metrics
+ *
+ * \param port a #GPPort
+ * \param enabled whether to collect them
+ *
+ * Metrics are disabled by default. While disabled, a transfer costs one
+ * more load and branch; while enabled, two clock reads and a few atomic
+ * increments. Disabling keeps what was collected so far.
+ *
+ * \return a gphoto2 error code
+ **/
+int
+gp_port_set_stats_enabled (GPPort *port, int enabled)
+{
+	C_PARAMS (port);
+
+#ifdef __ATOMIC_RELAXED
+	__atomic_store_n (&port->pc->stats_enabled, !!enabled, __ATOMIC_RELAXED);
+#else
+	port->pc->stats_enabled = !!enabled;
+#endif
+	return (GP_OK);
+}
+
+/**
+ * \brief Get the transfer metrics of a port
+ *
+ * \param port a #GPPort
+ * \param stats the #GPPortStats to fill
+ *
+ * Copies the counters collected since the port was created or
+ * gp_port_reset_stats() was called, while metrics were enabled with
+ * gp_port_set_stats_enabled(). It does not block transfers and can be
+ * called from any thread; transfers in progress meanwhile may or may
+ * not be part of the copy.
+ *
+ * The interrupt queue counters are kept by the io library and are
+ * counted whether metrics are enabled or not.
+ *
+ * \return a gphoto2 error code
+ **/
+int
+gp_port_get_stats (GPPort *port, GPPortStats *stats)
+{
+	uint64_t *from, *to;
+	unsigned int i;
+
+	C_PARAMS (port && stats);
+
+	from = (uint64_t *)&port->pc->stats;
+	to = (uint64_t *)stats;
+	for (i = 0; i < sizeof (GPPortStats) / sizeof (uint64_t); i++)
+		to[i] = STATS_LOAD (from[i]);
+	if (port->pc->ops && port->pc->ops->get_stats)
+		CHECK_RESULT (port->pc->ops->get_stats (port, stats));
+	return (GP_OK);
+}
+
+/**
+ * \brief Reset the transfer metrics of a port
+ *
+ * \param port a #GPPort
+ *
+ * Sets all counters returned by gp_port_get_stats() to 0.
+ *
+ * \return a gphoto2 error code
+ **/
+int
+gp_port_reset_stats (GPPort *port)
+{
+	uint64_t *counters;
+	unsigned int i;
+
+	C_PARAMS (port);
+
+	counters = (uint64_t *)&port->pc->stats;
+	for (i = 0; i < sizeof (GPPortStats) / sizeof (uint64_t); i++)
+		STATS_STORE (counters[i], 0);
+	if (port->pc->ops && port->pc->ops->reset_stats)
+		CHECK_RESULT (port->pc->ops->reset_stats (port));
+	return (GP_OK);
+}
+
 /**
  * \brief Check for intterupt.
  *
@@ -463,6 +819,7 @@ int
 gp_port_check_int (GPPort *port, char *data, int size)
 {
         int retval;
+	uint64_t start;
 
 	gp_log (GP_LOG_DATA, __func__, "Reading %i = 0x%x bytes from interrupt endpoint...", size, size);
 
@@ -471,7 +828,10 @@ gp_port_check_int (GPPort *port, char *data, int size)
 
 	/* Check if we read as many bytes as expected */
 	CHECK_SUPP (port, "check_int", port->pc->ops->check_int);
+	start = STATS_START (port);
 	retval = port->pc->ops->check_int (port, data, size, port->timeout);
+	if (start)
+		stats_record (port, GP_PORT_STATS_CHECK_INT, start, retval);
 	CHECK_RESULT (retval);
 	LOG_DATA (data, retval, size, "Read   ", "from interrupt endpoint:");
 
@@ -496,6 +856,7 @@ int
 gp_port_check_int_fast (GPPort *port, char *data, int size)
 {
         int retval;
+	uint64_t start;
 
         gp_log (GP_LOG_DATA, __func__, "Reading %i = 0x%x bytes from interrupt endpoint...", size, size);
 
@@ -504,7 +865,10 @@ gp_port_check_int_fast (GPPort *port, char *data, int size)
 
 	/* Check if we read as many bytes as expected */
 	CHECK_SUPP (port, "check_int", port->pc->ops->check_int);
+	start = STATS_START (port);
 	retval = port->pc->ops->check_int (port, data, size, FAST_TIMEOUT);
+	if (start)
+		stats_record (port, GP_PORT_STATS_CHECK_INT, start, retval);
 	CHECK_RESULT (retval);
 
 #ifdef IGNORE_EMPTY_INTR_READS
@@ -841,6 +1205,19 @@ gp_port_usb_clear_halt (GPPort *port, int ep)
 	CHECK_INIT (port);
 
 	CHECK_SUPP (port, "clear_halt", port->pc->ops->clear_halt);
+	if (STATS_ENABLED (port)) {
+		switch (ep) {
+		case GP_PORT_USB_ENDPOINT_IN:
+			STATS_ADD (port->pc->stats.transfers[GP_PORT_STATS_READ].clear_halts, 1);
+			break;
+		case GP_PORT_USB_ENDPOINT_OUT:
+			STATS_ADD (port->pc->stats.transfers[GP_PORT_STATS_WRITE].clear_halts, 1);
+			break;
+		case GP_PORT_USB_ENDPOINT_INT:
+			STATS_ADD (port->pc->stats.transfers[GP_PORT_STATS_CHECK_INT].clear_halts, 1);
+			break;
+		}
+	}
         CHECK_RESULT (port->pc->ops->clear_halt (port, ep));
 
         return (GP_OK);
@@ -865,6 +1242,7 @@ gp_port_usb_msg_write (GPPort *port, int request, int value, int index,
 	char *bytes, int size)
 {
         int retval;
+	uint64_t start;
 
 	GP_LOG_DATA (bytes, size, "Writing message (request=0x%x value=0x%x index=0x%x size=%i=0x%x):",
 		     request, value, index, size, size);
@@ -873,7 +1251,10 @@ gp_port_usb_msg_write (GPPort *port, int request, int value, int index,
 	CHECK_INIT (port);
 
 	CHECK_SUPP (port, "msg_write", port->pc->ops->msg_write);
+	start = STATS_START (port);
         retval = port->pc->ops->msg_write(port, request, value, index, bytes, size);
+	if (start)
+		stats_record (port, GP_PORT_STATS_MSG_WRITE, start, retval);
 	CHECK_RESULT (retval);
 
         return (retval);
@@ -898,6 +1279,7 @@ gp_port_usb_msg_read (GPPort *port, int request, int value, int index,
 	char *bytes, int size)
 {
         int retval;
+	uint64_t start;
 
 	gp_log (GP_LOG_DATA, __func__, "Reading message (request=0x%x value=0x%x index=0x%x size=%i=0x%x)...",
 		request, value, index, size, size);
@@ -906,7 +1288,10 @@ gp_port_usb_msg_read (GPPort *port, int request, int value, int index,
 	CHECK_INIT (port);
 
 	CHECK_SUPP (port, "msg_read", port->pc->ops->msg_read);
+	start = STATS_START (port);
         retval = port->pc->ops->msg_read (port, request, value, index, bytes, size);
+	if (start)
+		stats_record (port, GP_PORT_STATS_MSG_READ, start, retval);
 	CHECK_RESULT (retval);
 
 	LOG_DATA (bytes, retval, size, "Read", "USB message (request=0x%x value=0x%x index=0x%x size=%i=0x%x)",
@@ -938,6 +1323,7 @@ gp_port_usb_msg_interface_write (GPPort *port, int request,
 	int value, int index, char *bytes, int size)
 {
         int retval;
+	uint64_t start;
 
 	GP_LOG_DATA (bytes, size, "Writing message (request=0x%x value=0x%x index=0x%x size=%i=0x%x)...",
 		     request, value, index, size, size);
@@ -946,8 +1332,11 @@ gp_port_usb_msg_interface_write (GPPort *port, int request,
 	CHECK_INIT (port);
 
 	CHECK_SUPP (port, "msg_build", port->pc->ops->msg_interface_write);
+	start = STATS_START (port);
         retval = port->pc->ops->msg_interface_write(port, request,
         		value, index, bytes, size);
+	if (start)
+		stats_record (port, GP_PORT_STATS_MSG_WRITE, start, retval);
 	CHECK_RESULT (retval);
 
         return (retval);
@@ -973,6 +1362,7 @@ gp_port_usb_msg_interface_read (GPPort *port, int request, int value, int index,
 	char *bytes, int size)
 {
         int retval;
+	uint64_t start;
 
 	gp_log (GP_LOG_DATA, __func__, "Reading message (request=0x%x value=0x%x index=0x%x size=%i=0x%x)...",
 		request, value, index, size, size);
@@ -981,8 +1371,11 @@ gp_port_usb_msg_interface_read (GPPort *port, int request, int value, int index,
 	CHECK_INIT (port);
 
 	CHECK_SUPP (port, "msg_read", port->pc->ops->msg_interface_read);
+	start = STATS_START (port);
         retval = port->pc->ops->msg_interface_read (port, request,
         		value, index, bytes, size);
+	if (start)
+		stats_record (port, GP_PORT_STATS_MSG_READ, start, retval);
 	CHECK_RESULT (retval);
 
 	LOG_DATA (bytes, retval, size, "Read", "USB message (request=0x%x value=0x%x index=0x%x size=%i=0x%x)",
@@ -1016,6 +1409,7 @@ gp_port_usb_msg_class_write (GPPort *port, int request,
 	int value, int index, char *bytes, int size)
 {
         int retval;
+	uint64_t start;
 
 	GP_LOG_DATA (bytes, size, "Writing message (request=0x%x value=0x%x index=0x%x size=%i=0x%x):",
 		     request, value, index, size, size);
@@ -1024,8 +1418,11 @@ gp_port_usb_msg_class_write (GPPort *port, int request,
 	CHECK_INIT (port);
 
 	CHECK_SUPP (port, "msg_build", port->pc->ops->msg_class_write);
+	start = STATS_START (port);
         retval = port->pc->ops->msg_class_write(port, request,
         		value, index, bytes, size);
+	if (start)
+		stats_record (port, GP_PORT_STATS_MSG_WRITE, start, retval);
 	CHECK_RESULT (retval);
 
         return (retval);
@@ -1051,6 +1448,7 @@ gp_port_usb_msg_class_read (GPPort *port, int request, int value, int index,
 	char *bytes, int size)
 {
         int retval;
+	uint64_t start;
 
 	gp_log (GP_LOG_DATA, __func__, "Reading message (request=0x%x value=0x%x index=0x%x size=%i=0x%x)...",
 		request, value, index, size, size);
@@ -1059,8 +1457,11 @@ gp_port_usb_msg_class_read (GPPort *port, int request, int value, int index,
 	CHECK_INIT (port);
 
 	CHECK_SUPP (port, "msg_read", port->pc->ops->msg_class_read);
+	start = STATS_START (port);
         retval = port->pc->ops->msg_class_read (port, request,
         		value, index, bytes, size);
+	if (start)
+		stats_record (port, GP_PORT_STATS_MSG_READ, start, retval);
 	CHECK_RESULT (retval);
 
 	LOG_DATA (bytes, retval, size, "Read", "USB message (request=0x%x value=0x%x index=0x%x size=%i=0x%x)",
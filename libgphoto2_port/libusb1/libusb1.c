@@ -28,6 +28,10 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 
 #include <libusb.h>
 
@@ -120,33 +124,112 @@ static int translate_libusb_error( int error, int default_return )
 	}
 }
 
-struct _PrivateIrqCompleted {
-	struct _PrivateIrqCompleted	*next;
-	enum libusb_transfer_status	status;
-	int							data_len;
-	unsigned char				*data;
+/* Buffers from libusb_dev_mem_alloc(). usbfs maps them into our address
+ * space, so bulk transfers into them need no copy between kernel and
+ * user space. Getting one is an mmap(), so they are kept for reuse. */
+struct _PrivateBuffer {
+	struct _PrivateBuffer	*next;
+	unsigned char		*data;
+	int			size;
+	int			used;
 };
 
+/* Unused buffers kept, enough for a stream and a plain read. */
+#define NB_SPARE_BUFFERS 10
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+# define HAVE_LIBUSB_DEV_MEM
+#endif
+
+#ifdef LIBUSB_HOTPLUG_MATCH_ANY
+# define HAVE_LIBUSB_HOTPLUG
+#endif
+
+#if defined(HAVE_LIBPTHREAD) && defined(HAVE_PTHREAD_H)
+# define USE_DEVICELIST_LOCK
+#endif
+
+#ifdef __GNUC__
+# define HAVE_DESTRUCTOR
+#endif
+
 #define NB_INTERRUPT_TRANSFERS 10
 /* FIXME: safe size? */
 #define INTERRUPT_BUFFER_SIZE 256
 
+/* Completed interrupt transfers wait in a ring of this many slots,
+ * a power of 2, for gp_libusb1_check_int(). */
+#define NB_IRQ_SLOTS 64
+
+struct _PrivateIrqCompleted {
+	enum libusb_transfer_status	status;
+	int				data_len;
+	unsigned char			data[INTERRUPT_BUFFER_SIZE];
+};
+
+/* _cb_irq() is the only one writing irqs_head, gp_libusb1_check_int()
+ * the only one writing irqs_tail, so the ring needs no lock even when
+ * they run in different threads. */
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+# define IRQ_LOAD(x)	__atomic_load_n (&(x), __ATOMIC_ACQUIRE)
+# define IRQ_STORE(x,v)	__atomic_store_n (&(x), (v), __ATOMIC_RELEASE)
+#else
+# define IRQ_LOAD(x)	(x)
+# define IRQ_STORE(x,v)	((x) = (v))
+#endif
+
+/* One USB device of the system, with all the descriptors the lookups
+ * below need. The config descriptors are parsed copies, they stay valid
+ * without the libusb_device they were read from. */
+struct _PrivateDevice {
+	int					busnr;
+	int					devnr;
+	struct libusb_device_descriptor		desc;
+	struct libusb_config_descriptor		**configs;	/* desc.bNumConfigurations, NULL if unreadable */
+};
+
+/* The USB devices of the system, shared by all ports of the process.
+ * Autodetection asks every port for every camera model, so these
+ * lookups must not go to the bus. Where libusb supports hotplug the list
+ * is only read again after a device arrived or left, otherwise at most
+ * once a second. It has its own libusb context, ports do their I/O on
+ * one of their own that is created when they are opened. */
+static struct {
+	libusb_context		*ctx;
+	int			users;
+	int			nrofdevs;
+	struct _PrivateDevice	*devs;
+	time_t			lastchecked;
+	int			changed;	/* set by the hotplug callback */
+#ifdef HAVE_LIBUSB_HOTPLUG
+	int				hotplug;
+	libusb_hotplug_callback_handle	cbhandle;
+#endif
+} devicelist;
+
+#ifdef USE_DEVICELIST_LOCK
+static pthread_mutex_t devicelist_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_DEVICELIST()	pthread_mutex_lock (&devicelist_lock)
+# define UNLOCK_DEVICELIST()	pthread_mutex_unlock (&devicelist_lock)
+#else
+# define LOCK_DEVICELIST()
+# define UNLOCK_DEVICELIST()
+#endif
+
 struct _GPPortPrivateLibrary {
 	libusb_context *ctx;
-	libusb_device *d;
 	libusb_device_handle *dh;
 
+	/* the device found by the find_* functions, -1 if none yet */
+	int busnr;
+	int devnr;
+
 	int config;
 	int interface;
 	int altsetting;
 
 	int detached;
 
-	time_t				devslastchecked;
-	int				nrofdevs;
-	struct libusb_device_descriptor	*descs;
-	libusb_device			**devs;
-
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 	/* for dumping the read usb content */
 	int				logfd;
@@ -154,8 +237,14 @@ struct _GPPortPrivateLibrary {
 
 	struct libusb_transfer		*transfers[NB_INTERRUPT_TRANSFERS];
 	int				nrofactiveinttransfers;
-	struct _PrivateIrqCompleted	*irqs_head;
-	struct _PrivateIrqCompleted	*irqs_tail;
+	struct _PrivateIrqCompleted	irqs[NB_IRQ_SLOTS];
+	volatile unsigned int		irqs_head;	/* next slot _cb_irq() fills */
+	volatile unsigned int		irqs_tail;	/* next slot check_int reads */
+	unsigned int			irqs_dropped;	/* ring was full, see gp_libusb1_get_stats() */
+	unsigned int			irqs_highwater;	/* most slots ever in use */
+
+	struct _PrivateBuffer		*buffers;
+	int				nodevmem;	/* libusb_dev_mem_alloc() failed */
 };
 
 GPPortType
@@ -165,29 +254,188 @@ gp_port_library_type (void)
 }
 
 
-static ssize_t
-load_devicelist (GPPortPrivateLibrary *pl) {
-	time_t	xtime;
+static void
+free_devicelist (void)
+{
+	int d, i;
 
-	time(&xtime);
-	if (xtime != pl->devslastchecked) {
-		if (pl->nrofdevs)
-			libusb_free_device_list (pl->devs, 1);
-		free (pl->descs);
-		pl->nrofdevs = 0;
-		pl->devs = NULL;
-		pl->descs = NULL;
+	for (d = 0; d < devicelist.nrofdevs; d++) {
+		for (i = 0; i < devicelist.devs[d].desc.bNumConfigurations; i++)
+			if (devicelist.devs[d].configs[i])
+				libusb_free_config_descriptor (devicelist.devs[d].configs[i]);
+		free (devicelist.devs[d].configs);
 	}
-	if (!pl->nrofdevs) {
-		int 	i;
+	free (devicelist.devs);
+	devicelist.devs = NULL;
+	devicelist.nrofdevs = 0;
+}
 
-		pl->nrofdevs = libusb_get_device_list (pl->ctx, &pl->devs);
-		C_MEM (pl->descs = calloc (pl->nrofdevs, sizeof(pl->descs[0])));
-		for (i=0;i<pl->nrofdevs;i++)
-			LOG_ON_LIBUSB_E (libusb_get_device_descriptor(pl->devs[i], &pl->descs[i]));
+#ifdef HAVE_LIBUSB_HOTPLUG
+static int LIBUSB_CALL
+_cb_hotplug (libusb_context *ctx, libusb_device *dev,
+	     libusb_hotplug_event event, void *user_data)
+{
+	devicelist.changed = 1;
+	return 0;
+}
+#endif
+
+/* Call with the devicelist locked. */
+static int
+load_devicelist (void) {
+	libusb_device	**devs = NULL;
+	time_t		xtime;
+	ssize_t		nrofdevs;
+	int		d, i;
+
+#ifdef HAVE_LIBUSB_HOTPLUG
+	if (devicelist.hotplug) {
+		struct timeval tv = { 0, 0 };
+
+		/* runs _cb_hotplug for what happened since the last call */
+		LOG_ON_LIBUSB_E (libusb_handle_events_timeout_completed (devicelist.ctx, &tv, NULL));
+	} else
+#endif
+	{
+		time(&xtime);
+		if (xtime != devicelist.lastchecked)
+			devicelist.changed = 1;
+		devicelist.lastchecked = xtime;
+	}
+	if (!devicelist.changed)
+		return devicelist.nrofdevs;
+
+	free_devicelist ();
+	nrofdevs = libusb_get_device_list (devicelist.ctx, &devs);
+	if (nrofdevs < 0)
+		return translate_libusb_error (nrofdevs, GP_ERROR_IO);
+	devicelist.devs = calloc (nrofdevs ? nrofdevs : 1, sizeof(devicelist.devs[0]));
+	if (!devicelist.devs) {
+		libusb_free_device_list (devs, 1);
+		return GP_ERROR_NO_MEMORY;
+	}
+	for (d = 0; d < nrofdevs; d++) {
+		struct _PrivateDevice *dev = &devicelist.devs[devicelist.nrofdevs];
+
+		if (LOG_ON_LIBUSB_E (libusb_get_device_descriptor (devs[d], &dev->desc)))
+			continue;
+		dev->configs = calloc (dev->desc.bNumConfigurations + 1, sizeof(dev->configs[0]));
+		if (!dev->configs)
+			continue;
+		for (i = 0; i < dev->desc.bNumConfigurations; i++)
+			LOG_ON_LIBUSB_E (libusb_get_config_descriptor (devs[d], i, &dev->configs[i]));
+		dev->busnr = libusb_get_bus_number (devs[d]);
+		dev->devnr = libusb_get_device_address (devs[d]);
+		devicelist.nrofdevs++;
+	}
+	libusb_free_device_list (devs, 1);
+	devicelist.changed = 0;
+	GP_LOG_D ("Read %d USB devices.", devicelist.nrofdevs);
+	return devicelist.nrofdevs;
+}
+
+static void
+release_devicelist (void)
+{
+#ifdef HAVE_LIBUSB_HOTPLUG
+	if (devicelist.hotplug)
+		libusb_hotplug_deregister_callback (devicelist.ctx, devicelist.cbhandle);
+	devicelist.hotplug = 0;
+#endif
+	free_devicelist ();
+	libusb_exit (devicelist.ctx);
+	devicelist.ctx = NULL;
+}
+
+/* Every port and every gp_port_library_list() call holds a reference. */
+static int
+ref_devicelist (void)
+{
+	LOCK_DEVICELIST ();
+	if (!devicelist.ctx) {
+		if (LOG_ON_LIBUSB_E (libusb_init (&devicelist.ctx))) {
+			devicelist.ctx = NULL;
+			UNLOCK_DEVICELIST ();
+			return GP_ERROR_IO;
+		}
+		devicelist.changed = 1;
+#ifdef HAVE_LIBUSB_HOTPLUG
+		if (libusb_has_capability (LIBUSB_CAP_HAS_HOTPLUG) &&
+		    !LOG_ON_LIBUSB_E (libusb_hotplug_register_callback (devicelist.ctx,
+				LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+				0, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+				LIBUSB_HOTPLUG_MATCH_ANY, _cb_hotplug, NULL,
+				&devicelist.cbhandle)))
+			devicelist.hotplug = 1;
+#endif
 	}
-	time (&pl->devslastchecked);
-	return pl->nrofdevs;
+	devicelist.users++;
+	UNLOCK_DEVICELIST ();
+	return GP_OK;
+}
+
+static void
+unref_devicelist (void)
+{
+	LOCK_DEVICELIST ();
+	devicelist.users--;
+#ifndef HAVE_DESTRUCTOR
+	/* Nothing would release it when this iolib gets unloaded. */
+	if (!devicelist.users)
+		release_devicelist ();
+#endif
+	UNLOCK_DEVICELIST ();
+}
+
+#ifdef HAVE_DESTRUCTOR
+/* Keeps the list while the iolib is loaded, not only while a port is
+ * initialized: gp_port_set_info() re-initializes the port for every
+ * path it is given. */
+static void __attribute__((destructor))
+unload_devicelist (void)
+{
+	if (devicelist.ctx)
+		release_devicelist ();
+}
+#endif
+
+/* Whether a device has interfaces other than those of classes a camera
+ * never uses. Except for HUBs, usually the interfaces have the classes,
+ * not the device. */
+static int
+gp_libusb1_maybe_camera (struct _PrivateDevice *dev, int skip_wireless)
+{
+	int i, i1, i2, unknownint = 0;
+
+	/* Devices which are definitely not cameras. */
+	if (	(dev->desc.bDeviceClass == LIBUSB_CLASS_HUB)		||
+		(dev->desc.bDeviceClass == LIBUSB_CLASS_HID)		||
+		(dev->desc.bDeviceClass == LIBUSB_CLASS_PRINTER)	||
+		(dev->desc.bDeviceClass == LIBUSB_CLASS_COMM)		||
+		(skip_wireless && (dev->desc.bDeviceClass == 0xe0))	/* wireless / bluetooth */
+	)
+		return 0;
+	for (i = 0; i < dev->desc.bNumConfigurations; i++) {
+		const struct libusb_config_descriptor *config = dev->configs[i];
+
+		if (!config) {
+			unknownint++;
+			continue;
+		}
+		for (i1 = 0; i1 < config->bNumInterfaces; i1++)
+			for (i2 = 0; i2 < config->interface[i1].num_altsetting; i2++) {
+				const struct libusb_interface_descriptor *intf = &config->interface[i1].altsetting[i2];
+				if (	(intf->bInterfaceClass == LIBUSB_CLASS_HID)	||
+					(intf->bInterfaceClass == LIBUSB_CLASS_PRINTER)	||
+					(intf->bInterfaceClass == LIBUSB_CLASS_COMM)	||
+					(skip_wireless && (intf->bInterfaceClass == 0xe0))	/* wireless/bluetooth*/
+				)
+					continue;
+				unknownint++;
+			}
+	}
+	/* when we find only hids, printer or comm ifaces  ... skip this */
+	return unknownint != 0;
 }
 
 int
@@ -195,15 +443,9 @@ gp_port_library_list (GPPortInfoList *list)
 {
 	GPPortInfo	info;
 	int		nrofdevices = 0;
-	int		d, i, i1, i2, unknownint;
-	libusb_context	*ctx;
-	libusb_device	**devs = NULL;
-	int		nrofdevs = 0;
-	struct libusb_device_descriptor	*descs;
+	int		d, nrofdevs;
 
-	C_LIBUSB (libusb_init (&ctx), GP_ERROR_IO);
-
-	/* TODO: make sure libusb_exit gets called in all error paths inside this function */
+	C_GP (ref_devicelist ());
 
 	/* generic matcher. This will catch passed XXX,YYY entries for instance. */
 	C_GP (gp_port_info_new (&info));
@@ -212,56 +454,15 @@ gp_port_library_list (GPPortInfoList *list)
 	gp_port_info_set_path (info, "^usb:");
 	gp_port_info_list_append (list, info); /* do not check return value, it might be -1 */
 
-	nrofdevs = libusb_get_device_list (ctx, &devs);
-	if (!nrofdevs) {
-		libusb_exit (ctx); /* should free all stuff above */
-		goto nodevices;
-	}
-
-	C_MEM (descs = calloc (nrofdevs, sizeof(descs[0])));
-	for (i=0;i<nrofdevs;i++)
-		LOG_ON_LIBUSB_E (libusb_get_device_descriptor(devs[i], &descs[i]));
-
-	for (d = 0; d < nrofdevs; d++) {
-		/* Devices which are definitely not cameras. */
-		if (	(descs[d].bDeviceClass == LIBUSB_CLASS_HUB)		||
-			(descs[d].bDeviceClass == LIBUSB_CLASS_HID)		||
-			(descs[d].bDeviceClass == LIBUSB_CLASS_PRINTER)	||
-			(descs[d].bDeviceClass == LIBUSB_CLASS_COMM)	||
-			(descs[d].bDeviceClass == 0xe0)	/* wireless / bluetooth */
-		)
-			continue;
-		/* excepts HUBs, usually the interfaces have the classes, not
-		 * the device */
-		unknownint = 0;
-		for (i = 0; i < descs[d].bNumConfigurations; i++) {
-			struct libusb_config_descriptor *config;
+	LOCK_DEVICELIST ();
+	nrofdevs = load_devicelist ();
 
-			if (LOG_ON_LIBUSB_E (libusb_get_config_descriptor (devs[d], i, &config))) {
-				unknownint++;
-				continue;
-			}
-			for (i1 = 0; i1 < config->bNumInterfaces; i1++)
-				for (i2 = 0; i2 < config->interface[i1].num_altsetting; i2++) {
-					const struct libusb_interface_descriptor *intf = &config->interface[i1].altsetting[i2];
-					if (	(intf->bInterfaceClass == LIBUSB_CLASS_HID)	||
-						(intf->bInterfaceClass == LIBUSB_CLASS_PRINTER)	||
-						(intf->bInterfaceClass == LIBUSB_CLASS_COMM)	||
-						(intf->bInterfaceClass == 0xe0)	/* wireless/bluetooth*/
-					)
-						continue;
-					unknownint++;
-				}
-			libusb_free_config_descriptor (config);
-		}
-		/* when we find only hids, printer or comm ifaces  ... skip this */
-		if (!unknownint)
-			continue;
-		/* Note: We do not skip USB storage. Some devices can support both,
-		 * and the Ricoh erronously reports it.
-		 */
-		nrofdevices++;
-	}
+	/* Note: We do not skip USB storage. Some devices can support both,
+	 * and the Ricoh erronously reports it.
+	 */
+	for (d = 0; d < nrofdevs; d++)
+		if (gp_libusb1_maybe_camera (&devicelist.devs[d], 1))
+			nrofdevices++;
 
 #if 0
 	/* If we already added usb:, and have 0 or 1 devices we have nothing to do.
@@ -273,62 +474,29 @@ gp_port_library_list (GPPortInfoList *list)
 		return (GP_OK);
 #endif
 
-	/* Redo the same bus/device walk, but now add the ports with usb:x,y notation,
+	/* Redo the same device walk, but now add the ports with usb:x,y notation,
 	 * so we can address all USB devices.
 	 */
 	for (d = 0; d < nrofdevs; d++) {
 		char path[200];
 
-		/* Devices which are definitely not cameras. */
-		if (	(descs[d].bDeviceClass == LIBUSB_CLASS_HUB)		||
-			(descs[d].bDeviceClass == LIBUSB_CLASS_HID)		||
-			(descs[d].bDeviceClass == LIBUSB_CLASS_PRINTER)	||
-			(descs[d].bDeviceClass == LIBUSB_CLASS_COMM)
-		)
-			continue;
-		/* excepts HUBs, usually the interfaces have the classes, not
-		 * the device */
-		unknownint = 0;
-		for (i = 0; i < descs[d].bNumConfigurations; i++) {
-			struct libusb_config_descriptor *config;
-
-			if (LOG_ON_LIBUSB_E (libusb_get_config_descriptor (devs[d], i, &config))) {
-				unknownint++;
-				continue;
-			}
-			for (i1 = 0; i1 < config->bNumInterfaces; i1++)
-				for (i2 = 0; i2 < config->interface[i1].num_altsetting; i2++) {
-					const struct libusb_interface_descriptor *intf = &config->interface[i1].altsetting[i2];
-					if (	(intf->bInterfaceClass == LIBUSB_CLASS_HID)	||
-						(intf->bInterfaceClass == LIBUSB_CLASS_PRINTER)	||
-						(intf->bInterfaceClass == LIBUSB_CLASS_COMM))
-						continue;
-					unknownint++;
-				}
-			libusb_free_config_descriptor (config);
-		}
-		/* when we find only hids, printer or comm ifaces  ... skip this */
-		if (!unknownint)
+		if (!gp_libusb1_maybe_camera (&devicelist.devs[d], 0))
 			continue;
-		/* Note: We do not skip USB storage. Some devices can support both,
-		 * and the Ricoh erronously reports it.
-		 */
-		C_GP (gp_port_info_new (&info));
+		if (gp_port_info_new (&info) < GP_OK)
+			break;
 		gp_port_info_set_type (info, GP_PORT_USB);
 		gp_port_info_set_name (info, "Universal Serial Bus");
 		snprintf (path,sizeof(path), "usb:%03d,%03d",
-			libusb_get_bus_number (devs[d]),
-			libusb_get_device_address (devs[d])
+			devicelist.devs[d].busnr,
+			devicelist.devs[d].devnr
 		);
 		gp_port_info_set_path (info, path);
-		C_GP (gp_port_info_list_append (list, info));
+		if (gp_port_info_list_append (list, info) < GP_OK)
+			break;
 	}
+	UNLOCK_DEVICELIST ();
+	unref_devicelist ();
 
-	libusb_free_device_list (devs, 1);
-	libusb_exit (ctx); /* should free all stuff above */
-	free (descs);
-
-nodevices:
 	/* This will only be added if no other device was ever added.
 	 * Users doing "usb:" usage will enter the regular expression matcher case. */
 	if (nrofdevices == 0) {
@@ -347,8 +515,9 @@ static int gp_libusb1_init (GPPort *port)
 	memset (port->pl, 0, sizeof (GPPortPrivateLibrary));
 
 	port->pl->config = port->pl->interface = port->pl->altsetting = -1;
+	port->pl->busnr = port->pl->devnr = -1;
 
-	if (LOG_ON_LIBUSB_E (libusb_init (&port->pl->ctx))) {
+	if (ref_devicelist () < GP_OK) {
 		free (port->pl);
 		port->pl = NULL;
 		return GP_ERROR_IO;
@@ -356,9 +525,6 @@ static int gp_libusb1_init (GPPort *port)
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 	unlink("usblog.raw");
 	port->pl->logfd = open("usblog.raw",O_CREAT|O_WRONLY,0644);
-#endif
-#if 0
-	libusb_set_debug (port->pl->ctx, 255);
 #endif
 	return GP_OK;
 }
@@ -367,21 +533,43 @@ static int
 gp_libusb1_exit (GPPort *port)
 {
 	if (port->pl) {
-		free (port->pl->descs);
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 		if (port->pl->logfd >=0 ) close (port->pl->logfd);
 #endif
-		if (port->pl->nrofdevs)
-			libusb_free_device_list (port->pl->devs, 1);
-		libusb_exit (port->pl->ctx);
+		if (port->pl->ctx)
+			libusb_exit (port->pl->ctx);
 		free (port->pl);
 		port->pl = NULL;
+		unref_devicelist ();
 	}
 	return GP_OK;
 }
 
 static int gp_libusb1_find_path_lib(GPPort *port);
 static int gp_libusb1_queue_interrupt_urbs (GPPort *port);
+
+/* Opens the device the find_* functions found, on the context of the port. */
+static int
+gp_libusb1_open_device (GPPort *port)
+{
+	libusb_device	**devs = NULL;
+	ssize_t		nrofdevs;
+	int		d, ret = LIBUSB_ERROR_NO_DEVICE;
+
+	nrofdevs = libusb_get_device_list (port->pl->ctx, &devs);
+	C_LIBUSB (nrofdevs, GP_ERROR_IO);
+	for (d = 0; d < nrofdevs; d++) {
+		if ((port->pl->busnr != libusb_get_bus_number (devs[d])) ||
+		    (port->pl->devnr != libusb_get_device_address (devs[d])))
+			continue;
+		ret = LOG_ON_LIBUSB_E (libusb_open (devs[d], &port->pl->dh));
+		break;
+	}
+	libusb_free_device_list (devs, 1);
+	if (ret < LIBUSB_SUCCESS)
+		return translate_libusb_error (ret, GP_ERROR_IO);
+	return GP_OK;
+}
 static int
 gp_libusb1_open (GPPort *port)
 {
@@ -390,12 +578,18 @@ gp_libusb1_open (GPPort *port)
 	GP_LOG_D ("()");
 	C_PARAMS (port);
 
-	if (!port->pl->d) {
+	if (port->pl->busnr < 0) {
 		gp_libusb1_find_path_lib(port);
-		C_PARAMS (port->pl->d);
+		C_PARAMS (port->pl->busnr >= 0);
 	}
 
-	C_LIBUSB (libusb_open (port->pl->d, &port->pl->dh), GP_ERROR_IO);
+	if (!port->pl->ctx) {
+		C_LIBUSB (libusb_init (&port->pl->ctx), GP_ERROR_IO);
+#if 0
+		libusb_set_debug (port->pl->ctx, 255);
+#endif
+	}
+	C_GP (gp_libusb1_open_device (port));
 	if (!port->pl->dh) {
 		int saved_errno = errno;
 		gp_port_set_error (port, _("Could not open USB device (%s)."),
@@ -498,6 +692,90 @@ _close_async_interrupts(GPPort *port)
 	return GP_OK;
 }
 
+#ifdef HAVE_LIBUSB_DEV_MEM
+static char *
+gp_libusb1_alloc_buffer_lib (GPPort *port, int size)
+{
+	struct _PrivateBuffer *buf;
+
+	if (!port->pl->dh || port->pl->nodevmem)
+		return NULL;
+	for (buf = port->pl->buffers; buf; buf = buf->next)
+		if (!buf->used && (buf->size == size)) {
+			buf->used = 1;
+			return (char*)buf->data;
+		}
+	if (!(buf = calloc (1, sizeof (*buf))))
+		return NULL;
+	buf->data = libusb_dev_mem_alloc (port->pl->dh, size);
+	if (!buf->data) {
+		/* not Linux, or a kernel before 4.6 */
+		GP_LOG_D ("No zero-copy USB buffers, using malloc() instead.");
+		port->pl->nodevmem = 1;
+		free (buf);
+		return NULL;
+	}
+	buf->size = size;
+	buf->used = 1;
+	buf->next = port->pl->buffers;
+	port->pl->buffers = buf;
+	return (char*)buf->data;
+}
+
+static int
+gp_libusb1_free_buffer_lib (GPPort *port, char *data, int size)
+{
+	struct _PrivateBuffer *buf, **prev;
+	int spare = 0;
+
+	for (buf = port->pl->buffers; buf; buf = buf->next)
+		spare += !buf->used;
+	for (prev = &port->pl->buffers; (buf = *prev); prev = &buf->next)
+		if (buf->data == (unsigned char*)data)
+			break;
+	if (!buf)
+		return GP_ERROR_BAD_PARAMETERS; /* not ours */
+	buf->used = 0;
+	if (spare >= NB_SPARE_BUFFERS) {
+		*prev = buf->next;
+		libusb_dev_mem_free (port->pl->dh, buf->data, buf->size);
+		free (buf);
+	}
+	return GP_OK;
+}
+
+static void
+gp_libusb1_release_buffers (GPPort *port)
+{
+	struct _PrivateBuffer *buf;
+
+	while ((buf = port->pl->buffers)) {
+		if (buf->used)
+			GP_LOG_E ("Buffer %p still in use when closing the port.", buf->data);
+		port->pl->buffers = buf->next;
+		libusb_dev_mem_free (port->pl->dh, buf->data, buf->size);
+		free (buf);
+	}
+}
+#else
+static char *
+gp_libusb1_alloc_buffer_lib (GPPort *port, int size)
+{
+	return NULL;
+}
+
+static int
+gp_libusb1_free_buffer_lib (GPPort *port, char *data, int size)
+{
+	return GP_ERROR_NOT_SUPPORTED;
+}
+
+static void
+gp_libusb1_release_buffers (GPPort *port)
+{
+}
+#endif
+
 static int
 gp_libusb1_close (GPPort *port)
 {
@@ -537,21 +815,13 @@ gp_libusb1_close (GPPort *port)
 			gp_port_set_error (port, _("Could not reattach kernel driver of camera device."));
 	}
 
+	gp_libusb1_release_buffers (port);
 	libusb_close (port->pl->dh);
 
-	struct _PrivateIrqCompleted *irq_iter;
-	struct _PrivateIrqCompleted *irq_next;
-
-	irq_iter=port->pl->irqs_head;
-	while (irq_iter != NULL) {
-		if (irq_iter->data)
-			free(irq_iter->data);
-		irq_next = irq_iter->next;
-		free(irq_iter);
-		irq_iter = irq_next;
-	}
-	port->pl->irqs_head = NULL;
-	port->pl->irqs_tail = NULL;
+	GP_LOG_D ("%u interrupts dropped, at most %u of %d queued.",
+		  port->pl->irqs_dropped, port->pl->irqs_highwater, NB_IRQ_SLOTS);
+	port->pl->irqs_head = 0;
+	port->pl->irqs_tail = 0;
 	port->pl->dh = NULL;
 	return GP_OK;
 }
@@ -614,6 +884,137 @@ gp_libusb1_read(GPPort *port, char *bytes, int size)
         return curread;
 }
 
+/* One transfer of gp_libusb1_read_stream(). */
+struct _PrivateStreamTransfer {
+	struct libusb_transfer	*transfer;
+	int			active;		/* submitted and not yet handed out */
+	int			completed;	/* set by _cb_stream */
+};
+
+static void LIBUSB_CALL
+_cb_stream(struct libusb_transfer *transfer)
+{
+	*(int*)transfer->user_data = 1;
+}
+
+static int
+gp_libusb1_submit_stream (GPPort *port, struct _PrivateStreamTransfer *st,
+			  unsigned long *submitted, unsigned long size, int transfer_size)
+{
+	int len = transfer_size;
+
+	if (size - *submitted < (unsigned long)len)
+		len = size - *submitted;
+	st->transfer->length = len;
+	st->completed = 0;
+	C_LIBUSB (libusb_submit_transfer (st->transfer), GP_ERROR_IO_READ);
+	st->active = 1;
+	*submitted += len;
+	return GP_OK;
+}
+
+/* Keeps up to transfers bulk IN transfers queued. Bulk transfers on one
+ * endpoint complete in the order they were submitted, so handing out
+ * the oldest one and resubmitting it for the next piece keeps the data
+ * in order. Never asks for more than size bytes, anything beyond would
+ * be the response of the device. */
+static int
+gp_libusb1_read_stream (GPPort *port, unsigned long size, int transfers,
+			int transfer_size, GPPortStreamFunc func, void *user_data)
+{
+	struct _PrivateStreamTransfer	*st;
+	struct libusb_transfer		*transfer;
+	unsigned long			submitted = 0;
+	int				i, head = 0, ret = GP_OK, r;
+
+	C_PARAMS (port && port->pl->dh && func && (transfers > 0) && (transfer_size > 0));
+
+	C_MEM (st = calloc (transfers, sizeof (*st)));
+	for (i = 0; i < transfers; i++) {
+		unsigned char *buf;
+
+		if (!(st[i].transfer = libusb_alloc_transfer (0))) {
+			ret = GP_ERROR_NO_MEMORY;
+			goto out;
+		}
+		buf = (unsigned char*)gp_libusb1_alloc_buffer_lib (port, transfer_size);
+		if (!buf && !(buf = malloc (transfer_size))) {
+			ret = GP_ERROR_NO_MEMORY;
+			goto out;
+		}
+		libusb_fill_bulk_transfer (st[i].transfer, port->pl->dh, port->settings.usb.inep,
+			buf, transfer_size, _cb_stream, &st[i].completed, port->timeout);
+	}
+
+	for (i = 0; (i < transfers) && (submitted < size) && (ret == GP_OK); i++)
+		ret = gp_libusb1_submit_stream (port, &st[i], &submitted, size, transfer_size);
+
+	while ((ret == GP_OK) && st[head].active) {
+		while (!st[head].completed) {
+			r = libusb_handle_events_completed (port->pl->ctx, &st[head].completed);
+			if ((r < LIBUSB_SUCCESS) && (r != LIBUSB_ERROR_INTERRUPTED)) {
+				ret = translate_libusb_error (LOG_ON_LIBUSB_E (r), GP_ERROR_IO_READ);
+				goto out;
+			}
+		}
+		st[head].active = 0;
+		transfer = st[head].transfer;
+		switch (transfer->status) {
+		case LIBUSB_TRANSFER_COMPLETED:
+			break;
+		case LIBUSB_TRANSFER_TIMED_OUT:
+			ret = GP_ERROR_TIMEOUT;
+			goto out;
+		case LIBUSB_TRANSFER_NO_DEVICE:
+			ret = GP_ERROR_IO_USB_FIND;
+			goto out;
+		default:
+			GP_LOG_E ("Stream transfer %p failed with status %d.", transfer, transfer->status);
+			ret = GP_ERROR_IO_READ;
+			goto out;
+		}
+		if (transfer->actual_length) {
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+			write(port->pl->logfd, transfer->buffer, transfer->actual_length);
+#endif
+			ret = func (port, (char*)transfer->buffer, transfer->actual_length, user_data);
+			if (ret < GP_OK)
+				goto out;
+		}
+		/* a short packet ends the data */
+		if (transfer->actual_length < transfer->length) {
+			GP_LOG_D ("Short stream transfer, %d of %d bytes.",
+				  transfer->actual_length, transfer->length);
+			goto out;
+		}
+		if (submitted < size)
+			ret = gp_libusb1_submit_stream (port, &st[head], &submitted, size, transfer_size);
+		head = (head + 1) % transfers;
+	}
+
+out:
+	/* Cancel and reap whatever is still in flight. */
+	for (i = 0; i < transfers; i++)
+		if (st[i].active && !st[i].completed)
+			libusb_cancel_transfer (st[i].transfer);
+	for (i = 0; i < transfers; i++) {
+		while (st[i].active && !st[i].completed) {
+			r = libusb_handle_events_completed (port->pl->ctx, &st[i].completed);
+			if ((r < LIBUSB_SUCCESS) && (r != LIBUSB_ERROR_INTERRUPTED))
+				break;
+		}
+		if (st[i].transfer && (!st[i].active || st[i].completed)) {
+			char *buf = (char*)st[i].transfer->buffer;
+
+			if (buf && (gp_libusb1_free_buffer_lib (port, buf, transfer_size) < GP_OK))
+				free (buf);
+			libusb_free_transfer (st[i].transfer);
+		}
+	}
+	free (st);
+	return ret;
+}
+
 static int
 gp_libusb1_reset(GPPort *port)
 {
@@ -627,10 +1028,56 @@ gp_libusb1_reset(GPPort *port)
 	return GP_OK;
 }
 
+static int
+gp_libusb1_get_stats (GPPort *port, GPPortStats *stats)
+{
+	C_PARAMS (port && port->pl && stats);
+
+	stats->irqs_dropped = IRQ_LOAD (port->pl->irqs_dropped);
+	stats->irqs_highwater = IRQ_LOAD (port->pl->irqs_highwater);
+	return GP_OK;
+}
+
+static int
+gp_libusb1_reset_stats (GPPort *port)
+{
+	C_PARAMS (port && port->pl);
+
+	IRQ_STORE (port->pl->irqs_dropped, 0);
+	IRQ_STORE (port->pl->irqs_highwater, 0);
+	return GP_OK;
+}
+
+/* Queues a completed interrupt for gp_libusb1_check_int(). */
+static void
+_irq_push(struct _GPPortPrivateLibrary *pl, struct libusb_transfer *transfer)
+{
+	struct _PrivateIrqCompleted *irq;
+	unsigned int head = pl->irqs_head;
+	unsigned int used = head - IRQ_LOAD (pl->irqs_tail);
+
+	if (used >= NB_IRQ_SLOTS) {
+		IRQ_STORE (pl->irqs_dropped, pl->irqs_dropped + 1);
+		GP_LOG_E ("Interrupt queue full, dropping interrupt with status %d.", transfer->status);
+		return;
+	}
+	irq = &pl->irqs[head % NB_IRQ_SLOTS];
+	irq->status = transfer->status;
+	irq->data_len = 0;
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+		irq->data_len = transfer->actual_length;
+		if (irq->data_len > INTERRUPT_BUFFER_SIZE)
+			irq->data_len = INTERRUPT_BUFFER_SIZE;
+		memcpy (irq->data, transfer->buffer, irq->data_len);
+	}
+	IRQ_STORE (pl->irqs_head, head + 1);
+	if (used + 1 > pl->irqs_highwater)
+		IRQ_STORE (pl->irqs_highwater, used + 1);
+}
+
 static void LIBUSB_CALL
 _cb_irq(struct libusb_transfer *transfer)
 {
-	struct _PrivateIrqCompleted *irq_new = NULL;
 	struct _GPPortPrivateLibrary *pl = transfer->user_data;
 	unsigned int i;
 	int ret;
@@ -639,17 +1086,8 @@ _cb_irq(struct libusb_transfer *transfer)
 
 	if ((transfer->status != LIBUSB_TRANSFER_CANCELLED) &&
 		(transfer->status != LIBUSB_TRANSFER_TIMED_OUT)
-	) {
-		irq_new = (struct _PrivateIrqCompleted *) calloc(1, sizeof (struct _PrivateIrqCompleted));
-		irq_new->status = transfer->status;
-
-		/* Add the irq to the list */
-		if (pl->irqs_tail)
-			pl->irqs_tail->next = irq_new;
-		pl->irqs_tail = irq_new;
-		if (!pl->irqs_head)
-			pl->irqs_head = irq_new;
-	}
+	)
+		_irq_push (pl, transfer);
 
 	if (	(transfer->status == LIBUSB_TRANSFER_CANCELLED) ||
 		(transfer->status == LIBUSB_TRANSFER_TIMED_OUT) || /* on close */
@@ -675,16 +1113,10 @@ _cb_irq(struct libusb_transfer *transfer)
 		return;
 	}
 
-	if (transfer->actual_length) {
+	/* the data was copied, the transfer keeps its buffer */
+	if (transfer->actual_length)
 		GP_LOG_DATA ((char*)transfer->buffer, transfer->actual_length, "interrupt");
 
-		irq_new->data_len = transfer->actual_length;
-		// Steal the transfer buffer and replace it with a new one for reusing the transfer
-		irq_new->data = transfer->buffer;
-		transfer->buffer = malloc(INTERRUPT_BUFFER_SIZE);
-		transfer->length = INTERRUPT_BUFFER_SIZE;
-	}
-
 	GP_LOG_D("Requeuing completed transfer %p", transfer);
 	ret = LOG_ON_LIBUSB_E(libusb_submit_transfer (transfer));
 	if (ret < LIBUSB_SUCCESS) {
@@ -731,15 +1163,13 @@ gp_libusb1_check_int (GPPort *port, char *bytes, int size, int timeout)
 	int 		ret;
 	struct timeval	tv;
 	struct _PrivateIrqCompleted *irq_cur = NULL;
+	unsigned int	head, tail;
 
 	C_PARAMS (port && port->pl->dh && timeout >= 0);
 
-	if (port->pl->irqs_head != NULL)
+	if (IRQ_LOAD (port->pl->irqs_head) != port->pl->irqs_tail)
 		goto handleirq;
 
-	if (!timeout)
-		return GP_ERROR_TIMEOUT;
-
 	/* If we have lost all the queued transfers, we should probably restart them
 	 * if there are long running error, like "no more device". That would be
 	 * reported upstream, so upstream can take care of that.
@@ -750,12 +1180,14 @@ gp_libusb1_check_int (GPPort *port, char *bytes, int size, int timeout)
 			return ret;
 	}
 
+	/* A timeout of 0 only handles what is already there, e.g. after
+	 * one of the fds from gp_libusb1_get_pollfds() became ready. */
 	tv.tv_sec = timeout/1000;
 	tv.tv_usec = (timeout%1000)*1000;
 
 	ret = LOG_ON_LIBUSB_E (libusb_handle_events_timeout(port->pl->ctx, &tv));
 
-	if (port->pl->irqs_head != NULL)
+	if (IRQ_LOAD (port->pl->irqs_head) != port->pl->irqs_tail)
 		goto handleirq;
 
 	if (ret < LIBUSB_SUCCESS)
@@ -764,7 +1196,9 @@ gp_libusb1_check_int (GPPort *port, char *bytes, int size, int timeout)
 	return GP_ERROR_TIMEOUT;
 
 handleirq:
-	irq_cur = port->pl->irqs_head;
+	head = IRQ_LOAD (port->pl->irqs_head);
+	tail = port->pl->irqs_tail;
+	irq_cur = &port->pl->irqs[tail % NB_IRQ_SLOTS];
 
 	switch (irq_cur->status) {
 	case LIBUSB_TRANSFER_COMPLETED:
@@ -773,43 +1207,28 @@ handleirq:
 	case LIBUSB_TRANSFER_NO_DEVICE:
 		ret = GP_ERROR_IO_USB_FIND;
 		/* Agglomerate similar errors to only report once. */
-		while ((irq_cur->next) &&
-			   (irq_cur->next->status == LIBUSB_TRANSFER_NO_DEVICE)
-		) {
-			port->pl->irqs_head = irq_cur->next;
-			if (irq_cur->data)
-				free(irq_cur->data);
-			free(irq_cur);
-			irq_cur = port->pl->irqs_head;
-		}
+		while ((tail + 1 != head) &&
+		       (port->pl->irqs[(tail + 1) % NB_IRQ_SLOTS].status == LIBUSB_TRANSFER_NO_DEVICE)
+		)
+			irq_cur = &port->pl->irqs[++tail % NB_IRQ_SLOTS];
 		break;
 	default:
 		ret = GP_ERROR_IO;
 		/* Agglomerate similar errors to only report once. */
-		while ((irq_cur->next) &&
-			   (irq_cur->next->status != LIBUSB_TRANSFER_COMPLETED) &&
-			   (irq_cur->next->status != LIBUSB_TRANSFER_NO_DEVICE)
-        ) {
-			port->pl->irqs_head = irq_cur->next;
-			if (irq_cur->data)
-				free(irq_cur->data);
-			free(irq_cur);
-			irq_cur = port->pl->irqs_head;
-		}
+		while ((tail + 1 != head) &&
+		       (port->pl->irqs[(tail + 1) % NB_IRQ_SLOTS].status != LIBUSB_TRANSFER_COMPLETED) &&
+		       (port->pl->irqs[(tail + 1) % NB_IRQ_SLOTS].status != LIBUSB_TRANSFER_NO_DEVICE)
+		)
+			irq_cur = &port->pl->irqs[++tail % NB_IRQ_SLOTS];
 		break;
 	}
 
 	if (size > irq_cur->data_len)
 		size = irq_cur->data_len;
-	if (irq_cur->data) {
-		if (size > 0)
-			memcpy(bytes, irq_cur->data, size);
-		free(irq_cur->data);
-	}
-	port->pl->irqs_head = irq_cur->next;
-	if (port->pl->irqs_head == NULL)
-		port->pl->irqs_tail = NULL;
-	free(irq_cur);
+	if (size > 0)
+		memcpy(bytes, irq_cur->data, size);
+	/* hands the slot back to _cb_irq() */
+	IRQ_STORE (port->pl->irqs_tail, tail + 1);
 
 	if (ret != GP_OK)
 		return ret;
@@ -817,6 +1236,42 @@ handleirq:
 	return size;
 }
 
+/* libusb handles its events on a few fds (the usbfs device nodes, a
+ * timerfd, an internal pipe). Once the interrupt transfers are queued,
+ * an interrupt from the camera makes one of them ready. */
+static int
+gp_libusb1_get_pollfds (GPPort *port, GPPortPollFd *fds, int max)
+{
+	const struct libusb_pollfd **pollfds;
+	int ret, n;
+
+	C_PARAMS (port && port->pl->ctx);
+
+	if (port->pl->dh &&
+	    (port->pl->nrofactiveinttransfers < NB_INTERRUPT_TRANSFERS)) {
+		ret = gp_libusb1_queue_interrupt_urbs (port);
+		if (ret != GP_OK)
+			return ret;
+	}
+
+	/* NULL on Windows, where libusb does not use fds */
+	pollfds = libusb_get_pollfds (port->pl->ctx);
+	if (!pollfds)
+		return GP_ERROR_NOT_SUPPORTED;
+	for (n = 0; pollfds[n]; n++) {
+		if (n >= max)
+			continue;
+		fds[n].fd = pollfds[n]->fd;
+		fds[n].events = pollfds[n]->events;
+	}
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000104)
+	libusb_free_pollfds (pollfds);
+#else
+	free (pollfds);
+#endif
+	return n;
+}
+
 static int
 gp_libusb1_msg(GPPort *port, int request, int value, int index, char *bytes, int size, int flags, int default_error)
 {
@@ -910,7 +1365,7 @@ gp_libusb1_update (GPPort *port)
 {
 	int ifacereleased = FALSE, changedone = FALSE;
 
-	C_PARAMS (port && port->pl && port->pl->ctx);
+	C_PARAMS (port && port->pl);
 
 	GP_LOG_D ("(old int=%d, conf=%d, alt=%d) port %s, (new int=%d, conf=%d, alt=%d) port %s",
 		port->settings.usb.interface,
@@ -1017,42 +1472,45 @@ gp_libusb1_update (GPPort *port)
 }
 
 static int
-gp_libusb1_find_ep(libusb_device *dev, int config, int interface, int altsetting, int direction, int type)
+gp_libusb1_find_ep(struct _PrivateDevice *dev, int config, int interface, int altsetting, int direction, int type)
 {
 	const struct libusb_interface_descriptor *intf;
-	struct libusb_config_descriptor *confdesc;
 	int i;
 
-	if (LOG_ON_LIBUSB_E (libusb_get_config_descriptor (dev, config, &confdesc)))
+	if (!dev->configs[config])
 		return -1;
 
-	intf = &confdesc->interface[interface].altsetting[altsetting];
+	intf = &dev->configs[config]->interface[interface].altsetting[altsetting];
 	for (i = 0; i < intf->bNumEndpoints; i++) {
 		if (((intf->endpoint[i].bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == direction) &&
-		    ((intf->endpoint[i].bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == type)) {
-			unsigned char ret;
-			ret = intf->endpoint[i].bEndpointAddress; /* intf is cleared after next line, copy epaddr! */
-			libusb_free_config_descriptor (confdesc);
-			return ret;
-		}
+		    ((intf->endpoint[i].bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == type))
+			return intf->endpoint[i].bEndpointAddress;
 	}
-	libusb_free_config_descriptor (confdesc);
 	return -1;
 }
 
 static int
-gp_libusb1_find_first_altsetting(struct libusb_device *dev, int *config, int *interface, int *altsetting)
+gp_libusb1_find_max_packet_size(struct _PrivateDevice *dev, int config, int interface, int altsetting, int ep)
 {
-	int i, i1, i2;
-	struct libusb_device_descriptor desc;
+	const struct libusb_interface_descriptor *intf;
+	int i;
 
-	if (LOG_ON_LIBUSB_E (libusb_get_device_descriptor (dev, &desc)))
-		return -1;
+	intf = &dev->configs[config]->interface[interface].altsetting[altsetting];
+	for (i = 0; i < intf->bNumEndpoints; i++)
+		if (intf->endpoint[i].bEndpointAddress == ep)
+			return intf->endpoint[i].wMaxPacketSize;
+	return 0;
+}
 
-	for (i = 0; i < desc.bNumConfigurations; i++) {
-		struct libusb_config_descriptor *confdesc;
+static int
+gp_libusb1_find_first_altsetting(struct _PrivateDevice *dev, int *config, int *interface, int *altsetting)
+{
+	int i, i1, i2;
 
-		if (LOG_ON_LIBUSB_E (libusb_get_config_descriptor (dev, i, &confdesc)))
+	for (i = 0; i < dev->desc.bNumConfigurations; i++) {
+		const struct libusb_config_descriptor *confdesc = dev->configs[i];
+
+		if (!confdesc)
 			return -1;
 
 		for (i1 = 0; i1 < confdesc->bNumInterfaces; i1++)
@@ -1061,11 +1519,8 @@ gp_libusb1_find_first_altsetting(struct libusb_device *dev, int *config, int *in
 					*config = i;
 					*interface = i1;
 					*altsetting = i2;
-					libusb_free_config_descriptor (confdesc);
-
 					return 0;
 				}
-		libusb_free_config_descriptor (confdesc);
 	}
 	return -1;
 }
@@ -1074,48 +1529,47 @@ static int
 gp_libusb1_find_path_lib(GPPort *port)
 {
 	char *s;
-	int d, busnr = 0, devnr = 0;
-	GPPortPrivateLibrary *pl;
+	int d, nrofdevs, busnr = 0, devnr = 0;
 
 	C_PARAMS (port);
 
-	pl = port->pl;
-
 	s = strchr (port->settings.usb.port,':');
 	C_PARAMS (s && (s[1] != '\0'));
 	C_PARAMS (sscanf (s+1, "%d,%d", &busnr, &devnr) == 2); /* usb:%d,%d */
 
-	pl->nrofdevs = load_devicelist (port->pl);
+	LOCK_DEVICELIST ();
+	nrofdevs = load_devicelist ();
 
-	for (d = 0; d < pl->nrofdevs; d++) {
-		struct libusb_config_descriptor *confdesc;
+	for (d = 0; d < nrofdevs; d++) {
+		struct _PrivateDevice *dev = &devicelist.devs[d];
+		const struct libusb_interface_descriptor *intf;
 		int config = -1, interface = -1, altsetting = -1;
 
-		if (busnr != libusb_get_bus_number (pl->devs[d]))
+		if (busnr != dev->busnr)
 			continue;
-		if (devnr != libusb_get_device_address (pl->devs[d]))
+		if (devnr != dev->devnr)
 			continue;
 
-		port->pl->d = pl->devs[d];
+		port->pl->busnr = dev->busnr;
+		port->pl->devnr = dev->devnr;
 
 		GP_LOG_D ("Found path %s", port->settings.usb.port);
 
 		/* Use the first config, interface and altsetting we find */
-		gp_libusb1_find_first_altsetting(pl->devs[d], &config, &interface, &altsetting);
-
-		if (LOG_ON_LIBUSB_E (libusb_get_config_descriptor (pl->devs[d], config, &confdesc)))
+		if (gp_libusb1_find_first_altsetting(dev, &config, &interface, &altsetting) < 0)
 			continue;
+		intf = &dev->configs[config]->interface[interface].altsetting[altsetting];
 
 		/* Set the defaults */
-		port->settings.usb.config = confdesc->bConfigurationValue;
-		port->settings.usb.interface = confdesc->interface[interface].altsetting[altsetting].bInterfaceNumber;
-		port->settings.usb.altsetting = confdesc->interface[interface].altsetting[altsetting].bAlternateSetting;
+		port->settings.usb.config = dev->configs[config]->bConfigurationValue;
+		port->settings.usb.interface = intf->bInterfaceNumber;
+		port->settings.usb.altsetting = intf->bAlternateSetting;
 
-		port->settings.usb.inep  = gp_libusb1_find_ep(pl->devs[d], config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_BULK);
-		port->settings.usb.outep = gp_libusb1_find_ep(pl->devs[d], config, interface, altsetting, LIBUSB_ENDPOINT_OUT, LIBUSB_TRANSFER_TYPE_BULK);
-		port->settings.usb.intep = gp_libusb1_find_ep(pl->devs[d], config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_INTERRUPT);
+		port->settings.usb.inep  = gp_libusb1_find_ep(dev, config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_BULK);
+		port->settings.usb.outep = gp_libusb1_find_ep(dev, config, interface, altsetting, LIBUSB_ENDPOINT_OUT, LIBUSB_TRANSFER_TYPE_BULK);
+		port->settings.usb.intep = gp_libusb1_find_ep(dev, config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_INTERRUPT);
 
-		port->settings.usb.maxpacketsize = libusb_get_max_packet_size (pl->devs[d], port->settings.usb.inep);
+		port->settings.usb.maxpacketsize = gp_libusb1_find_max_packet_size (dev, config, interface, altsetting, port->settings.usb.inep);
 		GP_LOG_D ("Detected defaults: config %d, interface %d, altsetting %d, "
 			"inep %02x, outep %02x, intep %02x, class %02x, subclass %02x",
 			port->settings.usb.config,
@@ -1124,12 +1578,13 @@ gp_libusb1_find_path_lib(GPPort *port)
 			port->settings.usb.inep,
 			port->settings.usb.outep,
 			port->settings.usb.intep,
-			confdesc->interface[interface].altsetting[altsetting].bInterfaceClass,
-			confdesc->interface[interface].altsetting[altsetting].bInterfaceSubClass
+			intf->bInterfaceClass,
+			intf->bInterfaceSubClass
 			);
-		libusb_free_config_descriptor (confdesc);
+		UNLOCK_DEVICELIST ();
 		return GP_OK;
 	}
+	UNLOCK_DEVICELIST ();
 #if 0
 	gp_port_set_error (port, _("Could not find USB device "
 		"(vendor 0x%x, product 0x%x). Make sure this device "
@@ -1141,13 +1596,10 @@ static int
 gp_libusb1_find_device_lib(GPPort *port, int idvendor, int idproduct)
 {
 	char *s;
-	int d, busnr = 0, devnr = 0;
-	GPPortPrivateLibrary *pl;
+	int d, nrofdevs, busnr = 0, devnr = 0;
 
 	C_PARAMS (port);
 
-	pl = port->pl;
-
 	s = strchr (port->settings.usb.port,':');
 	if (s && (s[1] != '\0')) { /* usb:%d,%d */
 		if (sscanf (s+1, "%d,%d", &busnr, &devnr) != 2) {
@@ -1167,47 +1619,48 @@ gp_libusb1_find_device_lib(GPPort *port, int idvendor, int idproduct)
 		return GP_ERROR_BAD_PARAMETERS;
 	}
 
-	pl->nrofdevs = load_devicelist (port->pl);
+	LOCK_DEVICELIST ();
+	nrofdevs = load_devicelist ();
 
-	for (d = 0; d < pl->nrofdevs; d++) {
-		struct libusb_config_descriptor *confdesc;
+	for (d = 0; d < nrofdevs; d++) {
+		struct _PrivateDevice *dev = &devicelist.devs[d];
+		const struct libusb_interface_descriptor *intf;
 		int config = -1, interface = -1, altsetting = -1;
 
-		if ((pl->descs[d].idVendor != idvendor) ||
-		    (pl->descs[d].idProduct != idproduct))
+		if ((dev->desc.idVendor != idvendor) ||
+		    (dev->desc.idProduct != idproduct))
 			continue;
 
-		if (busnr && (busnr != libusb_get_bus_number (pl->devs[d])))
+		if (busnr && (busnr != dev->busnr))
 			continue;
-		if (devnr && (devnr != libusb_get_device_address (pl->devs[d])))
+		if (devnr && (devnr != dev->devnr))
 			continue;
 
-		port->pl->d = pl->devs[d];
+		port->pl->busnr = dev->busnr;
+		port->pl->devnr = dev->devnr;
 
 		GP_LOG_D ("Looking for USB device (vendor 0x%x, product 0x%x)... found.", idvendor, idproduct);
 
 		/* Use the first config, interface and altsetting we find */
-		gp_libusb1_find_first_altsetting(pl->devs[d], &config, &interface, &altsetting);
-
-		if (LOG_ON_LIBUSB_E (libusb_get_config_descriptor (pl->devs[d], config, &confdesc)))
+		if (gp_libusb1_find_first_altsetting(dev, &config, &interface, &altsetting) < 0)
 			continue;
+		intf = &dev->configs[config]->interface[interface].altsetting[altsetting];
 
 		/* Set the defaults */
-		if (confdesc->interface[interface].altsetting[altsetting].bInterfaceClass
-		    == LIBUSB_CLASS_MASS_STORAGE) {
+		if (intf->bInterfaceClass == LIBUSB_CLASS_MASS_STORAGE) {
 			GP_LOG_D ("USB device (vendor 0x%x, product 0x%x) is a mass"
 				  " storage device, and might not function with gphoto2."
 				  " Reference: %s", idvendor, idproduct, URL_USB_MASSSTORAGE);
 		}
-		port->settings.usb.config = confdesc->bConfigurationValue;
-		port->settings.usb.interface = confdesc->interface[interface].altsetting[altsetting].bInterfaceNumber;
-		port->settings.usb.altsetting = confdesc->interface[interface].altsetting[altsetting].bAlternateSetting;
+		port->settings.usb.config = dev->configs[config]->bConfigurationValue;
+		port->settings.usb.interface = intf->bInterfaceNumber;
+		port->settings.usb.altsetting = intf->bAlternateSetting;
 
-		port->settings.usb.inep  = gp_libusb1_find_ep(pl->devs[d], config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_BULK);
-		port->settings.usb.outep = gp_libusb1_find_ep(pl->devs[d], config, interface, altsetting, LIBUSB_ENDPOINT_OUT, LIBUSB_TRANSFER_TYPE_BULK);
-		port->settings.usb.intep = gp_libusb1_find_ep(pl->devs[d], config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_INTERRUPT);
+		port->settings.usb.inep  = gp_libusb1_find_ep(dev, config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_BULK);
+		port->settings.usb.outep = gp_libusb1_find_ep(dev, config, interface, altsetting, LIBUSB_ENDPOINT_OUT, LIBUSB_TRANSFER_TYPE_BULK);
+		port->settings.usb.intep = gp_libusb1_find_ep(dev, config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_INTERRUPT);
 
-		port->settings.usb.maxpacketsize = libusb_get_max_packet_size (pl->devs[d], port->settings.usb.inep);
+		port->settings.usb.maxpacketsize = gp_libusb1_find_max_packet_size (dev, config, interface, altsetting, port->settings.usb.inep);
 		GP_LOG_D ("Detected defaults: config %d, interface %d, altsetting %d, "
 			  "inep %02x, outep %02x, intep %02x, class %02x, subclass %02x",
 			port->settings.usb.config,
@@ -1216,12 +1669,13 @@ gp_libusb1_find_device_lib(GPPort *port, int idvendor, int idproduct)
 			port->settings.usb.inep,
 			port->settings.usb.outep,
 			port->settings.usb.intep,
-			confdesc->interface[interface].altsetting[altsetting].bInterfaceClass,
-			confdesc->interface[interface].altsetting[altsetting].bInterfaceSubClass
+			intf->bInterfaceClass,
+			intf->bInterfaceSubClass
 			);
-		libusb_free_config_descriptor (confdesc);
+		UNLOCK_DEVICELIST ();
 		return GP_OK;
 	}
+	UNLOCK_DEVICELIST ();
 #if 0
 	gp_port_set_error (port, _("Could not find USB device "
 		"(vendor 0x%x, product 0x%x). Make sure this device "
@@ -1236,7 +1690,7 @@ gp_libusb1_find_device_lib(GPPort *port, int idvendor, int idproduct)
  * It is documented to some degree on various internet pages.
  */
 static int
-gp_libusb1_match_mtp_device(struct libusb_device *dev,int *configno, int *interfaceno, int *altsettingno)
+gp_libusb1_match_mtp_device(struct _PrivateDevice *dev,int *configno, int *interfaceno, int *altsettingno)
 {
 	/* Marcus: Avoid this probing altogether, its too unstable on some devices */
 	return 0;
@@ -1379,29 +1833,25 @@ errout:
 }
 
 static int
-gp_libusb1_match_device_by_class(struct libusb_device *dev, int class, int subclass, int protocol, int *configno, int *interfaceno, int *altsettingno)
+gp_libusb1_match_device_by_class(struct _PrivateDevice *dev, int class, int subclass, int protocol, int *configno, int *interfaceno, int *altsettingno)
 {
 	int i, i1, i2;
-	struct libusb_device_descriptor desc;
 
 	if (class == 666) /* Special hack for MTP devices with MS OS descriptors. */
 		return gp_libusb1_match_mtp_device (dev, configno, interfaceno, altsettingno);
 
-	if (LOG_ON_LIBUSB_E (libusb_get_device_descriptor(dev, &desc)))
-		return 0;
-
-	if (desc.bDeviceClass == class &&
+	if (dev->desc.bDeviceClass == class &&
 	    (subclass == -1 ||
-	     desc.bDeviceSubClass == subclass) &&
+	     dev->desc.bDeviceSubClass == subclass) &&
 	    (protocol == -1 ||
-	     desc.bDeviceProtocol == protocol))
+	     dev->desc.bDeviceProtocol == protocol))
 		return 1;
 
 
-	for (i = 0; i < desc.bNumConfigurations; i++) {
-		struct libusb_config_descriptor *config;
+	for (i = 0; i < dev->desc.bNumConfigurations; i++) {
+		const struct libusb_config_descriptor *config = dev->configs[i];
 
-		if (LOG_ON_LIBUSB_E (libusb_get_config_descriptor (dev, i, &config)))
+		if (!config)
 			continue;
 
 		for (i1 = 0; i1 < config->bNumInterfaces; i1++) {
@@ -1420,13 +1870,10 @@ gp_libusb1_match_device_by_class(struct libusb_device *dev, int class, int subcl
 					*configno = i;
 					*interfaceno = i1;
 					*altsettingno = i2;
-
-					libusb_free_config_descriptor (config);
 					return 2;
 				}
 			}
 		}
-		libusb_free_config_descriptor (config);
 	}
 	return 0;
 }
@@ -1435,13 +1882,10 @@ static int
 gp_libusb1_find_device_by_class_lib(GPPort *port, int class, int subclass, int protocol)
 {
 	char *s;
-	int d, busnr = 0, devnr = 0;
-	GPPortPrivateLibrary *pl;
+	int d, nrofdevs, busnr = 0, devnr = 0;
 
 	C_PARAMS (port);
 
-	pl = port->pl;
-
 	s = strchr (port->settings.usb.port,':');
 	if (s && (s[1] != '\0')) { /* usb:%d,%d */
 		if (sscanf (s+1, "%d,%d", &busnr, &devnr) != 2) {
@@ -1457,60 +1901,60 @@ gp_libusb1_find_device_by_class_lib(GPPort *port, int class, int subclass, int p
 	 */
 	C_PARAMS (class);
 
-	pl->nrofdevs = load_devicelist (port->pl);
-	for (d = 0; d < pl->nrofdevs; d++) {
-		struct libusb_config_descriptor *confdesc;
-		int i, ret, config = -1, interface = -1, altsetting = -1;
+	LOCK_DEVICELIST ();
+	nrofdevs = load_devicelist ();
+	for (d = 0; d < nrofdevs; d++) {
+		struct _PrivateDevice *dev = &devicelist.devs[d];
+		const struct libusb_interface_descriptor *intf;
+		int ret, config = -1, interface = -1, altsetting = -1;
 
-		if (busnr && (busnr != libusb_get_bus_number (pl->devs[d])))
+		if (busnr && (busnr != dev->busnr))
 			continue;
-		if (devnr && (devnr != libusb_get_device_address (pl->devs[d])))
+		if (devnr && (devnr != dev->devnr))
 			continue;
 
 		GP_LOG_D ("Looking for USB device (class 0x%x, subclass, 0x%x, protocol 0x%x)...",
 			  class, subclass, protocol);
 
-		ret = gp_libusb1_match_device_by_class(pl->devs[d], class, subclass, protocol, &config, &interface, &altsetting);
+		ret = gp_libusb1_match_device_by_class(dev, class, subclass, protocol, &config, &interface, &altsetting);
 		if (!ret)
 			continue;
 
-		port->pl->d = pl->devs[d];
+		port->pl->busnr = dev->busnr;
+		port->pl->devnr = dev->devnr;
 		GP_LOG_D ("Found USB class device (class 0x%x, subclass, 0x%x, protocol 0x%x)",
 			  class, subclass, protocol);
 
-		if (LOG_ON_LIBUSB_E (libusb_get_config_descriptor (pl->devs[d], config, &confdesc)))
+		/* a device class match (1) does not say which interface */
+		if ((config == -1) || !dev->configs[config])
 			continue;
+		intf = &dev->configs[config]->interface[interface].altsetting[altsetting];
 
 		/* Set the defaults */
-		port->settings.usb.config = confdesc->bConfigurationValue;
-		port->settings.usb.interface = confdesc->interface[interface].altsetting[altsetting].bInterfaceNumber;
-		port->settings.usb.altsetting = confdesc->interface[interface].altsetting[altsetting].bAlternateSetting;
-
-		port->settings.usb.inep  = gp_libusb1_find_ep(pl->devs[d], config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_BULK);
-		port->settings.usb.outep = gp_libusb1_find_ep(pl->devs[d], config, interface, altsetting, LIBUSB_ENDPOINT_OUT, LIBUSB_TRANSFER_TYPE_BULK);
-		port->settings.usb.intep = gp_libusb1_find_ep(pl->devs[d], config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_INTERRUPT);
-		port->settings.usb.maxpacketsize = 0;
+		port->settings.usb.config = dev->configs[config]->bConfigurationValue;
+		port->settings.usb.interface = intf->bInterfaceNumber;
+		port->settings.usb.altsetting = intf->bAlternateSetting;
+
+		port->settings.usb.inep  = gp_libusb1_find_ep(dev, config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_BULK);
+		port->settings.usb.outep = gp_libusb1_find_ep(dev, config, interface, altsetting, LIBUSB_ENDPOINT_OUT, LIBUSB_TRANSFER_TYPE_BULK);
+		port->settings.usb.intep = gp_libusb1_find_ep(dev, config, interface, altsetting, LIBUSB_ENDPOINT_IN, LIBUSB_TRANSFER_TYPE_INTERRUPT);
 		GP_LOG_D ("inep to look for is %02x", port->settings.usb.inep);
-		for (i=0;i<confdesc->interface[interface].altsetting[altsetting].bNumEndpoints;i++) {
-			if (port->settings.usb.inep == confdesc->interface[interface].altsetting[altsetting].endpoint[i].bEndpointAddress) {
-				port->settings.usb.maxpacketsize = confdesc->interface[interface].altsetting[altsetting].endpoint[i].wMaxPacketSize;
-				break;
-			}
-		}
+		port->settings.usb.maxpacketsize = gp_libusb1_find_max_packet_size (dev, config, interface, altsetting, port->settings.usb.inep);
 		GP_LOG_D ("Detected defaults: config %d, interface %d, altsetting %d, "
 			  "idVendor ID %04x, idProduct %04x, inep %02x, outep %02x, intep %02x",
 			port->settings.usb.config,
 			port->settings.usb.interface,
 			port->settings.usb.altsetting,
-			pl->descs[d].idVendor,
-			pl->descs[d].idProduct,
+			dev->desc.idVendor,
+			dev->desc.idProduct,
 			port->settings.usb.inep,
 			port->settings.usb.outep,
 			port->settings.usb.intep
 		);
-		libusb_free_config_descriptor (confdesc);
+		UNLOCK_DEVICELIST ();
 		return GP_OK;
 	}
+	UNLOCK_DEVICELIST ();
 #if 0
 	gp_port_set_error (port, _("Could not find USB device "
 		"(class 0x%x, subclass 0x%x, protocol 0x%x). Make sure this device "
@@ -1533,9 +1977,17 @@ gp_port_library_operations (void)
 	ops->open   = gp_libusb1_open;
 	ops->close  = gp_libusb1_close;
 	ops->read   = gp_libusb1_read;
+	ops->read_stream = gp_libusb1_read_stream;
+#ifdef HAVE_LIBUSB_DEV_MEM
+	ops->alloc_buffer = gp_libusb1_alloc_buffer_lib;
+	ops->free_buffer = gp_libusb1_free_buffer_lib;
+#endif
 	ops->reset  = gp_libusb1_reset;
 	ops->write  = gp_libusb1_write;
 	ops->check_int = gp_libusb1_check_int;
+	ops->get_pollfds = gp_libusb1_get_pollfds;
+	ops->get_stats = gp_libusb1_get_stats;
+	ops->reset_stats = gp_libusb1_reset_stats;
 	ops->update = gp_libusb1_update;
 	ops->clear_halt = gp_libusb1_clear_halt_lib;
 	ops->msg_write  = gp_libusb1_msg_write_lib;
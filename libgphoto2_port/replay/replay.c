@@ -0,0 +1,898 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/* replay.c
+ *
+ * Copyright 2026 The gPhoto project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Records the traffic of a USB camera into a trace file and replays it
+ * later without the camera, e.g. to benchmark a camera driver on a
+ * machine without one.
+ *
+ *   record:FILE        talks to the camera on the "usb:" port and writes
+ *                      every operation, its result, its data and how
+ *                      long it took to FILE
+ *   replay:FILE        answers every operation from FILE, as fast as
+ *                      possible
+ *   replay-timed:FILE  the same, but each operation takes as long as
+ *                      it did when it was recorded
+ *
+ * The camera model has to be given explicitly, e.g. with gphoto2
+ * --camera, as these ports are not autodetected, and the replayed
+ * session has to make the same calls as the recorded one; only the
+ * number of interrupt polls that came back empty may differ. Data
+ * written that differs from the recording is logged, an operation
+ * that differs fails with GP_ERROR_IO.
+ *
+ * The trace starts with the 8 bytes "GPTRACE1", followed by records of
+ *
+ *   op        1 byte, REC_*
+ *   usecs     how long the operation took
+ *   result    what it returned
+ *   args      a fixed number of arguments per op, see recops[]
+ *   len       the number of data bytes that follow
+ *   data      written data for writes, read data for reads
+ *
+ * with all numbers LEB128 encoded, the signed ones zigzag encoded first.
+ * Arguments are 64 bit, so a read_stream of 2 GB or more keeps its size.
+ */
+
+#include "config.h"
+#include <gphoto2/gphoto2-port-library.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include <gphoto2/gphoto2-port.h>
+#include <gphoto2/gphoto2-port-info-list.h>
+#include <gphoto2/gphoto2-port-result.h>
+#include <gphoto2/gphoto2-port-log.h>
+
+#ifdef ENABLE_NLS
+#  include <libintl.h>
+#  undef _
+#  define _(String) dgettext (GETTEXT_PACKAGE, String)
+#  ifdef gettext_noop
+#    define N_(String) gettext_noop (String)
+#  else
+#    define N_(String) (String)
+#  endif
+#else
+#  define textdomain(String) (String)
+#  define gettext(String) (String)
+#  define dgettext(Domain,Message) (Message)
+#  define dcgettext(Domain,Message,Type) (Message)
+#  define bindtextdomain(Domain,Directory) (Domain)
+#  define _(String) (String)
+#  define N_(String) (String)
+#endif
+
+#define CHECK(result) {int r=(result); if (r<0) return (r);}
+
+#define TRACE_MAGIC	"GPTRACE1"
+
+enum {
+	MODE_RECORD,
+	MODE_REPLAY,
+	MODE_REPLAY_TIMED
+};
+
+enum {
+	REC_OPEN,
+	REC_CLOSE,
+	REC_RESET,
+	REC_READ,
+	REC_WRITE,
+	REC_CHECK_INT,
+	REC_CLEAR_HALT,
+	REC_MSG_WRITE,
+	REC_MSG_READ,
+	REC_MSG_INTERFACE_WRITE,
+	REC_MSG_INTERFACE_READ,
+	REC_MSG_CLASS_WRITE,
+	REC_MSG_CLASS_READ,
+	REC_FIND_DEVICE,
+	REC_FIND_DEVICE_BY_CLASS,
+	REC_STREAM_DATA,
+	REC_READ_STREAM,
+	REC_LAST
+};
+
+#define MAX_ARGS	10
+
+/* The USB settings find_device and find_device_by_class found, stored
+ * after their arguments. */
+#define USB_SETTINGS	7
+
+static const struct {
+	const char	*name;
+	int		nargs;	/* arguments stored */
+	int		nin;	/* of which the first nin must match on replay */
+} recops[REC_LAST] = {
+	{ "open",			0, 0 },
+	{ "close",			0, 0 },
+	{ "reset",			0, 0 },
+	{ "read",			1, 1 },	/* size */
+	{ "write",			1, 1 },	/* size */
+	{ "check_int",			2, 1 },	/* size, timeout */
+	{ "clear_halt",			1, 1 },	/* ep */
+	{ "msg_write",			4, 4 },	/* request, value, index, size */
+	{ "msg_read",			4, 4 },
+	{ "msg_interface_write",	4, 4 },
+	{ "msg_interface_read",		4, 4 },
+	{ "msg_class_write",		4, 4 },
+	{ "msg_class_read",		4, 4 },
+	{ "find_device",		2 + USB_SETTINGS, 2 },	/* vendor, product */
+	{ "find_device_by_class",	3 + USB_SETTINGS, 3 },	/* class, subclass, protocol */
+	{ "stream data",		0, 0 },
+	{ "read_stream",		1, 1 },	/* size */
+};
+
+typedef struct {
+	int		op;
+	uint64_t	usecs;
+	int		result;
+	int64_t		args[MAX_ARGS];
+	unsigned int	len;
+} Record;
+
+struct _GPPortPrivateLibrary {
+	int		mode;
+	FILE		*f;		/* the trace, NULL until first used */
+	unsigned long	nr;		/* records read or written so far */
+
+	/* Recording */
+	GPPort		*inner;		/* the port of the camera */
+	int		failed;		/* writing the trace failed */
+
+	/* Replaying */
+	Record		rec;		/* the record read ahead */
+	int		pending;	/* rec is read, but not yet used */
+	unsigned char	*data;		/* its data */
+	unsigned int	datasize;	/* allocated size of data */
+};
+
+/* The ports are USB ports, but the USB iolib must still be loaded. */
+GPPortType
+gp_port_library_type (void)
+{
+	return (GP_PORT_NONE);
+}
+
+int
+gp_port_library_list (GPPortInfoList *list)
+{
+	static const char *paths[] = { "^record:", "^replay:", "^replay-timed:" };
+	GPPortInfo info;
+	unsigned int i;
+
+	for (i = 0; i < sizeof (paths) / sizeof (paths[0]); i++) {
+		CHECK (gp_port_info_new (&info));
+		gp_port_info_set_type (info, GP_PORT_USB);
+		gp_port_info_set_name (info, "");
+		gp_port_info_set_path (info, paths[i]);
+		gp_port_info_list_append (list, info); /* do not check, might be -1 */
+	}
+	return (GP_OK);
+}
+
+static uint64_t
+now (void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+		return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+	{
+		struct timeval tv;
+
+		gettimeofday (&tv, NULL);
+		return ((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+	}
+}
+
+static void
+sleep_usecs (uint64_t usecs)
+{
+	while (usecs) {
+		unsigned int n = usecs > 500000 ? 500000 : usecs;
+
+		usleep (n);
+		usecs -= n;
+	}
+}
+
+static void
+put_uint (FILE *f, uint64_t v)
+{
+	do {
+		int c = v & 0x7f;
+
+		v >>= 7;
+		putc (v ? c | 0x80 : c, f);
+	} while (v);
+}
+
+static void
+put_int (FILE *f, int64_t v)
+{
+	put_uint (f, ((uint64_t)v << 1) ^ (v < 0 ? ~(uint64_t)0 : 0));
+}
+
+static int
+get_uint (FILE *f, uint64_t *v)
+{
+	int c, shift = 0;
+
+	*v = 0;
+	do {
+		if (((c = getc (f)) == EOF) || (shift > 63))
+			return (GP_ERROR_IO_READ);
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return (GP_OK);
+}
+
+static int
+get_int (FILE *f, int64_t *v)
+{
+	uint64_t u;
+
+	CHECK (get_uint (f, &u));
+	*v = (int64_t)((u >> 1) ^ (0 - (u & 1)));
+	return (GP_OK);
+}
+
+/* Open the trace on first use, the path is only known after init. */
+static int
+trace_open (GPPort *port)
+{
+	GPPortPrivateLibrary *pl = port->pl;
+	GPPortInfo info;
+	char *path, *file, magic[8];
+
+	if (pl->f)
+		return (GP_OK);
+
+	CHECK (gp_port_get_info (port, &info));
+	CHECK (gp_port_info_get_path (info, &path));
+	file = strchr (path, ':') + 1;
+	if (!strncmp (path, "record:", 7))
+		pl->mode = MODE_RECORD;
+	else if (!strncmp (path, "replay-timed:", 13))
+		pl->mode = MODE_REPLAY_TIMED;
+	else
+		pl->mode = MODE_REPLAY;
+
+	pl->f = fopen (file, pl->mode == MODE_RECORD ? "wb" : "rb");
+	if (!pl->f) {
+		gp_port_set_error (port, _("Could not open trace '%s'"), file);
+		return (GP_ERROR_IO);
+	}
+	if (pl->mode == MODE_RECORD) {
+		fwrite (TRACE_MAGIC, 1, 8, pl->f);
+		GP_LOG_D ("Recording to '%s'.", file);
+	} else {
+		if ((fread (magic, 1, 8, pl->f) != 8) ||
+		    memcmp (magic, TRACE_MAGIC, 8)) {
+			gp_port_set_error (port, _("'%s' is not a port trace"), file);
+			fclose (pl->f);
+			pl->f = NULL;
+			return (GP_ERROR_IO_READ);
+		}
+		GP_LOG_D ("Replaying '%s'%s.", file,
+			  pl->mode == MODE_REPLAY_TIMED ? " at recorded speed" : "");
+	}
+	return (GP_OK);
+}
+
+/* The port of the camera to record, created on first use. */
+static int
+record_start (GPPort *port)
+{
+	GPPortInfoList *list;
+	GPPortInfo info;
+	int ret;
+
+	CHECK (trace_open (port));
+	if (port->pl->inner)
+		return (GP_OK);
+
+	CHECK (gp_port_info_list_new (&list));
+	ret = gp_port_info_list_load (list);
+	if (ret >= GP_OK)
+		ret = gp_port_info_list_lookup_path (list, "usb:");
+	if (ret >= GP_OK)
+		ret = gp_port_info_list_get_info (list, ret, &info);
+	if (ret >= GP_OK)
+		ret = gp_port_new (&port->pl->inner);
+	if (ret >= GP_OK) {
+		ret = gp_port_set_info (port->pl->inner, info);
+		if (ret < GP_OK) {
+			gp_port_free (port->pl->inner);
+			port->pl->inner = NULL;
+		}
+	}
+	gp_port_info_list_free (list);
+	return (ret);
+}
+
+static void
+record_write (GPPort *port, int op, uint64_t start, int result,
+	      const int64_t *args, const char *data, int len)
+{
+	GPPortPrivateLibrary *pl = port->pl;
+	int i;
+
+	putc (op, pl->f);
+	put_uint (pl->f, now () - start);
+	put_int (pl->f, result);
+	for (i = 0; i < recops[op].nargs; i++)
+		put_int (pl->f, args[i]);
+	if (len < 0)
+		len = 0;
+	put_uint (pl->f, len);
+	fwrite (data, 1, len, pl->f);
+
+	if (ferror (pl->f) && !pl->failed) {
+		GP_LOG_E ("Writing record %lu (%s) to the trace failed.",
+			  pl->nr, recops[op].name);
+		pl->failed = 1;
+	}
+	pl->nr++;
+}
+
+/* Read the next record into pl->rec unless it is already there. */
+static int
+replay_peek (GPPort *port)
+{
+	GPPortPrivateLibrary *pl = port->pl;
+	Record *rec = &pl->rec;
+	uint64_t len;
+	int64_t result;
+	int c, i;
+
+	if (pl->pending)
+		return (GP_OK);
+
+	c = getc (pl->f);
+	if (c == EOF) {
+		gp_port_set_error (port, _("End of the trace after %lu records"), pl->nr);
+		return (GP_ERROR_IO);
+	}
+	if (c >= REC_LAST)
+		goto corrupt;
+	rec->op = c;
+	if ((get_uint (pl->f, &rec->usecs) < GP_OK) ||
+	    (get_int (pl->f, &result) < GP_OK))
+		goto corrupt;
+	rec->result = (int)result;
+	for (i = 0; i < recops[rec->op].nargs; i++)
+		if (get_int (pl->f, &rec->args[i]) < GP_OK)
+			goto corrupt;
+	if ((get_uint (pl->f, &len) < GP_OK) || (len > 0x7fffffff))
+		goto corrupt;
+	rec->len = len;
+	if (rec->len > pl->datasize) {
+		unsigned char *data = realloc (pl->data, rec->len);
+
+		C_MEM (data);
+		pl->data = data;
+		pl->datasize = rec->len;
+	}
+	if (fread (pl->data, 1, rec->len, pl->f) != rec->len)
+		goto corrupt;
+	pl->pending = 1;
+	return (GP_OK);
+
+corrupt:
+	gp_port_set_error (port, _("The trace is corrupt at record %lu"), pl->nr);
+	return (GP_ERROR_IO_READ);
+}
+
+/*
+ * Take the next record, which has to be op with the given arguments.
+ * Interrupt polls are timing dependent: when op is one, but the trace
+ * has something else next, it is answered with a timeout; when the
+ * trace has one, but op is something else, it is skipped.
+ */
+static int
+replay_expect (GPPort *port, int op, const int64_t *args)
+{
+	GPPortPrivateLibrary *pl = port->pl;
+	Record *rec = &pl->rec;
+	int i;
+
+	CHECK (trace_open (port));
+	while (1) {
+		CHECK (replay_peek (port));
+		if ((rec->op != REC_CHECK_INT) || (op == REC_CHECK_INT))
+			break;
+		if (rec->result > 0)
+			GP_LOG_E ("Skipping interrupt data of record %lu for %s.",
+				  pl->nr, recops[op].name);
+		pl->pending = 0;
+		pl->nr++;
+	}
+	if (rec->op != op) {
+		if (op == REC_CHECK_INT)
+			return (GP_ERROR_TIMEOUT);
+		gp_port_set_error (port, _("Replay diverged at record %lu: "
+			"%s instead of %s"), pl->nr, recops[op].name,
+			recops[rec->op].name);
+		return (GP_ERROR_IO);
+	}
+	for (i = 0; i < recops[op].nin; i++) {
+		if (rec->args[i] == args[i])
+			continue;
+		gp_port_set_error (port, _("Replay diverged at record %lu: "
+			"%s argument %d is %lld instead of %lld"), pl->nr,
+			recops[op].name, i, (long long)args[i],
+			(long long)rec->args[i]);
+		return (GP_ERROR_IO);
+	}
+	pl->pending = 0;
+	pl->nr++;
+	if (pl->mode == MODE_REPLAY_TIMED)
+		sleep_usecs (rec->usecs);
+	return (GP_OK);
+}
+
+/* Copy the data of a read record, at most size bytes. */
+static int
+replay_data (GPPort *port, char *bytes, int size)
+{
+	Record *rec = &port->pl->rec;
+
+	if ((rec->result > 0) && bytes)
+		memcpy (bytes, port->pl->data,
+			rec->len < (unsigned int)size ? rec->len : (unsigned int)size);
+	return (rec->result);
+}
+
+/* Compare written data with the recording, the result comes from it. */
+static int
+replay_compare (GPPort *port, const char *bytes, int size)
+{
+	Record *rec = &port->pl->rec;
+	int i;
+
+	for (i = 0; (i < size) && ((unsigned int)i < rec->len); i++)
+		if (bytes[i] != (char)port->pl->data[i]) {
+			GP_LOG_E ("Record %lu: written data differs from the "
+				  "recording at byte %d.", port->pl->nr - 1, i);
+			break;
+		}
+	return (rec->result);
+}
+
+static int
+gp_port_replay_init (GPPort *port)
+{
+	C_MEM (port->pl = calloc (1, sizeof (GPPortPrivateLibrary)));
+	return (GP_OK);
+}
+
+static int
+gp_port_replay_exit (GPPort *port)
+{
+	GPPortPrivateLibrary *pl = port->pl;
+
+	if (!pl)
+		return (GP_OK);
+	if (pl->inner)
+		gp_port_free (pl->inner);
+	if (pl->f) {
+		if (pl->mode == MODE_RECORD)
+			GP_LOG_D ("Recorded %lu operations.", pl->nr);
+		else
+			GP_LOG_D ("Replayed %lu operations.", pl->nr);
+		fclose (pl->f);
+	}
+	free (pl->data);
+	free (pl);
+	port->pl = NULL;
+	return (GP_OK);
+}
+
+/* Whether this port records; opens the trace and the camera if so. */
+static int
+recording (GPPort *port)
+{
+	CHECK (trace_open (port));
+	if (port->pl->mode != MODE_RECORD)
+		return (0);
+	CHECK (record_start (port));
+	/* The timeout is kept in GPPort, not passed to the port library. */
+	gp_port_set_timeout (port->pl->inner, port->timeout);
+	return (1);
+}
+
+/* Operations without data in or out. */
+static int
+replay_simple (GPPort *port, int op, int (*func)(GPPort *))
+{
+	uint64_t start;
+	int ret;
+
+	CHECK (ret = recording (port));
+	if (ret) {
+		start = now ();
+		ret = func (port->pl->inner);
+		record_write (port, op, start, ret, NULL, NULL, 0);
+		return (ret);
+	}
+	CHECK (replay_expect (port, op, NULL));
+	return (port->pl->rec.result);
+}
+
+static int
+gp_port_replay_open (GPPort *port)
+{
+	return (replay_simple (port, REC_OPEN, gp_port_open));
+}
+
+static int
+gp_port_replay_close (GPPort *port)
+{
+	/* Nothing was opened if nothing was used. */
+	if (!port->pl->f)
+		return (GP_OK);
+	return (replay_simple (port, REC_CLOSE, gp_port_close));
+}
+
+static int
+gp_port_replay_reset (GPPort *port)
+{
+	return (replay_simple (port, REC_RESET, gp_port_reset));
+}
+
+static int
+gp_port_replay_read (GPPort *port, char *bytes, int size)
+{
+	int64_t args[1] = { size };
+	uint64_t start;
+	int ret;
+
+	CHECK (ret = recording (port));
+	if (ret) {
+		start = now ();
+		ret = gp_port_read (port->pl->inner, bytes, size);
+		record_write (port, REC_READ, start, ret, args, bytes, ret);
+		return (ret);
+	}
+	CHECK (replay_expect (port, REC_READ, args));
+	return (replay_data (port, bytes, size));
+}
+
+static int
+gp_port_replay_write (GPPort *port, const char *bytes, int size)
+{
+	int64_t args[1] = { size };
+	uint64_t start;
+	int ret;
+
+	CHECK (ret = recording (port));
+	if (ret) {
+		start = now ();
+		ret = gp_port_write (port->pl->inner, bytes, size);
+		record_write (port, REC_WRITE, start, ret, args, bytes, size);
+		return (ret);
+	}
+	CHECK (replay_expect (port, REC_WRITE, args));
+	return (replay_compare (port, bytes, size));
+}
+
+static int
+gp_port_replay_check_int (GPPort *port, char *bytes, int size, int timeout)
+{
+	int64_t args[2] = { size, timeout };
+	uint64_t start;
+	int ret;
+
+	CHECK (ret = recording (port));
+	if (ret) {
+		start = now ();
+		gp_port_set_timeout (port->pl->inner, timeout);
+		ret = gp_port_check_int (port->pl->inner, bytes, size);
+		record_write (port, REC_CHECK_INT, start, ret, args, bytes, ret);
+		return (ret);
+	}
+	CHECK (replay_expect (port, REC_CHECK_INT, args));
+	return (replay_data (port, bytes, size));
+}
+
+/* Passes the pieces of a recorded stream on and records them. */
+typedef struct {
+	GPPort			*port;
+	GPPortStreamFunc	func;
+	void			*user_data;
+	uint64_t		last;
+} RecordStream;
+
+static int
+record_stream_func (GPPort *inner, const char *data, int size, void *user_data)
+{
+	RecordStream *stream = user_data;
+
+	record_write (stream->port, REC_STREAM_DATA, stream->last, 0, NULL, data, size);
+	stream->last = now ();
+	return (stream->func (stream->port, data, size, stream->user_data));
+}
+
+static int
+gp_port_replay_read_stream (GPPort *port, unsigned long size, int transfers,
+			    int transfersize, GPPortStreamFunc func,
+			    void *user_data)
+{
+	int64_t args[1] = { (int64_t)size };
+	int ret, fret = GP_OK;
+	RecordStream stream;
+
+	CHECK (ret = recording (port));
+	if (ret) {
+		stream.port = port;
+		stream.func = func;
+		stream.user_data = user_data;
+		stream.last = now ();
+		CHECK (gp_port_set_stream_transfers (port->pl->inner, transfers,
+						     transfersize));
+		ret = gp_port_read_stream (port->pl->inner, size,
+					   record_stream_func, &stream);
+		record_write (port, REC_READ_STREAM, stream.last, ret, args, NULL, 0);
+		return (ret);
+	}
+	while (1) {
+		CHECK (replay_peek (port));
+		if (port->pl->rec.op != REC_STREAM_DATA)
+			break;
+		CHECK (replay_expect (port, REC_STREAM_DATA, NULL));
+		/* After an error the recorded stream was cancelled. */
+		if (fret >= GP_OK)
+			fret = func (port, (char *)port->pl->data,
+				     port->pl->rec.len, user_data);
+	}
+	CHECK (replay_expect (port, REC_READ_STREAM, args));
+	return (fret < GP_OK ? fret : port->pl->rec.result);
+}
+
+static int
+gp_port_replay_update (GPPort *port)
+{
+	GPPortSettings settings;
+
+	memcpy (&port->settings.usb, &port->settings_pending.usb,
+		sizeof (port->settings.usb));
+	if (!port->pl->inner)
+		return (GP_OK);
+
+	/* Pass the camera driver's settings on, keeping the real path. */
+	CHECK (gp_port_get_settings (port->pl->inner, &settings));
+	memcpy (&settings.usb, &port->settings.usb,
+		offsetof (GPPortSettingsUSB, port));
+	return (gp_port_set_settings (port->pl->inner, settings));
+}
+
+static int
+gp_port_replay_clear_halt (GPPort *port, int ep)
+{
+	int64_t args[1] = { ep };
+	uint64_t start;
+	int ret;
+
+	CHECK (ret = recording (port));
+	if (ret) {
+		start = now ();
+		ret = gp_port_usb_clear_halt (port->pl->inner, ep);
+		record_write (port, REC_CLEAR_HALT, start, ret, args, NULL, 0);
+		return (ret);
+	}
+	CHECK (replay_expect (port, REC_CLEAR_HALT, args));
+	return (port->pl->rec.result);
+}
+
+typedef int (*MsgFunc) (GPPort *, int, int, int, char *, int);
+
+static int
+replay_msg (GPPort *port, int op, MsgFunc func, int request, int value,
+	    int index, char *bytes, int size)
+{
+	int64_t args[4] = { request, value, index, size };
+	int ret, in = op == REC_MSG_READ || op == REC_MSG_INTERFACE_READ ||
+		      op == REC_MSG_CLASS_READ;
+	uint64_t start;
+
+	CHECK (ret = recording (port));
+	if (ret) {
+		start = now ();
+		ret = func (port->pl->inner, request, value, index, bytes, size);
+		record_write (port, op, start, ret, args, bytes, in ? ret : size);
+		return (ret);
+	}
+	CHECK (replay_expect (port, op, args));
+	if (in)
+		return (replay_data (port, bytes, size));
+	return (replay_compare (port, bytes, size));
+}
+
+static int
+gp_port_replay_msg_write (GPPort *port, int request, int value, int index,
+			  char *bytes, int size)
+{
+	return (replay_msg (port, REC_MSG_WRITE, gp_port_usb_msg_write,
+			    request, value, index, bytes, size));
+}
+
+static int
+gp_port_replay_msg_read (GPPort *port, int request, int value, int index,
+			 char *bytes, int size)
+{
+	return (replay_msg (port, REC_MSG_READ, gp_port_usb_msg_read,
+			    request, value, index, bytes, size));
+}
+
+static int
+gp_port_replay_msg_interface_write (GPPort *port, int request, int value,
+				    int index, char *bytes, int size)
+{
+	return (replay_msg (port, REC_MSG_INTERFACE_WRITE,
+			    gp_port_usb_msg_interface_write,
+			    request, value, index, bytes, size));
+}
+
+static int
+gp_port_replay_msg_interface_read (GPPort *port, int request, int value,
+				   int index, char *bytes, int size)
+{
+	return (replay_msg (port, REC_MSG_INTERFACE_READ,
+			    gp_port_usb_msg_interface_read,
+			    request, value, index, bytes, size));
+}
+
+static int
+gp_port_replay_msg_class_write (GPPort *port, int request, int value,
+				int index, char *bytes, int size)
+{
+	return (replay_msg (port, REC_MSG_CLASS_WRITE,
+			    gp_port_usb_msg_class_write,
+			    request, value, index, bytes, size));
+}
+
+static int
+gp_port_replay_msg_class_read (GPPort *port, int request, int value,
+			       int index, char *bytes, int size)
+{
+	return (replay_msg (port, REC_MSG_CLASS_READ,
+			    gp_port_usb_msg_class_read,
+			    request, value, index, bytes, size));
+}
+
+/* The settings find_device and find_device_by_class fill in. */
+static void
+usb_settings_get (GPPort *port, int64_t *args)
+{
+	args[0] = port->settings.usb.config;
+	args[1] = port->settings.usb.interface;
+	args[2] = port->settings.usb.altsetting;
+	args[3] = port->settings.usb.inep;
+	args[4] = port->settings.usb.outep;
+	args[5] = port->settings.usb.intep;
+	args[6] = port->settings.usb.maxpacketsize;
+}
+
+static void
+usb_settings_set (GPPort *port, const int64_t *args)
+{
+	port->settings.usb.config	= args[0];
+	port->settings.usb.interface	= args[1];
+	port->settings.usb.altsetting	= args[2];
+	port->settings.usb.inep		= args[3];
+	port->settings.usb.outep	= args[4];
+	port->settings.usb.intep	= args[5];
+	port->settings.usb.maxpacketsize = args[6];
+}
+
+static int
+replay_find (GPPort *port, int op, int64_t *args, int nargs)
+{
+	GPPortSettings settings;
+	uint64_t start;
+	int ret;
+
+	CHECK (ret = recording (port));
+	if (ret) {
+		start = now ();
+		if (op == REC_FIND_DEVICE)
+			ret = gp_port_usb_find_device (port->pl->inner,
+						       args[0], args[1]);
+		else
+			ret = gp_port_usb_find_device_by_class (port->pl->inner,
+						args[0], args[1], args[2]);
+		if (ret >= GP_OK) {
+			CHECK (gp_port_get_settings (port->pl->inner, &settings));
+			memcpy (&port->settings.usb, &settings.usb,
+				offsetof (GPPortSettingsUSB, port));
+		}
+		usb_settings_get (port, args + nargs);
+		record_write (port, op, start, ret, args, NULL, 0);
+		return (ret);
+	}
+	CHECK (replay_expect (port, op, args));
+	if (port->pl->rec.result >= GP_OK)
+		usb_settings_set (port, port->pl->rec.args + nargs);
+	return (port->pl->rec.result);
+}
+
+static int
+gp_port_replay_find_device (GPPort *port, int idvendor, int idproduct)
+{
+	int64_t args[2 + USB_SETTINGS] = { idvendor, idproduct };
+
+	return (replay_find (port, REC_FIND_DEVICE, args, 2));
+}
+
+static int
+gp_port_replay_find_device_by_class (GPPort *port, int class, int subclass,
+				     int protocol)
+{
+	int64_t args[3 + USB_SETTINGS] = { class, subclass, protocol };
+
+	return (replay_find (port, REC_FIND_DEVICE_BY_CLASS, args, 3));
+}
+
+GPPortOperations *
+gp_port_library_operations (void)
+{
+	GPPortOperations *ops;
+
+	ops = calloc (1, sizeof (GPPortOperations));
+	if (!ops)
+		return (NULL);
+
+	ops->init	= gp_port_replay_init;
+	ops->exit	= gp_port_replay_exit;
+	ops->open	= gp_port_replay_open;
+	ops->close	= gp_port_replay_close;
+	ops->reset	= gp_port_replay_reset;
+	ops->read	= gp_port_replay_read;
+	ops->write	= gp_port_replay_write;
+	ops->check_int	= gp_port_replay_check_int;
+	ops->read_stream = gp_port_replay_read_stream;
+	ops->update	= gp_port_replay_update;
+	ops->clear_halt	= gp_port_replay_clear_halt;
+	ops->msg_write	= gp_port_replay_msg_write;
+	ops->msg_read	= gp_port_replay_msg_read;
+	ops->msg_interface_write = gp_port_replay_msg_interface_write;
+	ops->msg_interface_read	 = gp_port_replay_msg_interface_read;
+	ops->msg_class_write	 = gp_port_replay_msg_class_write;
+	ops->msg_class_read	 = gp_port_replay_msg_class_read;
+	ops->find_device	 = gp_port_replay_find_device;
+	ops->find_device_by_class = gp_port_replay_find_device_by_class;
+
+	return (ops);
+}
@@ -57,6 +57,9 @@
 #ifdef HAVE_SYS_SELECT_H
 # include <sys/select.h>
 #endif
+#ifdef HAVE_LINUX_SERIAL_H
+# include <linux/serial.h>
+#endif
 
 #ifdef HAVE_TERMIOS_H
 #  include <termios.h>
@@ -203,9 +206,28 @@
 #define GP_PORT_SERIAL_RANGE_HIGH       0
 #endif
 
+#if defined(TIOCGSERIAL) && defined(TIOCSSERIAL) && defined(ASYNC_LOW_LATENCY)
+# define GP_PORT_SERIAL_LOW_LATENCY
+#endif
+
+/* Size of the read-ahead ring of a port */
+#define GP_PORT_SERIAL_RING_SIZE 4096
+
 struct _GPPortPrivateLibrary {
 	int fd;       /* Device handle */
 	int baudrate; /* Current speed */
+
+	/*
+	 * Bytes read from the device but not yet by the camera driver,
+	 * still with the 0xff escapes of the parity mode. They start at
+	 * ring[start] and wrap around at the end of the ring.
+	 */
+	unsigned char ring[GP_PORT_SERIAL_RING_SIZE];
+	unsigned int start, len;
+
+#ifdef GP_PORT_SERIAL_LOW_LATENCY
+	int low_latency; /* We set ASYNC_LOW_LATENCY, clear it on close */
+#endif
 };
 
 static int gp_port_serial_check_speed (GPPort *dev);
@@ -392,6 +414,35 @@ gp_port_serial_exit (GPPort *dev)
 	return GP_OK;
 }
 
+#ifdef GP_PORT_SERIAL_LOW_LATENCY
+/*
+ * ASYNC_LOW_LATENCY has the driver hand received bytes on right away
+ * instead of collecting them for a few milliseconds first, which is what
+ * the request/response protocols of serial cameras wait on. Drivers that
+ * do not support it, e.g. of ptys, refuse; that is fine.
+ */
+static void
+gp_port_serial_set_low_latency (GPPort *dev, int on)
+{
+	struct serial_struct ss;
+
+	if (ioctl (dev->pl->fd, TIOCGSERIAL, &ss) < 0)
+		return;
+	if (on == !!(ss.flags & ASYNC_LOW_LATENCY))
+		return;
+	if (on)
+		ss.flags |= ASYNC_LOW_LATENCY;
+	else
+		ss.flags &= ~ASYNC_LOW_LATENCY;
+	if (ioctl (dev->pl->fd, TIOCSSERIAL, &ss) < 0) {
+		GP_LOG_D ("Could not %s ASYNC_LOW_LATENCY.",
+			  on ? "set" : "clear");
+		return;
+	}
+	dev->pl->low_latency = on;
+}
+#endif
+
 static int
 gp_port_serial_open (GPPort *dev)
 {
@@ -444,6 +495,12 @@ gp_port_serial_open (GPPort *dev)
 		dev->pl->fd = 0;
 		return GP_ERROR_IO;
 	}
+	dev->pl->start = dev->pl->len = 0;
+
+#ifdef GP_PORT_SERIAL_LOW_LATENCY
+	dev->pl->low_latency = 0;
+	gp_port_serial_set_low_latency (dev, 1);
+#endif
 
 	return GP_OK;
 }
@@ -456,7 +513,12 @@ gp_port_serial_close (GPPort *dev)
 	if (!dev)
 		return (GP_OK);
 
+	dev->pl->len = 0;
 	if (dev->pl->fd) {
+#ifdef GP_PORT_SERIAL_LOW_LATENCY
+		if (dev->pl->low_latency)
+			gp_port_serial_set_low_latency (dev, 0);
+#endif
 		if (close (dev->pl->fd) == -1) {
 			int saved_errno = errno;
 			gp_port_set_error (dev, _("Could not close "
@@ -536,12 +598,82 @@ gp_port_serial_write (GPPort *dev, const char *bytes, int size)
 }
 
 
+/*
+ * Waits up to the port timeout for data and reads what is there, up to
+ * size bytes. Returns the number of bytes read.
+ */
+static int
+gp_port_serial_read_avail (GPPort *dev, unsigned char *bytes, int size)
+{
+	struct timeval timeout;
+	fd_set readfs;          /* file descriptor set */
+	int now;
+
+	FD_ZERO (&readfs);
+	FD_SET (dev->pl->fd, &readfs);
+
+	timeout.tv_usec = (dev->timeout % 1000) * 1000;
+	timeout.tv_sec = (dev->timeout / 1000);
+
+	/* Any data available? */
+	if (!select (dev->pl->fd + 1, &readfs, NULL, NULL, &timeout))
+		return GP_ERROR_TIMEOUT;
+	if (!FD_ISSET (dev->pl->fd, &readfs))
+		return (GP_ERROR_TIMEOUT);
+
+	now = read (dev->pl->fd, bytes, size);
+	if (now <= 0) {
+		/* Readable but nothing to read means hangup */
+		if (now < 0)
+			gp_port_set_error (dev, _("Could not read from "
+						  "port (%s)"),
+					   strerror (errno));
+		return GP_ERROR_IO_READ;
+	}
+	return now;
+}
+
+/*
+ * Reads everything the device has, as far as it fits into the free
+ * space of the ring up to its end. One wakeup thus brings in all bytes
+ * received by then instead of one.
+ */
+static int
+gp_port_serial_fill (GPPort *dev)
+{
+	GPPortPrivateLibrary *pl = dev->pl;
+	unsigned int end, space;
+	int now;
+
+	if (!pl->len)
+		pl->start = 0;
+	end = (pl->start + pl->len) % GP_PORT_SERIAL_RING_SIZE;
+	if (end < pl->start || pl->len == GP_PORT_SERIAL_RING_SIZE)
+		space = pl->start - end;
+	else
+		space = GP_PORT_SERIAL_RING_SIZE - end;
+	if (!space)
+		return GP_OK;
+
+	CHECK (now = gp_port_serial_read_avail (dev, pl->ring + end, space));
+	pl->len += now;
+	return GP_OK;
+}
+
+static void
+gp_port_serial_consume (GPPortPrivateLibrary *pl, unsigned int n)
+{
+	pl->start = (pl->start + n) % GP_PORT_SERIAL_RING_SIZE;
+	pl->len -= n;
+}
+
 static int
 gp_port_serial_read (GPPort *dev, char *bytes, int size)
 {
-        struct timeval timeout;
-        fd_set readfs;          /* file descriptor set */
-        int readen = 0, now;
+	GPPortPrivateLibrary *pl;
+	unsigned char *p, *next;
+	unsigned int n;
+	int readen = 0, now;
 
 	C_PARAMS (dev);
 
@@ -552,67 +684,71 @@ gp_port_serial_read (GPPort *dev, char *bytes, int size)
 	/* Make sure we are operating at the specified speed */
 	CHECK (gp_port_serial_check_speed (dev));
 
-        FD_ZERO (&readfs);
-        FD_SET (dev->pl->fd, &readfs);
-
-        while (readen < size) {
+	pl = dev->pl;
+	while (readen < size) {
+		if (dev->settings.serial.parity == GP_PORT_SERIAL_PARITY_OFF &&
+		    !pl->len && size - readen >= GP_PORT_SERIAL_RING_SIZE) {
+			/* Nothing to decode, no need to go through the ring */
+			CHECK (now = gp_port_serial_read_avail (dev,
+					(unsigned char *)bytes + readen,
+					size - readen));
+			readen += now;
+			continue;
+		}
 
-		/* Set timeout value within input loop */
-                timeout.tv_usec = (dev->timeout % 1000) * 1000;
-                timeout.tv_sec = (dev->timeout / 1000);
+		if (!pl->len)
+			CHECK (gp_port_serial_fill (dev));
+
+		/* Copy the bytes up to the end of the ring or the next
+		 * escape, whichever comes first. */
+		p = pl->ring + pl->start;
+		n = pl->len;
+		if (n > GP_PORT_SERIAL_RING_SIZE - pl->start)
+			n = GP_PORT_SERIAL_RING_SIZE - pl->start;
+		if (n > (unsigned int)(size - readen))
+			n = size - readen;
+		if (dev->settings.serial.parity != GP_PORT_SERIAL_PARITY_OFF) {
+			next = memchr (p, 0xff, n);
+			if (next)
+				n = next - p;
+		}
+		if (n) {
+			memcpy (bytes + readen, p, n);
+			gp_port_serial_consume (pl, n);
+			readen += n;
+			continue;
+		}
 
-		/* Any data available? */
-                if (!select (dev->pl->fd + 1, &readfs, NULL, NULL, &timeout))
-                        return GP_ERROR_TIMEOUT;
-		if (!FD_ISSET (dev->pl->fd, &readfs))
-			return (GP_ERROR_TIMEOUT);
+		/* An escape, we need the byte after it, too. */
+		if (pl->len < 2) {
+			CHECK (gp_port_serial_fill (dev));
+			continue;
+		}
 
-		if (dev->settings.serial.parity != GP_PORT_SERIAL_PARITY_OFF) {
-		    unsigned char ffchar[1];
-		    unsigned char nullchar[1];
-
-		    ffchar[0] = 0xff;
-		    nullchar[0] = 0;
-		    now = read (dev->pl->fd, bytes, 1);
-		    if (now < 0)
-			    return GP_ERROR_IO_READ;
-		    if (!memcmp(bytes,ffchar,1)) {
-			now = read (dev->pl->fd, bytes, 1);
-			if (now < 0)
-				return GP_ERROR_IO_READ;
-
-			/* Parity errors are signaled by the serial layer
-			 * as 0xff 0x00 sequence.
-			 *
-			 * 0xff sent by the camera are escaped as
-			 * 0xff 0xff sequence.
-			 *
-			 * All other 0xff 0xXX sequences are errors.
-			 *
-			 * cf. man tcsetattr, description of PARMRK.
-			 */
-			if (!memcmp(bytes,nullchar,1)) {
-			    gp_port_set_error (dev, _("Parity error."));
-			    return GP_ERROR_IO_READ;
-			}
-			if (!memcmp(bytes,ffchar,1)) {
-			    gp_port_set_error (dev, _("Unexpected parity response sequence 0xff 0x%02x."), ((unsigned char*)bytes)[0]);
-			    return GP_ERROR_IO_READ;
-			}
-			/* Ok, we read 1 byte and it is 0xff */
-			/* FALLTHROUGH */
-		    }
-		} else {
-		    /* Just read the bytes */
-		    now = read (dev->pl->fd, bytes, size - readen);
-		    if (now < 0)
-			    return GP_ERROR_IO_READ;
+		/* Parity errors are signaled by the serial layer
+		 * as 0xff 0x00 sequence.
+		 *
+		 * 0xff sent by the camera are escaped as
+		 * 0xff 0xff sequence.
+		 *
+		 * All other 0xff 0xXX sequences are errors.
+		 *
+		 * cf. man tcsetattr, description of PARMRK.
+		 */
+		n = pl->ring[(pl->start + 1) % GP_PORT_SERIAL_RING_SIZE];
+		gp_port_serial_consume (pl, 2);
+		if (n == 0x00) {
+			gp_port_set_error (dev, _("Parity error."));
+			return GP_ERROR_IO_READ;
 		}
-		bytes += now;
-		readen += now;
-        }
+		if (n != 0xff) {
+			gp_port_set_error (dev, _("Unexpected parity response sequence 0xff 0x%02x."), n);
+			return GP_ERROR_IO_READ;
+		}
+		bytes[readen++] = (char)0xff;
+	}
 
-        return readen;
+	return readen;
 }
 
 #ifdef HAVE_TERMIOS_H
@@ -721,6 +857,10 @@ gp_port_serial_flush (GPPort *dev, int direction)
 	/* Make sure we are operating at the specified speed */
 	CHECK (gp_port_serial_check_speed (dev));
 
+	/* Bytes read ahead are input, too */
+	if (!direction)
+		dev->pl->len = 0;
+
 #ifdef HAVE_TERMIOS_H
 	if (tcflush (dev->pl->fd, direction ? TCOFLUSH : TCIFLUSH) < 0) {
 		int saved_errno = errno;
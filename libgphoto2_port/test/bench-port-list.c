@@ -0,0 +1,140 @@
+/* bench-port-list.c
+ *
+ * Copyright 2026 The gPhoto project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Times gp_port_info_list_lookup_path() on a port list shaped like the
+ * one of a build host with many ttys and disks: the ports of the
+ * installed iolibs plus, by default, 500 more serial, disk and USB
+ * ports. Prints the time per lookup of a listed path and of a path only
+ * a generic entry matches. Point IOLIBS at the iolibs of the build tree
+ * to run it uninstalled; it needs the disk iolib.
+ *
+ * Usage: bench-port-list [number-of-ports [rounds]]
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <gphoto2/gphoto2-port-info-list.h>
+#include <gphoto2/gphoto2-port-result.h>
+
+
+#define CHECK(r) {int ret = r; if (ret < 0) {printf ("Got error: %s\n", gp_port_result_as_string (ret)); return (1);}}
+
+static double
+now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+append (GPPortInfoList *list, GPPortType type, const char *name,
+	const char *path)
+{
+	GPPortInfo info;
+
+	CHECK (gp_port_info_new (&info));
+	CHECK (gp_port_info_set_type (info, type));
+	CHECK (gp_port_info_set_name (info, name));
+	CHECK (gp_port_info_set_path (info, path));
+	gp_port_info_list_append (list, info); /* -1 for generic entries */
+	return (0);
+}
+
+/*
+ * Path of the i-th regular port, 60% serial, 30% disk, 10% USB. None of
+ * them names a device the iolibs could have listed already.
+ */
+static GPPortType
+port_path (int i, int n, char *buf, size_t size)
+{
+	if (i < n * 6 / 10) {
+		snprintf (buf, size, "serial:/dev/bench-tty%d", i);
+		return GP_PORT_SERIAL;
+	}
+	if (i < n * 9 / 10) {
+		snprintf (buf, size, "disk:/bench/disk%d", i);
+		return GP_PORT_DISK;
+	}
+	snprintf (buf, size, "usb:%03d,%03d", 200 + i / 100, i % 100);
+	return GP_PORT_USB;
+}
+
+int
+main (int argc, char **argv)
+{
+	GPPortInfoList *list;
+	char path[64];
+	double t0, tfirst, texact, tgeneric;
+	int i, j, base, n = 500, rounds = 100;
+
+	if (argc > 1)
+		n = atoi (argv[1]);
+	if (argc > 2)
+		rounds = atoi (argv[2]);
+
+	/* The generic entries come from the installed iolibs. */
+	CHECK (gp_port_info_list_new (&list));
+	CHECK (gp_port_info_list_load (list));
+	CHECK (base = gp_port_info_list_count (list));
+	for (i = 0; i < n; i++) {
+		GPPortType type = port_path (i, n, path, sizeof (path));
+
+		if (append (list, type, "Port", path))
+			return (1);
+	}
+
+	t0 = now ();
+	port_path (0, n, path, sizeof (path));
+	CHECK (gp_port_info_list_lookup_path (list, path));
+	tfirst = now () - t0;
+
+	t0 = now ();
+	for (j = 0; j < rounds; j++)
+		for (i = 0; i < n; i++) {
+			port_path (i, n, path, sizeof (path));
+			if (gp_port_info_list_lookup_path (list, path) != base + i) {
+				printf ("Wrong index for '%s'\n", path);
+				return (1);
+			}
+		}
+	texact = now () - t0;
+
+	/* Only the generic entry of the disk iolib matches these, and
+	 * every one of them adds a port to the list. */
+	t0 = now ();
+	for (i = 0; i < rounds; i++) {
+		snprintf (path, sizeof (path), "disk:/bench/new%d", i);
+		CHECK (gp_port_info_list_lookup_path (list, path));
+	}
+	tgeneric = now () - t0;
+
+	printf ("%d ports: first lookup %8.3f us, listed path %8.3f us/lookup, "
+		"generic path %8.3f us/lookup\n", base + n, tfirst * 1000000.0,
+		texact * 1000000.0 / (rounds * n), tgeneric * 1000000.0 / rounds);
+
+	CHECK (gp_port_info_list_free (list));
+	return (0);
+}
@@ -0,0 +1,185 @@
+/* bench-serial-read.c
+ *
+ * Copyright 2026 The gPhoto project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Reads data through the serial iolib from a pty whose other side a
+ * child process writes to, in reads of a few bytes the way serial
+ * camera drivers read their packets, and checks it. Prints the time and
+ * the CPU time per byte, once without parity and once in the parity
+ * mode, where the tty escapes every 0xff in the data as 0xff 0xff.
+ * Point IOLIBS at the iolibs of the build tree to run it uninstalled.
+ *
+ * Usage: bench-serial-read [kilobytes [bytes-per-read]]
+ */
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <gphoto2/gphoto2-port.h>
+#include <gphoto2/gphoto2-port-info-list.h>
+#include <gphoto2/gphoto2-port-result.h>
+
+
+#define CHECK(r) {int ret = r; if (ret < 0) {printf ("Got error: %s\n", gp_port_result_as_string (ret)); return (1);}}
+
+/* Covers all byte values, 0xff included. */
+#define PATTERN(i) ((unsigned char)((i) * 131 + ((i) >> 8)))
+
+static double
+now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double
+cpu (void)
+{
+	struct rusage ru;
+
+	getrusage (RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+}
+
+static void
+writer (int fd, int size)
+{
+	unsigned char buf[4096];
+	int i, n, w;
+
+	for (i = 0; i < size; i += n) {
+		n = size - i < (int)sizeof (buf) ? size - i : (int)sizeof (buf);
+		for (w = 0; w < n; w++)
+			buf[w] = PATTERN (i + w);
+		for (w = 0; w < n; ) {
+			int ret = write (fd, buf + w, n - w);
+
+			if (ret < 0)
+				_exit (1);
+			w += ret;
+		}
+	}
+	_exit (0);
+}
+
+static int
+bench (GPPortInfo info, int master, int size, int chunk,
+       GPPortSerialParity parity)
+{
+	GPPort *port;
+	GPPortSettings settings;
+	char *buf;
+	double t0, c0, t, c;
+	int i, n, status;
+	pid_t pid;
+
+	CHECK (gp_port_new (&port));
+	CHECK (gp_port_set_info (port, info));
+	CHECK (gp_port_set_timeout (port, 2000));
+	CHECK (gp_port_open (port));
+	CHECK (gp_port_get_settings (port, &settings));
+	settings.serial.speed = 115200;
+	settings.serial.parity = parity;
+	CHECK (gp_port_set_settings (port, settings));
+
+	/* Only write once the tty is raw. */
+	pid = fork ();
+	if (pid < 0)
+		return (1);
+	if (!pid)
+		writer (master, size);
+
+	if (!(buf = malloc (chunk)))
+		return (1);
+	t0 = now (); c0 = cpu ();
+	for (i = 0; i < size; i += n) {
+		int j;
+
+		n = size - i < chunk ? size - i : chunk;
+		CHECK (gp_port_read (port, buf, n));
+		for (j = 0; j < n; j++)
+			if ((unsigned char)buf[j] != PATTERN (i + j)) {
+				printf ("Wrong byte at %d\n", i + j);
+				return (1);
+			}
+	}
+	t = now () - t0; c = cpu () - c0;
+	free (buf);
+
+	if (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status) ||
+	    WEXITSTATUS (status))
+		return (1);
+	printf ("parity %-3s: %6d KB in reads of %4d bytes in %7.3f s, "
+		"cpu %7.3f s (%6.3f us/byte)\n",
+		parity == GP_PORT_SERIAL_PARITY_OFF ? "off" : "on",
+		size / 1024, chunk, t, c, c * 1000000.0 / size);
+
+	gp_port_close (port);
+	gp_port_free (port);
+	return (0);
+}
+
+int
+main (int argc, char **argv)
+{
+	GPPortInfoList *list;
+	GPPortInfo info;
+	char path[128];
+	int master, size = 1024 * 1024, chunk = 1;
+
+	if (argc > 1)
+		size = atoi (argv[1]) * 1024;
+	if (argc > 2)
+		chunk = atoi (argv[2]);
+
+	if ((master = posix_openpt (O_RDWR | O_NOCTTY)) < 0 ||
+	    grantpt (master) || unlockpt (master)) {
+		perror ("posix_openpt");
+		return (1);
+	}
+	snprintf (path, sizeof (path), "serial:%s", ptsname (master));
+
+	CHECK (gp_port_info_list_new (&list));
+	CHECK (gp_port_info_list_load (list));
+	CHECK (gp_port_info_list_get_info (list,
+			gp_port_info_list_lookup_path (list, path), &info));
+
+	if (bench (info, master, size, chunk, GP_PORT_SERIAL_PARITY_OFF) ||
+	    bench (info, master, size, chunk, GP_PORT_SERIAL_PARITY_EVEN))
+		return (1);
+
+	CHECK (gp_port_info_list_free (list));
+	close (master);
+	return (0);
+}
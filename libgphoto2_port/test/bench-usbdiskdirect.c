@@ -0,0 +1,196 @@
+/* bench-usbdiskdirect.c
+ *
+ * Copyright 2026 The gPhoto project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Runs the usbdiskdirect iolib against an image file or a loop device
+ * instead of a picture frame, and checks what it reads back:
+ *  - writes and reads all of it one 512 byte sector at a time,
+ *  - sends "commands" the way st2205 does: writes a sector at a fixed
+ *    offset and reads it back, then reads a 32 KB block elsewhere,
+ *  - reads and writes at offsets and sizes not aligned to sectors.
+ * Prints the time each of them takes. THE CONTENTS OF THE IMAGE ARE
+ * OVERWRITTEN. Point IOLIBS at the iolibs of the build tree to run it
+ * uninstalled.
+ *
+ * Usage: bench-usbdiskdirect image [megabytes [commands]]
+ */
+#define _DEFAULT_SOURCE
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <gphoto2/gphoto2-port.h>
+#include <gphoto2/gphoto2-port-info-list.h>
+#include <gphoto2/gphoto2-port-result.h>
+
+
+#define CHECK(r) {int ret = r; if (ret < 0) {printf ("Got error: %s\n", gp_port_result_as_string (ret)); return (1);}}
+#define CHECK_SIZE(r,size) {int ret = r; if (ret != (size)) {printf ("Got %d instead of %d bytes: %s\n", ret, (int)(size), gp_port_result_as_string (ret)); return (1);}}
+
+#define SECTOR		512
+#define CMD_OFFSET	(4 * SECTOR)
+#define BLOCK_OFFSET	(64 * SECTOR)
+#define BLOCK_SIZE	(32 * 1024)
+
+#define PATTERN(offset,seed) ((unsigned char)((offset) * 7 + ((offset) >> 9) + (seed)))
+
+static double
+now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+fill (char *buf, int size, int offset, int seed)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = PATTERN (offset + i, seed);
+}
+
+static int
+verify (const char *buf, int size, int offset, int seed)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		if ((unsigned char)buf[i] != PATTERN (offset + i, seed)) {
+			printf ("Wrong byte at %d\n", offset + i);
+			return (1);
+		}
+	return (0);
+}
+
+static void
+report (const char *what, double t, int ops)
+{
+	printf ("%-28s: %7.3f s (%7.2f us each)\n", what, t, t * 1000000.0 / ops);
+}
+
+int
+main (int argc, char **argv)
+{
+	GPPortInfoList *list;
+	GPPortInfo info;
+	GPPort *port;
+	char path[256], *buf, *odd;
+	double t0;
+	int fd, i, size = 8, commands = 1000;
+
+	if (argc < 2) {
+		printf ("Usage: %s image [megabytes [commands]]\n", argv[0]);
+		return (1);
+	}
+	if (argc > 2)
+		size = atoi (argv[2]);
+	if (argc > 3)
+		commands = atoi (argv[3]);
+	size *= 1024 * 1024;
+
+	/* Image files need to be large enough, devices already are */
+	fd = open (argv[1], O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror (argv[1]);
+		return (1);
+	}
+	if (lseek (fd, 0, SEEK_END) < size && ftruncate (fd, size)) {
+		perror (argv[1]);
+		return (1);
+	}
+	close (fd);
+
+	/* Like camera drivers for O_DIRECT devices do */
+	if (posix_memalign ((void **)&buf, 4096, BLOCK_SIZE) ||
+	    !(odd = malloc (3 * SECTOR)))
+		return (1);
+
+	snprintf (path, sizeof (path), "usbdiskdirect:%s", argv[1]);
+	CHECK (gp_port_info_list_new (&list));
+	CHECK (gp_port_info_list_load (list));
+	CHECK (gp_port_info_list_get_info (list,
+			gp_port_info_list_lookup_path (list, path), &info));
+	CHECK (gp_port_new (&port));
+	CHECK (gp_port_set_info (port, info));
+	CHECK (gp_port_open (port));
+
+	t0 = now ();
+	CHECK (gp_port_seek (port, 0, SEEK_SET));
+	for (i = 0; i < size; i += SECTOR) {
+		fill (buf, SECTOR, i, 0);
+		CHECK_SIZE (gp_port_write (port, buf, SECTOR), SECTOR);
+	}
+	report ("sector writes", now () - t0, size / SECTOR);
+
+	t0 = now ();
+	CHECK (gp_port_seek (port, 0, SEEK_SET));
+	for (i = 0; i < size; i += SECTOR) {
+		CHECK_SIZE (gp_port_read (port, buf, SECTOR), SECTOR);
+		if (verify (buf, SECTOR, i, 0))
+			return (1);
+	}
+	report ("sector reads", now () - t0, size / SECTOR);
+
+	/* A command must never be answered from what was there before */
+	t0 = now ();
+	for (i = 1; i <= commands; i++) {
+		fill (buf, SECTOR, CMD_OFFSET, i);
+		CHECK_SIZE (gp_port_seek (port, CMD_OFFSET, SEEK_SET), CMD_OFFSET);
+		CHECK_SIZE (gp_port_write (port, buf, SECTOR), SECTOR);
+		CHECK_SIZE (gp_port_seek (port, CMD_OFFSET, SEEK_SET), CMD_OFFSET);
+		CHECK_SIZE (gp_port_read (port, buf, SECTOR), SECTOR);
+		if (verify (buf, SECTOR, CMD_OFFSET, i))
+			return (1);
+		CHECK_SIZE (gp_port_seek (port, BLOCK_OFFSET, SEEK_SET), BLOCK_OFFSET);
+		CHECK_SIZE (gp_port_read (port, buf, BLOCK_SIZE), BLOCK_SIZE);
+		if (verify (buf, BLOCK_SIZE, BLOCK_OFFSET, 0))
+			return (1);
+	}
+	report ("commands", now () - t0, commands);
+
+	/* Offsets, sizes and memory not aligned to sectors */
+	t0 = now ();
+	fill (odd, 2 * SECTOR + 3, SECTOR + 100, 0x55);
+	CHECK (gp_port_seek (port, SECTOR + 100, SEEK_SET));
+	CHECK_SIZE (gp_port_write (port, odd, 2 * SECTOR + 3), 2 * SECTOR + 3);
+	CHECK (gp_port_seek (port, SECTOR, SEEK_SET));
+	CHECK_SIZE (gp_port_read (port, odd + 1, 3 * SECTOR - 1), 3 * SECTOR - 1);
+	if (verify (odd + 1, 100, SECTOR, 0) ||
+	    verify (odd + 101, 2 * SECTOR + 3, SECTOR + 100, 0x55) ||
+	    verify (odd + 104 + 2 * SECTOR, SECTOR - 104, 3 * SECTOR + 103, 0))
+		return (1);
+	report ("unaligned write and read", now () - t0, 1);
+
+	CHECK (gp_port_close (port));
+	CHECK (gp_port_free (port));
+	CHECK (gp_port_info_list_free (list));
+	free (buf);
+	free (odd);
+	return (0);
+}
@@ -0,0 +1,323 @@
+/* test-replay.c
+ *
+ * Copyright 2026 The gPhoto project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Records a short session with a scripted camera through the replay
+ * port library and replays the trace. The port library is built into
+ * the test, with the USB port of the camera replaced by the stub below,
+ * so neither a camera nor a USB port library is needed.
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <gphoto2/gphoto2-port.h>
+#include <gphoto2/gphoto2-port-library.h>
+#include <gphoto2/gphoto2-port-info-list.h>
+#include <gphoto2/gphoto2-port-result.h>
+#include <gphoto2/gphoto2-port-log.h>
+
+#include "../libgphoto2_port/gphoto2-port-info.h"
+
+
+#ifdef __GNUC__
+#define __unused__ __attribute__((unused))
+#else
+#define __unused__
+#endif
+
+
+/* The trace the port being tested uses, "record:..." or "replay:..." */
+static GPPortInfo port_info;
+
+static int
+stub_get_info (GPPort __unused__ *port, GPPortInfo *info)
+{
+	*info = port_info;
+	return (GP_OK);
+}
+
+/*
+ * The camera: answers a read with READ_DATA, has one interrupt
+ * pending and streams STREAM_SIZE bytes in three pieces.
+ */
+#define READ_DATA	"0123456789"
+#define STREAM_SIZE	100000
+
+static int camera_interrupts;
+
+static int
+stub_open (GPPort __unused__ *port)
+{
+	camera_interrupts = 1;
+	return (GP_OK);
+}
+
+static int
+stub_close (GPPort __unused__ *port)
+{
+	return (GP_OK);
+}
+
+static int
+stub_set_timeout (GPPort __unused__ *port, int __unused__ timeout)
+{
+	return (GP_OK);
+}
+
+static int
+stub_write (GPPort __unused__ *port, const char __unused__ *data, int size)
+{
+	return (size);
+}
+
+static int
+stub_read (GPPort __unused__ *port, char *data, int size)
+{
+	if (size > (int)strlen (READ_DATA))
+		size = strlen (READ_DATA);
+	memcpy (data, READ_DATA, size);
+	return (size);
+}
+
+static int
+stub_check_int (GPPort __unused__ *port, char *data, int size)
+{
+	if (!camera_interrupts)
+		return (GP_ERROR_TIMEOUT);
+	camera_interrupts--;
+	if (size > 3)
+		size = 3;
+	memcpy (data, "evt", size);
+	return (size);
+}
+
+static int
+stub_set_stream_transfers (GPPort __unused__ *port, int __unused__ transfers,
+			   int __unused__ transfersize)
+{
+	return (GP_OK);
+}
+
+static unsigned char
+stream_byte (unsigned long offset)
+{
+	return (offset * 7) & 0xff;
+}
+
+static int
+stub_read_stream (GPPort *port, unsigned long __unused__ size,
+		  GPPortStreamFunc func, void *user_data)
+{
+	static const int pieces[] = { 40000, 40000, 20000 };
+	char buf[40000];
+	unsigned long offset = 0;
+	unsigned int i;
+	int j, ret;
+
+	for (i = 0; i < sizeof (pieces) / sizeof (pieces[0]); i++) {
+		for (j = 0; j < pieces[i]; j++)
+			buf[j] = stream_byte (offset + j);
+		ret = func (port, buf, pieces[i], user_data);
+		if (ret < GP_OK)
+			return (ret);
+		offset += pieces[i];
+	}
+	return (offset);
+}
+
+#define gp_port_get_info		stub_get_info
+#define gp_port_open			stub_open
+#define gp_port_close			stub_close
+#define gp_port_set_timeout		stub_set_timeout
+#define gp_port_write			stub_write
+#define gp_port_read			stub_read
+#define gp_port_check_int		stub_check_int
+#define gp_port_set_stream_transfers	stub_set_stream_transfers
+#define gp_port_read_stream		stub_read_stream
+
+#include "../replay/replay.c"
+
+#undef CHECK
+#define CHECK(r) {int ret = r; if (ret < 0) {printf ("Got error: %s\n", gp_port_result_as_string (ret)); return (1);}}
+#define EXPECT(c) {if (!(c)) {printf ("%s:%d: '%s' failed\n", __FILE__, __LINE__, #c); return (1);}}
+
+/* Checks the pieces of a stream and counts them. */
+typedef struct {
+	unsigned long	offset;
+	int		pieces[4];
+	int		npieces;
+} Stream;
+
+static int
+stream_func (GPPort __unused__ *port, const char *data, int size,
+	     void *user_data)
+{
+	Stream *stream = user_data;
+	int i;
+
+	for (i = 0; i < size; i++)
+		if ((unsigned char)data[i] != stream_byte (stream->offset + i))
+			return (GP_ERROR_IO_READ);
+	if (stream->npieces < 4)
+		stream->pieces[stream->npieces] = size;
+	stream->npieces++;
+	stream->offset += size;
+	return (GP_OK);
+}
+
+/* A port of the replay library on path, not opened yet. */
+static int
+port_new (GPPort **port, const char *prefix, const char *trace)
+{
+	char path[256];
+
+	snprintf (path, sizeof (path), "%s:%s", prefix, trace);
+	free (port_info->path);
+	CHECK (gp_port_info_set_path (port_info, path));
+	CHECK (gp_port_new (port));
+	CHECK (gp_port_replay_init (*port));
+	return (GP_OK);
+}
+
+static int
+port_free (GPPort *port)
+{
+	CHECK (gp_port_replay_exit (port));
+	CHECK (gp_port_free (port));
+	return (GP_OK);
+}
+
+/* What the camera driver does, in both sessions. */
+static int
+session_start (GPPort *port)
+{
+	char buf[64];
+
+	CHECK (gp_port_replay_open (port));
+	EXPECT (gp_port_replay_write (port, "PING", 4) == 4);
+	EXPECT (gp_port_replay_check_int (port, buf, sizeof (buf), 50) == 3);
+	EXPECT (!memcmp (buf, "evt", 3));
+	return (0);
+}
+
+static int
+session_end (GPPort *port)
+{
+	char buf[64];
+	Stream stream;
+
+	memset (buf, 0, sizeof (buf));
+	EXPECT (gp_port_replay_read (port, buf, sizeof (buf)) == (int)strlen (READ_DATA));
+	EXPECT (!strcmp (buf, READ_DATA));
+
+	memset (&stream, 0, sizeof (stream));
+	EXPECT (gp_port_replay_read_stream (port, STREAM_SIZE, 4, 16384,
+					    stream_func, &stream) == STREAM_SIZE);
+	EXPECT (stream.offset == STREAM_SIZE);
+	EXPECT ((stream.npieces == 3) && (stream.pieces[0] == 40000) &&
+		(stream.pieces[1] == 40000) && (stream.pieces[2] == 20000));
+
+	/* Sizes beyond an int are kept. */
+	memset (&stream, 0, sizeof (stream));
+	EXPECT (gp_port_replay_read_stream (port, (unsigned long)INT_MAX + 2,
+					    4, 16384, stream_func,
+					    &stream) == STREAM_SIZE);
+
+	CHECK (gp_port_replay_close (port));
+	return (0);
+}
+
+static int
+test_replay (const char *trace)
+{
+	GPPort *port;
+	char buf[64];
+	Stream stream;
+
+	printf ("*** Recording a session...\n");
+	CHECK (port_new (&port, "record", trace));
+	CHECK (gp_port_new (&port->pl->inner)); /* the stub camera */
+	if (session_start (port))
+		return (1);
+	/* Polls that time out are recorded, too. */
+	EXPECT (gp_port_replay_check_int (port, buf, sizeof (buf), 50) == GP_ERROR_TIMEOUT);
+	EXPECT (gp_port_replay_check_int (port, buf, sizeof (buf), 50) == GP_ERROR_TIMEOUT);
+	if (session_end (port))
+		return (1);
+	EXPECT (!port->pl->failed);
+	CHECK (port_free (port));
+
+	printf ("*** Replaying it...\n");
+	CHECK (port_new (&port, "replay", trace));
+	if (session_start (port))
+		return (1);
+	/*
+	 * The recorded empty polls are skipped. Polls that were not
+	 * recorded time out without taking a record.
+	 */
+	EXPECT (gp_port_replay_check_int (port, buf, sizeof (buf), 50) == GP_ERROR_TIMEOUT);
+	if (session_end (port))
+		return (1);
+	EXPECT (gp_port_replay_read (port, buf, sizeof (buf)) == GP_ERROR_IO);
+	CHECK (port_free (port));
+
+	printf ("*** Replaying it with a different call...\n");
+	CHECK (port_new (&port, "replay", trace));
+	if (session_start (port))
+		return (1);
+	EXPECT (gp_port_replay_read (port, buf, 32) == GP_ERROR_IO);
+	CHECK (port_free (port));
+
+	printf ("*** Replaying it with a different stream size...\n");
+	CHECK (port_new (&port, "replay", trace));
+	if (session_start (port))
+		return (1);
+	EXPECT (gp_port_replay_read (port, buf, sizeof (buf)) == (int)strlen (READ_DATA));
+	memset (&stream, 0, sizeof (stream));
+	EXPECT (gp_port_replay_read_stream (port, STREAM_SIZE - 1, 4, 16384,
+					    stream_func, &stream) == GP_ERROR_IO);
+	CHECK (port_free (port));
+	return (0);
+}
+
+int
+main ()
+{
+	char trace[] = "/tmp/test-replay-XXXXXX";
+	int fd, ret;
+
+	fd = mkstemp (trace);
+	if (fd < 0) {
+		printf ("Could not create a file for the trace.\n");
+		return (1);
+	}
+	close (fd);
+	CHECK (gp_port_info_new (&port_info));
+	ret = test_replay (trace);
+	unlink (trace);
+	free (port_info->path);
+	free (port_info);
+	return (ret);
+}
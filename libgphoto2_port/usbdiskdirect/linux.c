@@ -18,6 +18,7 @@
  * Boston, MA  02110-1301  USA
  */
 #define _DEFAULT_SOURCE
+#define _GNU_SOURCE /* statx() */
 
 #include "config.h"
 #include <gphoto2/gphoto2-port-library.h>
@@ -25,14 +26,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #ifdef HAVE_FCNTL_H
 # include <fcntl.h>
 #endif
 #ifdef HAVE_LIMITS_H
 # include <limits.h>
 #endif
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <linux/fs.h>
 #ifdef HAVE_SYS_PARAM_H
 # include <sys/param.h>
 #endif
@@ -70,8 +75,34 @@
 
 #define CHECK(result) {int r=(result); if (r<0) return (r);}
 
+/*
+ * Size of the read-ahead and of the write-back buffer. Reads that
+ * continue where the previous one ended read this much, contiguous
+ * writes are collected up to this much before they go to the device.
+ */
+#define GP_PORT_USBDISKDIRECT_BUFFER_SIZE (128 * 1024)
+
 struct _GPPortPrivateLibrary {
 	int fd;       /* Device handle */
+
+	/*
+	 * With O_DIRECT, offsets, sizes and memory must be aligned to the
+	 * logical block size of the device. Everything that is not goes
+	 * through the buffers below, which are.
+	 */
+	unsigned int align, mem_align;
+	off_t offset;		/* Current position, pread()/pwrite() use it */
+	off_t next;		/* Where a sequential read would start */
+
+	/* Data of the device at ra_offset */
+	char *ra;
+	off_t ra_offset;
+	unsigned int ra_len;
+
+	/* Data to be written to the device at wb_offset */
+	char *wb;
+	off_t wb_offset;
+	unsigned int wb_len;
 };
 
 GPPortType
@@ -237,6 +268,13 @@ gp_port_library_list (GPPortInfoList *list)
 			break;
 	}
 	gp_system_closedir (dir);
+
+	/* generic usbdiskdirect:/xxx matcher, e.g. for loop devices */
+	gp_port_info_new (&info);
+	gp_port_info_set_type (info, GP_PORT_USB_DISK_DIRECT);
+	gp_port_info_set_name (info, "");
+	gp_port_info_set_path (info, "^usbdiskdirect:");
+	gp_port_info_list_append (list, info); /* do not check return */
 	return GP_OK;
 }
 
@@ -255,12 +293,137 @@ gp_port_usbdiskdirect_exit (GPPort *port)
 {
 	C_PARAMS (port);
 
+	free (port->pl->ra);
+	free (port->pl->wb);
 	free (port->pl);
 	port->pl = NULL;
 
 	return GP_OK;
 }
 
+/*
+ * pread()/pwrite() all of size bytes unless the device ends first.
+ * Returns the number of bytes transferred.
+ */
+static int
+gp_port_usbdiskdirect_pio (GPPort *port, int writing, char *bytes, int size,
+			   off_t offset)
+{
+	ssize_t ret;
+	int done = 0;
+
+	while (done < size) {
+		if (writing)
+			ret = pwrite (port->pl->fd, bytes + done, size - done,
+				      offset + done);
+		else
+			ret = pread (port->pl->fd, bytes + done, size - done,
+				     offset + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			if (writing)
+				gp_port_set_error (port, _("Could not write to "
+					"'%s' (%m)."),
+					port->settings.usbdiskdirect.path);
+			else
+				gp_port_set_error (port, _("Could not read from "
+					"'%s' (%m)."),
+					port->settings.usbdiskdirect.path);
+			return GP_ERROR_IO;
+		}
+		if (!ret)
+			break;
+		done += ret;
+	}
+	return done;
+}
+
+static int
+gp_port_usbdiskdirect_short_write (GPPort *port)
+{
+	gp_port_set_error (port, _("Could not write beyond the end of '%s'."),
+			   port->settings.usbdiskdirect.path);
+	return GP_ERROR_IO;
+}
+
+static int
+gp_port_usbdiskdirect_flush_wb (GPPort *port)
+{
+	GPPortPrivateLibrary *pl = port->pl;
+	int ret, len;
+
+	if (!pl->wb_len)
+		return GP_OK;
+
+	ret = gp_port_usbdiskdirect_pio (port, 1, pl->wb, pl->wb_len,
+					 pl->wb_offset);
+	len = pl->wb_len;
+	pl->wb_len = 0;
+	CHECK (ret);
+	if (ret < len)
+		return gp_port_usbdiskdirect_short_write (port);
+	return GP_OK;
+}
+
+/*
+ * Sets up the buffers for a newly opened device. The alignment is what
+ * the kernel reports for O_DIRECT, else the logical block size of block
+ * devices and the block size of the file system for image files.
+ */
+static int
+gp_port_usbdiskdirect_alloc (GPPort *port)
+{
+	GPPortPrivateLibrary *pl = port->pl;
+	struct stat st;
+	int size = 0, mem_size;
+#ifdef HAVE_STRUCT_STATX_STX_DIO_OFFSET_ALIGN
+	struct statx stx;
+#endif
+
+	if (fstat (pl->fd, &st)) {
+		gp_port_set_error (port, _("Could not get information about "
+			"'%s' (%m)."), port->settings.usbdiskdirect.path);
+		return GP_ERROR_IO;
+	}
+#ifdef BLKSSZGET
+	if (S_ISBLK (st.st_mode) && ioctl (pl->fd, BLKSSZGET, &size) < 0)
+		size = 0;
+#endif
+	if (!S_ISBLK (st.st_mode))
+		size = st.st_blksize;
+	mem_size = size;
+#ifdef HAVE_STRUCT_STATX_STX_DIO_OFFSET_ALIGN
+	if (!statx (pl->fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) &&
+	    (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align) {
+		size = stx.stx_dio_offset_align;
+		mem_size = stx.stx_dio_mem_align;
+	}
+#endif
+	pl->align = 512;
+	while (pl->align < (unsigned int)size &&
+	       pl->align < GP_PORT_USBDISKDIRECT_BUFFER_SIZE)
+		pl->align *= 2;
+	for (pl->mem_align = 1; pl->mem_align < (unsigned int)mem_size &&
+	     pl->mem_align < 4096; pl->mem_align *= 2);
+	GP_LOG_D ("Aligning direct IO to %u bytes, memory to %u bytes.",
+		  pl->align, pl->mem_align);
+
+	if (posix_memalign ((void **)&pl->ra, 4096,
+			    GP_PORT_USBDISKDIRECT_BUFFER_SIZE) ||
+	    posix_memalign ((void **)&pl->wb, 4096,
+			    GP_PORT_USBDISKDIRECT_BUFFER_SIZE)) {
+		free (pl->ra);
+		pl->ra = NULL;
+		return GP_ERROR_NO_MEMORY;
+	}
+
+	pl->offset = 0;
+	pl->next = -1;
+	pl->ra_len = pl->wb_len = 0;
+	return GP_OK;
+}
+
 static int
 gp_port_usbdiskdirect_open (GPPort *port)
 {
@@ -280,21 +443,41 @@ gp_port_usbdiskdirect_open (GPPort *port)
 		CHECK (result)
 	}
 	port->pl->fd = open (path, O_RDWR|O_DIRECT|O_SYNC);
+	if (port->pl->fd == -1 && errno == EINVAL) {
+		/* Images on file systems without O_DIRECT, e.g. tmpfs */
+		GP_LOG_D ("'%s' does not support O_DIRECT.", path);
+		port->pl->fd = open (path, O_RDWR|O_SYNC);
+	}
 	if (port->pl->fd == -1) {
 		gp_port_usbdiskdirect_unlock (port, path);
 		gp_port_set_error (port, _("Failed to open '%s' (%m)."), path);
 		return GP_ERROR_IO;
 	}
 
+	result = gp_port_usbdiskdirect_alloc (port);
+	if (result < GP_OK) {
+		close (port->pl->fd);
+		port->pl->fd = -1;
+		gp_port_usbdiskdirect_unlock (port, path);
+		return result;
+	}
+
 	return GP_OK;
 }
 
 static int
 gp_port_usbdiskdirect_close (GPPort *port)
 {
+	int result;
+
 	if (!port || port->pl->fd == -1)
 		return GP_OK;
 
+	result = gp_port_usbdiskdirect_flush_wb (port);
+	free (port->pl->ra);
+	free (port->pl->wb);
+	port->pl->ra = port->pl->wb = NULL;
+
 	if (close (port->pl->fd) == -1) {
 		gp_port_set_error (port, _("Could not close "
 			"'%s' (%m)."), port->settings.usbdiskdirect.path);
@@ -305,11 +488,12 @@ gp_port_usbdiskdirect_close (GPPort *port)
 	CHECK (gp_port_usbdiskdirect_unlock (port,
 					port->settings.usbdiskdirect.path))
 
-	return GP_OK;
+	return result;
 }
 
 static int gp_port_usbdiskdirect_seek (GPPort *port, int offset, int whence)
 {
+	GPPortPrivateLibrary *pl;
 	off_t ret;
 
 	C_PARAMS (port);
@@ -317,56 +501,166 @@ static int gp_port_usbdiskdirect_seek (GPPort *port, int offset, int whence)
 	/* The device needs to be opened for that operation */
 	if (port->pl->fd == -1)
 		CHECK (gp_port_usbdiskdirect_open (port))
-
-	ret = lseek (port->pl->fd, offset, whence);
-	if (ret == -1) {
+	pl = port->pl;
+
+	/* Reads and writes use the position, no need to ask the kernel */
+	switch (whence) {
+	case SEEK_SET:
+		ret = offset;
+		break;
+	case SEEK_CUR:
+		ret = pl->offset + offset;
+		break;
+	default:
+		ret = lseek (pl->fd, offset, whence);
+		break;
+	}
+	if (ret < 0) {
 		gp_port_set_error (port, _("Could not seek to offset: %x on "
 			"'%s' (%m)."), offset,
 			port->settings.usbdiskdirect.path);
 		return GP_ERROR_IO;
 	}
+	pl->offset = ret;
 
 	return ret;
 }
 
+/*
+ * Writes that are aligned and continue the pending ones are collected in
+ * the write-back buffer and go to the device in one pwrite() when it is
+ * full, on the next other write or read and on close. Everything else is
+ * written right away; unaligned parts by reading the blocks around them
+ * first.
+ */
 static int
 gp_port_usbdiskdirect_write (GPPort *port, const char *bytes, int size)
 {
+	GPPortPrivateLibrary *pl;
+	off_t start, end, offset;
+	unsigned int n;
 	int ret;
 
-	C_PARAMS (port);
+	C_PARAMS (port && size >= 0);
 
 	/* The device needs to be opened for that operation */
 	if (port->pl->fd == -1)
 		CHECK (gp_port_usbdiskdirect_open (port))
-
-	ret = write (port->pl->fd, bytes, size);
-	if (ret < 0) {
-		gp_port_set_error (port, _("Could not write to '%s' (%m)."),
-				   port->settings.usbdiskdirect.path);
-		return GP_ERROR_IO;
+	pl = port->pl;
+
+	/* The device changes, whatever we read ahead may be stale */
+	pl->ra_len = 0;
+	pl->next = -1;
+
+	offset = pl->offset;
+	while (size > 0) {
+		if (pl->wb_len &&
+		    (offset != pl->wb_offset + pl->wb_len ||
+		     pl->wb_len == GP_PORT_USBDISKDIRECT_BUFFER_SIZE))
+			CHECK (gp_port_usbdiskdirect_flush_wb (port));
+		if (!pl->wb_len)
+			pl->wb_offset = offset;
+
+		if (!(offset % pl->align) && size >= (int)pl->align) {
+			n = GP_PORT_USBDISKDIRECT_BUFFER_SIZE - pl->wb_len;
+			if (n > (unsigned int)size)
+				n = size - size % pl->align;
+			memcpy (pl->wb + pl->wb_len, bytes, n);
+			pl->wb_len += n;
+		} else {
+			/* Read, modify and write the blocks around it */
+			CHECK (gp_port_usbdiskdirect_flush_wb (port));
+			start = offset - offset % pl->align;
+			end = start + pl->align;
+			n = end - offset;
+			if (n > (unsigned int)size)
+				n = size;
+			memset (pl->wb, 0, pl->align);
+			CHECK (gp_port_usbdiskdirect_pio (port, 0, pl->wb,
+							  pl->align, start));
+			memcpy (pl->wb + (offset - start), bytes, n);
+			CHECK (ret = gp_port_usbdiskdirect_pio (port, 1, pl->wb,
+							pl->align, start));
+			if (ret < (int)pl->align)
+				return gp_port_usbdiskdirect_short_write (port);
+		}
+		bytes += n;
+		offset += n;
+		size -= n;
 	}
+	ret = offset - pl->offset;
+	pl->offset = offset;
 
 	return ret;
 }
 
+/*
+ * Aligned reads into aligned memory go straight to the caller unless
+ * they are small and continue the previous read. The rest is read
+ * through the read-ahead buffer: a whole buffer if the read continues
+ * the previous one, else just the blocks around it. Later reads get
+ * what they can from there. Writes empty it, so nothing read after a
+ * command to a picture frame comes from before it.
+ */
 static int
 gp_port_usbdiskdirect_read (GPPort *port, char *bytes, int size)
 {
-	int ret;
+	GPPortPrivateLibrary *pl;
+	off_t start, offset;
+	unsigned int n, len;
+	int ret, sequential;
 
-	C_PARAMS (port);
+	C_PARAMS (port && size >= 0);
 
 	/* The device needs to be opened for that operation */
 	if (port->pl->fd == -1)
 		CHECK (gp_port_usbdiskdirect_open (port))
-
-	ret = read (port->pl->fd, bytes, size);
-	if (ret < 0) {
-		gp_port_set_error (port, _("Could not read from '%s' (%m)."),
-				   port->settings.usbdiskdirect.path);
-		return GP_ERROR_IO;
+	pl = port->pl;
+
+	CHECK (gp_port_usbdiskdirect_flush_wb (port));
+
+	offset = pl->offset;
+	sequential = (offset == pl->next);
+	while (size > 0) {
+		if (pl->ra_len && offset >= pl->ra_offset &&
+		    offset < pl->ra_offset + pl->ra_len) {
+			n = pl->ra_offset + pl->ra_len - offset;
+			if (n > (unsigned int)size)
+				n = size;
+			memcpy (bytes, pl->ra + (offset - pl->ra_offset), n);
+		} else if (!(offset % pl->align) &&
+			   !((unsigned long)bytes % pl->mem_align) &&
+			   size >= (int)(sequential ?
+					 GP_PORT_USBDISKDIRECT_BUFFER_SIZE :
+					 pl->align)) {
+			n = size - size % pl->align;
+			CHECK (ret = gp_port_usbdiskdirect_pio (port, 0, bytes,
+								n, offset));
+			if (!ret)
+				break;
+			n = ret;
+		} else {
+			start = offset - offset % pl->align;
+			len = (offset - start) + size;
+			if (sequential || len > GP_PORT_USBDISKDIRECT_BUFFER_SIZE)
+				len = GP_PORT_USBDISKDIRECT_BUFFER_SIZE;
+			else if (len % pl->align)
+				len += pl->align - len % pl->align;
+			pl->ra_len = 0;
+			CHECK (ret = gp_port_usbdiskdirect_pio (port, 0, pl->ra,
+								len, start));
+			if (ret <= offset - start)
+				break;
+			pl->ra_offset = start;
+			pl->ra_len = ret;
+			continue;
+		}
+		bytes += n;
+		offset += n;
+		size -= n;
 	}
+	ret = offset - pl->offset;
+	pl->offset = pl->next = offset;
 
 	return ret;
 }
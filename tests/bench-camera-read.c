@@ -0,0 +1,124 @@
+/* bench-camera-read.c
+ *
+ * Copyright 2026 The gPhoto project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Downloads one file from the first camera found, once with one read at
+ * a time and once with gp_port_read_stream() keeping several transfers
+ * in flight, and prints the throughput and CPU time of both. Use a
+ * large file, e.g. a movie, on a camera connected to a fast port. On
+ * Linux both read into zero-copy buffers from gp_port_alloc_buffer()
+ * where the kernel supports them.
+ *
+ * Usage: bench-camera-read folder file [transfers [kilobytes]]
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <gphoto2/gphoto2-camera.h>
+#include <gphoto2/gphoto2-port.h>
+#include <gphoto2/gphoto2-result.h>
+
+
+#define CHECK(r) {int ret = r; if (ret < 0) {printf ("Got error: %s\n", gp_result_as_string (ret)); return (1);}}
+
+static double
+now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double
+cpu (void)
+{
+	struct rusage ru;
+
+	getrusage (RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+}
+
+static int
+bench (Camera *camera, GPContext *context, const char *folder,
+       const char *name, int transfers, int size)
+{
+	CameraFile *file;
+	const char *data;
+	unsigned long len;
+	double t0, c0, t, c;
+
+	CHECK (gp_port_set_stream_transfers (camera->port, transfers, size));
+	CHECK (gp_file_new (&file));
+
+	t0 = now (); c0 = cpu ();
+	CHECK (gp_camera_file_get (camera, folder, name, GP_FILE_TYPE_NORMAL,
+				   file, context));
+	t = now () - t0; c = cpu () - c0;
+	CHECK (gp_file_get_data_and_size (file, &data, &len));
+
+	if (transfers)
+		printf ("%3d x %5d KB in flight", transfers, size / 1024);
+	else
+		printf ("one read at a time    ");
+	printf (": %8.1f MB in %7.3f s (%7.1f MB/s), cpu %7.3f s (%6.3f s/GB)\n",
+		len / (1024.0 * 1024.0), t, len / (1024.0 * 1024.0) / t, c,
+		c * 1024.0 * 1024.0 * 1024.0 / len);
+
+	CHECK (gp_file_unref (file));
+	return (0);
+}
+
+int
+main (int argc, char **argv)
+{
+	GPContext *context;
+	Camera *camera;
+	int transfers = 8, size = 512 * 1024;
+
+	if (argc < 3) {
+		printf ("Usage: %s folder file [transfers [kilobytes]]\n", argv[0]);
+		return (1);
+	}
+	if (argc > 3)
+		transfers = atoi (argv[3]);
+	if (argc > 4)
+		size = atoi (argv[4]) * 1024;
+
+	context = gp_context_new ();
+	/* the second download must come from the camera again */
+	gp_context_set_flags (context, GP_CONTEXT_FLAG_NO_CACHE);
+	CHECK (gp_camera_new (&camera));
+	CHECK (gp_camera_init (camera, context));
+
+	if (bench (camera, context, argv[1], argv[2], 0, 0) ||
+	    bench (camera, context, argv[1], argv[2], transfers, size))
+		return (1);
+
+	gp_camera_exit (camera, context);
+	gp_camera_unref (camera);
+	gp_context_unref (context);
+	return (0);
+}
@@ -0,0 +1,277 @@
+/* bench-file.c
+ *
+ * Copyright 2026 The gPhoto project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Times appending to a memory CameraFile in 512 KB blocks, the way camera
+ * drivers download a file: once without and once with gp_file_reserve(),
+ * and once to a chunked file from gp_file_new_chunked().
+ *
+ * Then times a download of 128 MB from a simulated camera into a slow
+ * file sink, with and without gp_file_set_write_behind().
+ *
+ * For every directory given, writes a file of that size there and times
+ * saving it with a plain read/write loop, with gp_file_save() and with
+ * gp_file_copy() between two filedescriptor files, printing the wall
+ * clock and CPU time of each.
+ *
+ * Usage: bench-file [megabytes [directory...]]    (default 4096)
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include <gphoto2/gphoto2-file.h>
+#include <gphoto2/gphoto2-result.h>
+
+
+#define CHECK(r) {int ret = r; if (ret < 0) {printf ("Got error: %s\n", gp_result_as_string (ret)); return (1);}}
+
+#define BLOCKSIZE (512 * 1024)
+
+/* Simulated time to get one block from the camera and to write it out. */
+#define USB_USEC  3000
+#define SINK_USEC 4000
+#define SINK_BLOCKS 256
+
+static double
+now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* User and system time used so far. */
+static double
+cpu (void)
+{
+	struct rusage ru;
+
+	getrusage (RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+}
+
+enum {
+	GROW,
+	RESERVE,
+	CHUNKED
+};
+
+static int
+bench (unsigned long total, int mode, const char *block)
+{
+	static const char *names[] = {"geometric growth", "gp_file_reserve", "chunked"};
+	CameraFile *file;
+	const char *data;
+	unsigned long done, size;
+	double t0, tappend, tget;
+
+	if (mode == CHUNKED)
+		CHECK (gp_file_new_chunked (&file))
+	else
+		CHECK (gp_file_new (&file));
+
+	t0 = now ();
+	if (mode == RESERVE)
+		CHECK (gp_file_reserve (file, total));
+	for (done = 0; done < total; done += BLOCKSIZE)
+		CHECK (gp_file_append (file, block, BLOCKSIZE));
+	tappend = now () - t0;
+
+	t0 = now ();
+	/* Chunked files would have to be joined to get the data. */
+	CHECK (gp_file_get_data_and_size (file, (mode == CHUNKED) ? NULL : &data, &size));
+	tget = now () - t0;
+	if (size != total) {
+		printf ("Size mismatch: %lu instead of %lu\n", size, total);
+		return (1);
+	}
+
+	printf ("%-16s %6lu MB: append %8.3f s (%8.1f MB/s), get_data %8.3f s\n",
+		names[mode],
+		total / (1024 * 1024), tappend,
+		total / (1024.0 * 1024.0) / tappend, tget);
+
+	CHECK (gp_file_unref (file));
+	return (0);
+}
+
+static int
+slow_size (void *priv, uint64_t *size)
+{
+	*size = 0;
+	return (GP_OK);
+}
+
+static int
+slow_write (void *priv, unsigned char *data, uint64_t *len)
+{
+	usleep (SINK_USEC * *len / BLOCKSIZE);
+	return (GP_OK);
+}
+
+static CameraFileHandler slow_sink = { slow_size, NULL, slow_write };
+
+static int
+bench_sink (int write_behind, const char *block)
+{
+	CameraFile *file;
+	double t0, t;
+	int i;
+
+	CHECK (gp_file_new_from_handler (&file, &slow_sink, NULL));
+	if (write_behind)
+		CHECK (gp_file_set_write_behind (file, 4, BLOCKSIZE));
+
+	t0 = now ();
+	for (i = 0; i < SINK_BLOCKS; i++) {
+		usleep (USB_USEC);
+		CHECK (gp_file_append (file, block, BLOCKSIZE));
+	}
+	CHECK (gp_file_flush (file));
+	t = now () - t0;
+
+	printf ("%-16s %6d MB to a slow sink: %8.3f s (%8.1f MB/s)\n",
+		write_behind ? "write-behind" : "direct writes",
+		SINK_BLOCKS * (BLOCKSIZE / 1024) / 1024, t,
+		SINK_BLOCKS * (BLOCKSIZE / 1024) / 1024 / t);
+
+	CHECK (gp_file_unref (file));
+	return (0);
+}
+
+/* What gp_file_save() used to do: 64 KB blocks through user space. */
+static int
+copy_loop (int from, const char *to)
+{
+	char buf[65536];
+	ssize_t res;
+	FILE *fp;
+
+	if ((-1 == lseek (from, 0, SEEK_SET)) || !(fp = fopen (to, "wb")))
+		return (GP_ERROR_IO);
+	while ((res = read (from, buf, sizeof (buf))) > 0)
+		if (fwrite (buf, 1, res, fp) != (size_t)res)
+			break;
+	fclose (fp);
+	return (res ? GP_ERROR_IO : GP_OK);
+}
+
+static void
+report (const char *name, unsigned long total, double t0, double c0)
+{
+	double t = now () - t0, c = cpu () - c0;
+
+	printf ("%-16s %6lu MB: %8.3f s (%8.1f MB/s), cpu %8.3f s\n", name,
+		total / (1024 * 1024), t, total / (1024.0 * 1024.0) / t, c);
+}
+
+static int
+bench_save (const char *dir, unsigned long total, const char *block)
+{
+	char src[1024], dst[1024];
+	CameraFile *file, *copy;
+	unsigned long done;
+	double t0, c0;
+	int fd, fd2;
+
+	snprintf (src, sizeof (src), "%s/bench-file.src", dir);
+	snprintf (dst, sizeof (dst), "%s/bench-file.dst", dir);
+	if (-1 == (fd = open (src, O_RDWR | O_CREAT | O_TRUNC, 0644))) {
+		printf ("Cannot create %s\n", src);
+		return (1);
+	}
+	CHECK (gp_file_new_from_fd (&file, fd));
+	for (done = 0; done < total; done += BLOCKSIZE)
+		CHECK (gp_file_append (file, block, BLOCKSIZE));
+	printf ("saving to %s:\n", dir);
+
+	t0 = now (); c0 = cpu ();
+	CHECK (copy_loop (fd, dst));
+	report ("read/write loop", total, t0, c0);
+	unlink (dst);
+
+	t0 = now (); c0 = cpu ();
+	CHECK (gp_file_save (file, dst));
+	report ("gp_file_save", total, t0, c0);
+	unlink (dst);
+
+	if (-1 == (fd2 = open (dst, O_RDWR | O_CREAT | O_TRUNC, 0644))) {
+		printf ("Cannot create %s\n", dst);
+		return (1);
+	}
+	CHECK (gp_file_new_from_fd (&copy, fd2));
+	t0 = now (); c0 = cpu ();
+	CHECK (gp_file_copy (copy, file));
+	report ("gp_file_copy", total, t0, c0);
+
+	CHECK (gp_file_unref (copy));
+	CHECK (gp_file_unref (file));
+	close (fd2);
+	close (fd);
+	unlink (dst);
+	unlink (src);
+	return (0);
+}
+
+int
+main (int argc, char **argv)
+{
+	unsigned long total, mb = 4096;
+	char *block;
+	int i;
+
+	if (argc > 1)
+		mb = strtoul (argv[1], NULL, 10);
+	total = mb * 1024 * 1024;
+	if (!total || (total / (1024 * 1024) != mb)) {
+		printf ("Cannot append %lu MB on this platform.\n", mb);
+		return (1);
+	}
+
+	block = malloc (BLOCKSIZE);
+	if (!block)
+		return (1);
+	memset (block, 0x5a, BLOCKSIZE);
+
+	if (bench (total, GROW, block) || bench (total, RESERVE, block) ||
+	    bench (total, CHUNKED, block) ||
+	    bench_sink (0, block) || bench_sink (1, block)) {
+		free (block);
+		return (1);
+	}
+	for (i = 2; i < argc; i++)
+		if (bench_save (argv[i], total, block)) {
+			free (block);
+			return (1);
+		}
+	free (block);
+	return (0);
+}
@@ -0,0 +1,212 @@
+/* bench-filesys.c
+ *
+ * Copyright 2026 The gPhoto project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Times the gp_filesystem_* lookup paths on a synthetic folder with a
+ * large number of files. The time per lookup should stay flat when the
+ * number of files grows. Also prints the time gp_filesystem_reset()
+ * takes and, where /proc/self/statm exists, the resident memory per file.
+ *
+ * Usage: bench-filesys [max-number-of-files]
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include <gphoto2/gphoto2-filesys.h>
+#include <gphoto2/gphoto2-result.h>
+
+
+#ifdef __GNUC__
+#define __unused__ __attribute__((unused))
+#else
+#define __unused__
+#endif
+
+
+#define CHECK(r) {int ret = r; if (ret < 0) {printf ("Got error: %s\n", gp_result_as_string (ret)); return (1);}}
+
+#define FOLDER "/store_00010001/DCIM/100BENCH"
+
+static int nrofiles;
+
+/* Resident set size in bytes, 0 if unknown. */
+static double
+resident (void)
+{
+	unsigned long size, rss = 0;
+	FILE *f;
+
+	f = fopen ("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+	if (fscanf (f, "%lu %lu", &size, &rss) != 2)
+		rss = 0;
+	fclose (f);
+	return (double)rss * sysconf (_SC_PAGESIZE);
+}
+
+static double
+now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Folder names are passed with or without a trailing slash. */
+static int
+is_folder (const char *folder, const char *name)
+{
+	size_t len = strlen (name);
+
+	return !strncmp (folder, name, len) &&
+		(!folder[len] || !strcmp (folder + len, "/"));
+}
+
+static void
+file_name (int i, char *buf, size_t size)
+{
+	snprintf (buf, size, "IMG_%07d.JPG", i);
+}
+
+static int
+get_info_func (CameraFilesystem __unused__ *fs, const char __unused__ *folder,
+	       const char __unused__ *file,
+	       CameraFileInfo *info, void __unused__ *data, GPContext __unused__ *context)
+{
+	memset (info, 0, sizeof (*info));
+	info->file.fields = GP_FILE_INFO_SIZE;
+	info->file.size = 1234;
+	return (GP_OK);
+}
+
+static int
+file_list_func (CameraFilesystem __unused__ *fs, const char *folder,
+		CameraList *list,
+		void __unused__ *data, GPContext __unused__ *context)
+{
+	char name[32];
+	int i;
+
+	if (!is_folder (folder, FOLDER))
+		return (GP_OK);
+	for (i = 0; i < nrofiles; i++) {
+		file_name (i, name, sizeof (name));
+		gp_list_append (list, name, NULL);
+	}
+	return (GP_OK);
+}
+
+static int
+folder_list_func (CameraFilesystem __unused__ *fs, const char *folder,
+		  CameraList *list,
+		  void __unused__ *data, GPContext __unused__ *context)
+{
+	if (!strcmp (folder, "/"))
+		gp_list_append (list, "store_00010001", NULL);
+	else if (is_folder (folder, "/store_00010001"))
+		gp_list_append (list, "DCIM", NULL);
+	else if (is_folder (folder, "/store_00010001/DCIM"))
+		gp_list_append (list, "100BENCH", NULL);
+	return (GP_OK);
+}
+
+static CameraFilesystemFuncs fsfuncs = {
+	.get_info_func = get_info_func,
+	.file_list_func = file_list_func,
+	.folder_list_func = folder_list_func,
+};
+
+static int
+bench (int n)
+{
+	CameraFilesystem *fs;
+	CameraFileInfo info;
+	CameraList *list;
+	const char *name;
+	char buf[32];
+	double t0, tlist, tinfo, tnum, treset, rss0, rss;
+	int i;
+
+	nrofiles = n;
+	rss0 = resident ();
+	CHECK (gp_list_new (&list));
+	CHECK (gp_filesystem_new (&fs));
+	CHECK (gp_filesystem_set_funcs (fs, &fsfuncs, NULL));
+
+	t0 = now ();
+	CHECK (gp_filesystem_list_files (fs, FOLDER, list, NULL));
+	tlist = now () - t0;
+
+	t0 = now ();
+	for (i = 0; i < n; i++) {
+		file_name (i, buf, sizeof (buf));
+		CHECK (gp_filesystem_get_info (fs, FOLDER, buf, &info, NULL));
+	}
+	tinfo = now () - t0;
+
+	t0 = now ();
+	for (i = 0; i < n; i++) {
+		CHECK (gp_filesystem_name (fs, FOLDER, i, &name, NULL));
+		if (gp_filesystem_number (fs, FOLDER, name, NULL) != i) {
+			printf ("Index mismatch for '%s'\n", name);
+			return (1);
+		}
+	}
+	tnum = now () - t0;
+	rss = resident ();
+
+	t0 = now ();
+	CHECK (gp_filesystem_reset (fs));
+	treset = now () - t0;
+
+	printf ("%8d files: list %8.3f s, get_info %8.3f us/file, "
+		"name+number %8.3f us/file, reset %8.3f s", n, tlist,
+		tinfo * 1000000.0 / n, tnum * 1000000.0 / n, treset);
+	if (rss0 && (rss > rss0))
+		printf (", %6.0f bytes/file", (rss - rss0) / n);
+	printf ("\n");
+
+	CHECK (gp_filesystem_free (fs));
+	CHECK (gp_list_free (list));
+	return (0);
+}
+
+int
+main (int argc, char **argv)
+{
+	int n, max = 100000;
+
+	if (argc > 1)
+		max = atoi (argv[1]);
+
+	for (n = 1000; n <= max; n *= 10)
+		if (bench (n))
+			return (1);
+	return (0);
+}
@@ -0,0 +1,160 @@
+/* bench-replay.c
+ *
+ * Copyright 2026 The gPhoto project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Runs a fixed camera session and prints how long each part took:
+ * camera init, listing all folders and files, downloading one file and
+ * a number of liveview previews. Run it once on a "record:FILE" port
+ * with the camera connected, then on "replay:FILE" or
+ * "replay-timed:FILE" without it, with the same arguments, to time the
+ * camera driver without the camera, e.g. on a build machine.
+ *
+ * Usage: bench-replay port model [folder file [previews]]
+ *
+ * e.g.   bench-replay record:/tmp/d750.trace "Nikon DSC D750" \
+ *                     /store_00010001/DCIM/100D750 DSC_0001.JPG 50
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <gphoto2/gphoto2-camera.h>
+#include <gphoto2/gphoto2-port-info-list.h>
+#include <gphoto2/gphoto2-result.h>
+
+
+#define CHECK(r) {int ret = r; if (ret < 0) {printf ("Got error: %s\n", gp_result_as_string (ret)); return (1);}}
+
+static double
+now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+list_folder (Camera *camera, GPContext *context, const char *folder,
+	     int *nrofolders, int *nrofiles)
+{
+	CameraList *list;
+	const char *name;
+	char path[1024];
+	int i, n;
+
+	CHECK (gp_list_new (&list));
+	CHECK (gp_camera_folder_list_files (camera, folder, list, context));
+	CHECK (n = gp_list_count (list));
+	*nrofiles += n;
+
+	CHECK (gp_list_reset (list));
+	CHECK (gp_camera_folder_list_folders (camera, folder, list, context));
+	CHECK (n = gp_list_count (list));
+	*nrofolders += n;
+	for (i = 0; i < n; i++) {
+		CHECK (gp_list_get_name (list, i, &name));
+		snprintf (path, sizeof (path), "%s%s%s", folder,
+			  strcmp (folder, "/") ? "/" : "", name);
+		if (list_folder (camera, context, path, nrofolders, nrofiles))
+			return (1);
+	}
+	CHECK (gp_list_free (list));
+	return (0);
+}
+
+int
+main (int argc, char **argv)
+{
+	CameraAbilitiesList *al;
+	CameraAbilities a;
+	GPPortInfoList *il;
+	GPPortInfo info;
+	GPContext *context;
+	CameraFile *file;
+	Camera *camera;
+	const char *data;
+	unsigned long len;
+	int i, m, p, previews = 0, nrofolders = 0, nrofiles = 0;
+	double t0;
+
+	if ((argc != 3) && (argc != 5) && (argc != 6)) {
+		printf ("Usage: %s port model [folder file [previews]]\n", argv[0]);
+		return (1);
+	}
+	if (argc > 5)
+		previews = atoi (argv[5]);
+
+	context = gp_context_new ();
+	gp_context_set_flags (context, GP_CONTEXT_FLAG_NO_CACHE);
+	CHECK (gp_camera_new (&camera));
+
+	CHECK (gp_abilities_list_new (&al));
+	CHECK (gp_abilities_list_load (al, context));
+	CHECK (m = gp_abilities_list_lookup_model (al, argv[2]));
+	CHECK (gp_abilities_list_get_abilities (al, m, &a));
+	CHECK (gp_camera_set_abilities (camera, a));
+	CHECK (gp_abilities_list_free (al));
+
+	CHECK (gp_port_info_list_new (&il));
+	CHECK (gp_port_info_list_load (il));
+	CHECK (p = gp_port_info_list_lookup_path (il, argv[1]));
+	CHECK (gp_port_info_list_get_info (il, p, &info));
+	CHECK (gp_camera_set_port_info (camera, info));
+
+	t0 = now ();
+	CHECK (gp_camera_init (camera, context));
+	printf ("init     %8.3f s\n", now () - t0);
+
+	t0 = now ();
+	if (list_folder (camera, context, "/", &nrofolders, &nrofiles))
+		return (1);
+	printf ("list     %8.3f s, %d folders, %d files\n", now () - t0,
+		nrofolders, nrofiles);
+
+	if (argc > 4) {
+		CHECK (gp_file_new (&file));
+		t0 = now ();
+		CHECK (gp_camera_file_get (camera, argv[3], argv[4],
+					   GP_FILE_TYPE_NORMAL, file, context));
+		CHECK (gp_file_get_data_and_size (file, &data, &len));
+		printf ("download %8.3f s, %lu bytes\n", now () - t0, len);
+		CHECK (gp_file_unref (file));
+	}
+
+	if (previews) {
+		CHECK (gp_file_new (&file));
+		t0 = now ();
+		for (i = 0; i < previews; i++)
+			CHECK (gp_camera_capture_preview (camera, file, context));
+		t0 = now () - t0;
+		printf ("preview  %8.3f s, %.1f frames/s\n", t0, previews / t0);
+		CHECK (gp_file_unref (file));
+	}
+
+	gp_camera_exit (camera, context);
+	gp_camera_unref (camera);
+	gp_port_info_list_free (il);
+	gp_context_unref (context);
+	return (0);
+}
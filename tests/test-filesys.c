@@ -22,6 +22,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
 
 #ifdef HAVE_MCHECK_H
 #include <mcheck.h>
@@ -29,6 +31,7 @@
 
 #include <gphoto2/gphoto2-filesys.h>
 #include <gphoto2/gphoto2-result.h>
+#include <gphoto2/gphoto2-setting.h>
 #include <gphoto2/gphoto2-port-log.h>
 
 
@@ -40,6 +43,7 @@
 
 
 #define CHECK(r) {int ret = r; if (ret < 0) {printf ("Got error: %s\n", gp_result_as_string (ret)); return (1);}}
+#define EXPECT(c) {if (!(c)) {printf ("%s:%d: '%s' failed\n", __FILE__, __LINE__, #c); return (1);}}
 
 static void
 log_func (GPLogLevel __unused__ level, const char __unused__ *domain,
@@ -77,6 +81,16 @@ get_info_func (CameraFilesystem __unused__ *fs, const char __unused__ *folder,
 	return (GP_OK);
 }
 
+/* The filesystem passes folders with and without a trailing slash. */
+static int
+is_folder (const char *folder, const char *name)
+{
+	size_t len = strlen (name);
+
+	return !strncmp (folder, name, len) &&
+	       (!folder[len] || (!strcmp (folder + len, "/") && len > 1));
+}
+
 static int
 file_list_func (CameraFilesystem __unused__ *fs, const char *folder,
 		CameraList *list,
@@ -84,7 +98,7 @@ file_list_func (CameraFilesystem __unused__ *fs, const char *folder,
 {
 	printf ("### -> The camera will list the files in '%s' here.\n", folder);
 
-	if (!strcmp (folder, "/whatever")) {
+	if (is_folder (folder, "/whatever")) {
 		gp_list_append (list, "file1", NULL);
 		gp_list_append (list, "file2", NULL);
 		gp_list_append (list, "file3", NULL);
@@ -104,17 +118,17 @@ folder_list_func (CameraFilesystem __unused__ *fs, const char *folder,
 	printf ("### -> The camera will list the folders in '%s' here.\n",
 		folder);
 
-	if (!strcmp (folder, "/")) {
+	if (is_folder (folder, "/")) {
 		gp_list_append (list, "whatever", NULL);
 		gp_list_append (list, "another", NULL);
 	}
 
-	if (!strcmp (folder, "/whatever")) {
+	if (is_folder (folder, "/whatever")) {
 		gp_list_append (list, "directory", NULL);
 		gp_list_append (list, "dir", NULL);
 	}
 
-	if (!strcmp (folder, "/whatever/directory")) {
+	if (is_folder (folder, "/whatever/directory")) {
 		gp_list_append (list, "my_special_folder", NULL);
 	}
 
@@ -138,6 +152,489 @@ static CameraFilesystemFuncs fsfuncs = {
 	.file_list_func = file_list_func,
 	.folder_list_func = folder_list_func,
 };
+
+static int
+dcim_folder_list_func (CameraFilesystem __unused__ *fs, const char *folder,
+		       CameraList *list,
+		       void __unused__ *data, GPContext __unused__ *context)
+{
+	if (is_folder (folder, "/"))
+		gp_list_append (list, "DCIM", NULL);
+	return (GP_OK);
+}
+
+/* Like canon, konica and others: append the files, return an empty list. */
+static int
+appending_file_list_func (CameraFilesystem *fs, const char *folder,
+			  CameraList __unused__ *list,
+			  void __unused__ *data, GPContext *context)
+{
+	CHECK (gp_filesystem_append (fs, folder, "IMG_0001.JPG", context));
+	CHECK (gp_filesystem_append (fs, folder, "IMG_0002.JPG", context));
+	return (GP_OK);
+}
+
+static int
+test_append_while_listing (GPContext *context)
+{
+	CameraFilesystemFuncs funcs;
+	CameraFilesystem *fs;
+	CameraList *list;
+	const char *name;
+	int i;
+
+	printf ("*** Listing a folder whose files are appended while listing...\n");
+	memset (&funcs, 0, sizeof (funcs));
+	funcs.file_list_func = appending_file_list_func;
+	funcs.folder_list_func = dcim_folder_list_func;
+	CHECK (gp_filesystem_new (&fs));
+	CHECK (gp_filesystem_set_funcs (fs, &funcs, NULL));
+	CHECK (gp_list_new (&list));
+
+	for (i = 0; i < 2; i++) {
+		CHECK (gp_filesystem_list_files (fs, "/DCIM", list, context));
+		EXPECT (gp_list_count (list) == 2);
+		CHECK (gp_list_get_name (list, 1, &name));
+		EXPECT (!strcmp (name, "IMG_0002.JPG"));
+		EXPECT (gp_filesystem_count (fs, "/DCIM", context) == 2);
+
+		/* and once more after the folder has been made dirty */
+		CHECK (gp_filesystem_reset (fs));
+	}
+
+	CHECK (gp_list_free (list));
+	CHECK (gp_filesystem_free (fs));
+	return (0);
+}
+
+/* Counts how the filesystem looks for the mtime in the EXIF data. */
+static int exif_requests, header_reads;
+
+static int
+exif_file_list_func (CameraFilesystem __unused__ *fs, const char *folder,
+		     CameraList *list,
+		     void __unused__ *data, GPContext __unused__ *context)
+{
+	if (is_folder (folder, "/DCIM")) {
+		gp_list_append (list, "IMG_0001.JPG", NULL);
+		gp_list_append (list, "MVI_0002.MOV", NULL);
+	}
+	return (GP_OK);
+}
+
+static int
+exif_get_file_func (CameraFilesystem __unused__ *fs,
+		    const char __unused__ *folder,
+		    const char __unused__ *filename, CameraFileType type,
+		    CameraFile __unused__ *file, void __unused__ *data,
+		    GPContext __unused__ *context)
+{
+	if (type == GP_FILE_TYPE_EXIF)
+		exif_requests++;
+	return (GP_ERROR_NOT_SUPPORTED);
+}
+
+/* Every file is a JPEG without an EXIF header. */
+static int
+exif_read_file_func (CameraFilesystem __unused__ *fs,
+		     const char __unused__ *folder,
+		     const char __unused__ *filename,
+		     CameraFileType __unused__ type, uint64_t offset,
+		     char *buf, uint64_t *size, void __unused__ *data,
+		     GPContext __unused__ *context)
+{
+	static const char jpeg[] = { '\xff', '\xd8', '\xff', '\xd9' };
+
+	header_reads++;
+	if (offset >= sizeof (jpeg))
+		offset = sizeof (jpeg);
+	if (*size > sizeof (jpeg) - offset)
+		*size = sizeof (jpeg) - offset;
+	memcpy (buf, jpeg + offset, *size);
+	return (GP_OK);
+}
+
+static int
+test_exif_mtime (GPContext *context)
+{
+	static const char *names[] = { "IMG_0001.JPG", "MVI_0002.MOV" };
+	CameraFilesystemFuncs funcs;
+	CameraFilesystem *fs;
+	CameraList *list;
+	CameraFile *file;
+	int i, j, reads;
+
+	printf ("*** Adding files without mtime...\n");
+	memset (&funcs, 0, sizeof (funcs));
+	funcs.file_list_func = exif_file_list_func;
+	funcs.folder_list_func = dcim_folder_list_func;
+	funcs.get_info_func = get_info_func;
+	funcs.get_file_func = exif_get_file_func;
+	funcs.read_file_func = exif_read_file_func;
+	CHECK (gp_filesystem_new (&fs));
+	CHECK (gp_filesystem_set_funcs (fs, &funcs, NULL));
+	CHECK (gp_list_new (&list));
+	CHECK (gp_filesystem_list_files (fs, "/DCIM", list, context));
+
+	/* The JPEG header is read once, the movie is not looked at. */
+	for (i = 0; i < 2; i++) {
+		reads = header_reads;
+		for (j = 0; j < 2; j++) {
+			CHECK (gp_file_new (&file));
+			CHECK (gp_file_append (file, "data", 4));
+			CHECK (gp_filesystem_set_file_noop (fs, "/DCIM", names[i],
+						GP_FILE_TYPE_NORMAL, file, context));
+			CHECK (gp_file_unref (file));
+			EXPECT ((header_reads > reads) == (!i && !j));
+			reads = header_reads;
+		}
+	}
+	EXPECT (exif_requests == 0);
+
+	CHECK (gp_list_free (list));
+	CHECK (gp_filesystem_free (fs));
+	return (0);
+}
+
+/* The camera behind the persistent cache tests: one file in /DCIM. */
+static uint64_t cache_stamp;	/* 0 to not stamp the file */
+static unsigned long cache_size;
+static int cache_info_calls, cache_preview_calls;
+
+static int
+stamping_file_list_func (CameraFilesystem *fs, const char *folder,
+			 CameraList *list,
+			 void __unused__ *data, GPContext *context)
+{
+	if (!is_folder (folder, "/DCIM"))
+		return (GP_OK);
+	CHECK (gp_list_append (list, "IMG_0001.JPG", NULL));
+	if (cache_stamp)
+		CHECK (gp_filesystem_set_stamp (fs, folder, "IMG_0001.JPG",
+						cache_stamp, context));
+	return (GP_OK);
+}
+
+static int
+cache_get_info_func (CameraFilesystem __unused__ *fs,
+		     const char __unused__ *folder, const char __unused__ *file,
+		     CameraFileInfo *info, void __unused__ *data,
+		     GPContext __unused__ *context)
+{
+	cache_info_calls++;
+	memset (info, 0, sizeof (CameraFileInfo));
+	info->file.fields = GP_FILE_INFO_SIZE | GP_FILE_INFO_MTIME;
+	info->file.size = cache_size;
+	info->file.mtime = 1000000000;
+	return (GP_OK);
+}
+
+static int
+cache_get_file_func (CameraFilesystem __unused__ *fs,
+		     const char __unused__ *folder,
+		     const char __unused__ *filename, CameraFileType type,
+		     CameraFile *file, void __unused__ *data,
+		     GPContext __unused__ *context)
+{
+	char buf[32];
+
+	if (type != GP_FILE_TYPE_PREVIEW)
+		return (GP_ERROR_NOT_SUPPORTED);
+	cache_preview_calls++;
+	snprintf (buf, sizeof (buf), "preview %lu", cache_size);
+	CHECK (gp_file_set_mime_type (file, GP_MIME_JPEG));
+	return (gp_file_append (file, buf, strlen (buf)));
+}
+
+/*
+ * One connection of the camera: lists /DCIM, gets the information and
+ * the preview of its file and checks how often the camera was asked.
+ */
+static int
+cache_session (GPContext *context, int info_calls, int preview_calls)
+{
+	CameraFilesystemFuncs funcs;
+	CameraFilesystem *fs;
+	CameraFileInfo info;
+	CameraList *list;
+	CameraFile *file;
+	const char *data;
+	unsigned long size;
+	char buf[32];
+
+	memset (&funcs, 0, sizeof (funcs));
+	funcs.file_list_func = stamping_file_list_func;
+	funcs.folder_list_func = dcim_folder_list_func;
+	funcs.get_info_func = cache_get_info_func;
+	funcs.get_file_func = cache_get_file_func;
+	CHECK (gp_filesystem_new (&fs));
+	CHECK (gp_filesystem_set_funcs (fs, &funcs, NULL));
+	CHECK (gp_filesystem_set_identity (fs, "test-filesys camera"));
+	CHECK (gp_list_new (&list));
+	CHECK (gp_filesystem_list_files (fs, "/DCIM", list, context));
+	EXPECT (gp_list_count (list) == 1);
+
+	CHECK (gp_filesystem_get_info (fs, "/DCIM", "IMG_0001.JPG", &info,
+				       context));
+	EXPECT (info.file.size == cache_size);
+
+	CHECK (gp_file_new (&file));
+	CHECK (gp_filesystem_get_file (fs, "/DCIM", "IMG_0001.JPG",
+				       GP_FILE_TYPE_PREVIEW, file, context));
+	CHECK (gp_file_get_data_and_size (file, &data, &size));
+	snprintf (buf, sizeof (buf), "preview %lu", cache_size);
+	EXPECT ((size == strlen (buf)) && !memcmp (data, buf, size));
+
+	EXPECT (cache_info_calls == info_calls);
+	EXPECT (cache_preview_calls == preview_calls);
+
+	CHECK (gp_file_unref (file));
+	CHECK (gp_list_free (list));
+	CHECK (gp_filesystem_free (fs));
+	return (0);
+}
+
+/* Removes the cache files and the directory holding them. */
+static void
+remove_cache_dir (const char *dir)
+{
+	char path[1024];
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir (dir);
+	if (d) {
+		while ((de = readdir (d))) {
+			if (!strcmp (de->d_name, ".") || !strcmp (de->d_name, ".."))
+				continue;
+			snprintf (path, sizeof (path), "%s/%s", dir, de->d_name);
+			unlink (path);
+		}
+		closedir (d);
+	}
+	rmdir (dir);
+}
+
+static int
+test_persistent_cache (GPContext *context)
+{
+	char dir[] = "/tmp/test-filesys-XXXXXX";
+	char olddir[256];
+	int ret = 1;
+
+	printf ("*** Reopening the persistent cache...\n");
+	if (!mkdtemp (dir)) {
+		printf ("Could not create a directory for the cache.\n");
+		return (1);
+	}
+	gp_setting_get ("libgphoto", "persistent-cache-dir", olddir);
+	gp_setting_set ("libgphoto", "persistent-cache-dir", dir);
+
+	cache_stamp = 1;
+	cache_size = 100;
+	/* asks the camera, then serves everything from the cache */
+	if (cache_session (context, 1, 1) || cache_session (context, 1, 1))
+		goto out;
+
+	/* the file was replaced by one of the same name */
+	cache_stamp = 2;
+	cache_size = 200;
+	if (cache_session (context, 2, 2) || cache_session (context, 2, 2))
+		goto out;
+
+	/* Without a stamp, the information is not taken from the cache,
+	 * the preview only while the size from the camera matches. */
+	cache_stamp = 0;
+	if (cache_session (context, 3, 2))
+		goto out;
+	cache_size = 300;
+	if (cache_session (context, 4, 3))
+		goto out;
+	ret = 0;
+out:
+	gp_setting_set ("libgphoto", "persistent-cache-dir", olddir);
+	remove_cache_dir (dir);
+	return (ret);
+}
+
+/*
+ * The camera behind the snapshot tests: /A with a file and a subfolder,
+ * fingerprinted as a whole, and /B, which is always listed.
+ */
+static struct {
+	const char	*folder, *name;
+	unsigned long	size;
+	int		present;
+} snap_files[] = {
+	{ "/A",     "a1", 10, 1 },
+	{ "/A/sub", "s1", 20, 1 },
+	{ "/B",     "b0", 30, 0 },
+	{ "/B",     "b1", 40, 1 },
+	{ "/B",     "b2", 50, 1 },
+	{ "/B",     "b3", 60, 1 },
+	{ "/B",     "b4", 70, 0 },
+};
+static int snap_sub_present = 1;
+static uint64_t snap_fingerprint;
+static int snap_listings_a;
+static char snap_changes[256];
+
+static int
+snap_file_list_func (CameraFilesystem __unused__ *fs, const char *folder,
+		     CameraList *list,
+		     void __unused__ *data, GPContext __unused__ *context)
+{
+	int i;
+
+	if (is_folder (folder, "/A") || is_folder (folder, "/A/sub"))
+		snap_listings_a++;
+	/* backwards, the snapshot has to sort them */
+	for (i = sizeof (snap_files) / sizeof (snap_files[0]) - 1; i >= 0; i--)
+		if (snap_files[i].present && is_folder (folder, snap_files[i].folder))
+			CHECK (gp_list_append (list, snap_files[i].name, NULL));
+	return (GP_OK);
+}
+
+static int
+snap_folder_list_func (CameraFilesystem __unused__ *fs, const char *folder,
+		       CameraList *list,
+		       void __unused__ *data, GPContext __unused__ *context)
+{
+	if (is_folder (folder, "/")) {
+		gp_list_append (list, "B", NULL);
+		gp_list_append (list, "A", NULL);
+	}
+	if (is_folder (folder, "/A") && snap_sub_present)
+		gp_list_append (list, "sub", NULL);
+	return (GP_OK);
+}
+
+static int
+snap_get_info_func (CameraFilesystem __unused__ *fs, const char *folder,
+		    const char *file, CameraFileInfo *info,
+		    void __unused__ *data, GPContext __unused__ *context)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof (snap_files) / sizeof (snap_files[0]); i++) {
+		if (!is_folder (folder, snap_files[i].folder) ||
+		    strcmp (file, snap_files[i].name))
+			continue;
+		memset (info, 0, sizeof (CameraFileInfo));
+		info->file.fields = GP_FILE_INFO_SIZE | GP_FILE_INFO_MTIME;
+		info->file.size = snap_files[i].size;
+		info->file.mtime = 1000000000;
+		return (GP_OK);
+	}
+	return (GP_ERROR_FILE_NOT_FOUND);
+}
+
+/* Like ptp2: only added and removed files change the fingerprint. */
+static int
+snap_fingerprint_func (CameraFilesystem __unused__ *fs, const char *folder,
+		       uint64_t *fingerprint, void __unused__ *data,
+		       GPContext __unused__ *context)
+{
+	if (!is_folder (folder, "/A"))
+		return (GP_ERROR_NOT_SUPPORTED);
+	*fingerprint = snap_fingerprint;
+	return (GP_OK);
+}
+
+static int
+snap_change_func (CameraFilesystemChange change, const char *folder,
+		  const char *filename, const CameraFileInfo __unused__ *info,
+		  void __unused__ *data)
+{
+	size_t len = strlen (snap_changes);
+
+	snprintf (snap_changes + len, sizeof (snap_changes) - len, "%c%s/%s ",
+		  (change == GP_FILESYSTEM_CHANGE_ADDED) ? '+' :
+		  (change == GP_FILESYSTEM_CHANGE_REMOVED) ? '-' : '*',
+		  folder, filename);
+	return (GP_OK);
+}
+
+/* Compares the camera with a snapshot, the changes go to snap_changes. */
+static int
+snap_diff (CameraFilesystem *fs, const char *snapshot, unsigned long size,
+	   char **newsnapshot, unsigned long *newsize, GPContext *context)
+{
+	snap_changes[0] = '\0';
+	CHECK (gp_filesystem_reset (fs));
+	return gp_filesystem_diff (fs, snapshot, size, snap_change_func, NULL,
+				   newsnapshot, newsize, context);
+}
+
+static int
+test_snapshot (GPContext *context)
+{
+	static const char *corrupt[] = {
+		"",
+		"gphoto2-snapshot 2\nD - /\n",
+		"gphoto2-snapshot 1\n",
+		"gphoto2-snapshot 1\nF 1 2 x\n",
+		"gphoto2-snapshot 1\nD - B\n",
+		"gphoto2-snapshot 1\nD - /\nF 1 x\n",
+		"gphoto2-snapshot 1\nD - /\nF 1 2 \n",
+		"gphoto2-snapshot 1\nD - /\nX\n",
+	};
+	CameraFilesystemFuncs funcs;
+	CameraFilesystem *fs;
+	char *snapshot, *newsnapshot;
+	unsigned long size, newsize;
+	unsigned int i;
+	int listings;
+
+	printf ("*** Comparing the filesystem with snapshots...\n");
+	memset (&funcs, 0, sizeof (funcs));
+	funcs.file_list_func = snap_file_list_func;
+	funcs.folder_list_func = snap_folder_list_func;
+	funcs.get_info_func = snap_get_info_func;
+	funcs.fingerprint_func = snap_fingerprint_func;
+	CHECK (gp_filesystem_new (&fs));
+	CHECK (gp_filesystem_set_funcs (fs, &funcs, NULL));
+
+	snap_fingerprint = 1;
+	CHECK (gp_filesystem_snapshot (fs, "/", &snapshot, &size, context));
+	CHECK (snap_diff (fs, snapshot, size, NULL, NULL, context));
+	EXPECT (!strcmp (snap_changes, ""));
+
+	/* /A keeps its fingerprint and is not listed, so the new size of
+	 * a1 goes unnoticed. */
+	snap_files[0].size = 11;
+	snap_files[2].present = 1;
+	snap_files[4].present = 0;
+	snap_files[5].size = 61;
+	snap_files[6].present = 1;
+	listings = snap_listings_a;
+	CHECK (snap_diff (fs, snapshot, size, &newsnapshot, &newsize, context));
+	EXPECT (!strcmp (snap_changes, "+/B/b0 -/B/b2 */B/b3 +/B/b4 "));
+	EXPECT (snap_listings_a == listings);
+	free (snapshot);
+	snapshot = newsnapshot;
+	size = newsize;
+	CHECK (snap_diff (fs, snapshot, size, NULL, NULL, context));
+	EXPECT (!strcmp (snap_changes, ""));
+
+	/* Files of folders that are gone are reported after the walk. */
+	snap_fingerprint = 2;
+	snap_sub_present = 0;
+	CHECK (snap_diff (fs, snapshot, size, NULL, NULL, context));
+	EXPECT (!strcmp (snap_changes, "*/A/a1 -/A/sub/s1 "));
+	EXPECT (snap_listings_a > listings);
+	free (snapshot);
+
+	for (i = 0; i < sizeof (corrupt) / sizeof (corrupt[0]); i++) {
+		EXPECT (snap_diff (fs, corrupt[i], strlen (corrupt[i]), NULL,
+				   NULL, context) == GP_ERROR_CORRUPTED_DATA);
+		EXPECT (!strcmp (snap_changes, ""));
+	}
+
+	CHECK (gp_filesystem_free (fs));
+	return (0);
+}
+
 int
 main ()
 {
@@ -285,6 +782,15 @@ main ()
 	printf ("*** Freeing file system...\n");
 	CHECK (gp_filesystem_free (fs));
 
+	if (test_append_while_listing (context))
+		return (1);
+	if (test_exif_mtime (context))
+		return (1);
+	if (test_persistent_cache (context))
+		return (1);
+	if (test_snapshot (context))
+		return (1);
+
 	gp_context_unref (context);
 
 	CHECK (gp_list_free(list));